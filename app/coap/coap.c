@@ -5,7 +5,6 @@
 #include "uri.h"
 
 extern void endpoint_setup(void);
-extern const coap_endpoint_t endpoints[];
 
 #ifdef COAP_DEBUG
 void coap_dumpHeader(coap_header_t *hdr)
@@ -421,11 +420,44 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
     scratch->p[0] = ((uint16_t)content_type & 0xFF00) >> 8;
     scratch->p[1] = ((uint16_t)content_type & 0x00FF);
     pkt->opts[0].buf.len = 2;
+    scratch->p += 2;    // leave room for coap_add_option()
+    scratch->len -= 2;
     pkt->payload.p = content;
     pkt->payload.len = content_len;
     return 0;
 }
 
+// Adds an uint option, keeping the options sorted as coap_build() expects.
+// The value is encoded into scratch, which must live until the packet is built.
+int coap_add_option(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, uint32_t value)
+{
+    int i, n;
+
+    if (pkt->numopts >= MAXOPT || scratch->len < sizeof(value))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    n = coap_encode_var_bytes(scratch->p, value);
+    for (i = pkt->numopts; i > 0 && pkt->opts[i-1].num > num; i--)
+        pkt->opts[i] = pkt->opts[i-1];
+    pkt->opts[i].num = num;
+    pkt->opts[i].buf.p = scratch->p;
+    pkt->opts[i].buf.len = n;
+    pkt->numopts++;
+    scratch->p += n;
+    scratch->len -= n;
+    return 0;
+}
+
+uint32_t coap_decode_var_bytes(const coap_buffer_t *buf)
+{
+    uint32_t val = 0;
+    size_t i;
+
+    for (i = 0; i < buf->len && i < sizeof(val); i++)
+        val = (val << 8) | buf->p[i];
+    return val;
+}
+
 
 unsigned int coap_encode_var_bytes(unsigned char *buf, unsigned int val) {
   unsigned int n, i;
@@ -446,6 +478,11 @@ static uint8_t _token_data[4] = {'n','o','d','e'};
 coap_buffer_t the_token = { _token_data, 4 };
 static unsigned short message_id;
 
+uint16_t coap_new_message_id(void)
+{
+    return message_id++;
+}
+
 int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtype_t t, coap_method_t m, coap_uri_t *uri, const uint8_t *payload, size_t payload_len)
 {
     int res;
@@ -505,43 +542,17 @@ int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, coap_msgtyp
     return 0;
 }
 
-// FIXME, if this looked in the table at the path before the method then
-// it could more easily return 405 errors
-int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt)
+int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, const coap_remote_t *remote)
 {
-    const coap_option_t *opt;
-    int i;
-    uint8_t count;
-    const coap_endpoint_t *ep = endpoints;
-
-    while(NULL != ep->handler)
-    {
-        if (ep->method != inpkt->hdr.code)
-            goto next;
-        if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
-        {
-            // if (count != ep->path->count)
-            if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
-                goto next;
-            for (i=0;i<ep->path->count;i++)
-            {
-                if (opt[i].buf.len != c_strlen(ep->path->elems[i]))
-                    goto next;
-                if (0 != c_memcmp(ep->path->elems[i], opt[i].buf.p, opt[i].buf.len))
-                    goto next;
-            }
-            // pre-path match!
-            if (count==ep->path->count+1 && ep->user_entry == NULL)
-                goto next;
-            return ep->handler(ep, scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
-        }
-next:
-        ep++;
-    }
+    coap_luser_entry *r = coap_find_resource(inpkt);
 
-    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    if (r == NULL)
+        return coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    if (r->ep->method != inpkt->hdr.code)
+        return coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_METHOD_NOT_ALLOWED, COAP_CONTENTTYPE_NONE);
 
-    return 0;
+    // fixed endpoints are indexed with a nameless entry
+    return r->ep->handler(r->ep, r->name ? r : NULL, remote, scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
 }
 
 void coap_setup(void)
@@ -15,6 +15,14 @@ extern "C" {
 #define MAX_PAYLOAD_SIZE 1024
 #define MAX_REQUEST_SIZE 576
 #define MAX_REQ_SCRATCH_SIZE 60
+#define MAX_RSP_SCRATCH_SIZE 16     // Content-Format, Observe, Block1/Block2 and Size2
+
+#define COAP_MAX_OBSERVERS 4        // per resource
+#define COAP_OBS_CON_EVERY 16       // every 16th notification is confirmable, RFC 7641 section 4.5
+#define COAP_OBS_CON_INTERVAL (24UL * 60 * 60 * 1000)   // and at least one a day, in ms
+#define COAP_BLOCK_SZX_MAX 6        // 1024 byte blocks, bounded by MAX_PAYLOAD_SIZE
+#define COAP_BLOCK_SZX_DEFAULT 5    // 512 byte blocks when the client didn't ask for a size
+#define COAP_BLOCK_SIZE(szx) (1U << ((szx) + 4))
 
 #define COAP_RESPONSE_CLASS(C) (((C) >> 5) & 0xFF)
 
@@ -77,8 +85,12 @@ typedef enum
     COAP_OPTION_URI_QUERY = 15,
     COAP_OPTION_ACCEPT = 17,
     COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_BLOCK2 = 23,    // http://tools.ietf.org/html/rfc7959#section-2.1
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
     COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
 } coap_option_num_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.1.1
@@ -107,7 +119,12 @@ typedef enum
     COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
     COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
     COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4)
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CONTINUE = MAKE_RSPCODE(2, 31),
+    COAP_RSPCODE_BAD_OPTION = MAKE_RSPCODE(4, 2),
+    COAP_RSPCODE_METHOD_NOT_ALLOWED = MAKE_RSPCODE(4, 5),
+    COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE = MAKE_RSPCODE(4, 8),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13)
 } coap_responsecode_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.3
@@ -143,7 +160,16 @@ typedef enum
 ///////////////////////
 typedef struct coap_endpoint_t coap_endpoint_t;
 
-typedef int (*coap_endpoint_func)(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+typedef struct coap_luser_entry coap_luser_entry;
+
+// Transport address of the peer a request came from
+typedef struct
+{
+    uint32_t ip;
+    uint16_t port;
+} coap_remote_t;
+
+typedef int (*coap_endpoint_func)(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
 #define MAX_SEGMENTS 3  // 2 = /foo/bar, 3 = /foo/bar/baz
 #define MAX_SEGMENTS_SIZE   16
 typedef struct
@@ -152,7 +178,19 @@ typedef struct
     const char *elems[MAX_SEGMENTS];
 } coap_endpoint_path_t;
 
-typedef struct coap_luser_entry coap_luser_entry;
+//http://tools.ietf.org/html/rfc7641#section-4.1
+typedef struct coap_observer coap_observer;
+
+struct coap_observer{
+    coap_observer *next;
+    coap_remote_t remote;
+    uint8_t tkl;
+    uint8_t tok[8];
+    uint16_t last_id;                   /* message id of the last notification, to match ACK and RST */
+    uint8_t con_pending;                /* confirmable notifications sent without an ACK */
+    uint8_t non_count;                  /* non-confirmable notifications since the last confirmable one */
+    uint32_t con_time;                  /* coap_timer_now() of the last confirmable notification */
+};
 
 struct coap_luser_entry{
     // int ref;
@@ -160,6 +198,11 @@ struct coap_luser_entry{
     const char *name;
     coap_luser_entry *next;
     int content_type;
+    const coap_endpoint_t *ep;          /* endpoint this resource lives under */
+    coap_luser_entry *hnext;            /* resource table bucket chain */
+    uint32_t key;                       /* coap_hash() of the full path */
+    coap_observer *observers;
+    uint32_t obs_seq;                   /* Observe sequence number of the last notification */
 };
 
 struct coap_endpoint_t{
@@ -185,7 +228,18 @@ const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uin
 int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
 void coap_dump(const uint8_t *buf, size_t buflen, bool bare);
 int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
-int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt);
+int coap_add_option(coap_rw_buffer_t *scratch, coap_packet_t *pkt, uint8_t num, uint32_t value);
+uint32_t coap_decode_var_bytes(const coap_buffer_t *buf);
+unsigned int coap_encode_var_bytes(unsigned char *buf, unsigned int val);
+uint16_t coap_new_message_id(void);
+int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, const coap_remote_t *remote);
+coap_luser_entry *coap_find_resource(const coap_packet_t *pkt);
+void coap_remove_observer(const coap_remote_t *remote, const coap_packet_t *rst);
+void coap_ack_observer(const coap_remote_t *remote, const coap_packet_t *ack);
+void coap_clear_observers(void);
+int coap_notify(coap_luser_entry *entry, int (*send)(void *arg, const coap_remote_t *remote, const uint8_t *msg, size_t len), void *arg);
+coap_luser_entry *coap_find_entry(coap_luser_entry *head, const char *name, size_t len);
+coap_luser_entry *coap_add_entry(coap_luser_entry *head, const char *name, int content_type);
 void coap_option_nibble(uint32_t value, uint8_t *nibble);
 void coap_setup(void);
 void endpoint_setup(void);
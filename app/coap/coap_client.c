@@ -4,8 +4,7 @@
 #include "coap.h"
 #include "hash.h"
 #include "node.h"
-
-extern coap_queue_t *gQueue;
+#include "coap_io.h"
 
 void coap_client_response_handler(char *data, unsigned short len, unsigned short size, const uint32_t ip, const uint32_t port)
 {
@@ -40,14 +39,8 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
 
     coap_tid_t id = COAP_INVALID_TID;
     coap_transaction_id(ip, port, &pkt, &id);
-    /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
-    coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
-    coap_timer_start(&gQueue);
+    /* transaction done, remove the node from the heap */
+    coap_transaction_done(id);
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
     {
@@ -63,7 +56,7 @@ void coap_client_response_handler(char *data, unsigned short len, unsigned short
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(!coap_pending()){ // if there is no node pending in the queue, disconnect from host.
 
   }
 }
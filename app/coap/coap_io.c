@@ -1,10 +1,35 @@
 #include "c_string.h"
+#include "c_stdlib.h"
 #include "coap_io.h"
 #include "node.h"
 #include "espconn.h"
 #include "coap_timer.h"
 
-extern coap_queue_t *gQueue;
+extern coap_heap_t gQueue;
+
+/* Congestion control state per peer, see http://tools.ietf.org/html/rfc7252#section-4.7 */
+typedef struct coap_peer_t {
+  struct coap_peer_t *next;
+  uint32_t ip;
+  uint16_t port;
+  unsigned char inflight;     /* transactions in the heap */
+  coap_queue_t *waiting;      /* FIFO of transactions not sent yet */
+  coap_queue_t *waiting_tail;
+} coap_peer_t;
+
+static coap_peer_t *peers[COAP_PEER_BUCKETS];
+static unsigned int waiting = 0;
+static unsigned char nstart = COAP_DEFAULT_NSTART;
+
+static void set_remote(struct espconn *pesp_conn, uint32_t ip, uint16_t port) {
+  if(pesp_conn->type == ESPCONN_TCP){
+    c_memcpy(pesp_conn->proto.tcp->remote_ip, &ip, sizeof(ip));
+    pesp_conn->proto.tcp->remote_port = port;
+  }else{
+    c_memcpy(pesp_conn->proto.udp->remote_ip, &ip, sizeof(ip));
+    pesp_conn->proto.udp->remote_port = port;
+  }
+}
 
 /* releases space allocated by PDU if free_pdu is set */
 coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu) {
@@ -26,11 +51,82 @@ coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu) {
   return id;
 }
 
+static coap_peer_t **peer_bucket(uint32_t ip, uint16_t port) {
+  return &peers[(ip ^ (ip >> 16) ^ port) & (COAP_PEER_BUCKETS - 1)];
+}
+
+static coap_peer_t *find_peer(uint32_t ip, uint16_t port, bool create) {
+  coap_peer_t **bucket = peer_bucket(ip, port);
+  coap_peer_t *peer;
+
+  for (peer = *bucket; peer; peer = peer->next) {
+    if (peer->ip == ip && peer->port == port)
+      return peer;
+  }
+  if (!create || !(peer = (coap_peer_t *)c_zalloc(sizeof(coap_peer_t))))
+    return NULL;
+  peer->ip = ip;
+  peer->port = port;
+  peer->next = *bucket;
+  *bucket = peer;
+  return peer;
+}
+
+static void release_peer(coap_peer_t *peer) {
+  coap_peer_t **pp;
+
+  if (peer->inflight || peer->waiting)
+    return;
+  for (pp = peer_bucket(peer->ip, peer->port); *pp; pp = &(*pp)->next) {
+    if (*pp == peer) {
+      *pp = peer->next;
+      c_free(peer);
+      return;
+    }
+  }
+}
+
+/* returns 0 if the node could not be queued, it is then still the caller's */
+static int start_transaction(coap_peer_t *peer, coap_queue_t *node, coap_tick_t now) {
+  node->t = now + node->timeout;
+  if (!coap_insert_node(&gQueue, node)) {
+    NODE_DBG("coap: insufficient memory, transaction %d dropped\n", node->id);
+    return 0;
+  }
+  peer->inflight++;
+  set_remote(node->pconn, node->ip, node->port);
+  espconn_sent(node->pconn, (unsigned char *)(node->pdu->msg.p), node->pdu->msg.len);
+  return 1;
+}
+
+/* A transaction of peer ended, let the next waiting one go */
+static void finish_transaction(coap_queue_t *node, coap_tick_t now) {
+  coap_peer_t *peer = find_peer(node->ip, node->port, false);
+
+  coap_delete_node(node);
+  if (!peer)
+    return;
+  peer->inflight--;
+  while (peer->waiting && peer->inflight < nstart) {
+    node = peer->waiting;
+    peer->waiting = node->next;
+    node->next = NULL;
+    waiting--;
+    if (!start_transaction(peer, node, now))
+      coap_delete_node(node);   // its sender was given the tid, the PDU is ours
+  }
+  release_peer(peer);
+}
+
 coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
   coap_queue_t *node;
-  coap_tick_t diff;
+  coap_peer_t *peer;
+  coap_tid_t id;
   uint32_t r;
 
+  if ( !pesp_conn || !pdu )
+    return COAP_INVALID_TID;
+
   node = coap_new_node();
   if (!node) {
     NODE_DBG("coap_send_confirmed: insufficient memory\n");
@@ -38,12 +134,25 @@ coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
   }
 
   node->retransmit_cnt = 0;
-  node->id = coap_send(pesp_conn, pdu);
-  if (COAP_INVALID_TID == node->id) {
-    NODE_DBG("coap_send_confirmed: error sending pdu\n");
+  node->pconn = pesp_conn;
+  node->pdu = pdu;
+  if(pesp_conn->type == ESPCONN_TCP){
+    c_memcpy(&node->ip, pesp_conn->proto.tcp->remote_ip, sizeof(node->ip));
+    node->port = pesp_conn->proto.tcp->remote_port;
+  }else{
+    c_memcpy(&node->ip, pesp_conn->proto.udp->remote_ip, sizeof(node->ip));
+    node->port = pesp_conn->proto.udp->remote_port;
+  }
+  coap_transaction_id(node->ip, node->port, pdu->pkt, &node->id);
+  id = node->id;
+
+  peer = find_peer(node->ip, node->port, true);
+  if (!peer) {
+    NODE_DBG("coap_send_confirmed: insufficient memory\n");
     coap_free_node(node);
     return COAP_INVALID_TID;
   }
+
   r = rand();
 
   /* add randomized RESPONSE_TIMEOUT to determine retransmission timeout */
@@ -51,21 +160,106 @@ coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu) {
     (COAP_DEFAULT_RESPONSE_TIMEOUT >> 1) *
     ((COAP_TICKS_PER_SECOND * (r & 0xFF)) >> 8);
 
-  node->pconn = pesp_conn;
-  node->pdu = pdu;
+  if (peer->inflight < nstart) {
+    if (!start_transaction(peer, node, coap_timer_now())) {
+      // the PDU stays with the caller, which frees it on COAP_INVALID_TID
+      coap_free_node(node);
+      release_peer(peer);
+      return COAP_INVALID_TID;
+    }
+    coap_timer_start(&gQueue);
+  } else {
+    if (peer->waiting)
+      peer->waiting_tail->next = node;
+    else
+      peer->waiting = node;
+    peer->waiting_tail = node;
+    waiting++;
+  }
+  return id;
+}
+
+void coap_retransmit(coap_queue_t *node, coap_tick_t now) {
+  /* re-initialize timeout when maximum number of retransmissions are not reached yet */
+  if (node->retransmit_cnt < COAP_DEFAULT_MAX_RETRANSMIT) {
+    node->retransmit_cnt++;
+    node->t = now + (node->timeout << node->retransmit_cnt);   // exponential back-off
+
+    NODE_DBG("** retransmission #%d of transaction %d\n",
+        node->retransmit_cnt, (((uint16_t)(node->pdu->pkt->hdr.id[0]))<<8)+node->pdu->pkt->hdr.id[1]);
+    set_remote(node->pconn, node->ip, node->port);
+    espconn_sent(node->pconn, (unsigned char *)(node->pdu->msg.p), node->pdu->msg.len);
+    if (coap_insert_node(&gQueue, node))
+      return;
+    NODE_DBG("retransmission: insufficient memory\n");
+  }
+  /* And finally delete the node */
+  finish_transaction(node, now);
+}
+
+int coap_transaction_done(const coap_tid_t id) {
+  coap_queue_t *node = coap_find_node(&gQueue, id);
 
-  /* Set timer for pdu retransmission. If this is the first element in
-   * the retransmission queue, the base time is set to the current
-   * time and the retransmission time is node->timeout. If there is
-   * already an entry in the sendqueue, we must check if this node is
-   * to be retransmitted earlier. Therefore, node->timeout is first
-   * normalized to the timeout and then inserted into the queue with
-   * an adjusted relative time.
-   */
-  coap_timer_stop();
-  coap_timer_update(&gQueue);
-  node->t = node->timeout;  
-  coap_insert_node(&gQueue, node);
+  if (!node)
+    return 0;
+  coap_extract_node(&gQueue, node);
+  finish_transaction(node, coap_timer_now());
   coap_timer_start(&gQueue);
-  return node->id;
+  return 1;
+}
+
+void coap_drop_conn(struct espconn *pesp_conn) {
+  coap_peer_t *peer, *next;
+  coap_queue_t **pn, *node;
+  unsigned short i, n = 0;
+  int b;
+
+  // waiting transactions first, so finishing the in-flight ones can't start them
+  for (b = 0; b < COAP_PEER_BUCKETS; b++) {
+    for (peer = peers[b]; peer; peer = peer->next) {
+      peer->waiting_tail = NULL;
+      for (pn = &peer->waiting; (node = *pn); ) {
+        if (node->pconn == pesp_conn) {
+          *pn = node->next;
+          coap_delete_node(node);
+          waiting--;
+        } else {
+          peer->waiting_tail = node;
+          pn = &node->next;
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < gQueue.count; i++) {
+    node = gQueue.node[i];
+    if (node->pconn == pesp_conn) {
+      if ((peer = find_peer(node->ip, node->port, false)))
+        peer->inflight--;
+      coap_delete_node(node);
+    } else {
+      gQueue.node[n++] = node;
+    }
+  }
+  gQueue.count = n;
+  coap_rebuild_heap(&gQueue);
+
+  for (b = 0; b < COAP_PEER_BUCKETS; b++) {
+    for (peer = peers[b]; peer; peer = next) {
+      next = peer->next;
+      release_peer(peer);
+    }
+  }
+}
+
+unsigned int coap_pending(void) {
+  return gQueue.count + waiting;
+}
+
+void coap_set_nstart(unsigned char n) {
+  nstart = n < 1 ? 1 : (n > COAP_MAX_NSTART ? COAP_MAX_NSTART : n);
+}
+
+unsigned char coap_get_nstart(void) {
+  return nstart;
 }
@@ -10,11 +10,35 @@ extern "C" {
 #include "espconn.h"
 #include "pdu.h"
 #include "hash.h"
-	
+#include "node.h"
+
+/* http://tools.ietf.org/html/rfc7252#section-4.7 */
+#define COAP_DEFAULT_NSTART 1     /* outstanding confirmable requests per peer */
+#define COAP_MAX_NSTART     16
+#define COAP_PEER_BUCKETS   16    /* power of two */
+
 coap_tid_t coap_send(struct espconn *pesp_conn, coap_pdu_t *pdu);
 
+/** Sends pdu now if the peer has less than NSTART transactions outstanding, else
+ *  queues it behind them. The pdu is owned by the queue unless COAP_INVALID_TID
+ *  is returned. */
 coap_tid_t coap_send_confirmed(struct espconn *pesp_conn, coap_pdu_t *pdu);
 
+/** Called by the timer for a transaction taken off the heap because it is due. */
+void coap_retransmit(coap_queue_t *node, coap_tick_t now);
+
+/** Completes the transaction answered by an ACK or RST, returns 0 if it is unknown. */
+int coap_transaction_done(const coap_tid_t id);
+
+/** Drops all transactions sent or waiting to be sent on pesp_conn. */
+void coap_drop_conn(struct espconn *pesp_conn);
+
+/** Number of transactions outstanding or waiting. */
+unsigned int coap_pending(void);
+
+void coap_set_nstart(unsigned char n);
+unsigned char coap_get_nstart(void);
+
 #ifdef __cplusplus
 }
 #endif
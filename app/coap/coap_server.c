@@ -4,14 +4,14 @@
 
 #include "coap.h"
 
-size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned short rsplen)
+size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned short rsplen, const coap_remote_t *remote)
 {
   NODE_DBG("coap_server_respond is called.\n");
   size_t rlen = rsplen;
   coap_packet_t pkt;
   pkt.content.p = NULL;
   pkt.content.len = 0;
-  uint8_t scratch_raw[4];
+  uint8_t scratch_raw[MAX_RSP_SCRATCH_SIZE];
   coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
   int rc;
 
@@ -25,6 +25,16 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
     NODE_DBG("Bad packet rc=%d\n", rc);
     return 0;
   }
+  else if (pkt.hdr.t == COAP_TYPE_RESET)
+  {
+    coap_remove_observer(remote, &pkt);
+    return 0;
+  }
+  else if (pkt.hdr.t == COAP_TYPE_ACK)
+  {
+    coap_ack_observer(remote, &pkt);
+    return 0;
+  }
   else
   {
     coap_packet_t rsppkt;
@@ -33,7 +43,7 @@ size_t coap_server_respond(char *req, unsigned short reqlen, char *rsp, unsigned
 #ifdef COAP_DEBUG
     coap_dumpPacket(&pkt);
 #endif
-    coap_handle_req(&scratch_buf, &pkt, &rsppkt);
+    coap_handle_req(&scratch_buf, &pkt, &rsppkt, remote);
     if (0 != (rc = coap_build(rsp, &rlen, &rsppkt))){
       NODE_DBG("coap_build failed rc=%d\n", rc);
       // return 0;
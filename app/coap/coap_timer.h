@@ -16,13 +16,15 @@ extern "C" {
 
 void coap_timer_elapsed(coap_tick_t *diff);
 
-void coap_timer_setup(coap_queue_t ** queue, coap_tick_t t);
+/** Monotonic time in ticks, used for the absolute deadlines in the heap. */
+coap_tick_t coap_timer_now(void);
 
-void coap_timer_stop(void);
+void coap_timer_setup(coap_heap_t *heap, coap_tick_t t);
 
-void coap_timer_update(coap_queue_t ** queue);
+void coap_timer_stop(void);
 
-void coap_timer_start(coap_queue_t ** queue);
+/** Arms the timer for the root of the heap, unless it is armed for it already. */
+void coap_timer_start(coap_heap_t *heap);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,8 @@
 #include "c_string.h"
 #include "c_stdlib.h"
 #include "coap.h"
+#include "coap_timer.h"
+#include "hash.h"
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -13,159 +15,444 @@
 
 void build_well_known_rsp(char *rsp, uint16_t rsplen);
 
-void endpoint_setup(void)
+// Resources are indexed by a hash of their full path, i.e. the fixed endpoints
+// as well as the variables and functions registered below them.
+#define RESOURCE_BUCKETS 16     // power of two
+static coap_luser_entry *resources[RESOURCE_BUCKETS];
+
+static void hash_segment(coap_key_t h, const uint8_t *s, size_t len)
 {
-    coap_setup();
+    coap_hash((const unsigned char *)"/", 1, h);
+    coap_hash(s, len, h);
 }
 
-static const coap_endpoint_path_t path_well_known_core = {2, {".well-known", "core"}};
-static int handle_get_well_known_core(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static uint32_t key_value(const coap_key_t h)
 {
-    outpkt->content.p = (uint8_t *)c_zalloc(MAX_PAYLOAD_SIZE);      // this should be free-ed when outpkt is built in coap_server_respond()
-    if(outpkt->content.p == NULL){
-        NODE_DBG("not enough memory\n");
-        return COAP_ERR_BUFFER_TOO_SMALL;
+    return ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | h[3];
+}
+
+static uint32_t path_key(const coap_endpoint_path_t *path, const char *name, size_t namelen)
+{
+    coap_key_t h = {0, 0, 0, 0};
+    int i;
+
+    for (i = 0; i < path->count; i++)
+        hash_segment(h, (const uint8_t *)path->elems[i], c_strlen(path->elems[i]));
+    if (name)
+        hash_segment(h, (const uint8_t *)name, namelen);
+    return key_value(h);
+}
+
+static int resource_matches(const coap_luser_entry *r, const coap_option_t *opt, uint8_t count)
+{
+    const coap_endpoint_path_t *path = r->ep->path;
+    int i;
+
+    if (count != path->count + (r->name ? 1 : 0))
+        return 0;
+    for (i = 0; i < path->count; i++)
+    {
+        if (opt[i].buf.len != c_strlen(path->elems[i]) || 0 != c_memcmp(path->elems[i], opt[i].buf.p, opt[i].buf.len))
+            return 0;
     }
-    outpkt->content.len = MAX_PAYLOAD_SIZE;
-    build_well_known_rsp(outpkt->content.p, outpkt->content.len);
-    return coap_make_response(scratch, outpkt, (const uint8_t *)outpkt->content.p, c_strlen(outpkt->content.p), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
+    return !r->name || (opt[i].buf.len == c_strlen(r->name) && 0 == c_memcmp(r->name, opt[i].buf.p, opt[i].buf.len));
 }
 
-static const coap_endpoint_path_t path_variable = {2, {"v1", "v"}};
-static int handle_get_variable(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static void resource_insert(coap_luser_entry *r)
+{
+    coap_luser_entry **bucket = &resources[r->key & (RESOURCE_BUCKETS - 1)];
+
+    r->hnext = *bucket;
+    *bucket = r;
+}
+
+coap_luser_entry *coap_find_resource(const coap_packet_t *pkt)
 {
     const coap_option_t *opt;
-    uint8_t count;
-    int n;
-    lua_State *L = lua_getstate();
-    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+    coap_key_t h = {0, 0, 0, 0};
+    coap_luser_entry *r;
+    uint8_t count, i;
+    uint32_t key;
+
+    if (NULL == (opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &count)))
+        return NULL;
+    for (i = 0; i < count; i++)
+        hash_segment(h, opt[i].buf.p, opt[i].buf.len);
+    key = key_value(h);
+
+    for (r = resources[key & (RESOURCE_BUCKETS - 1)]; r; r = r->hnext)
     {
-        if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
+        if (r->key == key && resource_matches(r, opt, count))
+            return r;
+    }
+    return NULL;
+}
+
+// Answers with the block of content asked for by the Block2 option of the request, see
+// http://tools.ietf.org/html/rfc7959#section-2.4. Content larger than a block is split
+// even if the client didn't ask for it. inpkt is NULL for notifications.
+static int make_block2_response(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, const coap_buffer_t *tok, coap_packet_t *outpkt, const uint8_t *content, size_t len, uint8_t id_hi, uint8_t id_lo, coap_content_type_t content_type)
+{
+    const coap_option_t *opt = NULL;
+    uint32_t num = 0, szx = COAP_BLOCK_SZX_DEFAULT, offset, total = len;
+    uint8_t count, more;
+    int rc;
+
+    if (inpkt && NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_BLOCK2, &count)))
+    {
+        uint32_t val = coap_decode_var_bytes(&opt->buf);
+        num = val >> 4;
+        szx = val & 0x07;
+        if (szx == 7)
+            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+        if (szx > COAP_BLOCK_SZX_MAX)   // answer with smaller blocks, the block number scales up
         {
-            NODE_DBG("should never happen.\n");
-            goto end;
+            num <<= szx - COAP_BLOCK_SZX_MAX;
+            szx = COAP_BLOCK_SZX_MAX;
         }
-        if (count == ep->path->count + 1)
+    }
+    else if (len <= COAP_BLOCK_SIZE(szx))
+        return coap_make_response(scratch, outpkt, content, len, id_hi, id_lo, tok, COAP_RSPCODE_CONTENT, content_type);
+
+    offset = num << (szx + 4);
+    if (offset > len || (offset == len && num > 0))
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    len -= offset;
+    more = len > COAP_BLOCK_SIZE(szx);
+    if (more)
+        len = COAP_BLOCK_SIZE(szx);
+
+    if (0 != (rc = coap_make_response(scratch, outpkt, content + offset, len, id_hi, id_lo, tok, COAP_RSPCODE_CONTENT, content_type)))
+        return rc;
+    if (0 != (rc = coap_add_option(scratch, outpkt, COAP_OPTION_BLOCK2, (num << 4) | (more << 3) | szx)))
+        return rc;
+    if (num == 0)   // let the client know what to expect
+        rc = coap_add_option(scratch, outpkt, COAP_OPTION_SIZE2, total);
+    return rc;
+}
+
+// Observers are identified by their transport address only, registering again
+// with a new token replaces the previous registration.
+static int add_observer(coap_luser_entry *entry, const coap_remote_t *remote, const coap_buffer_t *tok)
+{
+    coap_observer *o;
+    int n = 0;
+
+    if (tok->len > sizeof(o->tok))
+        return 0;
+    for (o = entry->observers; o; o = o->next, n++)
+    {
+        if (o->remote.ip == remote->ip && o->remote.port == remote->port)
+            break;
+    }
+    if (o == NULL)
+    {
+        if (n >= COAP_MAX_OBSERVERS || NULL == (o = (coap_observer *)c_zalloc(sizeof(coap_observer))))
+            return 0;
+        o->remote = *remote;
+        o->con_time = coap_timer_now();
+        o->next = entry->observers;
+        entry->observers = o;
+    }
+    o->tkl = tok->len;
+    if (tok->len)
+        c_memcpy(o->tok, tok->p, tok->len);
+    return 1;
+}
+
+static void drop_observer(coap_luser_entry *entry, const coap_remote_t *remote, const coap_header_t *rst)
+{
+    coap_observer **po = &entry->observers;
+
+    while (*po)
+    {
+        coap_observer *o = *po;
+        if (o->remote.ip == remote->ip && o->remote.port == remote->port &&
+            (!rst || o->last_id == ((rst->id[0] << 8) | rst->id[1])))
         {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (opt[count-1].buf.len != c_strlen(h->name))
-                {
-                    h = h->next;
-                    continue;
-                }
-                if (0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
-                {
-                    NODE_DBG("/v1/v/");
-                    NODE_DBG((char *)h->name);
-                    NODE_DBG(" match.\n");
-                    if(c_strlen(h->name))
-                    {
-                        n = lua_gettop(L);
-                        lua_getglobal(L, h->name);
-                        if (!lua_isnumber(L, -1) && !lua_isstring(L, -1)) {
-                            NODE_DBG ("should be a number or string.\n");
-                            lua_settop(L, n);
-                            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                        } else {
-                            const char *res = lua_tostring(L,-1);
-                            lua_settop(L, n);
-                            return coap_make_response(scratch, outpkt, (const uint8_t *)res, c_strlen(res), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, h->content_type);
-                        }
-                    }
-                } else {
-                    h = h->next;
-                }
+            *po = o->next;
+            c_free(o);
+            return;
+        }
+        po = &o->next;
+    }
+}
+
+// A client rejects a notification by answering it with RST
+void coap_remove_observer(const coap_remote_t *remote, const coap_packet_t *rst)
+{
+    coap_luser_entry *r;
+    int i;
+
+    for (i = 0; i < RESOURCE_BUCKETS; i++)
+    {
+        for (r = resources[i]; r; r = r->hnext)
+            drop_observer(r, remote, &rst->hdr);
+    }
+}
+
+// The client acknowledged the last confirmable notification
+void coap_ack_observer(const coap_remote_t *remote, const coap_packet_t *ack)
+{
+    coap_luser_entry *r;
+    coap_observer *o;
+    int i;
+
+    for (i = 0; i < RESOURCE_BUCKETS; i++)
+    {
+        for (r = resources[i]; r; r = r->hnext)
+        {
+            for (o = r->observers; o; o = o->next)
+            {
+                if (o->remote.ip == remote->ip && o->remote.port == remote->port &&
+                    o->last_id == ((ack->hdr.id[0] << 8) | ack->hdr.id[1]))
+                    o->con_pending = 0;
             }
-        }else{
-            NODE_DBG("/v1/v match.\n");
-            goto end;
         }
     }
-    NODE_DBG("none match.\n");
-end:
-    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
-static const coap_endpoint_path_t path_function = {2, {"v1", "f"}};
-static int handle_post_function(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+// Observations don't outlive the server they were registered with
+void coap_clear_observers(void)
 {
-    const coap_option_t *opt;
-    uint8_t count;
-    int n;
-    lua_State *L = lua_getstate();
-    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+    coap_luser_entry *r;
+    int i;
+
+    for (i = 0; i < RESOURCE_BUCKETS; i++)
     {
-        if ((count != ep->path->count ) && (count != ep->path->count + 1)) // +1 for /f/[function], /v/[variable]
+        for (r = resources[i]; r; r = r->hnext)
         {
-            NODE_DBG("should never happen.\n");
-            goto end;
+            while (r->observers)
+            {
+                coap_observer *o = r->observers;
+                r->observers = o->next;
+                c_free(o);
+            }
         }
-        if (count == ep->path->count + 1)
+    }
+}
+
+// Pushes the current value of a variable to the observers as 2.05 notifications,
+// returns the number of observers notified. Notifications are NON, except for every
+// COAP_OBS_CON_EVERY-th one and one at least every COAP_OBS_CON_INTERVAL, which are
+// CON. While a CON is unacknowledged, the following notifications are CON too and
+// take its place (RFC 7641 section 4.5.2). An observer is removed when a send fails
+// or after COAP_DEFAULT_MAX_RETRANSMIT of them went unacknowledged.
+int coap_notify(coap_luser_entry *entry, int (*send)(void *arg, const coap_remote_t *remote, const uint8_t *msg, size_t len), void *arg)
+{
+    lua_State *L = lua_getstate();
+    coap_observer *o, **po;
+    coap_tick_t now;
+    const char *res;
+    uint8_t *msg;
+    size_t len;
+    int n, sent = 0;
+
+    if (entry->observers == NULL)
+        return 0;
+
+    n = lua_gettop(L);
+    lua_getglobal(L, entry->name);
+    if (!lua_isnumber(L, -1) && !lua_isstring(L, -1)) {
+        lua_settop(L, n);
+        return 0;
+    }
+    res = lua_tolstring(L, -1, &len);   // stays referenced by the global while the messages are built
+
+    if (NULL == (msg = (uint8_t *)c_malloc(MAX_MESSAGE_SIZE))) {
+        lua_settop(L, n);
+        return 0;
+    }
+    entry->obs_seq = (entry->obs_seq + 1) & 0xFFFFFF;
+    now = coap_timer_now();
+
+    for (po = &entry->observers; (o = *po); )
+    {
+        coap_packet_t pkt;
+        uint8_t scratch_raw[MAX_RSP_SCRATCH_SIZE];
+        coap_rw_buffer_t scratch = {scratch_raw, sizeof(scratch_raw)};
+        coap_buffer_t tok = {o->tok, o->tkl};
+        uint16_t id = coap_new_message_id();
+        size_t msglen = MAX_MESSAGE_SIZE;
+        int con = o->con_pending || o->non_count + 1 >= COAP_OBS_CON_EVERY ||
+                  !COAP_TICK_BEFORE(now, o->con_time + COAP_OBS_CON_INTERVAL);
+        int drop = o->con_pending >= COAP_DEFAULT_MAX_RETRANSMIT;   // the client went away
+
+        if (!drop &&
+            0 == make_block2_response(&scratch, NULL, &tok, &pkt, (const uint8_t *)res, len, id >> 8, id & 0xFF, entry->content_type) &&
+            0 == coap_add_option(&scratch, &pkt, COAP_OPTION_OBSERVE, entry->obs_seq))
         {
-            coap_luser_entry *h = ep->user_entry->next;     // ->next: skip the first entry(head)
-            while(NULL != h){
-                if (opt[count-1].buf.len != c_strlen(h->name))
+            pkt.hdr.t = con ? COAP_TYPE_CON : COAP_TYPE_NONCON;
+            if (0 == coap_build(msg, &msglen, &pkt))
+            {
+                if (0 != send(arg, &o->remote, msg, msglen))
                 {
-                    h = h->next;
-                    continue;
+                    drop = 1;
                 }
-                if (0 == c_memcmp(h->name, opt[count-1].buf.p, opt[count-1].buf.len))
+                else
                 {
-                    NODE_DBG("/v1/f/");
-                    NODE_DBG((char *)h->name);
-                    NODE_DBG(" match.\n");
-
-                    if(c_strlen(h->name))
+                    o->last_id = id;
+                    if (con)
                     {
-                        n = lua_gettop(L);
-                        lua_getglobal(L, h->name);
-                        if (lua_type(L, -1) != LUA_TFUNCTION) {
-                            NODE_DBG ("should be a function\n");
-                            lua_settop(L, n);
-                            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                        } else {
-                            lua_pushlstring(L, inpkt->payload.p, inpkt->payload.len);     // make sure payload.p is filled with '\0' after payload.len, or use lua_pushlstring
-                            lua_call(L, 1, 1);
-                            if (!lua_isnil(L, -1)){  /* get return? */
-                                if( lua_isstring(L, -1) )   // deal with the return string
-                                {
-                                    size_t len = 0;
-                                    const char *ret = luaL_checklstring( L, -1, &len );
-                                    if(len > MAX_PAYLOAD_SIZE){
-                                        lua_settop(L, n);
-                                        luaL_error( L, "return string:<MAX_PAYLOAD_SIZE" );
-                                        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-                                    }
-                                    NODE_DBG((char *)ret);
-                                    NODE_DBG("\n");
-                                    lua_settop(L, n);
-                                    return coap_make_response(scratch, outpkt, ret, len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-                                } 
-                            } else {
-                                lua_settop(L, n);
-                                return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-                            }
-                        }
+                        o->con_pending++;
+                        o->non_count = 0;
+                        o->con_time = now;
                     }
-                } else {
-                    h = h->next;
+                    else
+                        o->non_count++;
+                    sent++;
                 }
             }
-        }else{
-            NODE_DBG("/v1/f match.\n");
-            goto end;
         }
+
+        if (drop)
+        {
+            *po = o->next;
+            c_free(o);
+        }
+        else
+            po = &o->next;
+    }
+
+    c_free(msg);
+    lua_settop(L, n);
+    return sent;
+}
+
+static const coap_endpoint_path_t path_well_known_core = {2, {".well-known", "core"}};
+static int handle_get_well_known_core(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    outpkt->content.p = (uint8_t *)c_zalloc(MAX_PAYLOAD_SIZE);      // this should be free-ed when outpkt is built in coap_server_respond()
+    if(outpkt->content.p == NULL){
+        NODE_DBG("not enough memory\n");
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    outpkt->content.len = MAX_PAYLOAD_SIZE;
+    build_well_known_rsp(outpkt->content.p, outpkt->content.len);
+    return make_block2_response(scratch, inpkt, &inpkt->tok, outpkt, (const uint8_t *)outpkt->content.p, c_strlen(outpkt->content.p), id_hi, id_lo, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
+}
+
+static const coap_endpoint_path_t path_variable = {2, {"v1", "v"}};
+static int handle_get_variable(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    int n, observing = 0, rc;
+    size_t len;
+    lua_State *L = lua_getstate();
+
+    if (entry == NULL)
+    {
+        NODE_DBG("/v1/v match.\n");
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    }
+
+    NODE_DBG("/v1/v/");
+    NODE_DBG((char *)entry->name);
+    NODE_DBG(" match.\n");
+    n = lua_gettop(L);
+    lua_getglobal(L, entry->name);
+    if (!lua_isnumber(L, -1) && !lua_isstring(L, -1)) {
+        NODE_DBG ("should be a number or string.\n");
+        lua_settop(L, n);
+        drop_observer(entry, remote, NULL);
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    }
+    const char *res = lua_tolstring(L, -1, &len);
+    lua_settop(L, n);
+
+    //http://tools.ietf.org/html/rfc7641#section-3.1
+    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_OBSERVE, &count)))
+    {
+        if (coap_decode_var_bytes(&opt->buf) == 0)
+            observing = add_observer(entry, remote, &inpkt->tok);
+        else
+            drop_observer(entry, remote, NULL);
+    }
+
+    if (0 != (rc = make_block2_response(scratch, inpkt, &inpkt->tok, outpkt, (const uint8_t *)res, len, id_hi, id_lo, entry->content_type)))
+        return rc;
+    if (observing)
+        rc = coap_add_option(scratch, outpkt, COAP_OPTION_OBSERVE, entry->obs_seq);
+    return rc;
+}
+
+static const coap_endpoint_path_t path_function = {2, {"v1", "f"}};
+static int handle_post_function(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    const coap_option_t *block1;
+    uint8_t count;
+    uint32_t val = 0;
+    int n, rc;
+    lua_State *L = lua_getstate();
+
+    if (entry == NULL)
+    {
+        NODE_DBG("/v1/f match.\n");
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    }
+
+    NODE_DBG("/v1/f/");
+    NODE_DBG((char *)entry->name);
+    NODE_DBG(" match.\n");
+
+    //http://tools.ietf.org/html/rfc7959#section-2.5
+    // Each block is handed to the function as it arrives, together with its offset
+    // and whether more follow, so large uploads never have to be held in memory.
+    if (NULL != (block1 = coap_findOptions(inpkt, COAP_OPTION_BLOCK1, &count)))
+    {
+        val = coap_decode_var_bytes(&block1->buf);
+        if ((val & 0x07) == 7)
+            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    }
+
+    n = lua_gettop(L);
+    lua_getglobal(L, entry->name);
+    if (lua_type(L, -1) != LUA_TFUNCTION) {
+        NODE_DBG ("should be a function\n");
+        lua_settop(L, n);
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    }
+    lua_pushlstring(L, inpkt->payload.p, inpkt->payload.len);     // make sure payload.p is filled with '\0' after payload.len, or use lua_pushlstring
+    if (block1) {
+        lua_pushinteger(L, (val >> 4) << ((val & 0x07) + 4));
+        lua_pushboolean(L, (val & 0x08) != 0);
+        lua_call(L, 3, 1);
+    } else {
+        lua_call(L, 1, 1);
+    }
+
+    if (block1 && (val & 0x08)) {   // more to come
+        lua_settop(L, n);
+        if (0 != (rc = coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTINUE, COAP_CONTENTTYPE_NONE)))
+            return rc;
+        return coap_add_option(scratch, outpkt, COAP_OPTION_BLOCK1, val);
+    }
+
+    size_t len = 0;
+    const char *ret = NULL;
+    if (lua_isstring(L, -1)) {  // deal with the return string
+        ret = lua_tolstring(L, -1, &len);
+        if(len > MAX_PAYLOAD_SIZE){
+            lua_settop(L, n);
+            luaL_error( L, "return string:<MAX_PAYLOAD_SIZE" );
+            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+        }
+        NODE_DBG((char *)ret);
+        NODE_DBG("\n");
     }
-    NODE_DBG("none match.\n");    
-end:
-    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    lua_settop(L, n);
+    if (0 != (rc = coap_make_response(scratch, outpkt, ret, len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, entry->content_type)))
+        return rc;
+    if (block1)
+        rc = coap_add_option(scratch, outpkt, COAP_OPTION_BLOCK1, val);
+    return rc;
 }
 
 extern int lua_put_line(const char *s, size_t l);
 
 static const coap_endpoint_path_t path_command = {2, {"v1", "c"}};
-static int handle_post_command(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_post_command(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
     if (inpkt->payload.len == 0)
         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
@@ -183,7 +470,7 @@ static int handle_post_command(const coap_endpoint_t *ep, coap_rw_buffer_t *scra
 
 static uint32_t id = 0;
 static const coap_endpoint_path_t path_id = {2, {"v1", "id"}};
-static int handle_get_id(const coap_endpoint_t *ep, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_get_id(const coap_endpoint_t *ep, coap_luser_entry *entry, const coap_remote_t *remote, coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
     id = system_get_chip_id();
     return coap_make_response(scratch, outpkt, (const uint8_t *)(&id), sizeof(uint32_t), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
@@ -198,13 +485,88 @@ coap_luser_entry *function_entry = &func_head;
 const coap_endpoint_t endpoints[] =
 {
     {COAP_METHOD_GET, handle_get_well_known_core, &path_well_known_core, "ct=40", NULL},
-    {COAP_METHOD_GET, handle_get_variable, &path_variable, "ct=0", &var_head},
+    {COAP_METHOD_GET, handle_get_variable, &path_variable, "ct=0;obs", &var_head},
     {COAP_METHOD_POST, handle_post_function, &path_function, NULL, &func_head},
     {COAP_METHOD_POST, handle_post_command, &path_command, NULL, NULL},
     {COAP_METHOD_GET, handle_get_id, &path_id, "ct=0", NULL},
     {(coap_method_t)0, NULL, NULL, NULL, NULL}
 };
 
+// nameless entries indexing the fixed endpoints
+static coap_luser_entry endpoint_entry[sizeof(endpoints) / sizeof(endpoints[0]) - 1];
+
+void endpoint_setup(void)
+{
+    int i;
+
+    coap_setup();
+    if (endpoint_entry[0].ep)
+        return;
+    for (i = 0; endpoints[i].handler; i++)
+    {
+        endpoint_entry[i].ep = &endpoints[i];
+        endpoint_entry[i].key = path_key(endpoints[i].path, NULL, 0);
+        resource_insert(&endpoint_entry[i]);
+    }
+}
+
+static const coap_endpoint_t *owner(coap_luser_entry *head)
+{
+    const coap_endpoint_t *ep;
+
+    for (ep = endpoints; ep->handler; ep++)
+    {
+        if (ep->user_entry == head)
+            return ep;
+    }
+    return NULL;
+}
+
+coap_luser_entry *coap_find_entry(coap_luser_entry *head, const char *name, size_t len)
+{
+    const coap_endpoint_t *ep = owner(head);
+    coap_luser_entry *r;
+    uint32_t key;
+
+    if (ep == NULL)
+        return NULL;
+    key = path_key(ep->path, name, len);
+    for (r = resources[key & (RESOURCE_BUCKETS - 1)]; r; r = r->hnext)
+    {
+        if (r->key == key && r->ep == ep && r->name && c_strlen(r->name) == len && 0 == c_memcmp(r->name, name, len))
+            return r;
+    }
+    return NULL;
+}
+
+// Registers a variable or function below the endpoint owning head, or updates
+// the content type if it exists already. The name is copied.
+coap_luser_entry *coap_add_entry(coap_luser_entry *head, const char *name, int content_type)
+{
+    size_t len = c_strlen(name);
+    coap_luser_entry *h = coap_find_entry(head, name, len);
+
+    if (h == NULL)
+    {
+        if (owner(head) == NULL)
+            return NULL;
+        h = (coap_luser_entry *)c_zalloc(sizeof(coap_luser_entry) + len + 1);
+        if (h == NULL)
+            return NULL;
+        c_memcpy((char *)(h + 1), name, len + 1);
+        h->name = (const char *)(h + 1);
+        h->ep = owner(head);
+        h->key = path_key(h->ep->path, name, len);
+        resource_insert(h);
+
+        while (NULL != head->next)   // keep registration order for .well-known/core
+            head = head->next;
+        head->next = h;
+    }
+    h->content_type = content_type;
+    return h;
+}
+
 void build_well_known_rsp(char *rsp, uint16_t rsplen)
 {
     const coap_endpoint_t *ep = endpoints;
@@ -14,6 +14,7 @@ typedef unsigned char coap_key_t[4];
 typedef int coap_tid_t;
 #define COAP_INVALID_TID -1
 
+void coap_hash(const unsigned char *s, unsigned int len, coap_key_t h);
 void coap_transaction_id(const uint32_t ip, const uint32_t port, const coap_packet_t *pkt, coap_tid_t *id);
 
 #ifdef __cplusplus
@@ -2,6 +2,8 @@
 #include "c_stdlib.h"
 #include "node.h"
 
+#define HEAP_INITIAL_SIZE 8
+
 static inline coap_queue_t *
 coap_malloc_node(void) {
   return (coap_queue_t *)c_zalloc(sizeof(coap_queue_t));
@@ -11,39 +13,80 @@ void coap_free_node(coap_queue_t *node) {
   c_free(node);
 }
 
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node) {
-  coap_queue_t *p, *q;
-  if ( !queue || !node )
-    return 0;
+static inline coap_queue_t **index_bucket(coap_heap_t *heap, coap_tid_t id) {
+  return &heap->index[(unsigned)id & (COAP_TID_BUCKETS - 1)];
+}
+
+static void index_add(coap_heap_t *heap, coap_queue_t *node) {
+  coap_queue_t **bucket = index_bucket(heap, node->id);
+
+  node->hnext = *bucket;
+  *bucket = node;
+}
+
+static void index_remove(coap_heap_t *heap, coap_queue_t *node) {
+  coap_queue_t **pn;
 
-  /* set queue head if empty */
-  if ( !*queue ) {
-    *queue = node;
-    return 1;
+  for (pn = index_bucket(heap, node->id); *pn; pn = &(*pn)->hnext) {
+    if (*pn == node) {
+      *pn = node->hnext;
+      break;
+    }
   }
+  node->hnext = NULL;
+}
 
-  /* replace queue head if PDU's time is less than head's time */
-  q = *queue;
-  if (node->t < q->t) {
-    node->next = q;
-    *queue = node;
-    q->t -= node->t;		/* make q->t relative to node->t */
-    return 1;
+static inline void heap_set(coap_heap_t *heap, unsigned short pos, coap_queue_t *node) {
+  heap->node[pos] = node;
+  node->pos = pos;
+}
+
+static void sift_up(coap_heap_t *heap, unsigned short pos) {
+  coap_queue_t *node = heap->node[pos];
+
+  while (pos > 0) {
+    unsigned short parent = (pos - 1) / 2;
+    if (!COAP_TICK_BEFORE(node->t, heap->node[parent]->t))
+      break;
+    heap_set(heap, pos, heap->node[parent]);
+    pos = parent;
   }
+  heap_set(heap, pos, node);
+}
 
-  /* search for right place to insert */
-  do {
-    node->t -= q->t;		/* make node-> relative to q->t */
-    p = q;
-    q = q->next;
-  } while (q && q->t <= node->t);
+static void sift_down(coap_heap_t *heap, unsigned short pos) {
+  coap_queue_t *node = heap->node[pos];
+
+  for (;;) {
+    unsigned short child = 2 * pos + 1;
+    if (child >= heap->count)
+      break;
+    if (child + 1 < heap->count && COAP_TICK_BEFORE(heap->node[child + 1]->t, heap->node[child]->t))
+      child++;
+    if (!COAP_TICK_BEFORE(heap->node[child]->t, node->t))
+      break;
+    heap_set(heap, pos, heap->node[child]);
+    pos = child;
+  }
+  heap_set(heap, pos, node);
+}
 
-  /* insert new item */
-  if (q) {
-    q->t -= node->t;		/* make q->t relative to node->t */
+int coap_insert_node(coap_heap_t *heap, coap_queue_t *node) {
+  if ( !heap || !node )
+    return 0;
+
+  if (heap->count == heap->size) {
+    unsigned short size = heap->size ? heap->size * 2 : HEAP_INITIAL_SIZE;
+    coap_queue_t **grown = (coap_queue_t **)c_realloc(heap->node, size * sizeof(coap_queue_t *));
+    if (!grown)
+      return 0;
+    heap->node = grown;
+    heap->size = size;
   }
-  node->next = q;
-  p->next = node;
+
+  heap->node[heap->count] = node;
+  sift_up(heap, heap->count++);
+  index_add(heap, node);
   return 1;
 }
 
@@ -57,12 +100,16 @@ int coap_delete_node(coap_queue_t *node) {
   return 1;
 }
 
-void coap_delete_all(coap_queue_t *queue) {
-  if ( !queue )
+void coap_delete_all(coap_heap_t *heap) {
+  if ( !heap )
     return;
 
-  coap_delete_all( queue->next );
-  coap_delete_node( queue );
+  while (heap->count)
+    coap_delete_node( heap->node[--heap->count] );
+  c_free(heap->node);
+  heap->node = NULL;
+  heap->size = 0;
+  c_memset(heap->index, 0, sizeof(heap->index));
 }
 
 coap_queue_t * coap_new_node(void) {
@@ -77,65 +124,67 @@ coap_queue_t * coap_new_node(void) {
   return node;
 }
 
-coap_queue_t * coap_peek_next( coap_queue_t *queue ) {
-  if ( !queue )
+coap_queue_t * coap_peek_next( coap_heap_t *heap ) {
+  if ( !heap || !heap->count )
     return NULL;
 
-  return queue;
+  return heap->node[0];
 }
 
-coap_queue_t * coap_pop_next( coap_queue_t **queue ) {		// this function is called inside timeout callback only.
-  coap_queue_t *next;
-
-  if ( !(*queue) )
-    return NULL;
+coap_queue_t * coap_pop_next( coap_heap_t *heap ) {
+  coap_queue_t *next = coap_peek_next(heap);
 
-  next = *queue;
-  *queue = (*queue)->next;
-  // if (queue) {
-  //   queue->t += next->t;
-  // }
-  next->next = NULL;
+  if (next)
+    coap_extract_node(heap, next);
   return next;
 }
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id){
-  coap_queue_t *p, *q, *node;
-  if ( !queue ) 
-    return 0;
-  if ( !*queue )  // if empty
-    return 0;
+coap_queue_t * coap_find_node( coap_heap_t *heap, const coap_tid_t id ) {
+  coap_queue_t *node;
 
-  q = *queue;
-  if (q->id == id) {
-    node = q;
-    *queue = q->next;
-    node->next = NULL;
-    if(*queue){
-      (*queue)->t += node->t;
-    }
-    coap_delete_node(node);
-    return 1;
+  if ( !heap )
+    return NULL;
+  for (node = *index_bucket(heap, id); node; node = node->hnext) {
+    if (node->id == id)
+      return node;
   }
+  return NULL;
+}
 
-  /* search for right node to remove */
-  while (q && q->id != id) {
-    p = q;
-    q = q->next;
-  }
+void coap_extract_node( coap_heap_t *heap, coap_queue_t *node ) {
+  unsigned short pos = node->pos;
+  coap_queue_t *last = heap->node[--heap->count];
 
-  /* find the node */
-  if (q) {
-    node = q; /* save the node */
-    p->next = q->next;  /* remove the node */
-    q = q->next;
-    node->next = NULL;
-    if (q)   // add node->t to the node after.
-    {
-      q->t += node->t;
-    }
-    coap_delete_node(node);
-    return 1;
+  node->next = NULL;
+  index_remove(heap, node);
+  if (last == node)
+    return;
+  heap_set(heap, pos, last);
+  // the moved node may belong either above or below its new position
+  if (pos > 0 && COAP_TICK_BEFORE(last->t, heap->node[(pos - 1) / 2]->t))
+    sift_up(heap, pos);
+  else
+    sift_down(heap, pos);
+}
+
+void coap_rebuild_heap( coap_heap_t *heap ) {
+  unsigned short i;
+
+  c_memset(heap->index, 0, sizeof(heap->index));
+  for (i = 0; i < heap->count; i++) {
+    heap->node[i]->pos = i;
+    index_add(heap, heap->node[i]);
   }
-  return 0;
+  for (i = heap->count / 2; i > 0; i--)
+    sift_down(heap, i - 1);
+}
+
+int coap_remove_node( coap_heap_t *heap, const coap_tid_t id){
+  coap_queue_t *node = coap_find_node(heap, id);
+
+  if ( !node )
+    return 0;
+  coap_extract_node(heap, node);
+  coap_delete_node(node);
+  return 1;
 }
@@ -11,18 +11,14 @@ extern "C" {
 struct coap_queue_t;
 typedef uint32_t coap_tick_t;
 
-/*
-1. queue(first)->t store when to send PDU for the next time, it's a base(absolute) time
-2. queue->next->t store the delta between time and base-time.  queue->next->t = timeout + now - basetime
-3. node->next->t store the delta between time and previous->t.  node->next->t = timeout + now - node->t - basetime
-4. time to fire:   10,   15,    18,    25
-		node->t:   10,   5,     3,     7
-*/
+/* ticks wrap around, compare them by their signed difference */
+#define COAP_TICK_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
 
 typedef struct coap_queue_t {
-  struct coap_queue_t *next;
+  struct coap_queue_t *next;	/**< link in the waiting list of the peer */
+  struct coap_queue_t *hnext;	/**< link in the tid index of the heap */
 
-  coap_tick_t t;	        /**< when to send PDU for the next time */
+  coap_tick_t t;	        /**< when to send PDU for the next time, absolute */
   unsigned char retransmit_cnt;	/**< retransmission counter, will be removed when zero */
   unsigned int timeout;		/**< the randomized timeout value */
 
@@ -31,25 +27,53 @@ typedef struct coap_queue_t {
   // coap_packet_t *pkt;
   coap_pdu_t *pdu;		/**< the CoAP PDU to send */
   struct espconn *pconn;
+  uint32_t ip;			/**< the peer, pconn may be shared by several */
+  uint16_t port;
+  unsigned short pos;		/**< index in the heap */
 } coap_queue_t;
 
+#define COAP_TID_BUCKETS 16    /* power of two */
+
+/*
+ * Binary min-heap on coap_queue_t->t. The root is the next transaction due for
+ * retransmission, insertion and removal are O(log n). The nodes in the heap are
+ * also hashed on their tid, so matching an ACK or RST to its transaction does
+ * not scan the heap.
+ */
+typedef struct {
+  coap_queue_t **node;
+  unsigned short count;
+  unsigned short size;
+  coap_queue_t *index[COAP_TID_BUCKETS];
+} coap_heap_t;
+
 void coap_free_node(coap_queue_t *node);
 
-/** Adds node to given queue, ordered by node->t. */
-int coap_insert_node(coap_queue_t **queue, coap_queue_t *node);
+/** Adds node to given heap, ordered by node->t. */
+int coap_insert_node(coap_heap_t *heap, coap_queue_t *node);
 
 /** Destroys specified node. */
 int coap_delete_node(coap_queue_t *node);
 
-/** Removes all items from given queue and frees the allocated storage. */
-void coap_delete_all(coap_queue_t *queue);
+/** Removes all items from given heap and frees the allocated storage. */
+void coap_delete_all(coap_heap_t *heap);
 
 /** Creates a new node suitable for adding to the CoAP sendqueue. */
 coap_queue_t *coap_new_node(void);
 
-coap_queue_t *coap_pop_next( coap_queue_t **queue );
+coap_queue_t *coap_peek_next( coap_heap_t *heap );
+
+coap_queue_t *coap_pop_next( coap_heap_t *heap );
+
+coap_queue_t *coap_find_node( coap_heap_t *heap, const coap_tid_t id );
+
+/** Takes node out of the heap without destroying it. */
+void coap_extract_node( coap_heap_t *heap, coap_queue_t *node );
+
+/** Restores the heap order and the tid index after the node array was modified directly. */
+void coap_rebuild_heap( coap_heap_t *heap );
 
-int coap_remove_node( coap_queue_t **queue, const coap_tid_t id);
+int coap_remove_node( coap_heap_t *heap, const coap_tid_t id);
 
 #ifdef __cplusplus
 }
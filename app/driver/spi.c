@@ -179,16 +179,28 @@ void spi_mast_byte_order(uint8 spi_no, uint8 order)
 *******************************************************************************/
 void spi_mast_blkset(uint8 spi_no, size_t bitlen, const uint8 *data)
 {
-    size_t aligned_len = bitlen >> 3;
+    size_t words = ((bitlen >> 3) + 3) >> 2;
+    uint32 reg = SPI_W0(spi_no);
 
     while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
 
-    if (aligned_len % 4) {
-        // length for memcpy needs to be aligned to uint32 bounday
-        // otherwise single byte writes are issued to the register and corrupt data
-        aligned_len += 4 - (aligned_len % 4);
+    // the FIFO registers must only be accessed with 32 bit writes
+    // otherwise single byte writes are issued to the register and corrupt data
+    if (((uint32)data & 3) == 0) {
+        const uint32 *src = (const uint32 *)data;
+        while (words--) {
+            WRITE_PERI_REG(reg, *src++);
+            reg += 4;
+        }
+    } else {
+        // unaligned source: assemble each word from bytes in memory order
+        while (words--) {
+            WRITE_PERI_REG(reg, (uint32)data[0]         | ((uint32)data[1] << 8) |
+                                ((uint32)data[2] << 16) | ((uint32)data[3] << 24));
+            data += 4;
+            reg  += 4;
+        }
     }
-    os_memcpy((void *)SPI_W0(spi_no), (const void *)data, aligned_len);
 }
 
 /******************************************************************************
@@ -38,6 +38,12 @@ extern UartDevice UartDev;
 
 static os_timer_t autobaud_timer;
 
+#ifdef UART_RX_BUFF_SIZE
+// Replaces the 0x100 byte buffer the ROM sets up. The read and write
+// positions run over RX_BUFF_SIZE + 1 bytes.
+static uint8 rx_buff[RX_BUFF_SIZE + 1];
+#endif
+
 static void (*alt_uart0_tx)(char txchar);
 
 LOCAL void ICACHE_RAM_ATTR
@@ -307,6 +313,52 @@ uart0_rx_intr_handler(void *para)
     }
 }
 
+/******************************************************************************
+ * FunctionName : uart_rx_peek
+ * Description  : Returns the received bytes which can be read in one go,
+ *                i.e. up to the write position or the end of the buffer.
+ *                They stay in the buffer until uart_rx_consume is called.
+ * Parameters   : const char **buf - set to the first byte
+ * Returns      : number of bytes
+*******************************************************************************/
+size_t ICACHE_FLASH_ATTR
+uart_rx_peek(const char **buf)
+{
+    RcvMsgBuff *pRxBuff = &(UartDev.rcv_buff);
+    uint8 *pWritePos = pRxBuff->pWritePos;
+    uint8 *pReadPos = pRxBuff->pReadPos;
+
+    *buf = (const char *)pReadPos;
+    if (pWritePos >= pReadPos)
+        return pWritePos - pReadPos;
+    return pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE + 1 - pReadPos;
+}
+
+/******************************************************************************
+ * FunctionName : uart_rx_consume
+ * Description  : Drops bytes returned by uart_rx_peek from the buffer
+ * Parameters   : size_t len - number of bytes, at most what uart_rx_peek gave
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_rx_consume(size_t len)
+{
+    RcvMsgBuff *pRxBuff = &(UartDev.rcv_buff);
+    uint8 *pEnd = pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE;
+
+    if (len == 0)
+        return;
+    ETS_INTR_LOCK();
+    // The ISR only moves the read position itself on overflow, in
+    // which case the bytes were lost anyway.
+    if (pRxBuff->pReadPos + len > pEnd) {
+        pRxBuff->pReadPos = pRxBuff->pRcvMsgBuff + (pRxBuff->pReadPos + len - pEnd - 1);
+    } else {
+        pRxBuff->pReadPos += len;
+    }
+    ETS_INTR_UNLOCK();
+}
+
 static void 
 uart_autobaud_timeout(void *timer_arg)
 {
@@ -355,6 +407,13 @@ uart_init(UartBautRate uart0_br, UartBautRate uart1_br, os_signal_t sig_input, u
     sig = sig_input;
     sig_flag = flag_input;
 
+#ifdef UART_RX_BUFF_SIZE
+    UartDev.rcv_buff.RcvBuffSize = RX_BUFF_SIZE;
+    UartDev.rcv_buff.pRcvMsgBuff = rx_buff;
+    UartDev.rcv_buff.pWritePos = rx_buff;
+    UartDev.rcv_buff.pReadPos = rx_buff;
+#endif
+
     // rom use 74880 baut_rate, here reinitialize
     UartDev.baut_rate = uart0_br;
     uart_config(UART0);
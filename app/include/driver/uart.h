@@ -5,8 +5,13 @@
 #include "eagle_soc.h"
 #include "c_types.h"
 #include "os_type.h"
+#include "user_config.h"
 
+#ifdef UART_RX_BUFF_SIZE
+#define RX_BUFF_SIZE    UART_RX_BUFF_SIZE
+#else
 #define RX_BUFF_SIZE    0x100
+#endif
 #define TX_BUFF_SIZE    100
 
 typedef enum {
@@ -113,6 +118,8 @@ typedef struct {
 void uart_init(UartBautRate uart0_br, UartBautRate uart1_br, os_signal_t sig_input, uint8 *flag_input);
 UartConfig uart_get_config(uint8 uart_no);
 void uart0_alt(uint8 on);
+size_t uart_rx_peek(const char **buf);
+void uart_rx_consume(size_t len);
 void uart0_sendStr(const char *str);
 void uart0_putc(const char c);
 void uart0_tx_buffer(uint8 *buf, uint16 len);
@@ -12,5 +12,25 @@ struct nodemcu_mdns_info {
 void nodemcu_mdns_close(void);
 bool nodemcu_mdns_init(struct nodemcu_mdns_info *);
 
+/*
+ * Client side. Once a query has been sent, records from all mDNS responses
+ * seen are cached until their TTL runs out. Names are in dotted form, e.g.
+ * "fishtank.local" or "_http._tcp.local".
+ */
+
+/* Called whenever a response changed the cache */
+void nodemcu_mdns_set_update_cb(void (*cb)(void));
+
+bool nodemcu_mdns_query_host(const char *host);
+bool nodemcu_mdns_query_service(const char *service);
+
+bool nodemcu_mdns_resolve_cached(const char *host, ip_addr_t *ip);
+
+/* host is NULL until the SRV record is known, ip until the A record is known */
+typedef void (*nodemcu_mdns_browse_cb)(void *arg, const char *instance, const char *host, uint16 port,
+                                       const ip_addr_t *ip, const uint8 *txt, uint16 txtlen);
+
+/* Reports the cached instances of a service, returns their number. cb may be NULL */
+int nodemcu_mdns_browse_cached(const char *service, nodemcu_mdns_browse_cb cb, void *arg);
 
 #endif
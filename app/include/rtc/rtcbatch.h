@@ -0,0 +1,165 @@
+/*
+ * Batching policy on top of the RTC sample FIFO.
+ *
+ * Samples are collected across several deep sleep cycles with the radio
+ * disabled on wake-up. Only the wake-up on which the batch is expected to be
+ * complete (either by sample count or because the oldest sample is getting
+ * too old) is started with RF enabled. Time spent awake with and without the
+ * radio, as well as time spent asleep, is accumulated so that the charge
+ * drawn can be estimated.
+ */
+#ifndef _RTCBATCH_H_
+#define _RTCBATCH_H_
+#include "rtcaccess.h"
+#include "rtcfifo.h"
+
+// Slots 21-30 hold the batch control block. The default rtcfifo storage starts at slot 32.
+//
+// 0: magic
+// 1: batch size, in samples. 0 disables the size check.
+// 2: deadline, in seconds since the oldest sample. 0 disables the deadline check.
+// 3: state. FIFO count at the last deep sleep in bits 0:15, RF enabled on wake-up in bit 31
+// 4: number of deep sleep cycles
+// 5: number of deep sleep cycles woken with RF enabled
+// 6: milliseconds awake with RF disabled
+// 7: milliseconds awake with RF enabled
+// 8: milliseconds asleep
+// 9: supply currents. Awake with RF in mA in bits 0:9, awake without RF in mA in bits 10:19,
+//    asleep in uA in bits 20:31
+
+#define RTC_BATCH_BASE          21
+#define RTC_BATCH_MAGIC         0x42746368
+
+#define RTC_BATCH_MAGIC_POS     (RTC_BATCH_BASE+0)
+#define RTC_BATCH_SIZE_POS      (RTC_BATCH_BASE+1)
+#define RTC_BATCH_DEADLINE_POS  (RTC_BATCH_BASE+2)
+#define RTC_BATCH_STATE_POS     (RTC_BATCH_BASE+3)
+#define RTC_BATCH_WAKES_POS     (RTC_BATCH_BASE+4)
+#define RTC_BATCH_RFWAKES_POS   (RTC_BATCH_BASE+5)
+#define RTC_BATCH_AWAKE_MS_POS  (RTC_BATCH_BASE+6)
+#define RTC_BATCH_RF_MS_POS     (RTC_BATCH_BASE+7)
+#define RTC_BATCH_SLEEP_MS_POS  (RTC_BATCH_BASE+8)
+#define RTC_BATCH_CURRENT_POS   (RTC_BATCH_BASE+9)
+
+#define RTC_BATCH_STATE_RF      0x80000000
+
+// Typical ESP8266 figures
+#define RTC_BATCH_DEFAULT_RF_MA     70
+#define RTC_BATCH_DEFAULT_AWAKE_MA  15
+#define RTC_BATCH_DEFAULT_SLEEP_UA  20
+
+static inline uint8_t rtc_batch_check_magic(void)
+{
+  return rtc_mem_read(RTC_BATCH_MAGIC_POS)==RTC_BATCH_MAGIC;
+}
+
+static inline void rtc_batch_disable(void)
+{
+  rtc_mem_write(RTC_BATCH_MAGIC_POS,0);
+}
+
+static inline uint32_t rtc_batch_get_size(void)
+{
+  return rtc_mem_read(RTC_BATCH_SIZE_POS);
+}
+
+static inline uint32_t rtc_batch_get_deadline(void)
+{
+  return rtc_mem_read(RTC_BATCH_DEADLINE_POS);
+}
+
+static inline uint32_t rtc_batch_get_rf_ma(void)
+{
+  return rtc_mem_read(RTC_BATCH_CURRENT_POS)&0x3ff;
+}
+
+static inline uint32_t rtc_batch_get_awake_ma(void)
+{
+  return (rtc_mem_read(RTC_BATCH_CURRENT_POS)>>10)&0x3ff;
+}
+
+static inline uint32_t rtc_batch_get_sleep_ua(void)
+{
+  return rtc_mem_read(RTC_BATCH_CURRENT_POS)>>20;
+}
+
+static inline void rtc_batch_reset_stats(void)
+{
+  rtc_mem_write(RTC_BATCH_WAKES_POS,0);
+  rtc_mem_write(RTC_BATCH_RFWAKES_POS,0);
+  rtc_mem_write(RTC_BATCH_AWAKE_MS_POS,0);
+  rtc_mem_write(RTC_BATCH_RF_MS_POS,0);
+  rtc_mem_write(RTC_BATCH_SLEEP_MS_POS,0);
+}
+
+static inline void rtc_batch_prepare(uint32_t size, uint32_t deadline_s, uint32_t rf_ma, uint32_t awake_ma, uint32_t sleep_ua)
+{
+  rtc_mem_write(RTC_BATCH_SIZE_POS,size);
+  rtc_mem_write(RTC_BATCH_DEADLINE_POS,deadline_s);
+  rtc_mem_write(RTC_BATCH_STATE_POS,RTC_BATCH_STATE_RF|(rtc_fifo_get_count()&0xffff));
+  rtc_mem_write(RTC_BATCH_CURRENT_POS,(rf_ma&0x3ff)|((awake_ma&0x3ff)<<10)|((sleep_ua&0xfff)<<20));
+  rtc_batch_reset_stats();
+  rtc_mem_write(RTC_BATCH_MAGIC_POS,RTC_BATCH_MAGIC);
+}
+
+// Whether the last deep sleep was set up to wake with RF enabled
+static inline uint8_t rtc_batch_rf_on_wake(void)
+{
+  return (rtc_mem_read(RTC_BATCH_STATE_POS)&RTC_BATCH_STATE_RF)!=0;
+}
+
+// Number of samples added since the last deep sleep, at least 1
+static inline uint32_t rtc_batch_samples_per_wake(void)
+{
+  uint32_t last=rtc_mem_read(RTC_BATCH_STATE_POS)&0xffff;
+  uint32_t count=rtc_fifo_get_count();
+
+  return (count>last) ? count-last : 1;
+}
+
+// Checks whether the batch would be complete after adding `extra` samples
+// `ahead_s` seconds after the most recently stored one
+static inline uint8_t rtc_batch_due_after(uint32_t ahead_s, uint32_t extra)
+{
+  uint32_t size=rtc_batch_get_size();
+  uint32_t deadline=rtc_batch_get_deadline();
+  uint32_t count=rtc_fifo_get_count();
+  sample_t oldest;
+
+  if (size && count+extra>=size)
+    return 1;
+  if (deadline && count && rtc_fifo_peek_sample(&oldest,0))
+    return rtc_fifo_get_tail_t()+ahead_s-oldest.timestamp>=deadline;
+  return 0;
+}
+
+static inline uint8_t rtc_batch_is_due(void)
+{
+  return rtc_batch_due_after(0,0);
+}
+
+// Book-keeping for a deep sleep about to start. `rf` tells whether the radio
+// was available during the wake period now ending, `rf_next` whether it will
+// be for the next one.
+static inline void rtc_batch_account(uint32_t awake_ms, uint32_t sleep_ms, uint8_t rf, uint8_t rf_next)
+{
+  uint32_t pos=rf ? RTC_BATCH_RF_MS_POS : RTC_BATCH_AWAKE_MS_POS;
+
+  rtc_mem_write(pos,rtc_mem_read(pos)+awake_ms);
+  rtc_mem_write(RTC_BATCH_SLEEP_MS_POS,rtc_mem_read(RTC_BATCH_SLEEP_MS_POS)+sleep_ms);
+  rtc_mem_write(RTC_BATCH_WAKES_POS,rtc_mem_read(RTC_BATCH_WAKES_POS)+1);
+  if (rf)
+    rtc_mem_write(RTC_BATCH_RFWAKES_POS,rtc_mem_read(RTC_BATCH_RFWAKES_POS)+1);
+  rtc_mem_write(RTC_BATCH_STATE_POS,(rf_next ? RTC_BATCH_STATE_RF : 0)|(rtc_fifo_get_count()&0xffff));
+}
+
+// Estimated charge drawn since the statistics were reset, in uAh
+static inline uint32_t rtc_batch_charge_uah(void)
+{
+  uint64_t ua_ms=(uint64_t)rtc_mem_read(RTC_BATCH_RF_MS_POS)*rtc_batch_get_rf_ma()*1000+
+                 (uint64_t)rtc_mem_read(RTC_BATCH_AWAKE_MS_POS)*rtc_batch_get_awake_ma()*1000+
+                 (uint64_t)rtc_mem_read(RTC_BATCH_SLEEP_MS_POS)*rtc_batch_get_sleep_ua();
+
+  return (uint32_t)(ua_ms/3600000);
+}
+#endif
@@ -44,7 +44,7 @@
 // 4: Reload value for (10). Needs to be applied by the firmware in the real boot (rtc_restart_samples_to_take())
 //
 // 5: FIFO location. First FIFO address in bits 0:7, first non-FIFO address in bits 8:15.
-//                   Number of tag spaces in bits 16:23
+//                   Number of tag spaces in bits 16:23, flags in bits 24:31 (see RTC_FIFO_FLAG_*)
 // 6: Number of samples in FIFO.
 // 7: FIFO tail (where next sample will be written. Increments by 1 for each sample)
 // 8: FIFO head (where next sample will be read. Increments by 1 for each sample)
@@ -80,6 +80,20 @@
 //     Bits 16:24  -> delta-t in seconds from previous entry
 //     Bits 0:15   -> sample value
 
+// Packed FIFO (RTC_FIFO_FLAG_PACKED set). The variable block consists of the tag spaces, followed by
+// a tail value space and a head value space per tag, the tail and head delta-t and the data area.
+//     The data area is a cyclic byte stream, FIFO head and tail hold byte offsets into it.
+//     Each sample is stored as
+//     1 byte      -> bits 0:3 tag index, bits 4:6 decimals, bit 7 set if delta-t equals that of the
+//                    previous sample
+//     varint      -> delta-t in seconds from previous entry, omitted if bit 7 is set
+//     varint      -> zigzag encoded difference to the previous value of the same tag
+//     Varints are little endian base-128, 7 bits per byte with bit 7 as continuation flag.
+
+#define RTC_FIFO_FLAG_PACKED   0x01
+#define RTC_FIFO_PACKED_MAXLEN 11
+#define RTC_FIFO_PACKED_MAXTAGS 16  // the tag index is a 4 bit field
+
 #define RTC_DEFAULT_FIFO_START 32
 #define RTC_DEFAULT_FIFO_END  128
 #define RTC_DEFAULT_TAGCOUNT    5
@@ -171,9 +185,24 @@ static inline uint32_t rtc_fifo_get_first(void)
   return rtc_fifo_get_tagpos()+rtc_fifo_get_tagcount();
 }
 
+static inline uint32_t rtc_fifo_get_flags(void)
+{
+  return (rtc_mem_read(RTC_FIFOLOC_POS)>>24)&0xff;
+}
+
 static inline void rtc_fifo_put_loc(uint32_t first, uint32_t last, uint32_t tagcount)
 {
-  rtc_mem_write(RTC_FIFOLOC_POS,first+(last<<8)+(tagcount<<16));
+  rtc_mem_write(RTC_FIFOLOC_POS,first+(last<<8)+(tagcount<<16)+(rtc_fifo_get_flags()<<24));
+}
+
+static inline void rtc_fifo_put_flags(uint32_t flags)
+{
+  rtc_mem_write(RTC_FIFOLOC_POS,(rtc_mem_read(RTC_FIFOLOC_POS)&0xffffff)+((flags&0xff)<<24));
+}
+
+static inline uint8_t rtc_fifo_is_packed(void)
+{
+  return (rtc_fifo_get_flags()&RTC_FIFO_FLAG_PACKED)!=0;
 }
 
 static inline uint32_t rtc_fifo_normalise_index(uint32_t index)
@@ -251,9 +280,257 @@ static inline void rtc_fifo_fill_sample(sample_t* dst, uint32_t entry, uint32_t
 }
 
 
+// ---- packed FIFO ----
+
+typedef struct
+{
+  uint32_t pos;
+  uint32_t timestamp;
+  uint32_t deltat;
+  uint32_t values[RTC_FIFO_PACKED_MAXTAGS];
+} rtc_fifo_cursor_t;
+
+static inline uint32_t rtc_fifo_packed_tailvals(void)
+{
+  return rtc_fifo_get_tagpos()+rtc_fifo_get_tagcount();
+}
+
+static inline uint32_t rtc_fifo_packed_headvals(void)
+{
+  return rtc_fifo_packed_tailvals()+rtc_fifo_get_tagcount();
+}
+
+static inline uint32_t rtc_fifo_packed_tail_dt_pos(void)
+{
+  return rtc_fifo_packed_headvals()+rtc_fifo_get_tagcount();
+}
+
+static inline uint32_t rtc_fifo_packed_head_dt_pos(void)
+{
+  return rtc_fifo_packed_tail_dt_pos()+1;
+}
+
+static inline uint32_t rtc_fifo_packed_data(void)
+{
+  return rtc_fifo_packed_head_dt_pos()+1;
+}
+
+// size of the data area in bytes
+static inline uint32_t rtc_fifo_packed_size(void)
+{
+  uint32_t data=rtc_fifo_packed_data();
+  uint32_t last=rtc_fifo_get_last();
+  return last>data ? (last-data)*4 : 0;
+}
+
+static inline uint32_t rtc_fifo_packed_used(void)
+{
+  uint32_t head=rtc_fifo_get_head();
+  uint32_t tail=rtc_fifo_get_tail();
+  uint32_t size=rtc_fifo_packed_size();
+
+  if (rtc_fifo_get_count()==0)
+    return 0;
+  if (head==tail)
+    return size;
+  return (tail+size-head)%size;
+}
+
+static inline uint8_t rtc_fifo_packed_read_byte(uint32_t pos)
+{
+  uint32_t word=rtc_mem_read(rtc_fifo_packed_data()+(pos>>2));
+  return (word>>((pos&3)*8))&0xff;
+}
+
+static inline void rtc_fifo_packed_write_byte(uint32_t pos, uint8_t val)
+{
+  uint32_t addr=rtc_fifo_packed_data()+(pos>>2);
+  uint32_t shift=(pos&3)*8;
+  rtc_mem_write(addr,(rtc_mem_read(addr)&~(0xffu<<shift))|((uint32_t)val<<shift));
+}
+
+static inline uint32_t rtc_fifo_packed_read_varint(rtc_fifo_cursor_t* c, uint32_t size)
+{
+  uint32_t val=0;
+  uint32_t shift=0;
+  uint8_t b;
+
+  do
+  {
+    b=rtc_fifo_packed_read_byte(c->pos);
+    c->pos=(c->pos+1)%size;
+    if (shift<32)
+      val|=(uint32_t)(b&0x7f)<<shift;
+    shift+=7;
+  } while (b&0x80);
+  return val;
+}
+
+static inline uint32_t rtc_fifo_packed_put_varint(uint8_t* buf, uint32_t val)
+{
+  uint32_t len=0;
+  while (val>=0x80)
+  {
+    buf[len++]=(val&0x7f)|0x80;
+    val>>=7;
+  }
+  buf[len++]=val;
+  return len;
+}
+
+static inline void rtc_fifo_packed_load_cursor(rtc_fifo_cursor_t* c)
+{
+  uint32_t vals=rtc_fifo_packed_headvals();
+  uint32_t count=rtc_fifo_get_tagcount();
+  uint32_t i;
+
+  if (count>sizeof(c->values)/sizeof(c->values[0]))
+    count=sizeof(c->values)/sizeof(c->values[0]);
+
+  c->pos=rtc_fifo_get_head();
+  c->timestamp=rtc_fifo_get_head_t();
+  c->deltat=rtc_mem_read(rtc_fifo_packed_head_dt_pos());
+  for (i=0;i<count;i++)
+    c->values[i]=rtc_mem_read(vals+i);
+}
+
+// decodes the sample at the cursor and advances it
+static inline void rtc_fifo_packed_decode(rtc_fifo_cursor_t* c, sample_t* dst)
+{
+  uint32_t size=rtc_fifo_packed_size();
+  uint8_t hdr=rtc_fifo_packed_read_byte(c->pos);
+  uint32_t tagindex=hdr&0x0f;
+  uint32_t zz;
+
+  c->pos=(c->pos+1)%size;
+  if (!(hdr&0x80))
+    c->deltat=rtc_fifo_packed_read_varint(c,size);
+  c->timestamp+=c->deltat;
+  zz=rtc_fifo_packed_read_varint(c,size);
+  c->values[tagindex]+=(zz>>1)^(-(zz&1));
+
+  dst->timestamp=c->timestamp;
+  dst->value=c->values[tagindex];
+  dst->decimals=(hdr>>4)&0x07;
+  dst->tag=rtc_mem_read(rtc_fifo_get_tagpos()+tagindex);
+}
+
+static inline int8_t rtc_fifo_packed_pop_sample(sample_t* dst)
+{
+  rtc_fifo_cursor_t c;
+  uint32_t tagindex;
+
+  if (rtc_fifo_get_count()==0)
+    return 0;
+
+  rtc_fifo_packed_load_cursor(&c);
+  tagindex=rtc_fifo_packed_read_byte(c.pos)&0x0f;
+  rtc_fifo_packed_decode(&c,dst);
+
+  rtc_fifo_put_head(c.pos);
+  rtc_fifo_put_head_t(c.timestamp);
+  rtc_mem_write(rtc_fifo_packed_head_dt_pos(),c.deltat);
+  rtc_mem_write(rtc_fifo_packed_headvals()+tagindex,c.values[tagindex]);
+  rtc_fifo_decrement_count();
+  return 1;
+}
+
+static inline int8_t rtc_fifo_packed_peek_sample(sample_t* dst, uint32_t from_top)
+{
+  rtc_fifo_cursor_t c;
+
+  if (rtc_fifo_get_count()<=from_top)
+    return 0;
+
+  rtc_fifo_packed_load_cursor(&c);
+  do
+    rtc_fifo_packed_decode(&c,dst);
+  while (from_top--);
+  return 1;
+}
+
+static inline void rtc_fifo_packed_reset_state(uint32_t timestamp)
+{
+  uint32_t tailvals=rtc_fifo_packed_tailvals();
+  uint32_t count=rtc_fifo_get_tagcount();
+  uint32_t i;
+
+  rtc_fifo_put_head(rtc_fifo_get_tail());
+  rtc_fifo_put_head_t(timestamp);
+  rtc_fifo_put_tail_t(timestamp);
+  // values of the tail and head spaces are stored back to back
+  for (i=0;i<count*2;i++)
+    rtc_mem_write(tailvals+i,0);
+  rtc_mem_write(rtc_fifo_packed_tail_dt_pos(),0);
+  rtc_mem_write(rtc_fifo_packed_head_dt_pos(),0);
+}
+
+static inline int rtc_fifo_find_tag_index(uint32_t tag);
+
+static inline void rtc_fifo_packed_store_sample(const sample_t* s)
+{
+  uint8_t buf[RTC_FIFO_PACKED_MAXLEN];
+  uint32_t len=1;
+  uint32_t size=rtc_fifo_packed_size();
+  int32_t tagindex=rtc_fifo_find_tag_index(s->tag);
+
+  if (rtc_fifo_get_count()==0)
+    rtc_fifo_packed_reset_state(s->timestamp);
+
+  int32_t deltat=s->timestamp-rtc_fifo_get_tail_t();
+
+  if (tagindex<0 || deltat<0)
+  { // Time went backwards or we ran out of tag spaces, start over
+    rtc_fifo_clear_content();
+    rtc_fifo_packed_reset_state(s->timestamp);
+    deltat=0;
+    tagindex=rtc_fifo_find_tag_index(s->tag);
+    if (tagindex<0)
+      return;
+  }
+
+  uint32_t tail_dt_pos=rtc_fifo_packed_tail_dt_pos();
+  uint32_t tailval_pos=rtc_fifo_packed_tailvals()+tagindex;
+  int32_t dv=s->value-rtc_mem_read(tailval_pos);
+
+  buf[0]=(tagindex&0x0f)|((s->decimals&0x07)<<4);
+  if ((uint32_t)deltat==rtc_mem_read(tail_dt_pos))
+    buf[0]|=0x80;
+  else
+    len+=rtc_fifo_packed_put_varint(buf+len,deltat);
+  len+=rtc_fifo_packed_put_varint(buf+len,((uint32_t)dv<<1)^(uint32_t)(dv>>31));
+
+  if (len>size)
+    return;
+
+  while (size-rtc_fifo_packed_used()<len)
+  { // Full! Need to remove samples
+    sample_t dummy;
+    rtc_fifo_packed_pop_sample(&dummy);
+  }
+
+  uint32_t tail=rtc_fifo_get_tail();
+  uint32_t i;
+  for (i=0;i<len;i++)
+  {
+    rtc_fifo_packed_write_byte(tail,buf[i]);
+    tail=(tail+1)%size;
+  }
+  rtc_fifo_put_tail(tail);
+  rtc_fifo_put_tail_t(s->timestamp);
+  rtc_mem_write(tail_dt_pos,deltat);
+  rtc_mem_write(tailval_pos,s->value);
+  rtc_fifo_increment_count();
+}
+
+// ---- end of packed FIFO ----
+
 // returns 1 if sample popped, 0 if not
 static inline int8_t rtc_fifo_pop_sample(sample_t* dst)
 {
+  if (rtc_fifo_is_packed())
+    return rtc_fifo_packed_pop_sample(dst);
+
   uint32_t count=rtc_fifo_get_count();
 
   if (count==0)
@@ -275,6 +552,9 @@ static inline int8_t rtc_fifo_pop_sample(sample_t* dst)
 // returns 1 if sample is available, 0 if not
 static inline int8_t rtc_fifo_peek_sample(sample_t* dst, uint32_t from_top)
 {
+  if (rtc_fifo_is_packed())
+    return rtc_fifo_packed_peek_sample(dst,from_top);
+
   if (rtc_fifo_get_count()<=from_top)
     return 0;
   uint32_t head=rtc_fifo_get_head();
@@ -299,6 +579,14 @@ static inline void rtc_fifo_drop_samples(uint32_t from_top)
 
   if (count<=from_top)
     from_top=count;
+
+  if (rtc_fifo_is_packed())
+  {
+    sample_t dummy;
+    while (from_top--)
+      rtc_fifo_packed_pop_sample(&dummy);
+    return;
+  }
   uint32_t head=rtc_fifo_get_head();
   uint32_t head_t=rtc_fifo_get_head_t();
 
@@ -350,6 +638,12 @@ static uint32_t rtc_fifo_construct_entry(uint32_t val, uint32_t tagindex, uint32
 
 static inline void rtc_fifo_store_sample(const sample_t* s)
 {
+  if (rtc_fifo_is_packed())
+  {
+    rtc_fifo_packed_store_sample(s);
+    return;
+  }
+
   uint32_t head=rtc_fifo_get_head();
   uint32_t tail=rtc_fifo_get_tail();
   uint32_t count=rtc_fifo_get_count();
@@ -431,7 +725,7 @@ static inline void rtc_fifo_clear_tags(void)
 
 static inline void rtc_fifo_clear_content(void)
 {
-  uint32_t first=rtc_fifo_get_first();
+  uint32_t first=rtc_fifo_is_packed() ? 0 : rtc_fifo_get_first();
   rtc_fifo_put_tail(first);
   rtc_fifo_put_head(first);
   rtc_fifo_put_count(0);
@@ -484,6 +778,7 @@ static inline void rtc_fifo_prepare(uint32_t samples_per_boot, uint32_t us_per_s
   rtc_mem_write(RTC_ALIGNMENT_POS,us_per_sample);
 
   rtc_put_samples_to_take(0);
+  rtc_fifo_put_flags(0);
   rtc_fifo_init_default(tagcount);
   rtc_fifo_set_magic();
 }
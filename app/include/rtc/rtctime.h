@@ -68,6 +68,7 @@ void rtctime_settimeofday (const struct rtc_timeval *tv);
 bool rtctime_have_time (void);
 void rtctime_deep_sleep_us (uint32_t us);
 void rtctime_deep_sleep_until_aligned_us (uint32_t align_us, uint32_t min_us);
+uint32_t rtctime_us_until_aligned (uint32_t align_us, uint32_t min_us);
 void rtctime_gmtime (const int32 stamp, struct rtc_tm *r);
 
 #endif
@@ -572,7 +572,9 @@ static void rtc_time_deep_sleep_us(uint32_t us)
   rtc_time_enter_deep_sleep_us(us);
 }
 
-static inline void rtc_time_deep_sleep_until_aligned(uint32_t align, uint32_t min_sleep_us)
+// Sleep time from now to the next multiple of align at least min_sleep_us
+// away, on the clock rtc_time_deep_sleep_us() counts in
+static inline uint32_t rtc_time_us_until_aligned(uint32_t align, uint32_t min_sleep_us)
 {
   uint64_t now=rtc_time_get_now_us_adjusted();
   uint64_t then=now+min_sleep_us;
@@ -582,7 +584,12 @@ static inline void rtc_time_deep_sleep_until_aligned(uint32_t align, uint32_t mi
     then+=align-1;
     then-=(then%align);
   }
-  rtc_time_deep_sleep_us(then-now);
+  return then-now;
+}
+
+static inline void rtc_time_deep_sleep_until_aligned(uint32_t align, uint32_t min_sleep_us)
+{
+  rtc_time_deep_sleep_us(rtc_time_us_until_aligned(align,min_sleep_us));
 }
 
 static void rtc_time_reset(bool clear_cali)
@@ -160,4 +160,15 @@
 // ***************************************************************************
 
 
+// ***************************************************************************
+// Configure the SPI HAL
+//
+// Data bytes sent to SPI displays are merged in a coalescing buffer of this
+// size (in bytes) and transferred in 64 byte HSPI FIFO bursts.  The buffer is
+// allocated once per display.
+#define U8G2_SPI_BUFFER_SIZE 256
+//
+// ***************************************************************************
+
+
 #endif /* _U8G2_DISPLAYS_H */
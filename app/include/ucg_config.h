@@ -48,4 +48,15 @@
 // ***************************************************************************
 
 
+// ***************************************************************************
+// Configure the SPI HAL
+//
+// Data bytes sent to the display are merged in a static coalescing buffer of
+// this size (in bytes) and transferred in 64 byte HSPI FIFO bursts.  Multiples
+// of 64 give the best throughput.
+#define UCG_SPI_BUFFER_SIZE 64
+//
+// ***************************************************************************
+
+
 #endif	/* __UCG_CONFIG_H__ */
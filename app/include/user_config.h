@@ -22,6 +22,18 @@
 //#define BIT_RATE_AUTOBAUD
 
 
+// Received characters are kept in a ring buffer until the Lua task reads
+// them, and the interpreter collects input lines of up to LUA_MAXINPUT
+// characters.  The defaults of 256 bytes are enough for typing, but code
+// pasted or sent by upload tools at high baud rates overruns them.  Larger
+// buffers cost RAM, and LUA_MAXINPUT is also used for a few buffers on the
+// stack.  node.upload() transfers files with flow control in blocks of half
+// the ring buffer.
+
+#define UART_RX_BUFF_SIZE 0x400
+#define LUA_MAXINPUT      512
+
+
 // Three separate build variants are now supported. The main difference is in the
 // processing of numeric data types.  If LUA_NUMBER_INTEGRAL is defined, then
 // all numeric calculations are done in integer, with divide being an integer
@@ -35,8 +47,15 @@
 // no performance loss.  However, you can define LUA_DWORD_ALIGNED_TVALUES and
 // this will force 16 byte TValues on FP builds.
 
+// FP builds can alternatively define LUA_NANBOX_TVALUES, which encodes the
+// type of non-numeric values in the unused NaN bit patterns of a double.  This
+// brings FP TValues down to 8 bytes as well, which shrinks tables, the stack
+// and closures by about a third, at the cost of a few instructions per type
+// check.  LFS images must be built with a luac.cross using the same setting.
+
 //#define LUA_NUMBER_INTEGRAL
 //#define LUA_DWORD_ALIGNED_TVALUES
+//#define LUA_NANBOX_TVALUES
 
 
 // The Lua Flash Store (LFS) allows you to store Lua code in Flash memory and
@@ -58,6 +77,41 @@
 //#define LUA_INIT_STRING "pcall(function() node.flashindex'_init'() end)"
 
 
+// require() compiles a module found as "name.lua" in the file system once and
+// keeps the bytecode in "name.luc" next to it (not "name.lc", which is already
+// on package.path for hand-compiled modules), which is then loaded instead
+// for as long as the source file is unchanged.  This saves both the compile
+// time and its RAM peak on every subsequent boot, but costs the space of the
+// extra files, and on SPIFFS, which keeps no file times, a read of the source
+// to check it is unchanged whenever a file has been written since.
+
+//#define LUA_REQUIRE_BYTECODE_CACHE
+
+
+// With LUA_LAZY_MODULE_INIT the init function of a built-in C module is only
+// run when the module is first referenced, instead of at boot.  This cuts the
+// start-up time and leaves the heap of unused modules free.  Modules whose
+// init sets up background work (timers, event handlers, interrupt tasks) must
+// still be opened at boot and are listed in LUA_EAGER_MODULES, as must those
+// whose init changes global state other modules rely on: tls sets the SSL
+// buffer size used by http, mqtt and websocket, net joins IGMP and cron arms
+// its timer.  Add any such module you build in.  The core Lua libraries are
+// always opened eagerly.  node.libinfo() reports the cost of each module init.
+
+//#define LUA_LAZY_MODULE_INIT
+#define LUA_EAGER_MODULES "tmr,wifi,gpio,net,tls,cron"
+
+
+// LUA_POOL_ALLOC serves Lua allocations of up to 64 bytes (strings, tables,
+// closures, upvalues, small node vectors) from 512 byte slabs split into
+// 8 byte size classes, instead of from the SDK heap one by one.  This keeps
+// the heap from being riddled with small holes over long uptimes, at the
+// cost of some slack in partly used slabs.  node.egc.poolinfo() reports
+// the use of each size class.
+
+//#define LUA_POOL_ALLOC
+
+
 // NodeMCU supports two file systems: SPIFFS and FATFS, the first is available
 // on all ESP8266 modules.  The latter requires extra H/W so is less common.
 // If you use SPIFFS then there are a number of options which impact the
@@ -79,6 +133,15 @@
 #define SPIFFS_MAX_OPEN_FILES 4 // maximum number of open files for SPIFFS
 #define FS_OBJ_NAME_LEN 31      // maximum length of a filename
 
+// The file system is normally mounted before Lua starts, which can take a
+// while on a large or fragmented SPIFFS.  FAST_BOOT defers the mount until a
+// file is first accessed, so that an application started from LFS (see
+// LUA_INIT_STRING above), e.g. one briefly woken from deep sleep, starts
+// running a few milliseconds after boot.  node.bootprofile() reports where
+// the start-up time goes.
+
+//#define FAST_BOOT
+
 //#define BUILD_FATFS
 
 
@@ -206,7 +269,8 @@ extern void luaL_dbgbreak(void);
 #endif
 #endif
 
-#if !defined(LUA_NUMBER_INTEGRAL) && defined (LUA_DWORD_ALIGNED_TVALUES)
+#if !defined(LUA_NUMBER_INTEGRAL) && defined (LUA_DWORD_ALIGNED_TVALUES) && \
+    !defined(LUA_NANBOX_TVALUES)
   #define LUA_PACK_TVALUES
 #else
   #undef LUA_PACK_TVALUES
@@ -29,6 +29,7 @@
 #include "lgc.h"
 #include "ldo.h"
 #include "lobject.h"
+#include "lmem.h"
 #include "lstate.h"
 #include "legc.h"
 
@@ -181,6 +182,268 @@ void *debug_realloc (void *b, size_t oldsize, size_t size) {
 }
 
 
+/* }====================================================================== */
+#elif defined(LUA_POOL_ALLOC)
+/*
+** {======================================================================
+** Size-class pools.  Blocks of up to POOL_MAXSIZE bytes are carved from
+** POOL_SLABSIZE slabs, with one slab list per POOL_GRAIN size class, so
+** that the many small, short lived Lua objects (strings, tables, closures,
+** upvalues, small node vectors) do not fragment the SDK heap.  Lua always
+** passes the old size of a block, so a block carries no header: its class
+** follows from the size and its slab from a binary search of all slabs,
+** which are indexed by address.  Slabs with free blocks are kept ahead of
+** full ones.  One empty slab per class is kept, so that allocations going
+** back and forth across a slab boundary don't hit the heap each time;
+** further empty slabs go back to the heap, and the kept ones do too when
+** the heap runs out.  If no slab can be had the block comes from the heap
+** instead, rounded up to the class size.
+** =======================================================================
+*/
+#define this_realloc pool_realloc
+#define POOL_GRAIN     8
+#define POOL_MAXSIZE   64
+#define POOL_SLABSIZE  512
+#define POOL_NCLASS    (POOL_MAXSIZE / POOL_GRAIN)
+#define poolclass(s)   (((s) - 1) / POOL_GRAIN)
+#define classsize(c)   (((c) + 1) * POOL_GRAIN)
+#define classblocks(c) (POOL_SLABSIZE / classsize(c))
+
+typedef union PoolSlab PoolSlab;
+union PoolSlab {
+  L_Umaxalign a;  /* keeps the blocks that follow aligned */
+  struct {
+    PoolSlab *next;
+    PoolSlab *prev;
+    void *free;            /* free blocks of this slab */
+    unsigned short used;   /* blocks handed out */
+    unsigned short cls;    /* size class */
+  };
+};
+
+typedef struct PoolClass {
+  PoolSlab *slabs;  /* slabs with free blocks first, then full ones */
+  PoolSlab *last;
+  lu_int32 nslab;
+  lu_int32 empty;      /* slabs with no block in use, at most one is kept */
+  lu_int32 used;
+  lu_int32 peak;
+  lu_int32 allocs;
+  lu_int32 fallbacks;  /* blocks that had to come from the heap */
+} PoolClass;
+static PoolClass pool[POOL_NCLASS];
+
+static PoolSlab **slabindex;  /* all slabs, by address */
+static int nslabindex, sizeslabindex;
+
+
+/* index of the last slab at or below b, or -1 */
+static int findslab (const void *b) {
+  int lo = 0, hi = nslabindex - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (cast(const char *, slabindex[mid]) <= cast(const char *, b))
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return hi;
+}
+
+static void unlinkslab (PoolClass *pc, PoolSlab *s) {
+  if (s->prev) s->prev->next = s->next;
+  else pc->slabs = s->next;
+  if (s->next) s->next->prev = s->prev;
+  else pc->last = s->prev;
+}
+
+static void linkfirst (PoolClass *pc, PoolSlab *s) {
+  s->prev = NULL;
+  s->next = pc->slabs;
+  if (pc->slabs) pc->slabs->prev = s;
+  else pc->last = s;
+  pc->slabs = s;
+}
+
+static void linklast (PoolClass *pc, PoolSlab *s) {
+  s->next = NULL;
+  s->prev = pc->last;
+  if (pc->last) pc->last->next = s;
+  else pc->slabs = s;
+  pc->last = s;
+}
+
+static PoolSlab *newslab (PoolClass *pc, int c) {
+  size_t bsize = classsize(c);
+  int n = classblocks(c);
+  PoolSlab *s;
+  char *b;
+  int i;
+  if (nslabindex == sizeslabindex) {
+    int size = sizeslabindex ? 2*sizeslabindex : 16;
+    PoolSlab **index = cast(PoolSlab **,
+                            c_realloc(slabindex, size*sizeof(PoolSlab *)));
+    if (index == NULL)
+      return NULL;
+    slabindex = index;
+    sizeslabindex = size;
+  }
+  s = cast(PoolSlab *, c_malloc(sizeof(PoolSlab) + n*bsize));
+  if (s == NULL)
+    return NULL;
+  i = findslab(s) + 1;
+  memmove(slabindex + i + 1, slabindex + i,
+          (nslabindex - i)*sizeof(PoolSlab *));
+  slabindex[i] = s;
+  nslabindex++;
+  s->free = NULL;
+  s->used = 0;
+  s->cls = c;
+  for (b = cast(char *, s + 1) + (n-1)*bsize; n--; b -= bsize) {
+    *cast(void **, b) = s->free;
+    s->free = b;
+  }
+  linkfirst(pc, s);
+  pc->nslab++;
+  pc->empty++;
+  return s;
+}
+
+static void freeslab (PoolClass *pc, PoolSlab *s, int i) {
+  unlinkslab(pc, s);
+  nslabindex--;
+  memmove(slabindex + i, slabindex + i + 1,
+          (nslabindex - i)*sizeof(PoolSlab *));
+  c_free(s);
+  pc->nslab--;
+  pc->empty--;
+}
+
+/* hand the kept empty slabs back to the heap, returns 0 if there were none */
+static int pool_trim (void) {
+  int c, freed = 0;
+  for (c = 0; c < POOL_NCLASS; c++) {
+    PoolClass *pc = &pool[c];
+    PoolSlab *s;
+    for (s = pc->slabs; s != NULL && pc->empty > 0; ) {
+      PoolSlab *next = s->next;
+      if (s->used == 0) {
+        freeslab(pc, s, findslab(s));
+        freed = 1;
+      }
+      s = next;
+    }
+  }
+  return freed;
+}
+
+static void *pool_alloc (size_t size) {
+  int c = poolclass(size);
+  PoolClass *pc = &pool[c];
+  PoolSlab *s = pc->slabs;
+  void *b;
+  if ((s == NULL || s->free == NULL) && (s = newslab(pc, c)) == NULL) {
+    pc->fallbacks++;
+    b = c_malloc(classsize(c));
+    if (b == NULL && pool_trim())
+      b = c_malloc(classsize(c));
+    return b;
+  }
+  b = s->free;
+  s->free = *cast(void **, b);
+  if (s->used++ == 0)
+    pc->empty--;
+  if (s->free == NULL && s->next != NULL) {  /* now full: to the back */
+    unlinkslab(pc, s);
+    linklast(pc, s);
+  }
+  if (++pc->used > pc->peak)
+    pc->peak = pc->used;
+  pc->allocs++;
+  return b;
+}
+
+static void pool_free (void *b, size_t size) {
+  int i = findslab(b);
+  PoolSlab *s = (i >= 0) ? slabindex[i] : NULL;
+  PoolClass *pc;
+  int wasfull;
+  if (s == NULL || cast(char *, b) >= cast(char *, s + 1) +
+                   classblocks(s->cls) * classsize(s->cls)) {
+    c_free(b);  /* a fallback block */
+    return;
+  }
+  lua_assert(s->cls == poolclass(size));
+  UNUSED(size);
+  pc = &pool[s->cls];
+  wasfull = (s->free == NULL);
+  *cast(void **, b) = s->free;
+  s->free = b;
+  s->used--;
+  pc->used--;
+  if (s->used == 0 && ++pc->empty > 1)
+    freeslab(pc, s, i);  /* one empty slab is kept already */
+  else if (wasfull && s != pc->slabs) {  /* has room again: to the front */
+    unlinkslab(pc, s);
+    linkfirst(pc, s);
+  }
+}
+
+static void *pool_realloc (void *ptr, size_t osize, size_t nsize) {
+  int inpool = (ptr != NULL && osize <= POOL_MAXSIZE);
+  void *nptr;
+  if (nsize == 0)
+    nptr = NULL;
+  else if (nsize <= POOL_MAXSIZE) {
+    if (inpool && poolclass(osize) == poolclass(nsize))
+      return ptr;  /* still fits its block */
+    nptr = pool_alloc(nsize);
+  }
+  else if (!inpool) {
+    nptr = c_realloc(ptr, nsize);
+    if (nptr == NULL && pool_trim())
+      nptr = c_realloc(ptr, nsize);
+    return nptr;
+  }
+  else {
+    nptr = c_malloc(nsize);
+    if (nptr == NULL && pool_trim())
+      nptr = c_malloc(nsize);
+  }
+  if (ptr != NULL && (nptr != NULL || nsize == 0)) {
+    if (nptr)
+      c_memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+    if (inpool)
+      pool_free(ptr, osize);
+    else
+      c_free(ptr);
+  }
+  return nptr;
+}
+
+LUALIB_API int luaL_poolinfo (lua_State *L) {
+  int c;
+  lua_createtable(L, POOL_NCLASS, 0);
+  for (c = 0; c < POOL_NCLASS; c++) {
+    PoolClass *pc = &pool[c];
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, classsize(c));
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, pc->nslab);
+    lua_setfield(L, -2, "slabs");
+    lua_pushinteger(L, pc->used);
+    lua_setfield(L, -2, "used");
+    lua_pushinteger(L, pc->peak);
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, pc->allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, pc->fallbacks);
+    lua_setfield(L, -2, "fallbacks");
+    lua_rawseti(L, -2, c + 1);
+  }
+  return 1;
+}
+
 /* }====================================================================== */
 #else
 #define this_realloc(p,os,s) c_realloc(p,s)
@@ -580,8 +843,9 @@ LUALIB_API const char *luaL_findtable (lua_State *L, int idx,
 */
 
 
-#define bufflen(B)	((B)->p - (B)->buffer)
-#define bufffree(B)	((size_t)(LUAL_BUFFERSIZE - bufflen(B)))
+#define bufflen(B)	((B)->p - (B)->b)
+#define bufffree(B)	((size_t)((B)->end - (B)->p))
+#define buffonstack(B)	((B)->b != (B)->buffer)
 
 #define LIMIT	(LUA_MINSTACK/2)
 
@@ -617,14 +881,76 @@ static void adjuststack (luaL_Buffer *B) {
 }
 
 
+/*
+** Makes room for sz more bytes in a growable buffer.  The contents move into
+** a new userdata, which takes the place of the old one on the stack; idx is
+** where the buffer's userdata is (or goes) relative to the top.
+*/
+static char *growbuffer (luaL_Buffer *B, size_t sz, int idx) {
+  lua_State *L = B->L;
+  size_t len = bufflen(B);
+  size_t newsize = (B->end - B->b) * 2;
+  char *newb;
+  if (sz > MAX_SIZET - len)
+    luaL_error(L, "buffer too large");
+  if (newsize - len < sz)
+    newsize = len + sz;
+  newb = (char *)lua_newuserdata(L, newsize);
+  c_memcpy(newb, B->b, len);
+  if (buffonstack(B))
+    lua_replace(L, idx - 1);  /* drop the old buffer */
+  else if (idx != -1)
+    lua_insert(L, idx);
+  B->b = newb;
+  B->p = newb + len;
+  B->end = newb + newsize;
+  return B->p;
+}
+
+
 LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B) {
+  if (B->grow)
+    return luaL_prepbuffsize(B, LUAL_BUFFERSIZE);
   if (emptybuffer(B))
     adjuststack(B);
   return B->buffer;
 }
 
 
+/*
+** Returns room for at least sz bytes, to be committed with luaL_addsize.  A
+** buffer emptied onto the stack is first collected into a growable one if
+** the request doesn't fit into its static buffer.
+*/
+LUALIB_API char *luaL_prepbuffsize (luaL_Buffer *B, size_t sz) {
+  if (bufffree(B) >= sz)
+    return B->p;
+  if (B->grow)
+    return growbuffer(B, sz, -1);
+  if (sz <= LUAL_BUFFERSIZE)
+    return luaL_prepbuffer(B);
+  else {
+    size_t l;
+    const char *s;
+    luaL_pushresult(B);
+    s = lua_tolstring(B->L, -1, &l);
+    B->grow = 1;
+    B->lvl = 0;
+    growbuffer(B, l + sz, -2);
+    c_memcpy(B->p, s, l);
+    B->p += l;
+    lua_pop(B->L, 1);
+    return B->p;
+  }
+}
+
+
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l) {
+  if (B->grow) {
+    c_memcpy(luaL_prepbuffsize(B, l), s, l);
+    B->p += l;
+    return;
+  }
   while (l--)
     luaL_addchar(B, *s++);
 }
@@ -636,6 +962,16 @@ LUALIB_API void luaL_addstring (luaL_Buffer *B, const char *s) {
 
 
 LUALIB_API void luaL_pushresult (luaL_Buffer *B) {
+  if (B->grow) {
+    lua_pushlstring(B->L, B->b, bufflen(B));
+    if (buffonstack(B))
+      lua_remove(B->L, -2);  /* remove the buffer's userdata */
+    B->b = B->p = B->buffer;
+    B->end = B->buffer + LUAL_BUFFERSIZE;
+    B->grow = 0;
+    B->lvl = 1;
+    return;
+  }
   emptybuffer(B);
   lua_concat(B->L, B->lvl);
   B->lvl = 1;
@@ -651,6 +987,12 @@ LUALIB_API void luaL_addvalue (luaL_Buffer *B) {
     B->p += vl;
     lua_pop(L, 1);  /* remove from stack */
   }
+  else if (B->grow) {
+    growbuffer(B, vl, -2);  /* the buffer goes below the value */
+    c_memcpy(B->p, s, vl);
+    B->p += vl;
+    lua_pop(L, 1);
+  }
   else {
     if (emptybuffer(B))
       lua_insert(L, -2);  /* put buffer before new value */
@@ -662,16 +1004,98 @@ LUALIB_API void luaL_addvalue (luaL_Buffer *B) {
 
 LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B) {
   B->L = L;
-  B->p = B->buffer;
+  B->b = B->p = B->buffer;
+  B->end = B->buffer + LUAL_BUFFERSIZE;
   B->lvl = 0;
+  B->grow = 0;
+}
+
+
+LUALIB_API char *luaL_buffinitsize (lua_State *L, luaL_Buffer *B, size_t sz) {
+  luaL_buffinit(L, B);
+  B->grow = 1;
+  return luaL_prepbuffsize(B, sz);
 }
 
 /* }====================================================== */
 
 
-LUALIB_API int luaL_ref (lua_State *L, int t) {
+/*
+** {======================================================
+** Reference system
+** =======================================================
+*/
+
+/*
+** References on the registry come from a pool kept with the global state
+** rather than from a free list threaded through the registry itself:
+** taking and releasing one is a push or pop on `slot', and each live slot
+** records who took it and the type of the value, so that leaks can be
+** tracked down to a module with node.refinfo().  The registry still holds
+** the values, so lua_rawgeti(L, LUA_REGISTRYINDEX, ref) works as ever; a
+** released slot is set to false, which keeps the registry's array part
+** dense without anchoring anything.
+*/
+
+#define REF_TYPEBITS	4
+#define refslot(o,tt)	(~(((o) << REF_TYPEBITS) | (tt)))
+#define slotowner(s)	(~(s) >> REF_TYPEBITS)
+#define slottype(s)	(~(s) & ((1 << REF_TYPEBITS) - 1))
+
+static int refowner (lua_State *L, RefPool *rp, const char *name) {
+  int i = rp->lastowner;
+  if (i < rp->nowner && rp->owner[i].name == name)
+    return i;  /* same caller as last time */
+  for (i = 0; i < rp->nowner; i++) {
+    if (rp->owner[i].name == name || !c_strcmp(rp->owner[i].name, name))
+      return rp->lastowner = i;
+  }
+  luaM_growvector(L, rp->owner, rp->nowner, rp->sizeowner, RefOwner,
+                  MAX_INT, "reference owners");
+  rp->owner[i].name = name;
+  rp->owner[i].live = rp->owner[i].peak = 0;
+  rp->owner[i].total = 0;
+  rp->nowner++;
+  return rp->lastowner = i;
+}
+
+
+LUALIB_API int luaL_refowner (lua_State *L, int t, const char *owner) {
+  RefPool *rp;
+  RefOwner *o;
+  int ref, i;
+  if (t != LUA_REGISTRYINDEX)
+    return (luaL_ref)(L, t);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);  /* remove from stack */
+    return LUA_REFNIL;  /* `nil' has a unique fixed reference */
+  }
+  rp = &G(L)->refs;
+  i = refowner(L, rp, owner ? owner : "?");
+  if (rp->free != 0) {  /* any free element? */
+    ref = rp->free;
+    rp->free = rp->slot[ref];
+  }
+  else {
+    luaM_growvector(L, rp->slot, rp->top + 1, rp->size, int,
+                    MAX_INT, "references");
+    ref = ++rp->top;
+  }
+  rp->slot[ref] = refslot(i, lua_type(L, -1));
+  o = rp->owner + i;
+  if (++o->live > o->peak)
+    o->peak = o->live;
+  o->total++;
+  lua_rawseti(L, LUA_REGISTRYINDEX, ref);
+  return ref;
+}
+
+
+LUALIB_API int (luaL_ref) (lua_State *L, int t) {
   int ref;
   t = abs_index(L, t);
+  if (t == LUA_REGISTRYINDEX)
+    return luaL_refowner(L, t, NULL);
   if (lua_isnil(L, -1)) {
     lua_pop(L, 1);  /* remove from stack */
     return LUA_REFNIL;  /* `nil' has a unique fixed reference */
@@ -694,6 +1118,17 @@ LUALIB_API int luaL_ref (lua_State *L, int t) {
 
 LUALIB_API void luaL_unref (lua_State *L, int t, int ref) {
   if (ref >= 0) {
+    if (t == LUA_REGISTRYINDEX) {
+      RefPool *rp = &G(L)->refs;
+      if (ref == 0 || ref > rp->top || rp->slot[ref] >= 0)
+        return;  /* not a live reference: ignore a double release */
+      rp->owner[slotowner(rp->slot[ref])].live--;
+      rp->slot[ref] = rp->free;
+      rp->free = ref;
+      lua_pushboolean(L, 0);
+      lua_rawseti(L, t, ref);
+      return;
+    }
     t = abs_index(L, t);
     lua_rawgeti(L, t, FREELIST_REF);
     lua_rawseti(L, t, ref);  /* t[ref] = t[FREELIST_REF] */
@@ -703,6 +1138,96 @@ LUALIB_API void luaL_unref (lua_State *L, int t, int ref) {
 }
 
 
+/*
+** Callbacks held by C modules are kept in a luaL_Callback rather than a
+** bare reference.  A Lua function (or C closure) is also cached in it:
+** objects don't move and the reference keeps it alive, so an event can
+** push it straight onto the stack without a registry lookup.
+*/
+LUALIB_API void luaL_cbrefowner (lua_State *L, luaL_Callback *cb,
+                                 const char *owner) {
+  void *fn = lua_type(L, -1) == LUA_TFUNCTION ?
+             (void *)lua_topointer(L, -1) : NULL;
+  luaL_unref(L, LUA_REGISTRYINDEX, cb->ref);
+  cb->ref = luaL_refowner(L, LUA_REGISTRYINDEX, owner);
+  cb->fn = cb->ref > 0 ? fn : NULL;
+}
+
+
+LUALIB_API void luaL_cbunref (lua_State *L, luaL_Callback *cb) {
+  luaL_unref(L, LUA_REGISTRYINDEX, cb->ref);
+  luaL_cbinit(cb);
+}
+
+
+LUALIB_API void luaL_cbpush (lua_State *L, const luaL_Callback *cb) {
+  if (cb->fn) {
+    api_check(L, L->top < L->ci->top);
+    setclvalue(L, L->top, cast(Closure *, cb->fn));
+    L->top++;
+  }
+  else
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cb->ref);
+}
+
+
+/* owner name as reported: the source file without its path and extension */
+static void pushownername (lua_State *L, const char *name) {
+  const char *s = c_strrchr(name, '/');
+  const char *e;
+  if (s) name = s + 1;
+  e = c_strrchr(name, '.');
+  lua_pushlstring(L, name, e ? (size_t)(e - name) : c_strlen(name));
+}
+
+
+/*
+** Lua: node.refinfo() returns a table keyed by module with the registry
+** references it took: {live = held now, peak = most held, total = taken in
+** all}.  node.refinfo(module) lists that module's live references instead,
+** as a table mapping each ref to the type of the value it holds.
+*/
+LUALIB_API int luaL_refinfo (lua_State *L) {
+  RefPool *rp = &G(L)->refs;
+  int i;
+  if (lua_isnoneornil(L, 1)) {
+    lua_createtable(L, 0, rp->nowner);
+    for (i = 0; i < rp->nowner; i++) {
+      RefOwner *o = rp->owner + i;
+      pushownername(L, o->name);
+      lua_createtable(L, 0, 3);
+      lua_pushinteger(L, o->live);
+      lua_setfield(L, -2, "live");
+      lua_pushinteger(L, o->peak);
+      lua_setfield(L, -2, "peak");
+      lua_pushinteger(L, o->total);
+      lua_setfield(L, -2, "total");
+      lua_rawset(L, -3);
+    }
+  }
+  else {
+    const char *module = luaL_checkstring(L, 1);
+    lua_newtable(L);
+    for (i = 0; i < rp->nowner; i++) {
+      int ref;
+      pushownername(L, rp->owner[i].name);
+      if (c_strcmp(lua_tostring(L, -1), module) == 0) {
+        for (ref = 1; ref <= rp->top; ref++) {
+          if (rp->slot[ref] < 0 && slotowner(rp->slot[ref]) == i) {
+            lua_pushstring(L, lua_typename(L, slottype(rp->slot[ref])));
+            lua_rawseti(L, -3, ref);
+          }
+        }
+      }
+      lua_pop(L, 1);
+    }
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -922,7 +1447,7 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   void *nptr;
 
   if (nsize == 0) {
-#ifdef DEBUG_ALLOCATOR 
+#if defined(DEBUG_ALLOCATOR) || defined(LUA_POOL_ALLOC)
     return (void *)this_realloc(ptr, osize, nsize);
 #else
     c_free(ptr);
@@ -80,7 +80,31 @@ LUALIB_API int (luaL_checkoption) (lua_State *L, int narg, const char *def,
                                    const char *const lst[]);
 
 LUALIB_API int (luaL_ref) (lua_State *L, int t);
+LUALIB_API int (luaL_refowner) (lua_State *L, int t, const char *owner);
 LUALIB_API void (luaL_unref) (lua_State *L, int t, int ref);
+LUALIB_API int (luaL_refinfo) (lua_State *L);
+#ifdef LUA_POOL_ALLOC
+LUALIB_API int (luaL_poolinfo) (lua_State *L);
+#endif
+
+/* registry references are accounted to the source file taking them */
+#define luaL_ref(L,t)	luaL_refowner(L, (t), __FILE__)
+
+/* a callback function held by a C module, see luaL_cbref */
+typedef struct luaL_Callback {
+  void *fn;  /* the function when it is a closure, else NULL */
+  int ref;  /* registry reference holding it, LUA_NOREF if none */
+} luaL_Callback;
+
+LUALIB_API void (luaL_cbrefowner) (lua_State *L, luaL_Callback *cb,
+                                   const char *owner);
+LUALIB_API void (luaL_cbunref) (lua_State *L, luaL_Callback *cb);
+LUALIB_API void (luaL_cbpush) (lua_State *L, const luaL_Callback *cb);
+
+/* pops the value on top into cb, replacing its previous function */
+#define luaL_cbref(L,cb)	luaL_cbrefowner(L, (cb), __FILE__)
+#define luaL_cbinit(cb)		((cb)->fn = NULL, (cb)->ref = LUA_NOREF)
+#define luaL_cbisset(cb)	((cb)->ref > 0)
 
 #ifdef LUA_CROSS_COMPILER
 LUALIB_API int (luaL_loadfile) (lua_State *L, const char *filename);
@@ -143,15 +167,25 @@ LUALIB_API void luaL_assertfail(const char *file, int line, const char *message)
 
 
 
+/*
+** A buffer started with luaL_buffinit is emptied onto the stack as a string
+** whenever it fills up, and these are concatenated by luaL_pushresult.  One
+** started with luaL_buffinitsize instead moves into a userdata on the stack
+** once it outgrows the static buffer, which is doubled in size as needed, so
+** the result is only made into a string once.
+*/
 typedef struct luaL_Buffer {
   char *p;			/* current position in buffer */
+  char *end;			/* end of the current buffer */
+  char *b;			/* start of the current buffer */
   int lvl;  /* number of strings in the stack (level) */
+  int grow;  /* growable buffer */
   lua_State *L;
   char buffer[LUAL_BUFFERSIZE];
 } luaL_Buffer;
 
 #define luaL_addchar(B,c) \
-  ((void)((B)->p < ((B)->buffer+LUAL_BUFFERSIZE) || luaL_prepbuffer(B)), \
+  ((void)((B)->p < (B)->end || luaL_prepbuffer(B)), \
    (*(B)->p++ = (char)(c)))
 
 /* compatibility only */
@@ -160,7 +194,9 @@ typedef struct luaL_Buffer {
 #define luaL_addsize(B,n)	((B)->p += (n))
 
 LUALIB_API void (luaL_buffinit) (lua_State *L, luaL_Buffer *B);
+LUALIB_API char *(luaL_buffinitsize) (lua_State *L, luaL_Buffer *B, size_t sz);
 LUALIB_API char *(luaL_prepbuffer) (luaL_Buffer *B);
+LUALIB_API char *(luaL_prepbuffsize) (luaL_Buffer *B, size_t sz);
 LUALIB_API void (luaL_addlstring) (luaL_Buffer *B, const char *s, size_t l);
 LUALIB_API void (luaL_addstring) (luaL_Buffer *B, const char *s);
 LUALIB_API void (luaL_addvalue) (luaL_Buffer *B);
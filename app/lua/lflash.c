@@ -13,6 +13,7 @@
 #include "lauxlib.h"
 #include "lstate.h"
 #include "lfunc.h"
+#include "lstring.h"
 #include "lflash.h"
 #include "platform.h"
 #include "vfs.h"
@@ -143,9 +144,10 @@ static void flashErase(uint32_t start, uint32_t end){
 }
 
 /* =====================================================================================
- * luaN_init(), luaN_reload_reboot() and luaN_index() are exported via lflash.h.
- * The first is the startup hook used in lstate.c and the last two are
- * implementations of the node.flash API calls.
+ * luaN_init(), luaN_reload_reboot(), luaN_index() and luaN_loader() are exported
+ * via lflash.h.  The first is the startup hook used in lstate.c, the next two are
+ * implementations of the node.flash API calls and the last is the require()
+ * searcher for LFS modules.
  */
 
 /*
@@ -299,6 +301,56 @@ LUAI_FUNC int luaN_index (lua_State *L) {
   lua_insert(L, 4);
   return 5;
 }
+
+
+/*
+ * The require() searcher for LFS modules, first in package.loaders.  The name
+ * is resolved through the module index that luac.cross puts into the image,
+ * so a miss costs a couple of flash reads.  Images built without an index are
+ * searched by calling the index function.  Returns the module main as a
+ * closure, or the reason it wasn't found for require's error message.
+ */
+LUAI_FUNC int luaN_loader (lua_State *L) {
+  size_t l;
+  const char *name = luaL_checklstring(L, 1, &l);
+  FlashHeader *fh = cast(FlashHeader *, flashAddr);
+  Proto *p = NULL;
+
+  if (!G(L)->ROpvmain) {
+    lua_pushliteral(L, "\n\tno LFS image loaded");
+    return 1;
+  }
+
+  if (fh->nModIndex) {
+    TString *ts = luaS_newlstr(L, name, l);
+    FlashModule *idx = cast(FlashModule *, fh->pModIndex);
+    lu_int32 mask = fh->nModIndex - 1, i = ts->tsv.hash & mask;
+
+    for (; idx[i].name; i = (i + 1) & mask) {
+      TString *mod = cast(TString *, idx[i].name);
+      if (mod == ts || (mod->tsv.hash == ts->tsv.hash && mod->tsv.len == l &&
+                        !memcmp(getstr(mod), name, l))) {
+        p = cast(Proto *, idx[i].mainProto);
+        break;
+      }
+    }
+  } else {
+    lua_settop(L, 1);
+    if (luaN_index(L) == 1 && lua_isfunction(L, -1))
+      return 1;
+  }
+
+  if (!p) {
+    lua_pushfstring(L, "\n\tno module '%s' in LFS", name);
+    return 1;
+  }
+
+  lua_pushnil(L);
+  Closure *cl = luaF_newLclosure(L, 0, hvalue(gt(L)));
+  cl->l.p = p;
+  setclvalue(L, L->top-1, cl);
+  return 1;
+}
 /* =====================================================================================
  * The following routines use my uzlib which was based on pfalcon's inflate and
  * deflate routines.  The standard NodeMCU make also makes two host tools uz_zip
@@ -17,7 +17,9 @@
 #endif
 #define FLASH_FORMAT_VERSION (1 << 8)
 #define FLASH_FORMAT_MASK    0xF00
-#ifdef LUA_PACK_TVALUES
+#if defined(LUA_NANBOX_TVALUES)
+# define FLASH_SIG_B2 0x20
+#elif defined(LUA_PACK_TVALUES)
 #ifdef LUA_NUMBER_INTEGRAL
 #error "LUA_PACK_TVALUES is only valid for Floating point builds" 
 #endif
@@ -25,7 +27,7 @@
 #else
 # define FLASH_SIG_B2 0x00
 #endif
-# define FLASH_SIG_B2_MASK 0x04
+# define FLASH_SIG_B2_MASK 0x24
 #define FLASH_SIG_ABSOLUTE    0x01
 #define FLASH_SIG_IN_PROGRESS 0x08
 #define FLASH_SIG  (0xfafaa050 | FLASH_FORMAT_VERSION |FLASH_SIG_B2 | FLASH_SIG_B1)
@@ -38,13 +40,23 @@ typedef struct {
   FlashAddr pROhash;        /* address of ROstrt hash */
   lu_int32  nROuse;         /* number of elements in ROstrt */
   int       nROsize;        /* size of ROstrt */
-  lu_int32  fill1;          /* reserved */
-  lu_int32  fill2;          /* reserved */
+  FlashAddr pModIndex;      /* address of module index, 0 if none */
+  lu_int32  nModIndex;      /* number of slots in module index */
 } FlashHeader;
 
+/*
+ * The module index is an open addressed hash of the module names, probed
+ * linearly from slot (name hash & (nModIndex-1)). Empty slots have name 0.
+ */
+typedef struct {
+  FlashAddr name;           /* address of module name TString */
+  FlashAddr mainProto;      /* address of module main Proto */
+} FlashModule;
+
 LUAI_FUNC void luaN_init (lua_State *L);
 LUAI_FUNC int  luaN_flashSetup (lua_State *L);
 LUAI_FUNC int  luaN_reload_reboot (lua_State *L);
 LUAI_FUNC int  luaN_index (lua_State *L);
+LUAI_FUNC int  luaN_loader (lua_State *L);
 #endif
 
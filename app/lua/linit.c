@@ -16,6 +16,12 @@
 #include "luaconf.h"
 #include "module.h"
 
+#ifndef LUA_CROSS_COMPILER
+#include "c_stdlib.h"
+#include "c_string.h"
+#include "user_interface.h"
+#endif
+
 #if !defined(LUA_CROSS_COMPILER) && !(MIN_OPT_LEVEL==2 && LUA_OPTIMIZE_MEMORY==2)
 # error "NodeMCU modules must be built with LTR enabled (MIN_OPT_LEVEL=2 and LUA_OPTIMIZE_MEMORY=2)"
 #endif
@@ -74,6 +80,7 @@ const LOCK_IN_SECTION(rotable) ROTable LUA_ROTABLES[] = {
 #endif
   };
 
+#ifdef LUA_CROSS_COMPILER
 void luaL_openlibs (lua_State *L) {
   const luaL_Reg *lib = lua_libs_base;
 
@@ -87,3 +94,135 @@ void luaL_openlibs (lua_State *L) {
   }
 }
 
+#else
+/*
+ * On the ESP each library open is timed and its heap use recorded.  With
+ * LUA_LAZY_MODULE_INIT, modules other than the core libraries and those
+ * listed in LUA_EAGER_MODULES aren't opened at start-up but the first time
+ * their ROTable is looked up in the ROM table, see luaV_gettable().
+ */
+#define LIB_PENDING 0
+#define LIB_OPEN    1
+
+typedef struct {
+  const luaL_Reg *lib;
+  const void *map;           /* ROTable of a module still to be opened */
+  uint32_t us;               /* time taken by the open */
+  int heap;                  /* heap used by the open */
+  int state;
+} LibInfo;
+
+static LibInfo *libinfo;
+static int nlibs;
+int luaL_lazypending;
+
+static void openlib (lua_State *L, LibInfo *li) {
+  uint32_t us = system_get_time();
+  int heap = system_get_free_heap_size();
+  li->state = LIB_OPEN;
+  lua_pushcfunction(L, li->lib->func);
+  lua_pushstring(L, li->lib->name);
+  lua_call(L, 1, 0);
+  li->us = system_get_time() - us;
+  li->heap = heap - (int)system_get_free_heap_size();
+}
+
+#ifdef LUA_LAZY_MODULE_INIT
+#ifndef LUA_EAGER_MODULES
+#define LUA_EAGER_MODULES ""
+#endif
+
+static int is_eager (const luaL_Reg *lib) {
+  const char *list = LUA_EAGER_MODULES;
+  size_t l = c_strlen(lib->name);
+  if (lib >= LUA_LIBS && lib < LUA_LIBS + sizeof(LUA_LIBS)/sizeof(LUA_LIBS[0]))
+    return 1;                /* core library */
+  while (list) {
+    if (!c_strncmp(list, lib->name, l) && (list[l] == ',' || list[l] == '\0'))
+      return 1;
+    if ((list = c_strchr(list, ',')) != NULL)
+      list++;
+  }
+  return 0;
+}
+
+static const void *module_map (const char *name) {
+  const luaR_entry *e;
+  for (e = lua_rotable_base; e->key.type != LUA_TNIL; e++)
+    if (e->key.type == LUA_TSTRING && ttisrotable(&e->value) &&
+        !c_strcmp(e->key.id.strkey, name))
+      return rvalue(&e->value);
+  return NULL;
+}
+
+/* Called with the value of a ROM table lookup, opens the module if pending */
+void luaL_lazyopen (lua_State *L, const void *map) {
+  int i;
+  for (i = 0; i < nlibs; i++) {
+    if (libinfo[i].map == map && libinfo[i].state == LIB_PENDING) {
+      luaL_lazypending--;
+      openlib(L, libinfo + i);
+      return;
+    }
+  }
+}
+#endif
+
+void luaL_openlibs (lua_State *L) {
+  const luaL_Reg *lib;
+  int i;
+
+  /* start afresh if called again */
+  if (libinfo) {
+    c_free(libinfo);
+    libinfo = NULL;
+  }
+  nlibs = 0;
+  luaL_lazypending = 0;
+  for (lib = lua_libs_base; lib->name; lib++)
+    if (lib->func)
+      nlibs++;
+  libinfo = (LibInfo *) c_zalloc(nlibs * sizeof(LibInfo));
+  if (!libinfo)
+    luaL_error(L, "not enough memory");
+
+  /* loop round and open libraries */
+  for (i = 0, lib = lua_libs_base; lib->name; lib++) {
+    if (lib->func) {
+      LibInfo *li = libinfo + i++;
+      li->lib = lib;
+#ifdef LUA_LAZY_MODULE_INIT
+      if (!is_eager(lib) && (li->map = module_map(lib->name)) != NULL) {
+        li->state = LIB_PENDING;
+        luaL_lazypending++;
+        continue;
+      }
+#endif
+      openlib(L, li);
+    }
+  }
+}
+
+/*
+ * Lua: node.libinfo() returns a table with an entry for each library with
+ * an open function: {us = open time, heap = heap used}, or false if it
+ * hasn't been opened yet.
+ */
+LUALIB_API int luaL_libinfo (lua_State *L) {
+  int i;
+  lua_createtable(L, 0, nlibs);
+  for (i = 0; i < nlibs; i++) {
+    LibInfo *li = libinfo + i;
+    if (li->state == LIB_OPEN) {
+      lua_createtable(L, 0, 2);
+      lua_pushinteger(L, li->us);
+      lua_setfield(L, -2, "us");
+      lua_pushinteger(L, li->heap);
+      lua_setfield(L, -2, "heap");
+    } else
+      lua_pushboolean(L, 0);
+    lua_setfield(L, -2, *li->lib->name ? li->lib->name : "_G");
+  }
+  return 1;
+}
+#endif
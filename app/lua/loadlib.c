@@ -25,6 +25,16 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+#include "lflash.h"
+#endif
+
+#if !defined(LUA_CROSS_COMPILER) && defined(LUA_REQUIRE_BYTECODE_CACHE)
+#include "lobject.h"
+#include "lstate.h"
+#include "lundump.h"
+#endif
+
 /* prefix for open functions in C libraries */
 #define LUA_POF		"luaopen_"
 
@@ -386,17 +396,322 @@ static void loaderror (lua_State *L, const char *filename) {
 }
 
 
+#ifndef LUA_CROSS_COMPILER
+/*
+** Results of findfile are remembered in a registry table per path variable,
+** misses as the error message (which starts with a newline) and hits as the
+** file name. The table is dropped whenever the path or the current
+** directory changes or a file may have been created, removed or renamed,
+** so a lookup costs no file system access most of the time.
+*/
+#define FOUNDCACHE	"_FOUND"
+
+static int findfile_memo (lua_State *L, const char *pname) {
+  int memo = lua_gettop(L) + 1;
+  lua_pushfstring(L, FOUNDCACHE "%s", pname);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  lua_getfield(L, LUA_ENVIRONINDEX, pname);
+  if (lua_istable(L, memo)) {
+    lua_rawgeti(L, memo, 1);  /* path the entries were found with */
+    lua_rawgeti(L, memo, 2);  /* file system state */
+    lua_rawgeti(L, memo, 3);  /* current directory */
+    if (!lua_rawequal(L, -3, memo + 1) ||
+        (uint32_t)lua_tonumber(L, -2) != vfs_changes() ||
+        (uint32_t)lua_tonumber(L, -1) != vfs_chdirs()) {
+      lua_pop(L, 3);
+      lua_pushnil(L);
+      lua_replace(L, memo);
+    } else
+      lua_pop(L, 3);
+  }
+  if (!lua_istable(L, memo)) {
+    lua_createtable(L, 3, 4);
+    lua_pushvalue(L, memo + 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushnumber(L, vfs_changes());
+    lua_rawseti(L, -2, 2);
+    lua_pushnumber(L, vfs_chdirs());
+    lua_rawseti(L, -2, 3);
+    lua_pushfstring(L, FOUNDCACHE "%s", pname);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    lua_replace(L, memo);
+  }
+  lua_pop(L, 1);  /* path */
+  return memo;
+}
+
+
+static const char * findfile_cached (lua_State *L, const char *name,
+                                                  const char *pname) {
+  const char *found;
+  int memo = findfile_memo(L, pname);
+  lua_getfield(L, memo, name);
+  if (lua_isstring(L, -1)) {
+    found = lua_tostring(L, -1);
+    return (*found == '\n') ? NULL : found;
+  }
+  lua_pop(L, 1);
+  found = findfile(L, name, pname);
+  if (found || *lua_tostring(L, -1) == '\n') {
+    lua_pushvalue(L, -1);  /* file name or error message */
+    lua_setfield(L, memo, name);
+  }
+  return found;
+}
+
+
+/* forget a file name that turned out not to be loadable */
+static void findfile_forget (lua_State *L, const char *name,
+                                           const char *pname) {
+  lua_pushfstring(L, FOUNDCACHE "%s", pname);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (lua_istable(L, -1)) {
+    lua_pushnil(L);
+    lua_setfield(L, -2, name);
+  }
+  lua_pop(L, 1);
+}
+
+
+/* keep the memo tables valid across a file system change of our own */
+static void findfile_restamp (lua_State *L, uint32_t before) {
+  static const char *const pnames[] = {"path", "cpath"};
+  int i;
+  for (i = 0; i < 2; i++) {
+    lua_pushfstring(L, FOUNDCACHE "%s", pnames[i]);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_istable(L, -1)) {
+      lua_rawgeti(L, -1, 2);
+      if ((uint32_t)lua_tonumber(L, -1) == before) {
+        lua_pushnumber(L, vfs_changes());
+        lua_rawseti(L, -3, 2);
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+}
+#else
+#define findfile_cached(L,n,p)	findfile(L,n,p)
+#endif
+
+
+#if !defined(LUA_CROSS_COMPILER) && defined(LUA_REQUIRE_BYTECODE_CACHE)
+/*
+** Bytecode cache. A module compiled from "name.lua" is dumped into
+** "name.luc" behind a header identifying the source by size, modification
+** time and (when the file system keeps no time) a hash of its contents.
+** The cached bytecode is loaded as long as the header matches the source.
+*/
+#define BC_MAGIC	"\033LC1"
+
+typedef struct BCHeader {
+  char magic[4];
+  uint32_t size;
+  uint32_t mtime;
+  uint32_t hash;
+} BCHeader;
+
+typedef struct LoadBC {
+  int f;
+  char buff[LUAL_BUFFERSIZE];
+} LoadBC;
+
+
+static const char *getBC (lua_State *L, void *ud, size_t *size) {
+  LoadBC *lb = (LoadBC *)ud;
+  (void)L;
+  if (L == NULL && size == NULL) /* direct mode check */
+    return NULL;
+  if (vfs_eof(lb->f)) return NULL;
+  *size = vfs_read(lb->f, lb->buff, sizeof(lb->buff));
+  return (*size > 0) ? lb->buff : NULL;
+}
+
+
+static int writeBC (lua_State *L, const void *p, size_t size, void *u) {
+  (void)L;
+  return (size != 0 && vfs_write(*(int *)u, p, size) != size);
+}
+
+
+/* FNV-1a over the contents of a file, 0 if it can't be read */
+static uint32_t bc_hash (const char *filename) {
+  char buff[LUAL_BUFFERSIZE];
+  sint32_t n;
+  uint32_t hash = 2166136261u;
+  int f = vfs_open(filename, "r");
+  if (!f) return 0;
+  while ((n = vfs_read(f, buff, sizeof(buff))) > 0) {
+    const char *b = buff;
+    while (n--)
+      hash = (hash ^ (unsigned char)*b++) * 16777619u;
+  }
+  vfs_close(f);
+  return hash;
+}
+
+
+/*
+** Content hashes are remembered per file name along with vfs_writes() and
+** vfs_changes(), so on a file system without times a source is only read
+** again after some file has been written, created, removed or renamed.
+*/
+#define HASHCACHE	"_BCHASH"
+
+typedef struct BCHashMemo {
+  uint32_t writes;
+  uint32_t changes;
+  uint32_t size;
+  uint32_t hash;
+} BCHashMemo;
+
+static uint32_t bc_hash_cached (lua_State *L, const char *filename,
+                                              uint32_t size) {
+  BCHashMemo m;
+  lua_getfield(L, LUA_REGISTRYINDEX, HASHCACHE);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, HASHCACHE);
+  }
+  lua_getfield(L, -1, filename);
+  if (lua_objlen(L, -1) == sizeof(m)) {
+    c_memcpy(&m, lua_tostring(L, -1), sizeof(m));
+    if (m.writes == vfs_writes() && m.changes == vfs_changes() &&
+        m.size == size) {
+      lua_pop(L, 2);
+      return m.hash;
+    }
+  }
+  lua_pop(L, 1);
+  m.writes = vfs_writes();
+  m.changes = vfs_changes();
+  m.size = size;
+  m.hash = bc_hash(filename);
+  lua_pushlstring(L, (const char *)&m, sizeof(m));
+  lua_setfield(L, -2, filename);
+  lua_pop(L, 1);
+  return m.hash;
+}
+
+
+/* identify the source file, returns 0 if it can't be read */
+static int bc_key (lua_State *L, const char *filename, BCHeader *h) {
+  struct vfs_stat st;
+  c_memcpy(h->magic, BC_MAGIC, 4);
+  h->hash = 0;
+  if (vfs_stat(filename, &st) != VFS_RES_OK)
+    return 0;
+  h->size = st.size;
+  h->mtime = 0;
+  if (st.tm_valid) {
+    /* unsigned, so a wrap-around is defined; it only needs to differ */
+    const vfs_time *t = &st.tm;
+    uint32_t m = (uint32_t)t->year;
+    m = m * 13 + (uint32_t)t->mon;
+    m = m * 32 + (uint32_t)t->day;
+    m = m * 24 + (uint32_t)t->hour;
+    m = m * 60 + (uint32_t)t->min;
+    h->mtime = m * 60 + (uint32_t)t->sec;
+  } else if ((h->hash = bc_hash_cached(L, filename, h->size)) == 0)
+    return 0;
+  return 1;
+}
+
+
+static int bc_load (lua_State *L, const char *bcname, const BCHeader *key) {
+  LoadBC lb;
+  BCHeader h;
+  int status;
+  lb.f = vfs_open(bcname, "r");
+  if (!lb.f) return LUA_ERRFILE;
+  if (vfs_read(lb.f, &h, sizeof(h)) != sizeof(h) ||
+      c_memcmp(&h, key, sizeof(h)) != 0) {
+    vfs_close(lb.f);
+    return LUA_ERRFILE;
+  }
+  status = lua_load(L, getBC, &lb, bcname);
+  vfs_close(lb.f);
+  return status;
+}
+
+
+static void bc_store (lua_State *L, const char *bcname, const BCHeader *key) {
+  uint32_t before = vfs_changes();
+  int f = vfs_open(bcname, "w");
+  int err;
+  if (!f) return;
+  err = vfs_write(f, key, sizeof(*key)) != sizeof(*key);
+  if (!err) {
+    lua_lock(L);
+    err = luaU_dump(L, clvalue(L->top - 1)->l.p, writeBC, &f, 0);
+    lua_unlock(L);
+  }
+  err |= vfs_flush(f) != VFS_RES_OK;
+  vfs_close(f);
+  if (err)
+    vfs_remove(bcname);  /* don't leave a truncated cache behind */
+  else
+    findfile_restamp(L, before);  /* cache files are not on the path */
+}
+
+
+static int loadfile_cached (lua_State *L, const char *filename) {
+  size_t l = c_strlen(filename);
+  BCHeader key;
+  const char *bcname;
+  int status;
+  if (l < 4 || c_strcmp(filename + l - 4, ".lua") != 0 ||
+      !bc_key(L, filename, &key))
+    return luaL_loadfsfile(L, filename);
+  lua_pushlstring(L, filename, l - 1);
+  lua_pushliteral(L, "c");
+  lua_concat(L, 2);
+  bcname = lua_tostring(L, -1);
+  if ((status = bc_load(L, bcname, &key)) == 0) {
+    lua_remove(L, -2);  /* cache file name */
+    return 0;
+  }
+  if (status != LUA_ERRFILE)
+    lua_pop(L, 1);  /* error message of a corrupt cache */
+  status = luaL_loadfsfile(L, filename);
+  if (status == 0)
+    bc_store(L, bcname, &key);
+  lua_remove(L, -2);  /* cache file name */
+  return status;
+}
+#elif !defined(LUA_CROSS_COMPILER)
+#define loadfile_cached(L,f)	luaL_loadfsfile(L,f)
+#endif
+
+
 static int loader_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
-  filename = findfile(L, name, "path");
+  filename = findfile_cached(L, name, "path");
   if (filename == NULL) return 1;  /* library not found in this path */
 #ifdef LUA_CROSS_COMPILER
   if (luaL_loadfile(L, filename) != 0)
+    loaderror(L, filename);
 #else
-  if (luaL_loadfsfile(L, filename) != 0)
+  switch (loadfile_cached(L, filename)) {
+    case 0:
+      break;
+    case LUA_ERRFILE:  /* gone since it was found? */
+      findfile_forget(L, name, "path");
+      lua_pop(L, 1);
+      filename = findfile(L, name, "path");
+      if (filename == NULL) return 1;
+      if (loadfile_cached(L, filename) == 0)
+        break;
+      /* fall through */
+    default:
+      loaderror(L, filename);
+  }
 #endif
-    loaderror(L, filename);
   return 1;  /* library loaded successfully */
 }
 
@@ -415,7 +730,7 @@ static const char *mkfuncname (lua_State *L, const char *modname) {
 static int loader_C (lua_State *L) {
   const char *funcname;
   const char *name = luaL_checkstring(L, 1);
-  const char *filename = findfile(L, name, "cpath");
+  const char *filename = findfile_cached(L, name, "cpath");
   if (filename == NULL) return 1;  /* library not found in this path */
   funcname = mkfuncname(L, name);
   if (ll_loadfunc(L, filename, funcname) != 0)
@@ -461,6 +776,53 @@ static const int sentinel_ = 0;
 #define sentinel	((void *)&sentinel_)
 
 
+static const lua_CFunction loaders[] = {
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+  luaN_loader,
+#endif
+  loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
+
+static const char *const loadernames[] = {
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+  "lfs",
+#endif
+  "preload", "lua", "c", "croot", NULL};
+
+
+/*
+** Count the require() calls satisfied by the i-th loader in package.stats,
+** keyed by the name of a built-in loader or else by its position.  i = 0
+** counts modules that weren't found.  The loaders table is at index 4.
+*/
+static void searchstat (lua_State *L, int i) {
+  lua_getfield(L, LUA_ENVIRONINDEX, "stats");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  if (i == 0)
+    lua_pushliteral(L, "notfound");
+  else {
+    lua_CFunction f;
+    int j;
+    lua_rawgeti(L, 4, i);
+    f = lua_tocfunction(L, -1);
+    lua_pop(L, 1);
+    for (j = 0; loaders[j] != NULL && loaders[j] != f; j++) ;
+    if (f != NULL && loaders[j] != NULL)
+      lua_pushstring(L, loadernames[j]);
+    else
+      lua_pushinteger(L, i);
+  }
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  lua_pushinteger(L, lua_tointeger(L, -1) + 1);
+  lua_remove(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+
 static int ll_require (lua_State *L) {
   const char *name = luaL_checkstring(L, 1);
   int i;
@@ -486,9 +848,11 @@ static int ll_require (lua_State *L) {
   lua_pushliteral(L, "");  /* error message accumulator */
   for (i=1; ; i++) {
     lua_rawgeti(L, -2, i);  /* get a loader */
-    if (lua_isnil(L, -1))
+    if (lua_isnil(L, -1)) {
+      searchstat(L, 0);
       luaL_error(L, "module " LUA_QS " not found:%s",
                     name, lua_tostring(L, -2));
+    }
     lua_pushstring(L, name);
     lua_call(L, 1, 1);  /* call it */
     if (lua_isfunction(L, -1))  /* did it find module? */
@@ -498,6 +862,7 @@ static int ll_require (lua_State *L) {
     else
       lua_pop(L, 1);
   }
+  searchstat(L, i);
   lua_pushlightuserdata(L, sentinel);
   lua_setfield(L, 2, name);  /* _LOADED[name] = sentinel */
   lua_pushstring(L, name);  /* pass name as argument to module */
@@ -647,9 +1012,6 @@ static const luaL_Reg ll_funcs[] = {
 };
 
 
-static const lua_CFunction loaders[] =
-  {loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
-
 #if LUA_OPTIMIZE_MEMORY > 0
 #undef MIN_OPT_LEVEL
 #define MIN_OPT_LEVEL 1
@@ -698,6 +1060,9 @@ LUALIB_API int luaopen_package (lua_State *L) {
   /* set field `preload' */
   lua_newtable(L);
   lua_setfield(L, -2, "preload");
+  /* set field `stats' */
+  lua_newtable(L);
+  lua_setfield(L, -2, "stats");
   lua_pushvalue(L, LUA_GLOBALSINDEX);
   luaL_register(L, NULL, ll_funcs);  /* open lib into global table */
   lua_pop(L, 1);
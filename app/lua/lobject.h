@@ -83,6 +83,77 @@ GET_BYTE_FN(marked,GCheader,4,8)
 /*
 ** Union of all Lua values
 */
+#ifdef LUA_NANBOX_TVALUES
+
+/*
+** NaN-boxed values: a TValue is a single 8 byte word, which holds either a
+** double or, in the otherwise unused negative quiet NaN space, a 4-bit type
+** tag and a 47-bit payload (pointer or boolean).  Numbers are stored with
+** any negative NaN replaced by the positive one, so that they compare below
+** the boxed values.  The payload is a full pointer on 32-bit targets and on
+** the usual 64-bit hosts.  On the ESP the words are only 4-byte aligned.
+*/
+#ifdef LUA_NUMBER_INTEGRAL
+# error "LUA_NANBOX_TVALUES is only valid for Floating point builds"
+#endif
+
+typedef unsigned long long lu_int64;
+
+#ifndef LUA_CROSS_COMPILER
+#pragma pack(4)
+#endif
+typedef union {
+  lua_Number n;
+  lu_int64 u;
+  struct {lu_int32 lo, hi;} w;  /* little-endian words, for static inits */
+} Value;
+
+#define TValuefields	Value value
+
+typedef struct lua_TValue {
+  TValuefields;
+} TValue;
+#ifndef LUA_CROSS_COMPILER
+#pragma pack()
+#endif
+
+#define NB_NUMMAX	0xFFF8000000000000ULL  /* boxed values are >= this */
+#define NB_NAN		0x7FF8000000000000ULL  /* the one NaN stored */
+#define NB_TAGSHIFT	47
+#define NB_PAYLOAD	((1ULL << NB_TAGSHIFT) - 1)
+#define NB_BOX(t)	(NB_NUMMAX | ((lu_int64)(t) << NB_TAGSHIFT))
+
+/* Static initialisers can't split an address, so 32-bit targets set words */
+#if __SIZEOF_POINTER__ == 4
+#define NB_INIT(p,t)	{.w = {(lu_int32)(p), (lu_int32)(NB_BOX(t) >> 32)}}
+#else
+#define NB_INIT(p,t)	{.u = (lu_int64)(size_t)(p) + NB_BOX(t)}
+#endif
+#define LUA_TVALUE_NIL NB_INIT(NULL, LUA_TNIL)
+
+static inline int nb_ttype (const TValue *o) {
+  lu_int64 u = o->value.u;
+  return u < NB_NUMMAX ? LUA_TNUMBER : (int)(u >> NB_TAGSHIFT) & 0xF;
+}
+
+/* Raw access to the value and type */
+#define ttype(o)	nb_ttype(o)
+#define tvp(o)		((void *)(size_t)((o)->value.u & NB_PAYLOAD))
+#define tvgc(o)		((GCObject *)tvp(o))
+#define tvn(o)		((o)->value.n)
+#define tvb(o)		((int)((o)->value.u & NB_PAYLOAD))
+#define settvp(o,x,t)	((o)->value.u = (lu_int64)(size_t)(x) | NB_BOX(t))
+#define settvgc		settvp
+#define settvb(o,x)	((o)->value.u = (lu_int64)(unsigned)(x) | NB_BOX(LUA_TBOOLEAN))
+#define settvn(o,x)	((o)->value.n = (x), \
+  (o)->value.u = (o)->value.u >= NB_NUMMAX ? NB_NAN : (o)->value.u)
+#define settvobj(o1,o2)	((o1)->value = (o2)->value)
+#define setnilvalue(obj) ((obj)->value.u = NB_BOX(LUA_TNIL))
+#define setttype(obj, stt) \
+  ((obj)->value.u = ((obj)->value.u & NB_PAYLOAD) | NB_BOX(stt))
+
+#else
+
 typedef union {
   GCObject *gc;
   void *p;
@@ -107,6 +178,22 @@ typedef struct lua_TValue {
 #pragma pack()
 #endif
 
+/* Raw access to the value and type */
+#define ttype(o)	((void) (o)->value, (o)->tt)
+#define tvp(o)		((o)->value.p)
+#define tvgc(o)		((o)->value.gc)
+#define tvn(o)		((o)->value.n)
+#define tvb(o)		((o)->value.b)
+#define settvp(o,x,t)	((o)->value.p = (x), (o)->tt = (t))
+#define settvgc(o,x,t)	((o)->value.gc = (x), (o)->tt = (t))
+#define settvb(o,x)	((o)->value.b = (x), (o)->tt = LUA_TBOOLEAN)
+#define settvn(o,x)	((o)->value.n = (x), (o)->tt = LUA_TNUMBER)
+#define settvobj(o1,o2)	((o1)->value = (o2)->value, (o1)->tt = (o2)->tt)
+#define setnilvalue(obj) ((obj)->tt=LUA_TNIL)
+#define setttype(obj, stt) ((void) (obj)->value, (obj)->tt = (stt))
+
+#endif
+
 /* Macros to test type */
 #define ttisnil(o)	(ttype(o) == LUA_TNIL)
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
@@ -123,20 +210,19 @@ typedef struct lua_TValue {
 
 /* Macros to access values */
 
-#define ttype(o)	((void) (o)->value, (o)->tt)
-#define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
-#define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
-#define rvalue(o)	check_exp(ttisrotable(o), (o)->value.p)
-#define fvalue(o) check_exp(ttislightfunction(o), (o)->value.p)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
-#define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
+#define gcvalue(o)	check_exp(iscollectable(o), tvgc(o))
+#define pvalue(o)	check_exp(ttislightuserdata(o), tvp(o))
+#define rvalue(o)	check_exp(ttisrotable(o), tvp(o))
+#define fvalue(o) check_exp(ttislightfunction(o), tvp(o))
+#define nvalue(o)	check_exp(ttisnumber(o), tvn(o))
+#define rawtsvalue(o)	check_exp(ttisstring(o), &tvgc(o)->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
-#define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
+#define rawuvalue(o)	check_exp(ttisuserdata(o), &tvgc(o)->u)
 #define uvalue(o)	(&rawuvalue(o)->uv)
-#define clvalue(o)	check_exp(ttisfunction(o), &(o)->value.gc->cl)
-#define hvalue(o)	check_exp(ttistable(o), &(o)->value.gc->h)
-#define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
-#define thvalue(o)	check_exp(ttisthread(o), &(o)->value.gc->th)
+#define clvalue(o)	check_exp(ttisfunction(o), &tvgc(o)->cl)
+#define hvalue(o)	check_exp(ttistable(o), &tvgc(o)->h)
+#define bvalue(o)	check_exp(ttisboolean(o), tvb(o))
+#define thvalue(o)	check_exp(ttisthread(o), &tvgc(o)->th)
 
 #define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
 
@@ -145,69 +231,68 @@ typedef struct lua_TValue {
 */
 
 #define checkconsistency(obj) \
-  lua_assert(!iscollectable(obj) || (ttype(obj) == (obj)->value.gc->gch.tt))
+  lua_assert(!iscollectable(obj) || (ttype(obj) == tvgc(obj)->gch.tt))
 
 #define checkliveness(g,obj) \
   lua_assert(!iscollectable(obj) || \
-  ((ttype(obj) == (obj)->value.gc->gch.tt) && !isdead(g, (obj)->value.gc)))
+  ((ttype(obj) == tvgc(obj)->gch.tt) && !isdead(g, tvgc(obj))))
 
 /* Macros to set values */
-#define setnilvalue(obj) ((obj)->tt=LUA_TNIL)
 
 #define setnvalue(obj,x) \
-  { lua_Number i_x = (x); TValue *i_o=(obj); i_o->value.n=i_x; i_o->tt=LUA_TNUMBER; }
+  { lua_Number i_x = (x); TValue *i_o=(obj); settvn(i_o, i_x); }
 
 #define setpvalue(obj,x) \
-  { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TLIGHTUSERDATA; }
+  { void *i_x = (x); TValue *i_o=(obj); settvp(i_o, i_x, LUA_TLIGHTUSERDATA); }
 
 #define setrvalue(obj,x) \
-  { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TROTABLE; }
+  { void *i_x = (x); TValue *i_o=(obj); settvp(i_o, i_x, LUA_TROTABLE); }
 
 #define setfvalue(obj,x) \
-  { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TLIGHTFUNCTION; }
+  { void *i_x = (x); TValue *i_o=(obj); settvp(i_o, i_x, LUA_TLIGHTFUNCTION); }
 
 #define setbvalue(obj,x) \
-  { int i_x = (x); TValue *i_o=(obj); i_o->value.b=i_x; i_o->tt=LUA_TBOOLEAN; }
+  { int i_x = (x); TValue *i_o=(obj); settvb(i_o, i_x); }
 
 #define setsvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TSTRING; \
+    settvgc(i_o, i_x, LUA_TSTRING); \
     checkliveness(G(L),i_o); }
 
 #define setuvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TUSERDATA; \
+    settvgc(i_o, i_x, LUA_TUSERDATA); \
     checkliveness(G(L),i_o); }
 
 #define setthvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TTHREAD; \
+    settvgc(i_o, i_x, LUA_TTHREAD); \
     checkliveness(G(L),i_o); }
 
 #define setclvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TFUNCTION; \
+    settvgc(i_o, i_x, LUA_TFUNCTION); \
     checkliveness(G(L),i_o); }
 
 #define sethvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TTABLE; \
+    settvgc(i_o, i_x, LUA_TTABLE); \
     checkliveness(G(L),i_o); }
 
 #define setptvalue(L,obj,x) \
   { GCObject *i_x = cast(GCObject *, (x)); \
     TValue *i_o=(obj); \
-    i_o->value.gc=i_x; i_o->tt=LUA_TPROTO; \
+    settvgc(i_o, i_x, LUA_TPROTO); \
     checkliveness(G(L),i_o); }
 
 #define setobj(L,obj1,obj2) \
   { const TValue *o2=(obj2); TValue *o1=(obj1); \
-    o1->value = o2->value; o1->tt=o2->tt; \
+    settvobj(o1, o2); \
     checkliveness(G(L),o1); }
 
 /*
@@ -229,8 +314,6 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, stt) ((void) (obj)->value, (obj)->tt = (stt))
-
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
 
 
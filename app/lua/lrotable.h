@@ -9,11 +9,19 @@
 #include "llimits.h"
 
 /* Macros one can use to define rotable entries */
+#ifdef LUA_NANBOX_TVALUES
+#define LRO_FUNCVAL(v)  {NB_INIT(v, LUA_TLIGHTFUNCTION)}
+#define LRO_LUDATA(v)   {NB_INIT(v, LUA_TLIGHTUSERDATA)}
+#define LRO_NUMVAL(v)   {{.n = v}}
+#define LRO_ROVAL(v)    {NB_INIT((void*)v, LUA_TROTABLE)}
+#define LRO_NILVAL      {NB_INIT(NULL, LUA_TNIL)}
+#else
 #define LRO_FUNCVAL(v)  {{.p = v}, LUA_TLIGHTFUNCTION}
 #define LRO_LUDATA(v)   {{.p = v}, LUA_TLIGHTUSERDATA}
 #define LRO_NUMVAL(v)   {{.n = v}, LUA_TNUMBER}
 #define LRO_ROVAL(v)    {{.p = (void*)v}, LUA_TROTABLE}
 #define LRO_NILVAL      {{.p = NULL}, LUA_TNIL}
+#endif
 #ifdef LUA_CROSS_COMPILER
 #define LRO_STRKEY(k)   {LUA_TSTRING, {.strkey = k}}
 #else
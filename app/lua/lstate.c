@@ -112,6 +112,8 @@ static void close_state (lua_State *L) {
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
   luaZ_freebuffer(L, &g->buff);
+  luaM_freearray(L, g->refs.slot, g->refs.size, int);
+  luaM_freearray(L, g->refs.owner, g->refs.sizeowner, RefOwner);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
@@ -171,6 +173,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.hash = NULL;
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
+  g->refs.slot = NULL;
+  g->refs.owner = NULL;
+  g->refs.size = g->refs.top = g->refs.free = 0;
+  g->refs.nowner = g->refs.sizeowner = g->refs.lastowner = 0;
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gcflags = GCFlagsNone;
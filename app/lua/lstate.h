@@ -42,6 +42,28 @@ typedef struct stringtable {
 } stringtable;
 
 
+/*
+** Pool of the references luaL_ref hands out on the registry (see lauxlib.c)
+*/
+typedef struct RefOwner {
+  const char *name;  /* source file which took the references */
+  int live;  /* references currently held */
+  int peak;  /* highest value of `live' */
+  lu_int32 total;  /* references taken in all */
+} RefOwner;
+
+typedef struct RefPool {
+  int *slot;  /* per ref: next free ref if >= 0, else owner and value type */
+  RefOwner *owner;
+  int size;  /* size of `slot' */
+  int top;  /* highest ref handed out */
+  int free;  /* first free ref, 0 if none */
+  int nowner;  /* number of owners */
+  int sizeowner;  /* size of `owner' */
+  int lastowner;  /* owner of the last reference taken */
+} RefPool;
+
+
 /*
 ** informations about a call
 */
@@ -80,6 +102,7 @@ typedef struct global_State {
   GCObject *weak;  /* list of weak tables (to be cleared) */
   GCObject *tmudata;  /* last element of list of userdata to be GC */
   Mbuffer buff;  /* temporary buffer for string concatentation */
+  RefPool refs;  /* registry references */
   lu_mem GCthreshold;
   lu_mem totalbytes;  /* number of bytes currently allocated */
   l_mem memlimit;  /* maximum number of bytes that can be allocated, 0 = no limit. <0 used with EGC_ON_MEM_LIMIT when free heap falls below -memlimit */
@@ -19,6 +19,9 @@
 /* macro to `unsign' a character */
 #define uchar(c)        ((unsigned char)(c))
 
+/* largest string a result may be built up to */
+#define MAXSIZE         ((size_t)(~(size_t)0) - 2)
+
 
 
 static int str_len (lua_State *L) {
@@ -91,7 +94,13 @@ static int str_rep (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   int n = luaL_checkint(L, 2);
-  luaL_buffinit(L, &b);
+  if (n <= 0) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  if (l > MAXSIZE / n)
+    return luaL_error(L, "resulting string too large");
+  luaL_buffinitsize(L, &b, l * n);
   while (n-- > 0)
     luaL_addlstring(&b, s, l);
   luaL_pushresult(&b);
@@ -163,9 +172,41 @@ static int str_dump (lua_State *L) {
 #define CAP_UNFINISHED	(-1)
 #define CAP_POSITION	(-2)
 
+
+/*
+** Compiled patterns.  The last LUA_PATCACHE patterns of up to PATC_MAXLEN
+** bytes are kept, keyed by their text, with each bracket class turned
+** into a 256-bit map and the anchor and literal prefix picked out.  The
+** matcher still walks the pattern text; it only looks sets up here
+** instead of scanning them for every subject character.
+*/
+#define PATC_MAXLEN	48
+#define PATC_MAXSETS	3
+
+typedef struct PatSet {
+  unsigned char at;   /* offset of the `[' in the pattern */
+  unsigned char end;  /* offset just past the `]' */
+  unsigned char bits[(UCHAR_MAX + 1) / 8];
+} PatSet;
+
+typedef struct CPattern {
+  unsigned char len;     /* pattern length, 0 for a free entry */
+  unsigned char anchor;  /* starts with `^' */
+  unsigned char prefix;  /* length of the literal prefix after any `^' */
+  unsigned char nset;
+  char pat[PATC_MAXLEN];
+  PatSet set[PATC_MAXSETS];
+} CPattern;
+
+#define setbit(st,c)	((st)->bits[(c) >> 3] |= 1 << ((c) & 7))
+#define testbit(st,c)	((st)->bits[(c) >> 3] & (1 << ((c) & 7)))
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end (`\0') of source string */
+  const char *p_init;  /* init of pattern, for set offsets */
+  const CPattern *cp;  /* compiled pattern, or NULL */
   lua_State *L;
   int level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -195,7 +236,21 @@ static int capture_to_close (MatchState *ms) {
 }
 
 
+static const PatSet *getset (MatchState *ms, const char *p) {
+  const CPattern *cp = ms->cp;
+  if (cp != NULL) {
+    int i, at = p - ms->p_init;
+    for (i = 0; i < cp->nset; i++)
+      if (cp->set[i].at == at) return &cp->set[i];
+  }
+  return NULL;
+}
+
+
 static const char *classend (MatchState *ms, const char *p) {
+  const PatSet *set;
+  if (*p == '[' && (set = getset(ms, p)) != NULL)
+    return ms->p_init + set->end;
   switch (*p++) {
     case L_ESC: {
       if (*p == '\0')
@@ -261,11 +316,15 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
-static int singlematch (int c, const char *p, const char *ep) {
+static int singlematch (MatchState *ms, int c, const char *p,
+                                        const char *ep) {
   switch (*p) {
     case '.': return 1;  /* matches any char */
     case L_ESC: return match_class(c, uchar(*(p+1)));
-    case '[': return matchbracketclass(c, p, ep-1);
+    case '[': {
+      const PatSet *set = getset(ms, p);
+      return set ? testbit(set, c) != 0 : matchbracketclass(c, p, ep-1);
+    }
     default:  return (uchar(*p) == c);
   }
 }
@@ -297,8 +356,13 @@ static const char *matchbalance (MatchState *ms, const char *s,
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
-  while ((s+i)<ms->src_end && singlematch(uchar(*(s+i)), p, ep))
-    i++;
+  const PatSet *set = (*p == '[') ? getset(ms, p) : NULL;
+  if (set != NULL)
+    while ((s+i)<ms->src_end && testbit(set, uchar(*(s+i))))
+      i++;
+  else
+    while ((s+i)<ms->src_end && singlematch(ms, uchar(*(s+i)), p, ep))
+      i++;
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
     const char *res = match(ms, (s+i), ep+1);
@@ -315,7 +379,7 @@ static const char *min_expand (MatchState *ms, const char *s,
     const char *res = match(ms, s, ep+1);
     if (res != NULL)
       return res;
-    else if (s<ms->src_end && singlematch(uchar(*s), p, ep))
+    else if (s<ms->src_end && singlematch(ms, uchar(*s), p, ep))
       s++;  /* try with one more repetition */
     else return NULL;
   }
@@ -385,8 +449,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
                                LUA_QL("%%f") " in pattern");
           ep = classend(ms, p);  /* points to what is next */
           previous = (s == ms->src_init) ? '\0' : *(s-1);
-          if (matchbracketclass(uchar(previous), p, ep-1) ||
-             !matchbracketclass(uchar(*s), p, ep-1)) return NULL;
+          if (singlematch(ms, uchar(previous), p, ep) ||
+             !singlematch(ms, uchar(*s), p, ep)) return NULL;
           p=ep; goto init;  /* else return match(ms, s, ep); */
         }
         default: {
@@ -409,7 +473,7 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
     }
     default: dflt: {  /* it is a pattern item */
       const char *ep = classend(ms, p);  /* points to what is next */
-      int m = s<ms->src_end && singlematch(uchar(*s), p, ep);
+      int m = s<ms->src_end && singlematch(ms, uchar(*s), p, ep);
       switch (*ep) {
         case '?': {  /* optional */
           const char *res;
@@ -437,10 +501,42 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** Needles of at least BMH_MINNEEDLE bytes in a haystack of at least
+** BMH_MINHAY bytes are searched Boyer-Moore-Horspool style; the shift
+** table is built per call, so shorter searches keep the memchr scan.
+** Shifts are capped at 255 to keep the table in bytes; a short shift
+** is always safe, just slower.
+*/
+#define BMH_MINNEEDLE	4
+#define BMH_MINHAY	128
+
+static const char *lmemfind_bmh (const char *s1, size_t l1,
+                                   const char *s2, size_t l2) {
+  unsigned char shift[UCHAR_MAX + 1];
+  size_t i, last = l2 - 1;
+  const char *end = s1 + (l1 - l2);  /* last possible start */
+  unsigned char c;
+  c_memset(shift, l2 > UCHAR_MAX ? UCHAR_MAX : (unsigned char)l2, sizeof(shift));
+  for (i = (l2 > UCHAR_MAX) ? l2 - UCHAR_MAX : 0; i < last; i++)
+    shift[uchar(s2[i])] = (unsigned char)(last - i);
+  c = uchar(s2[last]);
+  while (s1 <= end) {
+    unsigned char k = uchar(s1[last]);
+    if (k == c && c_memcmp(s1, s2, last) == 0)
+      return s1;
+    s1 += shift[k];
+  }
+  return NULL;  /* not found */
+}
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
+  else if (l2 >= BMH_MINNEEDLE && l1 >= BMH_MINHAY)
+    return lmemfind_bmh(s1, l1, s2, l2);
   else {
     const char *init;  /* to search for a `*s2' inside `s1' */
     l2--;  /* 1st char will be checked by `memchr' */
@@ -459,6 +555,99 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** Fills in cp from pattern p.  Anything the scan does not understand is
+** left to the matcher, which raises the proper error.
+*/
+static int patcompile (CPattern *cp, const char *p, size_t l) {
+  const char *p0 = p;
+  const char *q;
+  cp->nset = 0;
+  cp->anchor = (*p == '^');
+  if (cp->anchor) p++;
+  for (q = p; *q != '\0' && c_strchr(SPECIALS ")", *q) == NULL; q++)
+    if (*(q+1) != '\0' && c_strchr("*+-?", *(q+1)) != NULL)
+      break;  /* a quantified char is optional */
+  cp->prefix = (unsigned char)(q - p);
+  while (*p != '\0') {
+    if (*p == L_ESC) {
+      if (*(p+1) == 'b') {
+        if (*(p+2) == '\0' || *(p+3) == '\0') return 0;
+        p += 4;
+      }
+      else if (*(p+1) == 'f')
+        p += 2;  /* the set follows */
+      else if (*(p+1) == '\0') return 0;
+      else
+        p += 2;
+    }
+    else if (*p == '[') {  /* as in classend */
+      q = p + 1;
+      if (*q == '^') q++;
+      do {
+        if (*q == '\0') return 0;
+        if (*(q++) == L_ESC && *q != '\0')
+          q++;
+      } while (*q != ']');
+      if (cp->nset < PATC_MAXSETS) {  /* others stay interpreted */
+        PatSet *set = &cp->set[cp->nset++];
+        int c;
+        set->at = (unsigned char)(p - p0);
+        set->end = (unsigned char)(q + 1 - p0);
+        c_memset(set->bits, 0, sizeof(set->bits));
+        for (c = 0; c <= UCHAR_MAX; c++)
+          if (matchbracketclass(c, p, q)) setbit(set, c);
+      }
+      p = q + 1;
+    }
+    else
+      p++;
+  }
+  c_memcpy(cp->pat, p0, l);
+  cp->len = (unsigned char)l;
+  return 1;
+}
+
+
+static const char patcache_key = 'p';
+
+typedef struct PatCache {
+  int next;  /* entry to replace */
+  CPattern e[LUA_PATCACHE];
+} PatCache;
+
+/* returns the compiled form of p, or NULL if it is not cacheable */
+static const CPattern *patcache (lua_State *L, const char *p) {
+  size_t l = c_strlen(p);
+  PatCache *pc;
+  CPattern *cp;
+  int i;
+  if (l == 0 || l > PATC_MAXLEN) return NULL;
+  lua_pushlightuserdata(L, (void *)&patcache_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  pc = (PatCache *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (pc == NULL) {  /* first use: anchored in the registry */
+    lua_pushlightuserdata(L, (void *)&patcache_key);
+    pc = (PatCache *)lua_newuserdata(L, sizeof(PatCache));
+    c_memset(pc, 0, sizeof(PatCache));
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+  for (i = 0; i < LUA_PATCACHE; i++) {
+    cp = &pc->e[i];
+    if (cp->len == l && c_memcmp(cp->pat, p, l) == 0)
+      return cp;
+  }
+  cp = &pc->e[pc->next];
+  pc->next = (pc->next + 1) % LUA_PATCACHE;
+  if (!patcompile(cp, p, l)) {
+    cp->len = 0;
+    return NULL;
+  }
+  return cp;
+}
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -507,13 +696,21 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
+    const CPattern *cp = patcache(L, p);
+    size_t prefix = (cp && !cp->anchor) ? cp->prefix : 0;
+    int anchor;
     const char *s1=s+init;
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
+    ms.p_init = p;
+    ms.cp = cp;
+    anchor = (*p == '^') ? (p++, 1) : 0;
     do {
       const char *res;
+      if (prefix &&  /* skip to where the literal prefix is */
+          (s1 = lmemfind(s1, ms.src_end-s1, p, prefix)) == NULL)
+        break;
       ms.level = 0;
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -547,13 +744,20 @@ static int gmatch_aux (lua_State *L) {
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
   const char *p = lua_tostring(L, lua_upvalueindex(2));
   const char *src;
+  const CPattern *cp = patcache(L, p);
+  size_t prefix = (cp && !cp->anchor) ? cp->prefix : 0;  /* `^' is literal here */
   ms.L = L;
   ms.src_init = s;
   ms.src_end = s+ls;
+  ms.p_init = p;
+  ms.cp = cp;
   for (src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
        src <= ms.src_end;
        src++) {
     const char *e;
+    if (prefix &&
+        (src = lmemfind(src, ms.src_end-src, p, prefix)) == NULL)
+      break;
     ms.level = 0;
     if ((e = match(&ms, src, p)) != NULL) {
       lua_Integer newstart = e-s;
@@ -644,6 +848,7 @@ static int str_gsub (lua_State *L) {
   const char *p = luaL_checkstring(L, 2);
   int  tr = lua_type(L, 3);
   int max_s = luaL_optint(L, 4, srcl+1);
+  const char *p_init = p;
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
   MatchState ms;
@@ -656,20 +861,51 @@ static int str_gsub (lua_State *L) {
   ms.L = L;
   ms.src_init = src;
   ms.src_end = src+srcl;
-  while (n < max_s) {
+  ms.p_init = p_init;
+  ms.cp = NULL;
+  ms.level = 0;
+  if (!anchor && *p != '\0' && c_strpbrk(p, SPECIALS ")") == NULL) {
+    /* literal pattern: find each occurrence without the matcher */
+    size_t l2 = c_strlen(p);
     const char *e;
-    ms.level = 0;
-    e = match(&ms, src, p);
-    if (e) {
+    while (n < max_s &&
+           (e = lmemfind(src, ms.src_end-src, p, l2)) != NULL) {
       n++;
-      add_value(&ms, &b, src, e);
+      luaL_addlstring(&b, src, e-src);
+      add_value(&ms, &b, e, e+l2);
+      src = e+l2;
+    }
+  }
+  else {
+    CPattern cpat;  /* a copy: the replacement may run other patterns */
+    const CPattern *cp = patcache(L, p_init);
+    size_t prefix = 0;
+    if (cp != NULL) {
+      cpat = *cp;
+      ms.cp = &cpat;
+      prefix = anchor ? 0 : cpat.prefix;
+    }
+    while (n < max_s) {
+      const char *e;
+      if (prefix) {  /* copy up to where the literal prefix is */
+        if ((e = lmemfind(src, ms.src_end-src, p, prefix)) == NULL)
+          break;
+        luaL_addlstring(&b, src, e-src);
+        src = e;
+      }
+      ms.level = 0;
+      e = match(&ms, src, p);
+      if (e) {
+        n++;
+        add_value(&ms, &b, src, e);
+      }
+      if (e && e>src) /* non empty match? */
+        src = e;  /* skip it */
+      else if (src < ms.src_end)
+        luaL_addchar(&b, *src++);
+      else break;
+      if (anchor) break;
     }
-    if (e && e>src) /* non empty match? */
-      src = e;  /* skip it */
-    else if (src < ms.src_end)
-      luaL_addchar(&b, *src++);
-    else break;
-    if (anchor) break;
   }
   luaL_addlstring(&b, src, ms.src_end-src);
   luaL_pushresult(&b);
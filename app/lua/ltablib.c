@@ -10,6 +10,7 @@
 #define LUAC_CROSS_FILE
 
 #include "lua.h"
+#include C_HEADER_STRING
 
 #include "lauxlib.h"
 #include "lualib.h"
@@ -148,7 +149,7 @@ static int tconcat (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   i = luaL_optint(L, 3, 1);
   last = luaL_opt(L, luaL_checkint, 4, luaL_getn(L, 1));
-  luaL_buffinit(L, &b);
+  luaL_buffinitsize(L, &b, 0);
   for (; i < last; i++) {
     addfield(L, &b, i);
     luaL_addlstring(&b, sep, lsep);
@@ -166,8 +167,23 @@ static int tconcat (lua_State *L) {
 ** Quicksort
 ** (based on `Algorithms in MODULA-3', Robert Sedgewick;
 **  Addison-Wesley, 1993.)
+**
+** Partitioning is bounded as in introsort: a range still unsorted after
+** 2*log2(n) levels is finished with a heapsort, so neither an unlucky
+** input nor an inconsistent order function can make it quadratic.  The
+** pending ranges are kept on a small explicit stack instead of recursing.
 */
 
+#define SORT_MAXSTACK	32	/* pending ranges: larger one pushed, so < log2(n) */
+#define SORT_INSERTION	12	/* ranges this short are insertion sorted in C */
+
+
+static int sort_log2 (unsigned int n) {
+  int l = 0;
+  while (n >>= 1) l++;
+  return l;
+}
+
 
 static void set2 (lua_State *L, int i, int j) {
   lua_rawseti(L, 1, i);
@@ -189,9 +205,55 @@ static int sort_comp (lua_State *L, int a, int b) {
     return lua_lessthan(L, a, b);
 }
 
+/* moves a[i] down the heap a[l..u] to its place */
+static void siftdown (lua_State *L, int l, int i, int u) {
+  lua_rawgeti(L, 1, i);
+  for (;;) {
+    int c = l + 2*(i-l) + 1;  /* first child */
+    if (c > u) break;
+    lua_rawgeti(L, 1, c);
+    if (c < u) {
+      lua_rawgeti(L, 1, c+1);
+      if (sort_comp(L, -2, -1)) {  /* a[c] < a[c+1]? */
+        lua_remove(L, -2);
+        c++;
+      }
+      else
+        lua_pop(L, 1);
+    }
+    if (!sort_comp(L, -2, -1)) {  /* not less than the larger child? */
+      lua_pop(L, 1);
+      break;
+    }
+    lua_rawseti(L, 1, i);  /* move the child up */
+    i = c;
+  }
+  lua_rawseti(L, 1, i);
+}
+
+static void heapsort (lua_State *L, int l, int u) {
+  int i;
+  for (i = l + (u-l-1)/2; i >= l; i--)
+    siftdown(L, l, i, u);
+  for (i = u; i > l; i--) {
+    lua_rawgeti(L, 1, l);
+    lua_rawgeti(L, 1, i);
+    set2(L, l, i);  /* move the largest to the end */
+    siftdown(L, l, l, i-1);
+  }
+}
+
 static void auxsort (lua_State *L, int l, int u) {
+  int stack[SORT_MAXSTACK][3];
+  int top = 0;
+  int depth = 2*sort_log2(u-l+1);
+  for (;;) {
   while (l < u) {  /* for tail recursion */
     int i, j;
+    if (depth-- == 0) {  /* too many levels: finish the range off */
+      heapsort(L, l, u);
+      break;
+    }
     /* sort elements a[l], a[(l+u)/2] and a[u] */
     lua_rawgeti(L, 1, l);
     lua_rawgeti(L, 1, u);
@@ -241,15 +303,198 @@ static void auxsort (lua_State *L, int l, int u) {
     lua_rawgeti(L, 1, i);
     set2(L, u-1, i);  /* swap pivot (a[u-1]) with a[i] */
     /* a[l..i-1] <= a[i] == P <= a[i+1..u] */
-    /* adjust so that smaller half is in [j..i] and larger one in [l..u] */
+    /* push the larger half and go on with the smaller one */
     if (i-l < u-i) {
-      j=l; i=i-1; l=i+2;
+      stack[top][0] = i+1; stack[top][1] = u; u = i-1;
     }
     else {
-      j=i+1; i=u; u=j-2;
+      stack[top][0] = l; stack[top][1] = i-1; l = i+1;
+    }
+    stack[top++][2] = depth;
+  }
+  if (top == 0) break;
+  top--;
+  l = stack[top][0]; u = stack[top][1]; depth = stack[top][2];
+  }
+}
+
+
+/*
+** Without an order function, an array holding only numbers or only
+** strings is sorted in C: the values are copied into a buffer, sorted
+** there with the same bounded quicksort, and put back.  No comparison goes
+** through the VM.
+*/
+
+typedef int (*sort_lt) (const void *a, const void *b);
+
+typedef struct SortStr {
+  const char *s;
+  size_t l;
+  int i;  /* original position */
+} SortStr;
+
+
+static int num_lt (const void *a, const void *b) {
+  return luai_numlt(*(const lua_Number *)a, *(const lua_Number *)b);
+}
+
+/* as l_strcmp in lvm.c */
+static int str_lt (const void *a, const void *b) {
+  const char *l = ((const SortStr *)a)->s;
+  size_t ll = ((const SortStr *)a)->l;
+  const char *r = ((const SortStr *)b)->s;
+  size_t lr = ((const SortStr *)b)->l;
+  for (;;) {
+    int temp = c_strcoll(l, r);
+    if (temp != 0) return temp < 0;
+    else {  /* strings are equal up to a `\0' */
+      size_t len = c_strlen(l);  /* index of first `\0' in both strings */
+      if (len == lr)  /* r is finished? */
+        return 0;
+      else if (len == ll)  /* l is finished? */
+        return 1;
+      len++;
+      l += len; ll -= len; r += len; lr -= len;
     }
-    auxsort(L, j, i);  /* call recursively the smaller one */
-  }  /* repeat the routine for the larger one */
+  }
+}
+
+static void sort_swap (char *a, char *b, size_t sz) {
+  while (sz--) {
+    char t = *a;
+    *a++ = *b;
+    *b++ = t;
+  }
+}
+
+#define elem(i)		(a + (size_t)(i)*sz)
+
+static void csiftdown (char *a, size_t sz, int i, int n, sort_lt lt) {
+  for (;;) {
+    int c = 2*i + 1;
+    if (c >= n) break;
+    if (c+1 < n && lt(elem(c), elem(c+1))) c++;
+    if (!lt(elem(i), elem(c))) break;
+    sort_swap(elem(i), elem(c), sz);
+    i = c;
+  }
+}
+
+static void csort (char *a, size_t sz, int n, sort_lt lt) {
+  struct { char *a; int n, depth; } stack[SORT_MAXSTACK];
+  int top = 0;
+  int depth = 2*sort_log2(n);
+  for (;;) {
+    while (n > SORT_INSERTION) {
+      char *p;
+      int i, j;
+      if (depth-- == 0) {  /* heapsort the range */
+        for (i = n/2 - 1; i >= 0; i--)
+          csiftdown(a, sz, i, n, lt);
+        for (i = n-1; i > 0; i--) {
+          sort_swap(a, elem(i), sz);
+          csiftdown(a, sz, 0, i, lt);
+        }
+        n = 0;
+        break;
+      }
+      /* a[0] <= P == a[n-2] <= a[n-1] */
+      p = elem(n/2);
+      if (lt(p, a)) sort_swap(p, a, sz);
+      if (lt(elem(n-1), p)) {
+        sort_swap(elem(n-1), p, sz);
+        if (lt(p, a)) sort_swap(p, a, sz);
+      }
+      sort_swap(p, elem(n-2), sz);
+      p = elem(n-2);
+      i = 0; j = n-2;
+      for (;;) {
+        while (lt(elem(++i), p)) ;
+        while (lt(p, elem(--j))) ;
+        if (j < i) break;
+        sort_swap(elem(i), elem(j), sz);
+      }
+      sort_swap(elem(i), p, sz);
+      /* push the larger part, go on with the smaller one */
+      if (i < n-1-i) {
+        stack[top].a = elem(i+1); stack[top].n = n-1-i;
+        n = i;
+      }
+      else {
+        stack[top].a = a; stack[top].n = i;
+        a = elem(i+1); n = n-1-i;
+      }
+      stack[top++].depth = depth;
+    }
+    if (n > 1) {  /* insertion sort */
+      int i, j;
+      for (i = 1; i < n; i++)
+        for (j = i; j > 0 && lt(elem(j), elem(j-1)); j--)
+          sort_swap(elem(j), elem(j-1), sz);
+    }
+    if (top == 0) break;
+    top--;
+    a = stack[top].a; n = stack[top].n; depth = stack[top].depth;
+  }
+}
+
+#undef elem
+
+static int fastsort (lua_State *L, int n) {
+  int i;
+  lua_rawgeti(L, 1, 1);
+  i = lua_type(L, -1);
+  lua_pop(L, 1);
+  if (i == LUA_TNUMBER) {
+    lua_Number *a = (lua_Number *)lua_newuserdata(L, n * sizeof(lua_Number));
+    for (i = 0; i < n; i++) {
+      lua_rawgeti(L, 1, i+1);
+      if (lua_type(L, -1) != LUA_TNUMBER) {
+        lua_pop(L, 2);
+        return 0;
+      }
+      a[i] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    csort((char *)a, sizeof(lua_Number), n, num_lt);
+    for (i = 0; i < n; i++) {
+      lua_pushnumber(L, a[i]);
+      lua_rawseti(L, 1, i+1);
+    }
+  }
+  else if (i == LUA_TSTRING) {
+    SortStr *a = (SortStr *)lua_newuserdata(L, n * sizeof(SortStr));
+    for (i = 0; i < n; i++) {
+      lua_rawgeti(L, 1, i+1);
+      if (lua_type(L, -1) != LUA_TSTRING) {
+        lua_pop(L, 2);
+        return 0;
+      }
+      a[i].s = lua_tolstring(L, -1, &a[i].l);  /* anchored by the table */
+      a[i].i = i+1;
+      lua_pop(L, 1);
+    }
+    csort((char *)a, sizeof(SortStr), n, str_lt);
+    /* t[k] gets the old t[a[k].i]: move the strings round each cycle */
+    for (i = 0; i < n; i++) {
+      int j = i, from;
+      if (a[i].i == i+1) continue;  /* in place, or already moved */
+      lua_rawgeti(L, 1, i+1);
+      while ((from = a[j].i) != i+1) {
+        lua_rawgeti(L, 1, from);
+        lua_rawseti(L, 1, j+1);
+        a[j].i = j+1;
+        j = from-1;
+      }
+      lua_rawseti(L, 1, j+1);
+      a[j].i = j+1;
+    }
+  }
+  else
+    return 0;
+  lua_pop(L, 1);  /* buffer */
+  return 1;
 }
 
 static int sort (lua_State *L) {
@@ -258,7 +503,8 @@ static int sort (lua_State *L) {
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  if (n > 1 && (!lua_isnil(L, 2) || !fastsort(L, n)))
+    auxsort(L, 1, n);
   return 0;
 }
 
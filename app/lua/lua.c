@@ -14,6 +14,7 @@
 #include "driver/readline.h"
 #include "driver/uart.h"
 #include "platform.h"
+#include "vfs.h"
 
 #define lua_c
 
@@ -265,8 +266,10 @@ static int pmain (lua_State *L) {
   lua_gc(L, LUA_GCSTOP, 0);  /* stop collector during initialization */
   luaL_openlibs(L);  /* open libraries */
   lua_gc(L, LUA_GCRESTART, 0);
+  platform_boot_mark("lua_libs");
   print_version(L);
   s->status = handle_luainit(L);
+  platform_boot_mark("lua_init");
   script = collectargs(argv, &has_i, &has_v, &has_e);
   if (script < 0) {  /* invalid args? */
     s->status = 1;
@@ -416,99 +419,189 @@ extern bool run_input;
 extern uint16_t need_len;
 extern int16_t end_char;
 static char last_nl_char = '\0';
-static bool readline(lua_Load *load){
-  // NODE_DBG("readline() is called.\n");
-  bool need_dojob = false;
-  char ch;
-  while (uart_getc(&ch))
+
+/*
+** Binary upload: node.upload() directs the next `size` bytes of console
+** input into a file.  The sender keeps at most two blocks in flight; an
+** ACK is sent once a block has been written and a NAK if writing failed.
+** The upload is abandoned if no data arrives for UPLOAD_TIMEOUT ms.
+*/
+#define UPLOAD_BLOCK    (RX_BUFF_SIZE / 2)
+#define UPLOAD_TIMEOUT  3000
+#define UPLOAD_ACK      '\x06'
+#define UPLOAD_NAK      '\x15'
+
+static struct {
+  int fd;              /* 0 while no upload is running */
+  int failed;
+  uint32_t left;       /* bytes still to come */
+  uint32_t unacked;    /* bytes received since the last ACK */
+  char *name;
+  os_timer_t timer;
+} upload;
+
+static void upload_finish (const char *msg) {
+  vfs_close(upload.fd);
+  upload.fd = 0;
+  os_timer_disarm(&upload.timer);
+  if (msg) {
+    vfs_remove(upload.name);
+    l_message(NULL, msg);
+  }
+  c_free(upload.name);
+  upload.name = NULL;
+  c_puts(gLoad.prmt);
+}
+
+static void upload_timeout (void *arg) {
+  (void)arg;
+  if (upload.fd)
+    upload_finish("upload timed out");
+}
+
+/* Returns the number of bytes that belong to the upload */
+static size_t upload_input (const char *buf, size_t len) {
+  if (len > upload.left)
+    len = upload.left;
+  if (!upload.failed && vfs_write(upload.fd, buf, len) != len) {
+    upload.failed = 1;
+    uart_putc(UPLOAD_NAK);
+  }
+  upload.left -= len;
+  upload.unacked += len;
+  if (upload.unacked >= UPLOAD_BLOCK || upload.left == 0) {
+    if (!upload.failed)
+      uart_putc(UPLOAD_ACK);
+    upload.unacked = upload.unacked >= UPLOAD_BLOCK ? upload.unacked - UPLOAD_BLOCK : 0;
+  }
+  if (upload.left == 0)
+    upload_finish(upload.failed ? "upload failed" : NULL);
+  else {
+    os_timer_disarm(&upload.timer);
+    os_timer_arm(&upload.timer, UPLOAD_TIMEOUT, 0);
+  }
+  return len;
+}
+
+/* Returns the block size, or 0 if the file cannot be created */
+int lua_upload_start (const char *name, uint32_t size) {
+  if (upload.fd || (upload.name = c_malloc(c_strlen(name) + 1)) == NULL)
+    return 0;
+  c_strcpy(upload.name, name);
+  if ((upload.fd = vfs_open(name, "w")) == 0) {
+    c_free(upload.name);
+    upload.name = NULL;
+    return 0;
+  }
+  upload.failed = 0;
+  upload.left = size;
+  upload.unacked = 0;
+  if (size == 0) {
+    vfs_close(upload.fd);
+    upload.fd = 0;
+    c_free(upload.name);
+    upload.name = NULL;
+  } else {
+    os_timer_disarm(&upload.timer);
+    os_timer_setfn(&upload.timer, upload_timeout, NULL);
+    os_timer_arm(&upload.timer, UPLOAD_TIMEOUT, 0);
+  }
+  return UPLOAD_BLOCK;
+}
+
+/* Returns true once a complete line has been collected */
+static bool input_char (lua_Load *load, char ch) {
+  if(run_input)
   {
-    if(run_input)
+    char tmp_last_nl_char = last_nl_char;
+    // reset marker, will be finally set below when newline is processed
+    last_nl_char = '\0';
+
+    /* handle CR & LF characters
+       filters second char of LF&CR (\n\r) or CR&LF (\r\n) sequences */
+    if ((ch == '\r' && tmp_last_nl_char == '\n') || // \n\r sequence -> skip \r
+        (ch == '\n' && tmp_last_nl_char == '\r'))   // \r\n sequence -> skip \n
     {
-      char tmp_last_nl_char = last_nl_char;
-      // reset marker, will be finally set below when newline is processed
-      last_nl_char = '\0';
-
-      /* handle CR & LF characters
-         filters second char of LF&CR (\n\r) or CR&LF (\r\n) sequences */
-      if ((ch == '\r' && tmp_last_nl_char == '\n') || // \n\r sequence -> skip \r
-          (ch == '\n' && tmp_last_nl_char == '\r'))   // \r\n sequence -> skip \n
-      {
-        continue;
-      }
+      return false;
+    }
 
-      /* backspace key */
-      else if (ch == 0x7f || ch == 0x08)
+    /* backspace key */
+    else if (ch == 0x7f || ch == 0x08)
+    {
+      if (load->line_position > 0)
       {
-        if (load->line_position > 0)
-        {
-          if(uart0_echo) uart_putc(0x08);
-          if(uart0_echo) uart_putc(' ');
-          if(uart0_echo) uart_putc(0x08);
-          load->line_position--;
-        }
-        load->line[load->line_position] = 0;
-        continue;
+        if(uart0_echo) uart_putc(0x08);
+        if(uart0_echo) uart_putc(' ');
+        if(uart0_echo) uart_putc(0x08);
+        load->line_position--;
       }
-      /* EOT(ctrl+d) */
-      // else if (ch == 0x04)
-      // {
-      //   if (load->line_position == 0)
-      //     // No input which makes lua interpreter close 
-      //     donejob(load);
-      //   else
-      //     continue;
-      // }
-
-      /* end of line */
-      if (ch == '\r' || ch == '\n')
+      load->line[load->line_position] = 0;
+      return false;
+    }
+
+    /* end of line */
+    if (ch == '\r' || ch == '\n')
+    {
+      last_nl_char = ch;
+
+      load->line[load->line_position] = 0;
+      if(uart0_echo) uart_putc('\n');
+      uart_on_data_cb(load->line, load->line_position);
+      if (load->line_position == 0)
       {
-        last_nl_char = ch;
-
-        load->line[load->line_position] = 0;
-        if(uart0_echo) uart_putc('\n');
-        uart_on_data_cb(load->line, load->line_position);
-        if (load->line_position == 0)
-        {
-          /* Get a empty line, then go to get a new line */
-          c_puts(load->prmt);
-          continue;
-        } else {
-          load->done = 1;
-          need_dojob = true;
-          break;
-        }
+        /* Get a empty line, then go to get a new line */
+        c_puts(load->prmt);
+        return false;
+      } else {
+        load->done = 1;
+        return true;
       }
+    }
 
-      /* other control character or not an acsii character */
-      // if (ch < 0x20 || ch >= 0x80)
-      // {
-      //   continue;
-      // }
-      
-      /* echo */
-      if(uart0_echo) uart_putc(ch);
-
-          /* it's a large line, discard it */
-      if ( load->line_position + 1 >= load->len ){
-        load->line_position = 0;
-      }
+    /* echo */
+    if(uart0_echo) uart_putc(ch);
+
+        /* it's a large line, discard it */
+    if ( load->line_position + 1 >= load->len ){
+      load->line_position = 0;
     }
+  }
 
-    load->line[load->line_position] = ch;
-    load->line_position++;
+  load->line[load->line_position] = ch;
+  load->line_position++;
 
-    if(!run_input)
+  if(!run_input)
+  {
+    if( ((need_len!=0) && (load->line_position >= need_len)) || \
+      (load->line_position >= load->len) || \
+      ((end_char>=0) && ((unsigned char)ch==(unsigned char)end_char)) )
     {
-      if( ((need_len!=0) && (load->line_position >= need_len)) || \
-        (load->line_position >= load->len) || \
-        ((end_char>=0) && ((unsigned char)ch==(unsigned char)end_char)) )
-      {
-        uart_on_data_cb(load->line, load->line_position);
-        load->line_position = 0;
-      }
+      uart_on_data_cb(load->line, load->line_position);
+      load->line_position = 0;
     }
+  }
+  return false;
+}
+
+/*
+** Takes the received input from the UART buffer a block at a time, rather
+** than locking out interrupts for every character.
+*/
+static bool readline(lua_Load *load){
+  // NODE_DBG("readline() is called.\n");
+  bool need_dojob = false;
+  const char *buf;
+  size_t len, i;
 
-    ch = 0;
+  while (!need_dojob && (len = uart_rx_peek(&buf)) > 0)
+  {
+    if (upload.fd) {
+      uart_rx_consume(upload_input(buf, len));
+      continue;
+    }
+    for (i = 0; i < len && !need_dojob; i++)
+      need_dojob = input_char(load, buf[i]);
+    uart_rx_consume(i);
   }
   
   if( (load->line_position > 0) && (!run_input) && (need_len==0) && (end_char<0) )
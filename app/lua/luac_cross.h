@@ -34,8 +34,9 @@
 #define c_malloc malloc
 #define c_memcmp memcmp
 #define c_memcpy memcpy
+#define c_memset memset
 #define c_printf printf
-#define c_puts puts
+#define c_puts(s) fputs((s), stdout)  /* no newline, as on the ESP */
 #define c_reader reader
 #define c_realloc realloc
 #define c_sprintf sprintf
@@ -67,8 +67,8 @@ typedef unsigned int uint;
  * and int may not have the same size. Hence addresses with the must be declared as
  * the FlashAddr type rather than typed C pointers and must be accessed through macros.
  *
- * Also note that image built with a given LUA_PACK_TVALUES / LUA_NUNBER_INTEGRAL
- * combination must be loaded into a corresponding firmware build.  Hence these
+ * Also note that image built with a given LUA_PACK_TVALUES / LUA_NANBOX_TVALUES /
+ * LUA_NUNBER_INTEGRAL combination must be loaded into a corresponding firmware build.  Hence these
  * configuration options are also included in the FLash Signature.
  *
  * The Flash image is assembled up by first building the RO stringtable containing
@@ -97,6 +97,8 @@ typedef struct flashts {       /* This is the fixed 32-bit equivalent of TString
 #endif
 
 static uint curOffset = 0;
+static int shareTable;         /* stack index of the shared vector table */
+static uint sharedWords = 0;   /* image words saved by sharing */
 
 /*
  * The flashAddrTag is a bit array, one bit per flashImage word denoting
@@ -276,7 +278,9 @@ static void *resolveTString(lua_State* L, TString *s) {
  *   src     Source of record
  *   returns Address of destination record
  */
-#if defined(LUA_PACK_TVALUES)
+#if defined(LUA_NANBOX_TVALUES)
+#define TARGET_TV_SIZE (sizeof(lua_Number))
+#elif defined(LUA_PACK_TVALUES)
 #define TARGET_TV_SIZE (sizeof(lua_Number)+sizeof(lu_int32))
 #else
 #define TARGET_TV_SIZE (2*sizeof(lua_Number))
@@ -335,13 +339,22 @@ static void *flashCopy(lua_State* L, int n, const char *fmt, void *src) {
           if (ttisstring(sv)) {
             toFlashAddr(L, *d, resolveTString(L, rawtsvalue(sv)));
           } else if (ttisnumber(sv)) {
-            *cast(lua_Number*,d) = *cast(lua_Number*,s);
+            lua_Number n = nvalue(sv);  /* d is only word aligned */
+            memcpy(d, &n, sizeof(n));
+          } else if (ttisboolean(sv)) {
+            *d = bvalue(sv);
           } else if (!ttisnil(sv)){
             /* all other types are 4 byte */
             lua_assert(!iscollectable(sv));
-            *cast(uint *,d) = *cast(uint *,s);
+            *d = cast(uint, cast(size_t, tvp(sv)));
           }
+#ifdef LUA_NANBOX_TVALUES
+          /* the type tag is in the high word of a non-number */
+          if (!ttisnumber(sv))
+            d[1] = cast(uint, NB_BOX(ttype(sv)) >> 32);
+#else
           *cast(int *,cast(lua_Number*,d)+1) = ttype(sv);
+#endif
           s += FLASH_WORDS(TValue);
           d += TARGET_TV_SIZE/WORDSIZE;
          break;
@@ -353,6 +366,46 @@ static void *flashCopy(lua_State* L, int n, const char *fmt, void *src) {
   return dest;
 }
 
+/*
+ * Identical vectors (constants, code, upvalue and local names, ...) are stored
+ * once and shared by all the Protos using them.  The key for a vector is its
+ * image words followed by their address tags, so a match is exact down to the
+ * objects referenced.  As the vector just copied is the last allocation, a
+ * duplicate is simply rolled back.  Packed line info needs no handling here
+ * as it is already held as an RO string.
+ */
+static void *flashCopyShared(lua_State* L, int n, const char *fmt, void *src) {
+  uint start = curOffset, i, len;
+  void *p = flashCopy(L, n, fmt, src);
+  if (p == NULL)
+    return NULL;
+  len = curOffset - start;
+  size_t keylen = len * (WORDSIZE + 1);
+  char *key = luaM_newvector(L, keylen, char);
+  memcpy(key, flashImage + start, len * WORDSIZE);
+  for (i = 0; i < len; i++)
+    key[len * WORDSIZE + i] = getFlashAddrTag(start + i) ? 'A' : '-';
+  lua_pushlstring(L, key, keylen);
+  luaM_freearray(L, key, keylen, char);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, shareTable);
+  if (lua_isnil(L, -1)) {                  /* first copy: remember it */
+    lua_pop(L, 1);
+    lua_pushinteger(L, start);
+    lua_rawset(L, shareTable);
+    return p;
+  }
+  p = fromFashAddr(lua_tointeger(L, -1));  /* a duplicate: roll it back */
+  lua_pop(L, 2);
+  for (i = start; i < curOffset; i++)
+    flashAddrTag[_TW(i)] &= ~_TB(i);
+  memset(flashImage + start, 0, len * WORDSIZE);
+  curOffset = start;
+  sharedWords += len;
+  DBG_PRINT("Shared %u words at %u\n", len, cast(uint, cast(uint *, p) - flashImage));
+  return p;
+}
+
 /* The debug optimised version has a different Proto layout */
 #ifdef LUA_OPTIMIZE_DEBUG
 #define PROTO_COPY_MASK  "AHAAAAAASIIIIIIIAI"
@@ -361,9 +414,10 @@ static void *flashCopy(lua_State* L, int n, const char *fmt, void *src) {
 #endif
 
 /*
- * Do the actual prototype copy.
+ * Do the actual prototype copy.  If sub is not NULL then the image addresses
+ * of the included Protos are also returned in it.
  */
-static void *functionToFlash(lua_State* L, const Proto* orig) {
+static void *functionToFlash(lua_State* L, const Proto* orig, void **sub) {
   Proto f;
   int i;
 
@@ -375,12 +429,14 @@ static void *functionToFlash(lua_State* L, const Proto* orig) {
   if (f.sizep) {                /* clone included Protos */
     Proto **p = luaM_newvector(L, f.sizep, Proto *);
     for (i=0; i<f.sizep; i++)
-      p[i] = cast(Proto *, functionToFlash(L, f.p[i]));
-    f.p = cast(Proto **, flashCopy(L, f.sizep, "A", p));
+      p[i] = cast(Proto *, functionToFlash(L, f.p[i], NULL));
+    if (sub)
+      memcpy(sub, p, f.sizep * sizeof(Proto *));
+    f.p = cast(Proto **, flashCopyShared(L, f.sizep, "A", p));
     luaM_freearray(L, p, f.sizep, Proto *);
   }
-  f.k = cast(TValue *, flashCopy(L, f.sizek, "V", f.k));
-  f.code = cast(Instruction *, flashCopy(L, f.sizecode, "I", f.code));
+  f.k = cast(TValue *, flashCopyShared(L, f.sizek, "V", f.k));
+  f.code = cast(Instruction *, flashCopyShared(L, f.sizecode, "I", f.code));
 
 #ifdef LUA_OPTIMIZE_DEBUG
   if (f.packedlineinfo) {
@@ -388,23 +444,65 @@ static void *functionToFlash(lua_State* L, const Proto* orig) {
     f.packedlineinfo = cast(unsigned char *, resolveTString(L, ts)) + sizeof (FlashTS);
   }
 #else
-  f.lineinfo = cast(int *, flashCopy(L, f.sizelineinfo, "I", f.lineinfo));
+  f.lineinfo = cast(int *, flashCopyShared(L, f.sizelineinfo, "I", f.lineinfo));
 #endif
-  f.locvars = cast(struct LocVar *, flashCopy(L, f.sizelocvars, "SII", f.locvars));
-  f.upvalues = cast(TString **, flashCopy(L, f.sizeupvalues, "S", f.upvalues));
+  f.locvars = cast(struct LocVar *, flashCopyShared(L, f.sizelocvars, "SII", f.locvars));
+  f.upvalues = cast(TString **, flashCopyShared(L, f.sizeupvalues, "S", f.upvalues));
   return cast(void *, flashCopy(L, 1, PROTO_COPY_MASK, &f));
 }
 
+/*
+ * Build the module index used by the require() LFS searcher.  The lookup
+ * main generated by luac has the module root names as its first sizep
+ * constants, with sub[i] being the image address of the matching module.
+ * Duplicate names are skipped so that, as with the lookup main, the first
+ * file of a given name wins.
+ */
+static void createModIndex(lua_State *L, FlashHeader *fh,
+                           const Proto *main, void **sub) {
+  int i, n = main->sizep;
+  uint size;
+  FlashModule *idx;
+
+  if (n == 0)
+    return;
+  for (i = 0; i < n; i++)
+    if (i >= main->sizek || !ttisstring(main->k + i))
+      return;                                /* not a lookup main */
+  size = 4<<luaO_log2(n);                    /* under half full */
+  idx = cast(FlashModule *, flashAlloc(L, size * sizeof(FlashModule)));
+  for (i = 0; i < n; i++) {
+    TString *ts = rawtsvalue(main->k + i);
+    void *fts = resolveTString(L, ts);
+    uint j = lmod(ts->tsv.hash, size);
+    while (idx[j].name && fromFashAddr(idx[j].name) != fts)
+      j = (j + 1) & (size - 1);
+    if (idx[j].name)
+      continue;                              /* duplicate name */
+    toFlashAddr(L, idx[j].name, fts);
+    toFlashAddr(L, idx[j].mainProto, sub[i]);
+  }
+  toFlashAddr(L, fh->pModIndex, idx);
+  fh->nModIndex = size;
+}
+
 uint dumpToFlashImage (lua_State* L, const Proto *main, lua_Writer w, 
                        void* data, int strip, 
                        lu_int32 address, lu_int32 maxSize) {
 // parameter strip is ignored for now
   FlashHeader *fh = cast(FlashHeader *, flashAlloc(L, sizeof(FlashHeader)));
   int i, status;
+  void **sub = luaM_newvector(L, main->sizep, void *);
+  lua_newtable(L);
+  shareTable = lua_gettop(L);
   lua_newtable(L);
   scanProtoStrings(L, main);
   createROstrt(L,  fh);
-  toFlashAddr(L, fh->mainProto, functionToFlash(L, main));
+  toFlashAddr(L, fh->mainProto, functionToFlash(L, main, sub));
+  createModIndex(L, fh, main, sub);
+  luaM_freearray(L, sub, main->sizep, void *);
+  lua_pop(L, 2);                         /* string map and shared vectors */
+  DBG_PRINT("%u words shared\n", sharedWords);
   
   fh->flash_sig = FLASH_SIG + (address ? FLASH_SIG_ABSOLUTE : 0);
   fh->flash_size = curOffset*WORDSIZE;
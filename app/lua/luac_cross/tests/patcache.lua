@@ -0,0 +1,243 @@
+--
+-- Regression test for the compiled pattern cache in lstrlib.c.  Run it from
+-- the top of the tree with
+--
+--   ./luac.cross -e app/lua/luac_cross/tests/patcache.lua
+--
+-- Each call is compared with the same call on an uncached copy of the
+-- pattern: ("[^%z\1-\255]*"):rep(6) appended (before any closing `$')
+-- only ever matches the empty string, so it leaves the results alone, but
+-- takes the pattern past PATC_MAXLEN (48), which the cache does not take.
+-- The cases cover cache misses, hits, eviction past LUA_PATCACHE (4)
+-- entries, patterns longer than PATC_MAXLEN, more than PATC_MAXSETS (3)
+-- bracket sets and the literal prefix search of find, match, gmatch and
+-- gsub.  Any failure ends in an error, so luac.cross exits non-zero.
+--
+
+local MAXLEN = 48
+
+local failed = 0
+local function check(ok, what)
+  if not ok then
+    failed = failed + 1
+    print("FAIL: " .. what)
+  end
+end
+
+-- without patterns of its own, which would go through the cache
+local function uncached(p)
+  local pad = ("[^%z\1-\255]*"):rep(6)   -- sets that match no character
+  local i = #p
+  if p:byte(i) == 36 then                 -- `$', an anchor after even `%'s
+    repeat i = i - 1 until p:byte(i) ~= 37
+    if (#p - 1 - i) % 2 == 0 then return p:sub(1, -2) .. pad .. "$" end
+  end
+  return p .. pad
+end
+
+local function pack(...) return {n = select("#", ...), ...} end
+
+local function show(r)
+  local t = {}
+  for i = 1, r.n do
+    t[i] = type(r[i]) == "string" and ("%q"):format(r[i]) or tostring(r[i])
+  end
+  return "(" .. table.concat(t, ", ") .. ")"
+end
+
+local function same(a, b)
+  if a.n ~= b.n then return false end
+  for i = 1, a.n do
+    if a[i] ~= b[i] then return false end
+  end
+  return true
+end
+
+-- every way of running p over s, as one flat list of results
+local function run(s, p, init, repl)
+  local r = {n = 0}
+  local function add(t)
+    for i = 1, t.n do r.n = r.n + 1; r[r.n] = t[i] end
+    r.n = r.n + 1; r[r.n] = "|"
+  end
+  add(pack(pcall(string.find, s, p, init)))
+  add(pack(pcall(string.match, s, p, init)))
+  local ok, err = pcall(function()
+    for a, b, c in string.gmatch(s, p) do add(pack(a, b, c)) end
+  end)
+  add(pack(ok, err))
+  add(pack(pcall(string.gsub, s, p, repl or "<%0>")))
+  add(pack(pcall(string.gsub, s, p, "#", 2)))
+  add(pack(pcall(string.gsub, s, p, {a = "A", ab = false})))
+  add(pack(pcall(string.gsub, s, p, function(x, y) return y and x .. y end)))
+  return r
+end
+
+local function compare(s, p, init, what)
+  local r = run(s, p, init)
+  local u = uncached(p)
+  check(#u > MAXLEN, "uncached copy of " .. p)
+  local e = run(s, u, init)
+  -- error messages name the pattern only through its text, which is the same
+  check(same(r, e), ("%s: %q on %q: %s, uncached %s"):format(what or "", p, s,
+        show(r), show(e)))
+  return r
+end
+
+local cases = {
+  -- literal prefixes
+  {"key=value; key2=v2; key3=", "key(%d*)=(%w*)"},
+  {"GET /index.html HTTP/1.1\r\n", "GET (%S+) HTTP/(%d)%.(%d)"},
+  {"aaaab aab ab b", "aab"},
+  {"aaaab aab ab b", "aab+"},
+  {"aaaab aab ab b", "aa?b"},
+  {"abbbc ac abc", "ab*c"},
+  {"abbbc ac abc", "ab-c"},
+  {"a]b a]]b", "a]+b"},
+  {"cost a$b a$", "a$b"},
+  {"x.y.z", "x.y"},
+  {"line one\nline two\n", "line (%a+)\n"},
+  {"no match here", "zz(%d)"},
+  {"prefix at the end: ab", "ab."},
+  {"aXbaYb", "a(.)b"},
+  -- anchors, empty and position captures
+  {"GET / HTTP", "^GET"},
+  {"xGET / HTTP", "^GET"},
+  {"abc", "^"},
+  {"abc", "$"},
+  {"abcabc", "abc$"},
+  {"a$", "a%$"},
+  {"xxyxx", "x*"},
+  {"abcab", "()ab()"},
+  {"", "x*"},
+  {"abc", ""},
+  -- classes, sets, balances, frontiers and back references
+  {"f(a(b)c)d", "%b()"},
+  {"THE (quick) fox", "%f[%a]%a+"},
+  {"aa bb cd ee", "(%w)%1"},
+  {"_id9 x2 9z", "[%a_][%w_]*"},
+  {"a,b,,c", "[^,]+"},
+  {"DEADbeef 0x1F zz", "[a-fA-F0-9]+"},
+  {"a]b]]c", "[]]+"},
+  {"a]b]]c", "[^]]+"},
+  {"1-2.3", "[%-%.]"},
+  {"a-z", "[a%-z]+"},
+  {"\0ab\0ab", "%zab"},
+  {"\0ab\0ab", "[%z]a"},
+  {"caf\195\169 \128\255", "[\128-\255]+"},
+  -- more than PATC_MAXSETS sets, so some are interpreted
+  {"adgjm bdhkn cfilo", "[a-c][d-f][g-i][j-l][m-o]"},
+  {"adgjm bdhkn cfilo", "([a-c])[d-f]([g-i])[j-l][^m]"},
+  {"x1y2z3", "[xyz][0-9][xyz][0-9][xyz][0-9]"},
+  -- lengths around PATC_MAXLEN
+  {("ab"):rep(30), ("ab"):rep(24)},
+  {("ab"):rep(30), ("ab"):rep(23) .. "a."},
+  {("ab"):rep(30), ("ab"):rep(24) .. "a"},
+  {("ab"):rep(30), ("a"):rep(MAXLEN - 1) .. "b"},
+}
+
+-- misses, then hits
+for _, c in ipairs(cases) do
+  local first = compare(c[1], c[2], nil, "first use")
+  check(same(first, run(c[1], c[2])), "second use of " .. c[2])
+  check(same(first, run(c[1], c[2])), "third use of " .. c[2])
+end
+
+-- eviction: cycling through more patterns than the cache holds, so every
+-- use is a miss, and then again with a collection in between
+for round = 1, 3 do
+  for _, c in ipairs(cases) do compare(c[1], c[2], nil, "round " .. round) end
+  collectgarbage()
+end
+
+-- patterns of the same length that differ, used alternately
+for i = 1, 10 do
+  compare("abc bbc cbc", "a.c")
+  compare("abc bbc cbc", "b.c")
+  compare("abc bbc cbc", "[ab]c")
+  compare("abc bbc cbc", "[bc]c")
+end
+
+-- init, negative init and init past the end, with a literal prefix
+for _, init in ipairs({1, 2, 5, 12, 40, -3, -40}) do
+  compare("key=1 key=22 key=333", "key=(%d+)", init, "init " .. init)
+end
+
+-- gsub with a replacement that runs enough other patterns to reuse the
+-- cache entry of its own; they have other sets at the same offsets
+local others = {"a[a-z]+", "b[^0-9]", "c[%s]", "d[xyz]", "e[%p]", "(t)(u)"}
+local function repl(x)
+  for _, p in ipairs(others) do string.find(x .. "xq1rstu", p) end
+  return "<" .. x .. ">"
+end
+local s = "a12 ca1 a99 x a7 ab"
+local a, an = string.gsub(s, "a[0-9]+", repl)
+local b, bn = string.gsub(s, uncached("a[0-9]+"), repl)
+check(a == b and an == bn, "gsub replacement evicting its pattern: " .. a .. ", " .. b)
+check(a == "<a12> c<a1> <a99> x <a7> ab" and an == 4, "gsub replacement result " .. a)
+
+-- the same for a gmatch loop, between iterations
+local got, want = {}, {}
+for k, v in string.gmatch("k1=ab k2=cd k3=ef", "k[0-9]=([a-z]+)()") do
+  for _, p in ipairs(others) do string.match(v, p) end
+  got[#got + 1] = k .. v
+end
+for k, v in string.gmatch("k1=ab k2=cd k3=ef", uncached("k[0-9]=([a-z]+)()")) do
+  want[#want + 1] = k .. v
+end
+check(table.concat(got, ",") == table.concat(want, ",") and #got == 3,
+      "gmatch evicting its pattern: " .. table.concat(got, ","))
+
+-- malformed patterns raise the same error every time and are not kept
+local bad = {
+  {"[a", "missing"}, {"%", "ends with"}, {"(%w", "unfinished capture"},
+  {"%w)", "invalid pattern capture"}, {"(a)%2", "invalid capture index"},
+  {"%b", "unbalanced pattern"}, {"%ba", "unbalanced pattern"},
+  {"%f", "missing"}, {"[a-", "missing"},
+}
+for _, e in ipairs(bad) do
+  for i = 1, 3 do
+    local ok, err = pcall(string.find, "abc(a)", e[1])
+    check(not ok and err:find(e[2], 1, true) ~= nil,
+          ("%q use %d: %s"):format(e[1], i, tostring(err)))
+  end
+  check(string.find("abc", "b.") == 2, "cache usable after " .. e[1])
+end
+
+-- random patterns over random subjects
+math.randomseed(97)
+local atoms = {"a", "b", "c", "ab", "ba", ".", "%a", "%d", "%s", "%w",
+               "[ab]", "[^a]", "[a-c]", "[%d ]", "%b()", "%f[%a]"}
+local quants = {"", "", "", "*", "+", "-", "?"}
+local letters = "aabbc 1(2)"
+local function subject()
+  local t = {}
+  for i = 1, math.random(0, 24) do
+    local k = math.random(#letters)
+    t[i] = letters:sub(k, k)
+  end
+  return table.concat(t)
+end
+local function pattern()
+  local t, open = {}, 0
+  if math.random(6) == 1 then t[1] = "^" end
+  for i = 1, math.random(1, 6) do
+    if math.random(6) == 1 then t[#t + 1] = "("; open = open + 1 end
+    local a = atoms[math.random(#atoms)]
+    t[#t + 1] = a
+    if #a == 1 or a:sub(1, 1) == "[" or (#a == 2 and a:sub(1, 1) == "%") then
+      t[#t + 1] = quants[math.random(#quants)]
+    end
+    if open > 0 and math.random(3) == 1 then t[#t + 1] = ")"; open = open - 1 end
+  end
+  t[#t + 1] = (")"):rep(open)
+  if math.random(6) == 1 then t[#t + 1] = "$" end
+  return table.concat(t)
+end
+for i = 1, 3000 do
+  local p = pattern()
+  if #p <= MAXLEN then compare(subject(), p, nil, "random " .. i) end
+end
+
+if failed > 0 then error(failed .. " checks failed", 0) end
+print("patcache: all checks passed")
@@ -0,0 +1,231 @@
+--
+-- Regression test for the TValue representations of floating point builds
+-- (LUA_NANBOX_TVALUES, LUA_DWORD_ALIGNED_TVALUES or neither) on the host
+-- VM.  Run it from the top of the tree with luac.cross built for the
+-- setting under test:
+--
+--   make -C app/lua/luac_cross EXTRA_CCFLAGS=-DLUA_NANBOX_TVALUES
+--   ./luac.cross -e app/lua/luac_cross/tests/tvalue.lua
+--
+-- It checks that every kind of value survives being stored in and read
+-- back from the places a TValue lives, and that an LFS image written by
+-- this luac.cross carries the signature the firmware's loader expects for
+-- the same setting.  LUAC_CROSS overrides the luac.cross used for the
+-- image.  Any failure ends in an error, so luac.cross exits non-zero.
+--
+
+local failed = 0
+local function check(ok, what)
+  if not ok then
+    failed = failed + 1
+    print("FAIL: " .. what)
+  end
+end
+
+-- the same value, with NaN equal to NaN and 0 not equal to -0
+local function same(a, b)
+  if type(a) ~= type(b) then return false end
+  if type(a) == "number" then
+    if a ~= a then return b ~= b end
+    if a == 0 and b == 0 then return 1/a == 1/b end
+  end
+  return rawequal(a, b)
+end
+
+local function nan(x) return type(x) == "number" and x ~= x end
+
+-- a light userdata: the string library's pattern cache key in the registry
+string.find("light", "l.")
+local lud
+for k, v in pairs(debug.getregistry()) do
+  if type(k) == "userdata" then lud = k end
+end
+check(lud ~= nil, "light userdata key in the registry")
+
+local co = coroutine.create(function() end)
+local values = {
+  {"nil", nil}, {"true", true}, {"false", false},
+  {"0", 0}, {"-0", -0.0}, {"1", 1}, {"-1", -1},
+  {"2^53", 2^53}, {"-2^53", -2^53}, {"max", 1.7976931348623157e308},
+  {"min normal", 2.2250738585072014e-308}, {"denormal", 4.9406564584124654e-324},
+  {"pi", math.pi}, {"inf", math.huge}, {"-inf", -math.huge},
+  {"0/0", 0/0}, {"-(0/0)", -(0/0)}, {"inf-inf", math.huge - math.huge},
+  {"0*inf", 0 * math.huge}, {"sqrt(-1)", math.sqrt(-1)},
+  {"pow(-8,1/3)", math.pow(-8, 1/3)}, {"-1%0", -1 % 0},
+  {"string", "str"}, {"empty string", ""}, {"table", {}},
+  {"function", print}, {"closure", function() return 1 end},
+  {"coroutine", co}, {"file", io.stdout},
+  {"romtable", string}, {"lightfunction", string.len},
+  {"lightuserdata", lud},
+}
+
+for _, e in ipairs(values) do
+  local name, v = e[1], e[2]
+
+  local t = {v}                             -- array part
+  check(same(t[1], v), name .. " in an array slot")
+  t = {}
+  t.k = v                                   -- hash part
+  check(same(t.k, v), name .. " in a hash slot")
+  t = {n = 1, v, [100] = v}
+  check(same(t[1], v) and same(t[100], v), name .. " in a constructor")
+
+  if v ~= nil and not nan(v) then           -- as a key
+    t = {}
+    t[v] = name
+    check(t[v] == name, name .. " as a table key")
+    local seen
+    for k, w in pairs(t) do seen = k end
+    check(same(seen, v), name .. " as a key returned by next")
+  end
+
+  local up = v                              -- upvalues
+  local get = function() return up end
+  local set = function(x) up = x end
+  check(same(get(), v), name .. " in an upvalue")
+  set(v); set(get())
+  check(same(get(), v), name .. " written through an upvalue")
+
+  local function id(...) return ... end     -- stack and varargs
+  check(same(id(v), v), name .. " returned from a call")
+  check(select("#", id(v, v)) == 2 and same(select(2, id(v, v)), v),
+        name .. " in varargs")
+  check(same(unpack({1, v}, 2), v), name .. " through unpack")
+
+  local c = coroutine.wrap(function(x)      -- across coroutines
+    local y = coroutine.yield(x)
+    return y
+  end)
+  check(same(c(v), v), name .. " yielded by a coroutine")
+  check(same(c(v), v), name .. " resumed into a coroutine")
+
+  t = {1, 2, 3}                             -- moved by the table library
+  table.insert(t, 2, v)
+  check(same(t[2], v), name .. " after table.insert")
+  check(same(table.remove(t, 2), v), name .. " from table.remove")
+end
+
+-- NaNs stay numbers, whatever their sign and payload, and stay NaN
+for _, e in ipairs(values) do
+  local name, v = e[1], e[2]
+  if nan(v) then
+    local t = {v, v + 1, -v, v * 0}
+    for i = 1, #t do
+      check(nan(t[i]), name .. " arithmetic gives NaN")
+    end
+    check(not (v < 0) and not (v > 0) and not (v == v), name .. " compares false")
+    check(tostring(v):find("nan") ~= nil, name .. " prints as nan")
+    check(not pcall(function() local t = {} t[v] = 1 end),
+          name .. " is rejected as a table index")
+    check(({})[v] == nil, name .. " reads as an absent key")
+  end
+end
+
+-- ordering and arithmetic across the range
+local sorted = {-math.huge, -2^53, -1, -4.9406564584124654e-324, 0, 1, 2^53,
+                1.7976931348623157e308, math.huge}
+local shuffled = {}
+for i = #sorted, 1, -1 do shuffled[#shuffled + 1] = sorted[i] end
+table.sort(shuffled)
+for i = 1, #sorted do check(shuffled[i] == sorted[i], "sort order " .. i) end
+check(2^53 + 1 == 2^53 and 2^52 + 1 ~= 2^52, "53 bit mantissa")
+check(1.7976931348623157e308 * 2 == math.huge, "overflow to inf")
+check(-math.huge < -1.7976931348623157e308, "-inf below -max")
+
+-- values held only by tables survive collection; weak entries go
+local keep, weak = {}, setmetatable({}, {__mode = "k"})
+for i = 1, 1000 do
+  local v = ({ i, -i / 3, "s" .. i, {i}, function() return i end, true })[i % 6 + 1]
+  keep[i] = v
+  weak[{}] = v
+end
+collectgarbage()
+collectgarbage()
+local ok = true
+for i = 1, 1000 do
+  local v = keep[i]
+  local k = i % 6 + 1
+  if k == 1 then ok = ok and v == i
+  elseif k == 2 then ok = ok and v == -i / 3
+  elseif k == 3 then ok = ok and v == "s" .. i
+  elseif k == 4 then ok = ok and v[1] == i
+  elseif k == 5 then ok = ok and v() == i
+  else ok = ok and v == true end
+end
+check(ok, "1000 values after a full collection")
+check(next(weak) == nil, "weak keys collected")
+
+-- which representation this VM uses, from the size of an array slot
+collectgarbage("stop")
+local before = collectgarbage("count")
+local t = {}
+for i = 1, 1024 do t[i] = true end
+local tvsize = math.floor(collectgarbage("count") - before)  -- K per 1024
+collectgarbage("restart")
+local integral = (7 / 2 == 3)
+local nanbox = not integral and tvsize == 8
+print(("TValue %d bytes, %s numbers%s"):format(tvsize,
+      integral and "integer" or "floating point", nanbox and ", NaN-boxed" or ""))
+
+-- the LFS image header, checked as lflash.c checks it on load.  Position
+-- independent images are gzipped; absolute (-a) ones are written as is.
+local self = ...
+local luac = os.getenv("LUAC_CROSS") or
+             (self:match("^(.*)/") or ".") .. "/../../../../luac.cross"
+local src, img, raw = os.tmpname(), os.tmpname(), os.tmpname()
+local f = assert(io.open(src, "w"))
+f:write("local k = {1234.5678, true, 's'} return function() return k end\n")
+f:close()
+
+local function image(opts, gzipped)
+  local cmd = luac .. " " .. opts .. " -o " .. img .. " " .. src
+  if gzipped then cmd = cmd .. " && gzip -dc < " .. img .. " > " .. raw end
+  check(os.execute(cmd) == 0, cmd)
+  local f = assert(io.open(gzipped and raw or img, "rb"))
+  local data = f:read("*a")
+  f:close()
+  local function word(i)
+    local a, b, c, d = data:byte(i, i + 3)
+    return ((d * 256 + c) * 256 + b) * 256 + a
+  end
+  return data, word(1), word(5)
+end
+
+local function bits(w, mask)  -- w AND mask
+  local r, b = 0, 1
+  while b <= mask do
+    if mask % (2 * b) >= b and w % (2 * b) >= b then r = r + b end
+    b = b * 2
+  end
+  return r
+end
+
+local FLASH_SIG = 0xfafaa050 + 0x100   -- with FLASH_FORMAT_VERSION
+local SIG_B1 = integral and 0x02 or 0
+local NANBOX, PACKED, ABSOLUTE = 0x20, 0x04, 0x01
+local double = string.char(173, 250, 92, 109, 69, 74, 147, 64)  -- 1234.5678
+
+for _, form in ipairs({{"-f", true, 0}, {"-a 0x40280000", false, ABSOLUTE}}) do
+  local opts, absolute = form[1], form[3]
+  local data, sig, size = image(opts, form[2])
+  check(bits(sig, ABSOLUTE) == absolute, opts .. ": absolute bit")
+  check(bits(sig, 0xF00) == 0x100, opts .. ": format version")
+  check(bits(sig, NANBOX) == (nanbox and NANBOX or 0), opts .. ": NaN-box bit")
+  if nanbox then
+    check(bits(sig, PACKED) == 0, opts .. ": packed bit")
+  end
+  -- the packed bit cannot be told from here; take it from the image
+  local expect = FLASH_SIG + bits(sig, NANBOX + PACKED) + SIG_B1
+  check(sig - absolute == expect,
+        ("%s: signature %08x, expected %08x"):format(opts, sig, expect))
+  check(size > 0 and size % 4 == 0 and #data >= size, opts .. ": image size")
+  check(data:sub(1, size):find(double, 1, true) ~= nil,
+        opts .. ": number constant stored as a double")
+end
+
+os.remove(src)
+os.remove(img)
+os.remove(raw)
+
+if failed > 0 then error(failed .. " checks failed", 0) end
+print("tvalue: all checks passed")
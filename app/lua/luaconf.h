@@ -295,9 +295,11 @@ else
 /*
 @@ LUA_MAXINPUT is the maximum length for an input line in the
 @* stand-alone interpreter.
-** CHANGE it if you need longer lines.
+** CHANGE it if you need longer lines, or set it in user_config.h.
 */
+#ifndef LUA_MAXINPUT
 #define LUA_MAXINPUT	256
+#endif
                
 
 /*
@@ -773,6 +775,15 @@ union luai_Cast { double l_d; long l_l; };
 #define LUA_MAXCAPTURES		10
 
 
+/*
+@@ LUA_PATCACHE is the number of compiled patterns kept by the string
+@* library.
+** CHANGE it to trade RAM (about 160 bytes each) for matching speed when
+** a program cycles through more patterns than this.
+*/
+#define LUA_PATCACHE		4
+
+
 /*
 @@ lua_tmpnam is the function that the OS library uses to create a
 @* temporary name.
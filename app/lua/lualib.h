@@ -43,6 +43,15 @@ LUALIB_API int (luaopen_package) (lua_State *L);
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
 
+#ifndef LUA_CROSS_COMPILER
+LUALIB_API int (luaL_libinfo) (lua_State *L);
+#ifdef LUA_LAZY_MODULE_INIT
+/* number of modules waiting to be opened on first use */
+extern int luaL_lazypending;
+LUALIB_API void (luaL_lazyopen) (lua_State *L, const void *map);
+#endif
+#endif
+
 
 
 #ifndef lua_assert
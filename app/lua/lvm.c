@@ -26,11 +26,16 @@
 #include "ltm.h"
 #include "lvm.h"
 #include "lrotable.h"
+#include "lualib.h"
 
 
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP	100
 
+#if defined(LUA_LAZY_MODULE_INIT) && !defined(LUA_CROSS_COMPILER)
+extern const luaR_entry lua_rotable_base[];
+#endif
+
 #if defined LUA_NUMBER_INTEGRAL
 LUA_NUMBER luai_ipow(LUA_NUMBER a, LUA_NUMBER b) {
   if (b < 0)
@@ -145,6 +150,13 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       const TValue *res = luaH_get_ro(h, key); /* do a primitive get */
       if (!ttisnil(res) ||  /* result is no nil? */
           (tm = fasttm(L, (Table*)luaR_getmeta(h), TM_INDEX)) == NULL) { /* or no TM? */
+#if defined(LUA_LAZY_MODULE_INIT) && !defined(LUA_CROSS_COMPILER)
+        if (luaL_lazypending && h == lua_rotable_base && ttisrotable(res)) {
+          ptrdiff_t result = savestack(L, val);
+          luaL_lazyopen(L, rvalue(res));  /* first use of a module */
+          val = restorestack(L, result);
+        }
+#endif
         setobj2s(L, val, res);
         return;
       }
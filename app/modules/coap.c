@@ -20,7 +20,7 @@
 #include "coap_io.h"
 #include "coap_server.h"
 
-coap_queue_t *gQueue = NULL;
+coap_heap_t gQueue = {NULL, 0, 0};
 
 typedef struct lcoap_userdata
 {
@@ -44,8 +44,6 @@ static void coap_received(void *arg, char *pdata, unsigned short len)
   }
   // c_memcpy(buf, pdata, len);
 
-  size_t rsplen = coap_server_respond(pdata, len, buf, MAX_MESSAGE_SIZE+1);
-
   // SDK 1.4.0 changed behaviour, for UDP server need to look up remote ip/port
   remot_info *pr = 0;
   if (espconn_get_connection_info (pesp_conn, &pr, 0) != ESPCONN_OK)
@@ -54,7 +52,13 @@ static void coap_received(void *arg, char *pdata, unsigned short len)
   os_memmove (pesp_conn->proto.udp->remote_ip, pr->remote_ip, 4);
   // The remot_info apparently should *not* be os_free()d, fyi
 
-  espconn_sent(pesp_conn, (unsigned char *)buf, rsplen);
+  coap_remote_t remote;
+  c_memcpy(&remote.ip, pr->remote_ip, 4);
+  remote.port = pr->remote_port;
+
+  size_t rsplen = coap_server_respond(pdata, len, buf, MAX_MESSAGE_SIZE+1, &remote);
+  if (rsplen)
+    espconn_sent(pesp_conn, (unsigned char *)buf, rsplen);
 
   // c_memset(buf, 0, sizeof(buf));
 }
@@ -129,6 +133,7 @@ static int coap_delete( lua_State* L, const char* mt )
 
   if(cud->pesp_conn)
   {
+    coap_drop_conn(cud->pesp_conn);   // retransmissions must not outlive the espconn
     if(cud->pesp_conn->proto.udp->remote_port || cud->pesp_conn->proto.udp->local_port)
       espconn_delete(cud->pesp_conn);
     c_free(cud->pesp_conn->proto.udp);
@@ -271,19 +276,20 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
     uint32_t ip = 0, port = 0;
     coap_tid_t id = COAP_INVALID_TID;
 
-    c_memcpy(&ip, pesp_conn->proto.udp->remote_ip, sizeof(ip));
-    port = pesp_conn->proto.udp->remote_port;
+    // the espconn is shared by all outstanding requests, look up who answered
+    remot_info *pr = 0;
+    if (espconn_get_connection_info (pesp_conn, &pr, 0) == ESPCONN_OK) {
+      c_memcpy(&ip, pr->remote_ip, sizeof(ip));
+      port = pr->remote_port;
+    } else {
+      c_memcpy(&ip, pesp_conn->proto.udp->remote_ip, sizeof(ip));
+      port = pesp_conn->proto.udp->remote_port;
+    }
 
     coap_transaction_id(ip, port, &pkt, &id);
 
-    /* transaction done, remove the node from queue */
-    // stop timer
-    coap_timer_stop();
-    // remove the node
-    coap_remove_node(&gQueue, id);
-    // calculate time elapsed
-    coap_timer_update(&gQueue);
-    coap_timer_start(&gQueue);
+    /* transaction done, remove the node from the heap and let a waiting request to that peer go */
+    coap_transaction_done(id);
 
     if (COAP_RESPONSE_CLASS(pkt.hdr.code) == 2)
     {
@@ -299,7 +305,7 @@ static void coap_response_handler(void *arg, char *pdata, unsigned short len)
   }
 
 end:
-  if(!gQueue){ // if there is no node pending in the queue, disconnect from host.
+  if(!coap_pending()){ // if there is no node pending in the queue, disconnect from host.
     if(pesp_conn->proto.udp->remote_port || pesp_conn->proto.udp->local_port)
       espconn_delete(pesp_conn);
   }
@@ -439,33 +445,39 @@ static int coap_regist( lua_State* L, const char* mt, int isvar )
   if (name == NULL)
     return luaL_error( L, "name must be set." );
 
-  coap_luser_entry *h = NULL;
-  // if(lua_isstring(L, 3))
-  if(isvar)
-    h = variable_entry;
-  else
-    h = function_entry;
+  if (!coap_add_entry(isvar ? variable_entry : function_entry, name, content_type))
+    return luaL_error(L, "not enough memory");
 
-  while(NULL!=h->next){  // goto the end of the list
-    if(h->name!= NULL && c_strcmp(h->name, name)==0)  // key exist, override it
-      break;
-    h = h->next;
-  }
+  NODE_DBG("coap_regist is called.\n");
+  return 0;  
+}
 
-  if(h->name==NULL || c_strcmp(h->name, name)!=0){   // not exists. make a new one.
-    h->next = (coap_luser_entry *)c_zalloc(sizeof(coap_luser_entry));
-    h = h->next;
-    if(h == NULL)
-      return luaL_error(L, "not enough memory");
-    h->next = NULL;
-    h->name = NULL;
-  }  
+static int coap_notify_send(void *arg, const coap_remote_t *remote, const uint8_t *msg, size_t len)
+{
+  struct espconn *pesp_conn = arg;
 
-  h->name = name;
-  h->content_type = content_type;
+  c_memcpy(pesp_conn->proto.udp->remote_ip, &remote->ip, 4);
+  pesp_conn->proto.udp->remote_port = remote->port;
+  return espconn_sent(pesp_conn, (unsigned char *)msg, len);
+}
 
-  NODE_DBG("coap_regist is called.\n");
-  return 0;  
+// Lua: n = server:notify( "name" )
+static int coap_server_notify( lua_State* L )
+{
+  lcoap_userdata *cud;
+  coap_luser_entry *h;
+  size_t l;
+
+  cud = (lcoap_userdata *)luaL_checkudata(L, 1, "coap_server");
+  const char *name = luaL_checklstring( L, 2, &l );
+
+  h = coap_find_entry(variable_entry, name, l);
+  if (h == NULL)
+    return luaL_error(L, "not a registered variable");
+
+  // observers can only be reached while the server is listening
+  lua_pushinteger(L, cud->self_ref != LUA_NOREF ? coap_notify(h, coap_notify_send, cud->pesp_conn) : 0);
+  return 1;
 }
 
 // Lua: s = coap.createServer(function(conn))
@@ -479,6 +491,7 @@ static int coap_createServer( lua_State* L )
 static int coap_server_delete( lua_State* L )
 {
   const char *mt = "coap_server";
+  coap_clear_observers();
   return coap_delete(L, mt);
 }
 
@@ -493,6 +506,7 @@ static int coap_server_listen( lua_State* L )
 static int coap_server_close( lua_State* L )
 {
   const char *mt = "coap_server";
+  coap_clear_observers();
   return coap_close(L, mt);
 }
 
@@ -555,12 +569,25 @@ static int coap_client_delete( lua_State* L )
   return coap_request(L, COAP_METHOD_DELETE);
 }
 
+// Lua: n = coap.nstart([n])
+static int coap_nstart( lua_State* L )
+{
+  if (lua_isnumber(L, 1)) {
+    int n = lua_tointeger(L, 1);
+    luaL_argcheck(L, n >= 1 && n <= COAP_MAX_NSTART, 1, "out of range");
+    coap_set_nstart(n);
+  }
+  lua_pushinteger(L, coap_get_nstart());
+  return 1;
+}
+
 // Module function map
 static const LUA_REG_TYPE coap_server_map[] = {
   { LSTRKEY( "listen" ),  LFUNCVAL( coap_server_listen ) },
   { LSTRKEY( "close" ),   LFUNCVAL( coap_server_close ) },
   { LSTRKEY( "var" ),     LFUNCVAL( coap_server_var ) },
   { LSTRKEY( "func" ),    LFUNCVAL( coap_server_func ) },
+  { LSTRKEY( "notify" ),  LFUNCVAL( coap_server_notify ) },
   { LSTRKEY( "__gc" ),    LFUNCVAL( coap_server_delete ) },
   { LSTRKEY( "__index" ), LROVAL( coap_server_map ) },
   { LNILKEY, LNILVAL }
@@ -580,6 +607,7 @@ static const LUA_REG_TYPE coap_map[] =
 {
   { LSTRKEY( "Server" ),      LFUNCVAL( coap_createServer ) },
   { LSTRKEY( "Client" ),      LFUNCVAL( coap_createClient ) },
+  { LSTRKEY( "nstart" ),      LFUNCVAL( coap_nstart ) },
   { LSTRKEY( "CON" ),         LNUMVAL( COAP_TYPE_CON ) },
   { LSTRKEY( "NON" ),         LNUMVAL( COAP_TYPE_NONCON ) },
   { LSTRKEY( "TEXT_PLAIN"),   LNUMVAL( COAP_CONTENTTYPE_TEXT_PLAIN ) },
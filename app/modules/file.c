@@ -2,14 +2,12 @@
 
 #include "module.h"
 #include "lauxlib.h"
-#include "lmem.h"
 #include "platform.h"
 
 #include "c_types.h"
 #include "vfs.h"
 #include "c_string.h"
 
-#include <alloca.h>
 
 #define FILE_READ_CHUNK 1024
 
@@ -421,13 +419,6 @@ static int file_stat( lua_State* L )
 // g_read()
 static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
 {
-  static char *heap_mem = NULL;
-  // free leftover memory
-  if (heap_mem) {
-    luaM_free(L, heap_mem);
-    heap_mem = NULL;
-  }
-
   if(n <= 0)
     n = FILE_READ_CHUNK;
 
@@ -438,16 +429,12 @@ static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
   if(!fd)
     return luaL_error(L, "open a file first");
 
+  luaL_Buffer b;
   char *p;
   int i;
 
-  if (n > LUAL_BUFFERSIZE) {
-    // get buffer from heap
-    p = heap_mem = luaM_malloc(L, n);
-  } else {
-    // small chunks go onto the stack
-    p = alloca(n);
-  }
+  // large chunks are read straight into a heap buffer that becomes the result
+  p = luaL_buffinitsize(L, &b, n);
 
   n = vfs_read(fd, p, n);
   // bypass search if no end character provided
@@ -463,20 +450,15 @@ static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
   }
 
   if (i == 0 || n == VFS_RES_ERR) {
-    if (heap_mem) {
-      luaM_free(L, heap_mem);
-      heap_mem = NULL;
-    }
+    luaL_pushresult(&b);
+    lua_pop(L, 1);
     lua_pushnil(L);
     return 1;
   }
 
   vfs_lseek(fd, -(n - i), VFS_SEEK_CUR);
-  lua_pushlstring(L, p, i);
-  if (heap_mem) {
-    luaM_free(L, heap_mem);
-    heap_mem = NULL;
-  }
+  luaL_addsize(&b, i);
+  luaL_pushresult(&b);
   return 1;
 }
 
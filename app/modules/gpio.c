@@ -27,7 +27,7 @@
 // going to change.
 #define INTERRUPT_TYPE_IS_LEVEL(x)	((x) >= GPIO_PIN_INTR_LOLEVEL)
 
-static int gpio_cb_ref[GPIO_PIN_NUM];
+static luaL_Callback gpio_cb[GPIO_PIN_NUM];
 
 // This task is scheduled by the ISR and is used
 // to initiate the Lua-land gpio.trig() callback function
@@ -49,10 +49,10 @@ static void gpio_intr_callback_task (task_param_t param, uint8 priority)
   then = (then + (now & 0x7f000000)) & 0x7fffffff;
 
   NODE_DBG("pin:%d, level:%d \n", pin, level);
-  if(gpio_cb_ref[pin] != LUA_NOREF) {
+  if(luaL_cbisset(&gpio_cb[pin])) {
     // GPIO callbacks are run in L0 and include the level as a parameter
     lua_State *L = lua_getstate();
-    NODE_DBG("Calling: %08x\n", gpio_cb_ref[pin]);
+    NODE_DBG("Calling: %08x\n", gpio_cb[pin].ref);
 
     bool needs_callback = 1;
 
@@ -61,7 +61,7 @@ static void gpio_intr_callback_task (task_param_t param, uint8 priority)
       // the base level only modifies 'reported'. 
 
       // Do the actual callback
-      lua_rawgeti(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
+      luaL_cbpush(L, &gpio_cb[pin]);
       lua_pushinteger(L, level);
       lua_pushinteger(L, then);
       uint16_t seen = pin_counter[pin].seen;
@@ -97,31 +97,26 @@ static int lgpio_trig( lua_State* L )
     };
   luaL_argcheck(L, platform_gpio_exists(pin) && pin>0, 1, "Invalid interrupt pin");
 
-  int old_pin_ref = gpio_cb_ref[pin];
   int type = opts_type[luaL_checkoption(L, 2, "none", opts)];
 
   if (type == GPIO_PIN_INTR_DISABLE) {
     // "none" clears the callback
-    gpio_cb_ref[pin] = LUA_NOREF;
+    luaL_cbunref(L, &gpio_cb[pin]);
 
-  } else if (lua_gettop(L)==2 && old_pin_ref != LUA_NOREF) {
+  } else if (lua_gettop(L)==2 && luaL_cbisset(&gpio_cb[pin])) {
     // keep the old one if no callback 
-    old_pin_ref = LUA_NOREF;
 
   } else if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION) {
-    // set up the new callback if present
+    // set up the new callback if present, unreferencing any overwritten one
     lua_pushvalue(L, 3);
-    gpio_cb_ref[pin] = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &gpio_cb[pin]);
 
   } else {
      // invalid combination, so clear down any old callback and throw an error
-    if(old_pin_ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, old_pin_ref);
+    luaL_cbunref(L, &gpio_cb[pin]);
     luaL_argcheck(L,  0, 3, "invalid callback type");
   }
 
-  // unreference any overwritten callback
-  if(old_pin_ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, old_pin_ref);
-
   uint16_t seen;
 
   // Make sure that we clear out any queued interrupts
@@ -131,7 +126,7 @@ static int lgpio_trig( lua_State* L )
   } while (seen != pin_counter[pin].seen);
 
   NODE_DBG("Pin data: %d %d %08x, %d %d %d, %08x\n",
-          pin, type, pin_mux[pin], pin_num[pin], pin_func[pin], pin_int_type[pin], gpio_cb_ref[pin]);
+          pin, type, pin_mux[pin], pin_num[pin], pin_func[pin], pin_int_type[pin], gpio_cb[pin].ref);
   platform_gpio_intr_init(pin, type);
   return 0;
 }
@@ -156,7 +151,7 @@ NODE_DBG("pin,mode,pullup= %d %d %d\n",pin,mode,pullup);
 NODE_DBG("Pin data at mode: %d %08x, %d %d %d, %08x\n",
           pin, pin_mux[pin], pin_num[pin], pin_func[pin], 
 #ifdef GPIO_INTERRUPT_ENABLE
-          pin_int_type[pin], gpio_cb_ref[pin]
+          pin_int_type[pin], gpio_cb[pin].ref
 #else
           0, 0
 #endif
@@ -164,10 +159,7 @@ NODE_DBG("Pin data at mode: %d %08x, %d %d %d, %08x\n",
 
 #ifdef GPIO_INTERRUPT_ENABLE
   if (mode != INTERRUPT){     // disable interrupt
-    if(gpio_cb_ref[pin] != LUA_NOREF){
-      luaL_unref(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
-      gpio_cb_ref[pin] = LUA_NOREF;
-    }
+    luaL_cbunref(L, &gpio_cb[pin]);
   }
 #endif
 
@@ -353,7 +345,7 @@ int luaopen_gpio( lua_State *L ) {
 #ifdef GPIO_INTERRUPT_ENABLE
   int i;
   for(i=0;i<GPIO_PIN_NUM;i++){
-    gpio_cb_ref[i] = LUA_NOREF;
+    luaL_cbinit(&gpio_cb[i]);
   }
   platform_gpio_init(task_get_id(gpio_intr_callback_task));
 #endif
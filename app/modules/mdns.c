@@ -8,9 +8,25 @@
 
 #include "c_types.h"
 #include "mem.h"
+#include "osapi.h"
 #include "lwip/ip_addr.h"
 #include "nodemcu_mdns.h"
 #include "user_interface.h"
+#include "pm/swtimer.h"
+
+#define MDNS_RESOLVE_TIMEOUT  2000  // ms to wait for an address
+#define MDNS_BROWSE_WAIT      1000  // ms to collect responses to a browse
+
+// A pending resolve or browse, the callback runs when its timer fires
+typedef struct mdns_request {
+  struct mdns_request *next;
+  os_timer_t timer;
+  int cb_ref;
+  bool browse;
+  char name[1];
+} mdns_request;
+
+static mdns_request *requests;
 
 //
 // mdns.close()
@@ -87,10 +103,198 @@ static int mdns_register(lua_State *L)
   return 0;
 }
 
+static void mdns_push_txt(lua_State *L, const uint8 *txt, uint16 len)
+{
+  const uint8 *end = txt + len;
+
+  lua_newtable(L);
+  while (txt < end && txt + 1 + *txt <= end) {
+    const char *s = (const char *) txt + 1;
+    const char *eq = s;
+
+    while (eq < s + *txt && *eq != '=') {
+      eq++;
+    }
+    if (eq < s + *txt) {
+      lua_pushlstring(L, s, eq - s);
+      lua_pushlstring(L, eq + 1, s + *txt - eq - 1);
+    } else {
+      lua_pushlstring(L, s, *txt);
+      lua_pushboolean(L, 1);
+    }
+    if (lua_objlen(L, -2)) {
+      lua_rawset(L, -3);
+    } else {
+      lua_pop(L, 2);
+    }
+    txt += *txt + 1;
+  }
+}
+
+static void mdns_push_service(void *arg, const char *instance, const char *host, uint16 port,
+                              const ip_addr_t *ip, const uint8 *txt, uint16 txtlen)
+{
+  lua_State *L = (lua_State *) arg;
+  char iptmp[16];
+
+  lua_createtable(L, 0, 5);
+  lua_pushstring(L, instance);
+  lua_setfield(L, -2, "name");
+  if (host) {
+    lua_pushstring(L, host);
+    lua_setfield(L, -2, "host");
+    lua_pushinteger(L, port);
+    lua_setfield(L, -2, "port");
+  }
+  if (ip) {
+    c_sprintf(iptmp, IPSTR, IP2STR(&ip->addr));
+    lua_pushstring(L, iptmp);
+    lua_setfield(L, -2, "ip");
+  }
+  if (txt) {
+    mdns_push_txt(L, txt, txtlen);
+    lua_setfield(L, -2, "txt");
+  }
+  lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+}
+
+static void mdns_count_complete(void *arg, const char *instance, const char *host, uint16 port,
+                                const ip_addr_t *ip, const uint8 *txt, uint16 txtlen)
+{
+  if (host && ip) {
+    (*(int *) arg)++;
+  }
+}
+
+static void mdns_request_done(mdns_request *req)
+{
+  lua_State *L = lua_getstate();
+  mdns_request **pr;
+  ip_addr_t ip;
+
+  for (pr = &requests; *pr != req; pr = &(*pr)->next) {
+  }
+  *pr = req->next;
+  os_timer_disarm(&req->timer);
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, req->cb_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, req->cb_ref);
+  if (req->browse) {
+    lua_newtable(L);
+    nodemcu_mdns_browse_cached(req->name, mdns_push_service, L);
+  } else if (nodemcu_mdns_resolve_cached(req->name, &ip)) {
+    char iptmp[16];
+    c_sprintf(iptmp, IPSTR, IP2STR(&ip.addr));
+    lua_pushstring(L, iptmp);
+  } else {
+    lua_pushnil(L);
+  }
+  c_free(req);
+  lua_call(L, 1, 0);
+}
+
+static void mdns_request_timeout(void *arg)
+{
+  mdns_request_done((mdns_request *) arg);
+}
+
+// New records arrived, finish the resolves they answer
+static void mdns_cache_updated(void)
+{
+  mdns_request *req = requests;
+
+  while (req) {
+    mdns_request *next = req->next;
+    ip_addr_t ip;
+
+    if (!req->browse && nodemcu_mdns_resolve_cached(req->name, &ip)) {
+      mdns_request_done(req);
+      // the callback may have changed the list
+      next = requests;
+    }
+    req = next;
+  }
+}
+
+static void mdns_request_start(lua_State *L, const char *fmt, bool browse)
+{
+  const char *name = luaL_checkstring(L, 1);
+  int complete = 0;
+  bool cached;
+  uint32_t delay;
+
+  luaL_checkanyfunction(L, 2);
+  if (c_strlen(name) > 63) {
+    luaL_error(L, "name too long");
+  }
+
+  mdns_request *req = (mdns_request *) c_zalloc(sizeof(mdns_request) + c_strlen(name) + 16);
+  if (!req) {
+    luaL_error(L, "out of memory");
+  }
+  c_sprintf(req->name, fmt, name);
+  req->browse = browse;
+
+  if (browse) {
+    int count = nodemcu_mdns_browse_cached(req->name, mdns_count_complete, &complete);
+    cached = count && count == complete;
+  } else {
+    ip_addr_t ip;
+    cached = nodemcu_mdns_resolve_cached(req->name, &ip);
+  }
+
+  // Only go to the network if the cache can't answer
+  if (cached) {
+    delay = 1;
+  } else if (browse ? nodemcu_mdns_query_service(req->name) : nodemcu_mdns_query_host(req->name)) {
+    delay = browse ? MDNS_BROWSE_WAIT : MDNS_RESOLVE_TIMEOUT;
+  } else {
+    c_free(req);
+    luaL_error(L, "unable to send query");
+  }
+
+  lua_pushvalue(L, 2);
+  req->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  req->next = requests;
+  requests = req;
+  nodemcu_mdns_set_update_cb(mdns_cache_updated);
+
+  os_timer_setfn(&req->timer, mdns_request_timeout, req);
+  SWTIMER_REG_CB(mdns_request_timeout, SWTIMER_RESUME);
+  os_timer_arm(&req->timer, delay, 0);
+}
+
+//
+// mdns.resolve(hostname, function(ip) end)
+//
+static int mdns_resolve(lua_State *L)
+{
+  const char *name = luaL_checkstring(L, 1);
+  int len = c_strlen(name);
+
+  if (len > 6 && c_strcmp(name + len - 6, ".local") == 0) {
+    mdns_request_start(L, "%s", FALSE);
+  } else {
+    mdns_request_start(L, "%s.local", FALSE);
+  }
+  return 0;
+}
+
+//
+// mdns.browse(service, function(services) end)
+//
+static int mdns_browse(lua_State *L)
+{
+  mdns_request_start(L, "_%s._tcp.local", TRUE);
+  return 0;
+}
+
 // Module function map
 static const LUA_REG_TYPE mdns_map[] = {
   { LSTRKEY("register"),  LFUNCVAL(mdns_register)  },
   { LSTRKEY("close"),     LFUNCVAL(mdns_close)     },
+  { LSTRKEY("resolve"),   LFUNCVAL(mdns_resolve)   },
+  { LSTRKEY("browse"),    LFUNCVAL(mdns_browse)    },
   { LNILKEY, LNILVAL }
 };
 
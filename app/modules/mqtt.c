@@ -76,14 +76,14 @@ typedef struct lmqtt_userdata
 {
   struct espconn *pesp_conn;
   int self_ref;
-  int cb_connect_ref;
-  int cb_connect_fail_ref;
-  int cb_disconnect_ref;
-  int cb_message_ref;
-  int cb_overflow_ref;
-  int cb_suback_ref;
-  int cb_unsuback_ref;
-  int cb_puback_ref;
+  luaL_Callback cb_connect;
+  luaL_Callback cb_connect_fail;
+  luaL_Callback cb_disconnect;
+  luaL_Callback cb_message;
+  luaL_Callback cb_overflow;
+  luaL_Callback cb_suback;
+  luaL_Callback cb_unsuback;
+  luaL_Callback cb_puback;
   mqtt_state_t  mqtt_state;
   mqtt_connect_info_t connect_info;
   uint16_t keep_alive_tick;
@@ -122,8 +122,8 @@ static void mqtt_socket_disconnected(void *arg)    // tcp only
 
   if(mud->connected){     // call back only called when socket is from connection to disconnection.
     mud->connected = false;
-    if((mud->cb_disconnect_ref != LUA_NOREF) && (mud->self_ref != LUA_NOREF)) {
-      lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_disconnect_ref);
+    if(luaL_cbisset(&mud->cb_disconnect) && (mud->self_ref != LUA_NOREF)) {
+      luaL_cbpush(L, &mud->cb_disconnect);
       lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata(client) to callback func in lua
       call_back = true;
     }
@@ -217,15 +217,15 @@ static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, uint16_t len
   event_data.data_length = length;
   event_data.data = mqtt_get_publish_data(message, &event_data.data_length);
 
-  int cb_ref = !is_overflow ? mud->cb_message_ref : mud->cb_overflow_ref;
+  luaL_Callback *cb = !is_overflow ? &mud->cb_message : &mud->cb_overflow;
 
-  if(cb_ref == LUA_NOREF)
+  if(!luaL_cbisset(cb))
     return;
   if(mud->self_ref == LUA_NOREF)
     return;
   lua_State *L = lua_getstate();
   if(event_data.topic && (event_data.topic_length > 0)){
-    lua_rawgeti(L, LUA_REGISTRYINDEX, cb_ref);
+    luaL_cbpush(L, cb);
     lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
     lua_pushlstring(L, event_data.topic, event_data.topic_length);
   } else {
@@ -244,14 +244,14 @@ static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, uint16_t len
 
 static void mqtt_connack_fail(lmqtt_userdata * mud, int reason_code)
 {
-  if(mud->cb_connect_fail_ref == LUA_NOREF || mud->self_ref == LUA_NOREF)
+  if(!luaL_cbisset(&mud->cb_connect_fail) || mud->self_ref == LUA_NOREF)
   {
     return;
   }
 
   lua_State *L = lua_getstate();
 
-  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_connect_fail_ref);
+  luaL_cbpush(L, &mud->cb_connect_fail);
   lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata(client) to callback func in lua
   lua_pushinteger(L, reason_code);
   lua_call(L, 2, 0);
@@ -465,16 +465,15 @@ READPACKET:
         mud->connState = MQTT_DATA;
         NODE_DBG("MQTT: Connected\r\n");
         mud->keepalive_sent = 0;
-        luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_fail_ref);
-        mud->cb_connect_fail_ref = LUA_NOREF;
+        luaL_cbunref(L, &mud->cb_connect_fail);
         if (mud->mqtt_state.auto_reconnect == RECONNECT_POSSIBLE) {
           mud->mqtt_state.auto_reconnect = RECONNECT_ON;
         }
-        if(mud->cb_connect_ref == LUA_NOREF)
+        if(!luaL_cbisset(&mud->cb_connect))
           break;
         if(mud->self_ref == LUA_NOREF)
           break;
-        lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_connect_ref);
+        luaL_cbpush(L, &mud->cb_connect);
         lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata(client) to callback func in lua
         lua_call(L, 1, 0);
         break;
@@ -589,11 +588,11 @@ READPACKET:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_SUBSCRIBE && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Subscribe successful\r\n");
             msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-            if (mud->cb_suback_ref == LUA_NOREF)
+            if (!luaL_cbisset(&mud->cb_suback))
               break;
             if (mud->self_ref == LUA_NOREF)
               break;
-            lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_suback_ref);
+            luaL_cbpush(L, &mud->cb_suback);
             lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);
             lua_call(L, 1, 0);
           }
@@ -603,11 +602,11 @@ READPACKET:
             NODE_DBG("MQTT: UnSubscribe successful\r\n");
             msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
 
-            if (mud->cb_unsuback_ref == LUA_NOREF)
+            if (!luaL_cbisset(&mud->cb_unsuback))
               break;
             if (mud->self_ref == LUA_NOREF)
               break;
-            lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_unsuback_ref);
+            luaL_cbpush(L, &mud->cb_unsuback);
             lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);
             lua_call(L, 1, 0);
           }
@@ -632,11 +631,11 @@ READPACKET:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish with QoS = 1 successful\r\n");
             msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-            if(mud->cb_puback_ref == LUA_NOREF)
+            if(!luaL_cbisset(&mud->cb_puback))
               break;
             if(mud->self_ref == LUA_NOREF)
               break;
-            lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+            luaL_cbpush(L, &mud->cb_puback);
             lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
             lua_call(L, 1, 0);
           }
@@ -666,11 +665,11 @@ READPACKET:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREL && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish  with QoS = 2 successful\r\n");
             msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-            if(mud->cb_puback_ref == LUA_NOREF)
+            if(!luaL_cbisset(&mud->cb_puback))
               break;
             if(mud->self_ref == LUA_NOREF)
               break;
-            lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+            luaL_cbpush(L, &mud->cb_puback);
             lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
             lua_call(L, 1, 0);
           }
@@ -751,9 +750,9 @@ static void mqtt_socket_sent(void *arg)
   msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
   if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
     msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-    if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF) {
+    if(luaL_cbisset(&mud->cb_puback) && mud->self_ref != LUA_NOREF) {
       lua_State *L = lua_getstate();
-      lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+      luaL_cbpush(L, &mud->cb_puback);
       lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
       lua_call(L, 1, 0);
     }
@@ -938,15 +937,15 @@ static int mqtt_socket_client( lua_State* L )
   c_memset(mud, 0, sizeof(*mud));
   // pre-initialize it, in case of errors
   mud->self_ref = LUA_NOREF;
-  mud->cb_connect_ref = LUA_NOREF;
-  mud->cb_connect_fail_ref = LUA_NOREF;
-  mud->cb_disconnect_ref = LUA_NOREF;
+  luaL_cbinit(&mud->cb_connect);
+  luaL_cbinit(&mud->cb_connect_fail);
+  luaL_cbinit(&mud->cb_disconnect);
 
-  mud->cb_message_ref = LUA_NOREF;
-  mud->cb_overflow_ref = LUA_NOREF;
-  mud->cb_suback_ref = LUA_NOREF;
-  mud->cb_unsuback_ref = LUA_NOREF;
-  mud->cb_puback_ref = LUA_NOREF;
+  luaL_cbinit(&mud->cb_message);
+  luaL_cbinit(&mud->cb_overflow);
+  luaL_cbinit(&mud->cb_suback);
+  luaL_cbinit(&mud->cb_unsuback);
+  luaL_cbinit(&mud->cb_puback);
 
   mud->connState = MQTT_INIT;
 
@@ -1118,22 +1117,14 @@ static int mqtt_delete( lua_State* L )
   // -------
 
   // free (unref) callback ref
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_ref);
-  mud->cb_connect_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_fail_ref);
-  mud->cb_connect_fail_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_disconnect_ref);
-  mud->cb_disconnect_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_message_ref);
-  mud->cb_message_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_overflow_ref);
-  mud->cb_overflow_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_suback_ref);
-  mud->cb_suback_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_unsuback_ref);
-  mud->cb_unsuback_ref = LUA_NOREF;
-  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
-  mud->cb_puback_ref = LUA_NOREF;
+  luaL_cbunref(L, &mud->cb_connect);
+  luaL_cbunref(L, &mud->cb_connect_fail);
+  luaL_cbunref(L, &mud->cb_disconnect);
+  luaL_cbunref(L, &mud->cb_message);
+  luaL_cbunref(L, &mud->cb_overflow);
+  luaL_cbunref(L, &mud->cb_suback);
+  luaL_cbunref(L, &mud->cb_unsuback);
+  luaL_cbunref(L, &mud->cb_puback);
   lua_gc(L, LUA_GCSTOP, 0);
   luaL_unref(L, LUA_REGISTRYINDEX, mud->self_ref);
   mud->self_ref = LUA_NOREF;
@@ -1344,8 +1335,7 @@ static int mqtt_socket_connect( lua_State* L )
   // call back function when a connection is obtained, tcp only
   if ((stack<=top) && (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION)){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_ref);
-    mud->cb_connect_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_connect);
   }
 
   stack++;
@@ -1353,8 +1343,7 @@ static int mqtt_socket_connect( lua_State* L )
   // call back function when a connection fails
   if ((stack<=top) && (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION)){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_fail_ref);
-    mud->cb_connect_fail_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_connect_fail);
     stack++;
   }
 
@@ -1469,17 +1458,13 @@ static int mqtt_socket_on( lua_State* L )
   lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
 
   if( sl == 7 && c_strcmp(method, "connect") == 0){
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_ref);
-    mud->cb_connect_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_connect);
   }else if( sl == 7 && c_strcmp(method, "offline") == 0){
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_disconnect_ref);
-    mud->cb_disconnect_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_disconnect);
   }else if( sl == 7 && c_strcmp(method, "message") == 0){
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_message_ref);
-    mud->cb_message_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_message);
   }else if( sl == 8 && c_strcmp(method, "overflow") == 0){
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_overflow_ref);
-    mud->cb_overflow_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_overflow);
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
@@ -1576,8 +1561,7 @@ static int mqtt_socket_unsubscribe( lua_State* L ) {
 
   if( lua_type( L, stack ) == LUA_TFUNCTION || lua_type( L, stack ) == LUA_TLIGHTFUNCTION ) {    // TODO: this will overwrite the previous one.
     lua_pushvalue( L, stack );  // copy argument (func) to the top of stack
-    luaL_unref( L, LUA_REGISTRYINDEX, mud->cb_unsuback_ref );
-    mud->cb_unsuback_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+    luaL_cbref( L, &mud->cb_unsuback );
   }
 
   msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg,
@@ -1691,8 +1675,7 @@ static int mqtt_socket_subscribe( lua_State* L ) {
 
   if( lua_type( L, stack ) == LUA_TFUNCTION || lua_type( L, stack ) == LUA_TLIGHTFUNCTION ) {    // TODO: this will overwrite the previous one.
     lua_pushvalue( L, stack );  // copy argument (func) to the top of stack
-    luaL_unref( L, LUA_REGISTRYINDEX, mud->cb_suback_ref );
-    mud->cb_suback_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+    luaL_cbref( L, &mud->cb_suback );
   }
 
   msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg,
@@ -1766,8 +1749,7 @@ static int mqtt_socket_publish( lua_State* L )
 
   if (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
-    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
-    mud->cb_puback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &mud->cb_puback);
   }
 
   msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
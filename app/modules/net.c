@@ -52,19 +52,19 @@ typedef struct lnet_userdata {
   };
   union {
     struct {
-      int cb_accept_ref;
+      luaL_Callback cb_accept;
       int timeout;
     } server;
     struct {
       int wait_dns;
-      int cb_dns_ref;
-      int cb_receive_ref;
-      int cb_sent_ref;
+      luaL_Callback cb_dns;
+      luaL_Callback cb_receive;
+      luaL_Callback cb_sent;
       // Only for TCP:
       int hold;
-      int cb_connect_ref;
-      int cb_disconnect_ref;
-      int cb_reconnect_ref;
+      luaL_Callback cb_connect;
+      luaL_Callback cb_disconnect;
+      luaL_Callback cb_reconnect;
     } client;
   };
 } lnet_userdata;
@@ -108,18 +108,18 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
 
   switch (type) {
     case TYPE_TCP_CLIENT:
-      ud->client.cb_connect_ref = LUA_NOREF;
-      ud->client.cb_reconnect_ref = LUA_NOREF;
-      ud->client.cb_disconnect_ref = LUA_NOREF;
+      luaL_cbinit(&ud->client.cb_connect);
+      luaL_cbinit(&ud->client.cb_reconnect);
+      luaL_cbinit(&ud->client.cb_disconnect);
       ud->client.hold = 0;
     case TYPE_UDP_SOCKET:
       ud->client.wait_dns = 0;
-      ud->client.cb_dns_ref = LUA_NOREF;
-      ud->client.cb_receive_ref = LUA_NOREF;
-      ud->client.cb_sent_ref = LUA_NOREF;
+      luaL_cbinit(&ud->client.cb_dns);
+      luaL_cbinit(&ud->client.cb_receive);
+      luaL_cbinit(&ud->client.cb_sent);
       break;
     case TYPE_TCP_SERVER:
-      ud->server.cb_accept_ref = LUA_NOREF;
+      luaL_cbinit(&ud->server.cb_accept);
       break;
   }
   return ud;
@@ -132,12 +132,12 @@ static void net_err_cb(void *arg, err_t err) {
   if (!ud || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return;
   ud->pcb = NULL; // Will be freed at LWIP level
   lua_State *L = lua_getstate();
-  int ref;
-  if (err != ERR_OK && ud->client.cb_reconnect_ref != LUA_NOREF)
-    ref = ud->client.cb_reconnect_ref;
-  else ref = ud->client.cb_disconnect_ref;
-  if (ref != LUA_NOREF) {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+  luaL_Callback *cb;
+  if (err != ERR_OK && luaL_cbisset(&ud->client.cb_reconnect))
+    cb = &ud->client.cb_reconnect;
+  else cb = &ud->client.cb_disconnect;
+  if (luaL_cbisset(cb)) {
+    luaL_cbpush(L, cb);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
     lua_pushinteger(L, err);
     lua_call(L, 2, 0);
@@ -158,8 +158,8 @@ static err_t net_connected_cb(void *arg, struct tcp_pcb *tpcb, err_t err) {
     return ERR_ABRT;
   }
   lua_State *L = lua_getstate();
-  if (ud->self_ref != LUA_NOREF && ud->client.cb_connect_ref != LUA_NOREF) {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
+  if (ud->self_ref != LUA_NOREF && luaL_cbisset(&ud->client.cb_connect)) {
+    luaL_cbpush(L, &ud->client.cb_connect);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
     lua_call(L, 1, 0);
   }
@@ -173,8 +173,8 @@ static void net_dns_cb(const char *name, ip_addr_t *ipaddr, void *arg) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud) return;
   lua_State *L = lua_getstate();
-  if (ud->self_ref != LUA_NOREF && ud->client.cb_dns_ref != LUA_NOREF) {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_dns_ref);
+  if (ud->self_ref != LUA_NOREF && luaL_cbisset(&ud->client.cb_dns)) {
+    luaL_cbpush(L, &ud->client.cb_dns);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
     if (addr.addr != 0xFFFFFFFF) {
       char iptmp[16];
@@ -198,7 +198,7 @@ static void net_dns_cb(const char *name, ip_addr_t *ipaddr, void *arg) {
 }
 
 static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_t port) {
-  if (ud->client.cb_receive_ref == LUA_NOREF) {
+  if (!luaL_cbisset(&ud->client.cb_receive)) {
     pbuf_free(p);
     return;
   }
@@ -215,7 +215,7 @@ static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_
   struct pbuf *pp = p;
   while (pp)
   {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_receive_ref);
+    luaL_cbpush(L, &ud->client.cb_receive);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
     lua_pushlstring(L, pp->payload, pp->len);
     if (ud->type == TYPE_UDP_SOCKET) {
@@ -253,9 +253,9 @@ static err_t net_tcp_recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, er
 static err_t net_sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return ERR_ABRT;
-  if (ud->client.cb_sent_ref == LUA_NOREF) return ERR_OK;
+  if (!luaL_cbisset(&ud->client.cb_sent)) return ERR_OK;
   lua_State *L = lua_getstate();
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
+  luaL_cbpush(L, &ud->client.cb_sent);
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
   lua_call(L, 1, 0);
   return ERR_OK;
@@ -264,10 +264,10 @@ static err_t net_sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len) {
 static err_t net_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || ud->type != TYPE_TCP_SERVER || !ud->pcb) return ERR_ABRT;
-  if (ud->self_ref == LUA_NOREF || ud->server.cb_accept_ref == LUA_NOREF) return ERR_ABRT;
+  if (ud->self_ref == LUA_NOREF || !luaL_cbisset(&ud->server.cb_accept)) return ERR_ABRT;
 
   lua_State *L = lua_getstate();
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->server.cb_accept_ref);
+  luaL_cbpush(L, &ud->server.cb_accept);
 
   lnet_userdata *nud = net_create(L, TYPE_TCP_CLIENT);
   lua_pushvalue(L, 2);
@@ -383,8 +383,7 @@ int net_listen( lua_State *L ) {
   if (ud->type == TYPE_TCP_SERVER) {
     if (lua_isfunction(L, stack) || lua_islightfunction(L, stack)) {
       lua_pushvalue(L, stack++);
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->server.cb_accept_ref);
-      ud->server.cb_accept_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+      luaL_cbref(L, &ud->server.cb_accept);
     } else {
       return luaL_error(L, "need callback");
     }
@@ -454,8 +453,7 @@ int net_connect( lua_State *L ) {
   if (lua_gettop(L) > 3) {
     luaL_argcheck(L, lua_isfunction(L, 4) || lua_islightfunction(L, 4), 4, "not a function");
     lua_pushvalue(L, 4);
-    luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
-    ud->client.cb_connect_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &ud->client.cb_connect);
   }
   ud->tcp_pcb = tcp_new();
   if (!ud->tcp_pcb)
@@ -494,36 +492,34 @@ int net_on( lua_State *L ) {
   lnet_userdata *ud = net_get_udata(L);
   if (!ud || ud->type == TYPE_TCP_SERVER)
     return luaL_error(L, "invalid user data");
-  int *refptr = NULL;
+  luaL_Callback *cb = NULL;
   const char *name = luaL_checkstring(L, 2);
   if (!name) return luaL_error(L, "need callback name");
   switch (ud->type) {
     case TYPE_TCP_CLIENT:
       if (strcmp("connection",name)==0)
-        { refptr = &ud->client.cb_connect_ref; break; }
+        { cb = &ud->client.cb_connect; break; }
       if (strcmp("disconnection",name)==0)
-        { refptr = &ud->client.cb_disconnect_ref; break; }
+        { cb = &ud->client.cb_disconnect; break; }
       if (strcmp("reconnection",name)==0)
-        { refptr = &ud->client.cb_reconnect_ref; break; }
+        { cb = &ud->client.cb_reconnect; break; }
     case TYPE_UDP_SOCKET:
       if (strcmp("dns",name)==0)
-        { refptr = &ud->client.cb_dns_ref; break; }
+        { cb = &ud->client.cb_dns; break; }
       if (strcmp("receive",name)==0)
-        { refptr = &ud->client.cb_receive_ref; break; }
+        { cb = &ud->client.cb_receive; break; }
       if (strcmp("sent",name)==0)
-        { refptr = &ud->client.cb_sent_ref; break; }
+        { cb = &ud->client.cb_sent; break; }
       break;
     default: return luaL_error(L, "invalid user data");
   }
-  if (refptr == NULL)
+  if (cb == NULL)
     return luaL_error(L, "invalid callback name");
   if (lua_isfunction(L, 3) || lua_islightfunction(L, 3)) {
     lua_pushvalue(L, 3);
-    luaL_unref(L, LUA_REGISTRYINDEX, *refptr);
-    *refptr = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, cb);
   } else if (lua_isnil(L, 3)) {
-    luaL_unref(L, LUA_REGISTRYINDEX, *refptr);
-    *refptr = LUA_NOREF;
+    luaL_cbunref(L, cb);
   } else {
     return luaL_error(L, "invalid callback function");
   }
@@ -552,8 +548,7 @@ int net_send( lua_State *L ) {
   if (!data || datalen == 0) return luaL_error(L, "no data to send");
   if (lua_isfunction(L, stack) || lua_islightfunction(L, stack)) {
     lua_pushvalue(L, stack++);
-    luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
-    ud->client.cb_sent_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &ud->client.cb_sent);
   }
   if (ud->type == TYPE_UDP_SOCKET && !ud->pcb) {
     ud->udp_pcb = udp_new();
@@ -582,8 +577,8 @@ int net_send( lua_State *L ) {
     pbuf_take(pb, data, datalen);
     err = udp_sendto(ud->udp_pcb, pb, &addr, port);
     pbuf_free(pb);
-    if (ud->client.cb_sent_ref != LUA_NOREF) {
-      lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
+    if (luaL_cbisset(&ud->client.cb_sent)) {
+      luaL_cbpush(L, &ud->client.cb_sent);
       lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
       lua_call(L, 1, 0);
     }
@@ -627,11 +622,10 @@ int net_dns( lua_State *L ) {
   if (!domain)
     return luaL_error(L, "no domain specified");
   if (lua_isfunction(L, 3) || lua_islightfunction(L, 3)) {
-    luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_dns_ref);
     lua_pushvalue(L, 3);
-    ud->client.cb_dns_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    luaL_cbref(L, &ud->client.cb_dns);
   }
-  if (ud->client.cb_dns_ref == LUA_NOREF)
+  if (!luaL_cbisset(&ud->client.cb_dns))
     return luaL_error(L, "no callback specified");
   ud->client.wait_dns ++;
   int unref = 0;
@@ -793,23 +787,16 @@ int net_delete( lua_State *L ) {
   }
   switch (ud->type) {
     case TYPE_TCP_CLIENT:
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
-      ud->client.cb_connect_ref = LUA_NOREF;
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_disconnect_ref);
-      ud->client.cb_disconnect_ref = LUA_NOREF;
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_reconnect_ref);
-      ud->client.cb_reconnect_ref = LUA_NOREF;
+      luaL_cbunref(L, &ud->client.cb_connect);
+      luaL_cbunref(L, &ud->client.cb_disconnect);
+      luaL_cbunref(L, &ud->client.cb_reconnect);
     case TYPE_UDP_SOCKET:
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_dns_ref);
-      ud->client.cb_dns_ref = LUA_NOREF;
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_receive_ref);
-      ud->client.cb_receive_ref = LUA_NOREF;
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
-      ud->client.cb_sent_ref = LUA_NOREF;
+      luaL_cbunref(L, &ud->client.cb_dns);
+      luaL_cbunref(L, &ud->client.cb_receive);
+      luaL_cbunref(L, &ud->client.cb_sent);
       break;
     case TYPE_TCP_SERVER:
-      luaL_unref(L, LUA_REGISTRYINDEX, ud->server.cb_accept_ref);
-      ud->server.cb_accept_ref = LUA_NOREF;
+      luaL_cbunref(L, &ud->server.cb_accept);
       break;
   }
   lua_gc(L, LUA_GCSTOP, 0);
@@ -2,6 +2,7 @@
 
 #include "module.h"
 #include "lauxlib.h"
+#include "lualib.h"
 
 #include "ldebug.h"
 #include "ldo.h"
@@ -193,6 +194,22 @@ static int node_input( lua_State* L ) {
   return 0;
 }
 
+extern int lua_upload_start(const char *name, uint32_t size);
+
+// Lua: blocksize = upload(filename, size)
+static int node_upload( lua_State* L ) {
+  const char *fname = luaL_checkstring(L, 1);
+  lua_Integer size = luaL_checkinteger(L, 2);
+  int block;
+
+  luaL_argcheck(L, size >= 0, 2, "invalid size");
+  block = lua_upload_start(fname, (uint32_t)size);
+  if (!block)
+    return luaL_error(L, "cannot create %s", fname);
+  lua_pushinteger(L, block);
+  return 1;
+}
+
 static int output_redir_ref = LUA_NOREF;
 static int serial_debug = 1;
 void output_redirect(const char *str) {
@@ -274,7 +291,7 @@ static int node_compile( lua_State* L )
   c_strcpy(output, fname);
   // check here that filename end with ".lua".
   if (len < 4 || (c_strcmp( output + len - 4, ".lua") != 0) ) {
-    luaM_free( L, output );
+    luaM_freemem( L, output, len+1 );
     return luaL_error(L, "not a .lua file");
   }
 
@@ -283,7 +300,7 @@ static int node_compile( lua_State* L )
   NODE_DBG(output);
   NODE_DBG("\n");
   if (luaL_loadfsfile(L, fname) != 0) {
-    luaM_free( L, output );
+    luaM_freemem( L, output, len+1 );
     return luaL_error(L, lua_tostring(L, -1));
   }
 
@@ -294,7 +311,7 @@ static int node_compile( lua_State* L )
   file_fd = vfs_open(output, "w+");
   if (!file_fd)
   {
-    luaM_free( L, output );
+    luaM_freemem( L, output, len+1 );
     return luaL_error(L, "cannot open/write to file");
   }
 
@@ -308,7 +325,7 @@ static int node_compile( lua_State* L )
   }
   vfs_close(file_fd);
   file_fd = 0;
-  luaM_free( L, output );
+  luaM_freemem( L, output, len+1 );
 
   if (result == LUA_ERR_CC_INTOVERFLOW) {
     return luaL_error(L, "value too big or small for target integer type");
@@ -399,6 +416,25 @@ static int node_bootreason (lua_State *L)
   return n;
 }
 
+// Lua: { {phase=name, us=time}, ... } = bootprofile()
+static int node_bootprofile (lua_State *L)
+{
+  const char *phase;
+  uint32_t us;
+  unsigned n;
+
+  lua_newtable (L);
+  for (n = 0; platform_boot_get_mark (n, &phase, &us); ++n) {
+    lua_createtable (L, 0, 2);
+    lua_pushstring (L, phase);
+    lua_setfield (L, -2, "phase");
+    lua_pushinteger (L, us);
+    lua_setfield (L, -2, "us");
+    lua_rawseti (L, -2, n + 1);
+  }
+  return 1;
+}
+
 // Lua: restore()
 static int node_restore (lua_State *L)
 {
@@ -584,6 +620,9 @@ static int node_random (lua_State *L) {
 static const LUA_REG_TYPE node_egc_map[] = {
   { LSTRKEY( "meminfo" ),           LFUNCVAL( node_egc_meminfo ) },
   { LSTRKEY( "setmode" ),           LFUNCVAL( node_egc_setmode ) },
+#ifdef LUA_POOL_ALLOC
+  { LSTRKEY( "poolinfo" ),          LFUNCVAL( luaL_poolinfo ) },
+#endif
   { LSTRKEY( "NOT_ACTIVE" ),        LNUMVAL( EGC_NOT_ACTIVE ) },
   { LSTRKEY( "ON_ALLOC_FAILURE" ),  LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
   { LSTRKEY( "ON_MEM_LIMIT" ),      LNUMVAL( EGC_ON_MEM_LIMIT ) },
@@ -619,6 +658,7 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "flashsize" ), LFUNCVAL( node_flashsize) },
   { LSTRKEY( "input" ), LFUNCVAL( node_input ) },
   { LSTRKEY( "output" ), LFUNCVAL( node_output ) },
+  { LSTRKEY( "upload" ), LFUNCVAL( node_upload ) },
 // Moved to adc module, use adc.readvdd33()
 // { LSTRKEY( "readvdd33" ), LFUNCVAL( node_readvdd33) },
   { LSTRKEY( "compile" ), LFUNCVAL( node_compile) },
@@ -627,6 +667,9 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "setcpufreq" ), LFUNCVAL( node_setcpufreq) },
   { LSTRKEY( "getcpufreq" ), LFUNCVAL( node_getcpufreq) },
   { LSTRKEY( "bootreason" ), LFUNCVAL( node_bootreason) },
+  { LSTRKEY( "bootprofile" ), LFUNCVAL( node_bootprofile) },
+  { LSTRKEY( "libinfo" ), LFUNCVAL( luaL_libinfo ) },
+  { LSTRKEY( "refinfo" ), LFUNCVAL( luaL_refinfo ) },
   { LSTRKEY( "restore" ), LFUNCVAL( node_restore) },
   { LSTRKEY( "random" ), LFUNCVAL( node_random) },
 #ifdef LUA_OPTIMIZE_DEBUG
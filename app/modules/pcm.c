@@ -31,10 +31,37 @@ static void dispatch_callback( lua_State *L, int self_ref, int cb_ref, int retur
   }
 }
 
+static void free_bufs( cfg_t *cfg )
+{
+  for (int i = 0; i < PCM_MAX_BUFS; i++) {
+    if (cfg->bufs[i].data) {
+      c_free( cfg->bufs[i].data );
+      cfg->bufs[i].data = NULL;
+    }
+    cfg->bufs[i].buf_size = 0;
+  }
+}
+
+static void reset_bufs( cfg_t *cfg )
+{
+  for (int i = 0; i < PCM_MAX_BUFS; i++) {
+    cfg->bufs[i].len   = 0;
+    cfg->bufs[i].rpos  = 0;
+    cfg->bufs[i].empty = TRUE;
+  }
+  cfg->rbuf_idx = cfg->fbuf_idx = 0;
+}
+
 static int pcm_drv_free( lua_State *L )
 {
   GET_PUD();
 
+  // release the hardware unless drv:close() already did
+  if (!pud->closed) {
+    pud->drv->close( cfg );
+    pud->closed = TRUE;
+  }
+
   UNREF_CB( cfg->cb_data_ref );
   UNREF_CB( cfg->cb_drained_ref );
   UNREF_CB( cfg->cb_paused_ref );
@@ -42,14 +69,8 @@ static int pcm_drv_free( lua_State *L )
   UNREF_CB( cfg->cb_vu_ref );
   UNREF_CB( cfg->self_ref );
 
-  if (cfg->bufs[0].data) {
-    c_free( cfg->bufs[0].data );
-    cfg->bufs[0].data = NULL;
-  }
-  if (cfg->bufs[1].data) {
-    c_free( cfg->bufs[1].data );
-    cfg->bufs[1].data = NULL;
-  }
+  pcm_file_close( cfg );
+  free_bufs( cfg );
 
   return 0;
 }
@@ -57,10 +78,6 @@ static int pcm_drv_free( lua_State *L )
 // Lua: drv:close()
 static int pcm_drv_close( lua_State *L )
 {
-  GET_PUD();
-
-  pud->drv->close( cfg );
-
   return pcm_drv_free( L );
 }
 
@@ -74,8 +91,9 @@ static int pcm_drv_stop( lua_State *L )
 
   pud->drv->stop( cfg );
 
-  // invalidate the buffers
-  cfg->bufs[0].empty = cfg->bufs[1].empty = TRUE;
+  // invalidate the buffers and drop the file source
+  reset_bufs( cfg );
+  pcm_file_close( cfg );
 
   dispatch_callback( L, cfg->self_ref, cfg->cb_stopped_ref, 0 );
 
@@ -121,7 +139,7 @@ static int pcm_drv_play( lua_State *L )
 
   cfg->rate = luaL_optinteger( L, 2, PCM_RATE_8K );
 
-  luaL_argcheck( L, (cfg->rate >= PCM_RATE_1K) && (cfg->rate <= PCM_RATE_16K), 2, "invalid bit rate" );
+  luaL_argcheck( L, (cfg->rate >= pud->drv->min_rate) && (cfg->rate <= pud->drv->max_rate), 2, "invalid bit rate" );
 
   if (cfg->self_ref == LUA_NOREF) {
     lua_pushvalue( L, 1 );  // copy self userdata to the top of stack
@@ -135,6 +153,60 @@ static int pcm_drv_play( lua_State *L )
   return 0;
 }
 
+// Lua: drv:playfile(self, filename[, rate[, bufsize[, bufs]]])
+static int pcm_drv_playfile( lua_State *L )
+{
+  GET_PUD();
+
+  const char *fname = luaL_checkstring( L, 2 );
+  int bufsize = luaL_optinteger( L, 4, PCM_FILE_BUF_SIZE );
+  int nbufs   = luaL_optinteger( L, 5, PCM_FILE_BUFS );
+
+  luaL_argcheck( L, bufsize > 0, 4, "invalid buffer size" );
+  luaL_argcheck( L, (nbufs >= 2) && (nbufs <= PCM_MAX_BUFS), 5, "invalid number of buffers" );
+
+  // halt any ongoing playback before the ring is rebuilt
+  cfg->isr_throttled = -1;
+  pud->drv->stop( cfg );
+
+  int rate = pcm_file_open( cfg, fname );
+  if (rate == PCM_FILE_ERROR)
+    return luaL_error( L, "can't play file" );
+  if (rate == PCM_FILE_BAD_RATE && lua_isnoneornil( L, 3 )) {
+    pcm_file_close( cfg );
+    return luaL_error( L, "unsupported sample rate in WAV file" );
+  }
+  if (rate < 0 || !lua_isnoneornil( L, 3 ))
+    rate = luaL_optinteger( L, 3, PCM_RATE_8K );
+  if ((rate < pud->drv->min_rate) || (rate > pud->drv->max_rate)) {
+    pcm_file_close( cfg );
+    return luaL_argerror( L, 3, "invalid bit rate" );
+  }
+  cfg->rate = rate;
+
+  // allocate the read-ahead ring
+  free_bufs( cfg );
+  reset_bufs( cfg );
+  for (int i = 0; i < nbufs; i++) {
+    if (!(cfg->bufs[i].data = (uint8_t *)c_malloc( bufsize ))) {
+      pcm_file_close( cfg );
+      free_bufs( cfg );
+      return luaL_error( L, "out of memory" );
+    }
+    cfg->bufs[i].buf_size = bufsize;
+  }
+  cfg->num_bufs = nbufs;
+
+  if (cfg->self_ref == LUA_NOREF) {
+    lua_pushvalue( L, 1 );  // copy self userdata to the top of stack
+    cfg->self_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+
+  task_post_low( pcm_start_play_task, (os_param_t)pud );
+
+  return 0;
+}
+
 // Lua: drv.on(self, event, cb_fn)
 static int pcm_drv_on( lua_State *L )
 {
@@ -200,37 +272,47 @@ static int pcm_new( lua_State *L )
   cfg->cb_paused_ref = cfg->cb_stopped_ref = LUA_NOREF;
   cfg->cb_vu_ref     = LUA_NOREF;
 
-  cfg->bufs[0].buf_size = cfg->bufs[1].buf_size = 0;
-  cfg->bufs[0].data     = cfg->bufs[1].data     = NULL;
-  cfg->bufs[0].len      = cfg->bufs[1].len      = 0;
-  cfg->bufs[0].rpos     = cfg->bufs[1].rpos     = 0;
-  cfg->bufs[0].empty    = cfg->bufs[1].empty    = TRUE;
+  for (int i = 0; i < PCM_MAX_BUFS; i++) {
+    cfg->bufs[i].buf_size = 0;
+    cfg->bufs[i].data     = NULL;
+  }
+  reset_bufs( cfg );
+  cfg->num_bufs = 2;
+
+  cfg->fd        = 0;
+  cfg->file_left = 0;
+  cfg->dma       = NULL;
 
   cfg->vu_freq         = 10;
+  pud->closed          = FALSE;
 
   if (driver == PCM_DRIVER_SD) {
     cfg->pin = luaL_checkinteger( L, 2 );
     MOD_CHECK_ID(sigma_delta, cfg->pin);
 
     pud->drv = &pcm_drv_sd;
-
-    pud->drv->init( cfg );
-
-    /* set its metatable */
-    lua_pushvalue( L, -1 );  // copy self userdata to the top of stack
-    luaL_getmetatable( L, "pcm.driver" );
-    lua_setmetatable( L, -2 );
-
-    return 1;
+  } else if (driver == PCM_DRIVER_I2S) {
+    pud->drv = &pcm_drv_i2s;
   } else {
     pud->drv = NULL;
     return 0;
   }
+
+  if (!pud->drv->init( cfg ))
+    return luaL_error( L, "out of memory" );
+
+  /* set its metatable */
+  lua_pushvalue( L, -1 );  // copy self userdata to the top of stack
+  luaL_getmetatable( L, "pcm.driver" );
+  lua_setmetatable( L, -2 );
+
+  return 1;
 }
 
 
 static const LUA_REG_TYPE pcm_driver_map[] = {
   { LSTRKEY( "play" ),    LFUNCVAL( pcm_drv_play ) },
+  { LSTRKEY( "playfile" ), LFUNCVAL( pcm_drv_playfile ) },
   { LSTRKEY( "pause" ),   LFUNCVAL( pcm_drv_pause ) },
   { LSTRKEY( "stop" ),    LFUNCVAL( pcm_drv_stop ) },
   { LSTRKEY( "close" ),   LFUNCVAL( pcm_drv_close ) },
@@ -244,6 +326,7 @@ static const LUA_REG_TYPE pcm_driver_map[] = {
 static const LUA_REG_TYPE pcm_map[] = {
   { LSTRKEY( "new" ),      LFUNCVAL( pcm_new ) },
   { LSTRKEY( "SD" ),       LNUMVAL( PCM_DRIVER_SD ) },
+  { LSTRKEY( "I2S" ),      LNUMVAL( PCM_DRIVER_I2S ) },
   { LSTRKEY( "RATE_1K" ),  LNUMVAL( PCM_RATE_1K ) },
   { LSTRKEY( "RATE_2K" ),  LNUMVAL( PCM_RATE_2K ) },
   { LSTRKEY( "RATE_4K" ),  LNUMVAL( PCM_RATE_4K ) },
@@ -252,6 +335,9 @@ static const LUA_REG_TYPE pcm_map[] = {
   { LSTRKEY( "RATE_10K" ), LNUMVAL( PCM_RATE_10K ) },
   { LSTRKEY( "RATE_12K" ), LNUMVAL( PCM_RATE_12K ) },
   { LSTRKEY( "RATE_16K" ), LNUMVAL( PCM_RATE_16K ) },
+  { LSTRKEY( "RATE_22K" ), LNUMVAL( PCM_RATE_22K ) },
+  { LSTRKEY( "RATE_32K" ), LNUMVAL( PCM_RATE_32K ) },
+  { LSTRKEY( "RATE_44K" ), LNUMVAL( PCM_RATE_44K ) },
   { LNILKEY, LNILVAL }
 };
 
@@ -6,13 +6,16 @@
 #include "rtc/rtctime.h"
 #define RTCTIME_SLEEP_ALIGNED rtctime_deep_sleep_until_aligned_us
 #include "rtc/rtcfifo.h"
+#include "rtc/rtcbatch.h"
+#include "user_interface.h"
 
-// rtcfifo.prepare ([{sensor_count=n, interval_us=m, storage_begin=x, storage_end=y}])
+// rtcfifo.prepare ([{sensor_count=n, interval_us=m, storage_begin=x, storage_end=y, packed=b}])
 static int rtcfifo_prepare (lua_State *L)
 {
   uint32_t sensor_count = RTC_DEFAULT_TAGCOUNT;
   uint32_t interval_us = 0;
   int first = -1, last = -1;
+  int packed = 0;
 
   if (lua_istable (L, 1))
   {
@@ -36,14 +39,26 @@ static int rtcfifo_prepare (lua_State *L)
     if (lua_isnumber (L, -1))
       last = lua_tonumber (L, -1);
     lua_pop (L, 1);
+
+    lua_getfield (L, 1, "packed");
+    packed = lua_toboolean (L, -1);
+    lua_pop (L, 1);
   }
   else if (!lua_isnone (L, 1))
     return luaL_error (L, "expected table as arg #1");
 
+  if (packed && sensor_count > RTC_FIFO_PACKED_MAXTAGS)
+    return luaL_error (L, "packed format supports at most %d sensors",
+                       RTC_FIFO_PACKED_MAXTAGS);
+
   rtc_fifo_prepare (0, interval_us, sensor_count);
 
+  if (packed)
+    rtc_fifo_put_flags (RTC_FIFO_FLAG_PACKED);
   if (first != -1 && last != -1)
     rtc_fifo_put_loc (first, last, sensor_count);
+  if (packed || (first != -1 && last != -1))
+    rtc_fifo_clear_content ();
 
   return 0;
 }
@@ -70,7 +85,7 @@ static int rtcfifo_put (lua_State *L)
 
   sample_t s;
   s.timestamp = luaL_checknumber (L, 1);
-  s.value = luaL_checknumber (L, 2);
+  s.value = (int32_t)luaL_checknumber (L, 2);
   s.decimals = luaL_checknumber (L, 3);
   size_t len;
   const char *str = luaL_checklstring (L, 4, &len);
@@ -86,19 +101,33 @@ static int rtcfifo_put (lua_State *L)
 }
 
 
-static int extract_sample (lua_State *L, const sample_t *s)
+static void push_tag (lua_State *L, uint32_t tag)
 {
-  lua_pushnumber (L, s->timestamp);
-  lua_pushnumber (L, s->value);
-  lua_pushnumber (L, s->decimals);
   union {
     uint32_t u;
     char s[4];
-  } conv = { s->tag };
+  } conv = { tag };
   if (conv.s[3] == 0)
     lua_pushstring (L, conv.s);
   else
     lua_pushlstring (L, conv.s, 4);
+}
+
+static void push_value (lua_State *L, const sample_t *s)
+{
+  // packed storage keeps signed 32 bit values
+  if (rtc_fifo_is_packed ())
+    lua_pushnumber (L, (int32_t)s->value);
+  else
+    lua_pushnumber (L, s->value);
+}
+
+static int extract_sample (lua_State *L, const sample_t *s)
+{
+  lua_pushnumber (L, s->timestamp);
+  push_value (L, s);
+  lua_pushnumber (L, s->decimals);
+  push_tag (L, s->tag);
   return 4;
 }
 
@@ -142,6 +171,71 @@ static int rtcfifo_drop (lua_State *L)
 }
 
 
+static void put_le (luaL_Buffer *b, uint32_t val, int len)
+{
+  while (len--)
+  {
+    luaL_addchar (b, val & 0xff);
+    val >>= 8;
+  }
+}
+
+// samples = rtcfifo.drain ([max[, "blob"]])
+static int rtcfifo_drain (lua_State *L)
+{
+  check_fifo_magic (L);
+
+  uint32_t max = rtc_fifo_get_count ();
+  if (lua_isnumber (L, 1))
+  {
+    lua_Number n = lua_tonumber (L, 1);
+    luaL_argcheck (L, n >= 0, 1, "negative count");
+    if (n < max)
+      max = (uint32_t)n;
+  }
+
+  const char *fmt = luaL_optstring (L, 2, "table");
+  sample_t s;
+  uint32_t i;
+
+  if (strcmp (fmt, "blob") == 0)
+  {
+    // 13 bytes per sample: timestamp, value (uint32 LE), neg_e, name (4 bytes)
+    luaL_Buffer b;
+    luaL_buffinit (L, &b);
+    for (i = 0; i < max && rtc_fifo_pop_sample (&s); ++i)
+    {
+      put_le (&b, s.timestamp, 4);
+      put_le (&b, s.value, 4);
+      put_le (&b, s.decimals, 1);
+      put_le (&b, s.tag, 4);
+    }
+    luaL_pushresult (&b);
+  }
+  else if (strcmp (fmt, "table") == 0)
+  {
+    lua_createtable (L, max, 0);
+    for (i = 0; i < max && rtc_fifo_pop_sample (&s); ++i)
+    {
+      lua_createtable (L, 0, 4);
+      lua_pushnumber (L, s.timestamp);
+      lua_setfield (L, -2, "timestamp");
+      push_value (L, &s);
+      lua_setfield (L, -2, "value");
+      lua_pushnumber (L, s.decimals);
+      lua_setfield (L, -2, "neg_e");
+      push_tag (L, s.tag);
+      lua_setfield (L, -2, "name");
+      lua_rawseti (L, -2, i + 1);
+    }
+  }
+  else
+    return luaL_error (L, "unknown format");
+
+  return 1;
+}
+
+
 // num = rtcfifo.count ()
 static int rtcfifo_count (lua_State *L)
 {
@@ -152,14 +246,119 @@ static int rtcfifo_count (lua_State *L)
 }
 
 
+static uint32_t get_opt_field (lua_State *L, const char *key, uint32_t def)
+{
+  lua_getfield (L, 1, key);
+  if (lua_isnumber (L, -1))
+    def = lua_tonumber (L, -1);
+  lua_pop (L, 1);
+  return def;
+}
+
+// rtcfifo.batch ([{size=n, deadline=s, rf_ma=x, awake_ma=y, sleep_ua=z}])
+static int rtcfifo_batch (lua_State *L)
+{
+  check_fifo_magic (L);
+
+  if (lua_isnoneornil (L, 1))
+  {
+    rtc_batch_disable ();
+    return 0;
+  }
+  luaL_checktype (L, 1, LUA_TTABLE);
+
+  uint32_t size = get_opt_field (L, "size", 0);
+  uint32_t deadline = get_opt_field (L, "deadline", 0);
+  uint32_t rf_ma = get_opt_field (L, "rf_ma", RTC_BATCH_DEFAULT_RF_MA);
+  uint32_t awake_ma = get_opt_field (L, "awake_ma", RTC_BATCH_DEFAULT_AWAKE_MA);
+  uint32_t sleep_ua = get_opt_field (L, "sleep_ua", RTC_BATCH_DEFAULT_SLEEP_UA);
+
+  if (size == 0 && deadline == 0)
+    return luaL_error (L, "need size or deadline");
+  if (size > 0xffff || rf_ma > 0x3ff || awake_ma > 0x3ff || sleep_ua > 0xfff)
+    return luaL_error (L, "value out of range");
+
+  rtc_batch_prepare (size, deadline, rf_ma, awake_ma, sleep_ua);
+  return 0;
+}
+
+static void check_batch_magic (lua_State *L)
+{
+  check_fifo_magic (L);
+  if (!rtc_batch_check_magic ())
+    luaL_error (L, "rtcfifo batching not configured!");
+}
+
+// The radio is only unavailable when woken from a deep sleep we set up with RF disabled
+static uint8_t batch_rf_now (void)
+{
+  return system_get_rst_info ()->reason != REASON_DEEP_SLEEP_AWAKE ||
+         rtc_batch_rf_on_wake ();
+}
+
+
+// due, rf = rtcfifo.batch_due ()
+static int rtcfifo_batch_due (lua_State *L)
+{
+  check_batch_magic (L);
+
+  lua_pushboolean (L, rtc_batch_is_due ());
+  lua_pushboolean (L, batch_rf_now ());
+  return 2;
+}
+
+
+// stats = rtcfifo.batch_stats ([reset])
+static int rtcfifo_batch_stats (lua_State *L)
+{
+  check_batch_magic (L);
+
+  lua_createtable (L, 0, 6);
+  lua_pushnumber (L, rtc_mem_read (RTC_BATCH_WAKES_POS));
+  lua_setfield (L, -2, "wakes");
+  lua_pushnumber (L, rtc_mem_read (RTC_BATCH_RFWAKES_POS));
+  lua_setfield (L, -2, "rf_wakes");
+  lua_pushnumber (L, rtc_mem_read (RTC_BATCH_AWAKE_MS_POS));
+  lua_setfield (L, -2, "awake_ms");
+  lua_pushnumber (L, rtc_mem_read (RTC_BATCH_RF_MS_POS));
+  lua_setfield (L, -2, "rf_ms");
+  lua_pushnumber (L, rtc_mem_read (RTC_BATCH_SLEEP_MS_POS));
+  lua_setfield (L, -2, "sleep_ms");
+  lua_pushnumber (L, rtc_batch_charge_uah ());
+  lua_setfield (L, -2, "charge_uah");
+
+  if (lua_toboolean (L, 1))
+    rtc_batch_reset_stats ();
+  return 1;
+}
+
+
 #ifdef LUA_USE_MODULES_RTCTIME
+static void batch_deep_sleep (uint32_t min_us)
+{
+  // the same clock and rounding as rtc_fifo_deep_sleep_until_sample(), so
+  // batched and unbatched wake-ups land on the same sample boundaries
+  uint32_t sleep_us = rtctime_us_until_aligned (rtc_mem_read (RTC_ALIGNMENT_POS), min_us);
+
+  // only wake with RF enabled if the next wake-up completes the batch
+  uint8_t rf_next = rtc_batch_due_after ((sleep_us + 999999) / 1000000,
+                                         rtc_batch_samples_per_wake ());
+  rtc_batch_account (system_get_time () / 1000, sleep_us / 1000,
+                     batch_rf_now (), rf_next);
+  system_deep_sleep_set_option (rf_next ? 0 : 4);
+  rtctime_deep_sleep_us (sleep_us); // no return
+}
+
 // rtcfifo.dsleep_until_sample (min_sleep_us)
 static int rtcfifo_dsleep_until_sample (lua_State *L)
 {
   check_fifo_magic (L);
 
   uint32_t min_us = luaL_checknumber (L, 1);
-  rtc_fifo_deep_sleep_until_sample (min_us); // no return
+  if (rtc_batch_check_magic ())
+    batch_deep_sleep (min_us); // no return
+  else
+    rtc_fifo_deep_sleep_until_sample (min_us); // no return
   return 0;
 }
 #endif
@@ -173,6 +372,10 @@ static const LUA_REG_TYPE rtcfifo_map[] = {
   { LSTRKEY("peek"),                LFUNCVAL(rtcfifo_peek) },
   { LSTRKEY("drop"),                LFUNCVAL(rtcfifo_drop) },
   { LSTRKEY("count"),               LFUNCVAL(rtcfifo_count) },
+  { LSTRKEY("drain"),               LFUNCVAL(rtcfifo_drain) },
+  { LSTRKEY("batch"),               LFUNCVAL(rtcfifo_batch) },
+  { LSTRKEY("batch_due"),           LFUNCVAL(rtcfifo_batch_due) },
+  { LSTRKEY("batch_stats"),         LFUNCVAL(rtcfifo_batch_stats) },
 #ifdef LUA_USE_MODULES_RTCTIME
   { LSTRKEY("dsleep_until_sample"), LFUNCVAL(rtcfifo_dsleep_until_sample) },
 #endif
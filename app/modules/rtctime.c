@@ -91,6 +91,11 @@ void rtctime_deep_sleep_until_aligned_us (uint32_t align_us, uint32_t min_us)
   rtc_time_deep_sleep_until_aligned (align_us, min_us);
 }
 
+uint32_t rtctime_us_until_aligned (uint32_t align_us, uint32_t min_us)
+{
+  return rtc_time_us_until_aligned (align_us, min_us);
+}
+
 void rtctime_gmtime (const int32 stamp, struct rtc_tm *r)
 {
   int32_t i;
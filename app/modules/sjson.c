@@ -682,7 +682,10 @@ static int sjson_encoder(lua_State *L) {
 
 static void encode_lua_object(lua_State *L, ENC_DATA *data, int argno, const char *prefix, const char *suffix) {
   luaL_Buffer b;
-  luaL_buffinit(L, &b);
+  if (argno < 0) {
+    argno = lua_gettop(L) + argno + 1;
+  }
+  luaL_buffinitsize(L, &b, 0);
 
   luaL_addstring(&b, prefix);
 
@@ -901,7 +904,7 @@ static void sjson_encoder_make_next_chunk(lua_State *L, ENC_DATA *data) {
 
 static int sjson_encoder_read_int(lua_State *L, ENC_DATA *data, int readsize) {
   luaL_Buffer b;
-  luaL_buffinit(L, &b);
+  luaL_buffinitsize(L, &b, readsize);
 
   size_t len;
 
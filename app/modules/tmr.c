@@ -73,7 +73,8 @@ static const char* MAX_TIMEOUT_ERR_STR = "Range: 1-"STRINGIFY(MAX_TIMEOUT_DEF);
 
 typedef struct{
 	os_timer_t os;
-	sint32_t lua_ref, self_ref;
+	luaL_Callback cb;
+	sint32_t self_ref;
 	uint32_t interval;
 	uint8_t mode;
 }timer_struct_t;
@@ -99,9 +100,9 @@ static os_timer_t rtc_timer;
 static void alarm_timer_common(void* arg){
 	timer_t tmr = (timer_t)arg;
 	lua_State* L = lua_getstate();
-	if(tmr->lua_ref == LUA_NOREF)
+	if(!luaL_cbisset(&tmr->cb))
 		return;
-	lua_rawgeti(L, LUA_REGISTRYINDEX, tmr->lua_ref);
+	luaL_cbpush(L, &tmr->cb);
 	if (tmr->self_ref == LUA_REFNIL) {
 		uint32_t id = tmr - alarm_timers;
 		lua_pushinteger(L, id);
@@ -110,8 +111,7 @@ static void alarm_timer_common(void* arg){
 	}
 	//if the timer was set to single run we clean up after it
 	if(tmr->mode == TIMER_MODE_SINGLE){
-		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
-		tmr->lua_ref = LUA_NOREF;
+		luaL_cbunref(L, &tmr->cb);
 		tmr->mode = TIMER_MODE_OFF;
 	}else if(tmr->mode == TIMER_MODE_SEMI){
 		tmr->mode |= TIMER_IDLE_FLAG;
@@ -171,14 +171,11 @@ static int tmr_register(lua_State* L){
 	luaL_argcheck(L, (mode == TIMER_MODE_SINGLE || mode == TIMER_MODE_SEMI || mode == TIMER_MODE_AUTO), 3, "Invalid mode");
 	luaL_argcheck(L, (lua_type(L, 4) == LUA_TFUNCTION || lua_type(L, 4) == LUA_TLIGHTFUNCTION), 4, "Must be function");
 	//get the lua function reference
-	lua_pushvalue(L, 4);
-	sint32_t ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
 		os_timer_disarm(&tmr->os);
-	//there was a bug in this part, the second part of the following condition was missing
-	if(tmr->lua_ref != LUA_NOREF && tmr->lua_ref != ref)
-		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
-	tmr->lua_ref = ref;
+	//this also releases the previous function
+	lua_pushvalue(L, 4);
+	luaL_cbref(L, &tmr->cb);
 	tmr->mode = mode|TIMER_IDLE_FLAG;
 	tmr->interval = interval;
 	os_timer_setfn(&tmr->os, alarm_timer_common, tmr);
@@ -264,9 +261,7 @@ static int tmr_unregister(lua_State* L){
 
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
 		os_timer_disarm(&tmr->os);
-	if(tmr->lua_ref != LUA_NOREF)
-		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
-	tmr->lua_ref = LUA_NOREF;
+	luaL_cbunref(L, &tmr->cb);
 	tmr->mode = TIMER_MODE_OFF; 
 	return 0;
 }
@@ -370,7 +365,7 @@ static int tmr_create( lua_State *L ) {
 	if (!ud) return luaL_error(L, "not enough memory");
 	luaL_getmetatable(L, "tmr.timer");
 	lua_setmetatable(L, -2);
-	ud->lua_ref = LUA_NOREF;
+	luaL_cbinit(&ud->cb);
 	ud->self_ref = LUA_NOREF;
 	ud->mode = TIMER_MODE_OFF;
 	os_timer_disarm(&ud->os);
@@ -430,7 +425,7 @@ int luaopen_tmr( lua_State *L ){
 	luaL_rometatable(L, "tmr.timer", (void *)tmr_dyn_map);
 
 	for(i=0; i<NUM_TMR; i++){
-		alarm_timers[i].lua_ref = LUA_NOREF;
+		luaL_cbinit(&alarm_timers[i].cb);
 		alarm_timers[i].self_ref = LUA_REFNIL;
 		alarm_timers[i].mode = TIMER_MODE_OFF;
 		os_timer_disarm(&alarm_timers[i].os);
@@ -8,17 +8,17 @@
 #include "c_string.h"
 #include "rom.h"
 
-static int uart_receive_rf = LUA_NOREF;
+static luaL_Callback uart_receive_cb = { NULL, LUA_NOREF };
 bool run_input = true;
 bool uart_on_data_cb(const char *buf, size_t len){
   if(!buf || len==0)
     return false;
-  if(uart_receive_rf == LUA_NOREF)
+  if(!luaL_cbisset(&uart_receive_cb))
     return false;
   lua_State *L = lua_getstate();
   if(!L)
     return false;
-  lua_rawgeti(L, LUA_REGISTRYINDEX, uart_receive_rf);
+  luaL_cbpush(L, &uart_receive_cb);
   lua_pushlstring(L, buf, len);
   lua_call(L, 1, 0);
   return !run_input;
@@ -69,17 +69,9 @@ static int l_uart_on( lua_State* L )
   }
   if(sl == 4 && c_strcmp(method, "data") == 0){
     run_input = true;
-    if(uart_receive_rf != LUA_NOREF){
-      luaL_unref(L, LUA_REGISTRYINDEX, uart_receive_rf);
-      uart_receive_rf = LUA_NOREF;
-    }
-    if(!lua_isnil(L, -1)){
-      uart_receive_rf = luaL_ref(L, LUA_REGISTRYINDEX);
-      if(run==0)
-        run_input = false;
-    } else {
-      lua_pop(L, 1);
-    }
+    if(!lua_isnil(L, -1) && run==0)
+      run_input = false;
+    luaL_cbref(L, &uart_receive_cb);  // a nil just releases the old callback
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
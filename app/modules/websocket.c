@@ -6,6 +6,10 @@
 // ws:on("receive", function(_, data, opcode) print(data) end)
 // ws:on("close", function(_, reasonCode) print('ws closed', reasonCode) end)
 // ws:connect('ws://echo.websocket.org')
+//
+// srv = websocket.createServer()
+// srv:on("receive", function(srv, id, data, opcode) srv:broadcast(data) end)
+// srv:listen(80)
 
 #include "lmem.h"
 #include "lualib.h"
@@ -18,8 +22,13 @@
 #include "c_stdlib.h"
 
 #include "websocketclient.h"
+#include "websocketserver.h"
 
 #define METATABLE_WSCLIENT "websocket.client"
+#define METATABLE_WSSERVER "websocket.server"
+
+#define WSSERVER_DEFAULT_TIMEOUT 30
+#define WSSERVER_DEFAULT_MAX_PAYLOAD 4096
 
 typedef struct ws_data {
   int self_ref;
@@ -46,7 +55,7 @@ static void websocketclient_onConnectionCallback(ws_info *ws) {
   }
 }
 
-static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *message, int opCode) {
+static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *message, int opCode, int isFin) {
   NODE_DBG("websocketclient_onReceiveCallback\n");
 
   lua_State *L = lua_getstate();
@@ -62,7 +71,8 @@ static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *messag
     lua_rawgeti(L, LUA_REGISTRYINDEX, data->self_ref);  // pass itself, #1 callback argument
     lua_pushlstring(L, message, len); // #2 callback argument
     lua_pushnumber(L, opCode); // #3 callback argument
-    lua_call(L, 3, 0);
+    lua_pushboolean(L, isFin); // #4 callback argument, false while more pieces of a streamed message follow
+    lua_call(L, 4, 0);
   }
 }
 
@@ -104,6 +114,8 @@ static int websocket_createClient(lua_State *L) {
   ws_info *ws = (ws_info *) lua_newuserdata(L, sizeof(ws_info));
   ws->connectionState = 0;
   ws->extraHeaders = NULL;
+  ws->streamThreshold = 0;
+  ws->wantDeflate = false;
   ws->onConnection = &websocketclient_onConnectionCallback;
   ws->onReceive = &websocketclient_onReceiveCallback;
   ws->onFailure = &websocketclient_onCloseCallback;
@@ -236,6 +248,16 @@ static int websocketclient_config(lua_State *L) {
   }
   lua_pop(L, 1); // pop headers
 
+  lua_getfield(L, 2, "stream");
+  if (!lua_isnil(L, -1))
+    ws->streamThreshold = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "deflate");
+  if (!lua_isnil(L, -1))
+    ws->wantDeflate = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
   return 0;
 }
 
@@ -307,9 +329,247 @@ static int websocketclient_gc(lua_State *L) {
   return 0;
 }
 
+typedef struct wsserver_data {
+  wss_server server;
+  int self_ref;
+  int onConnection;
+  int onReceive;
+  int onDisconnection;
+} wsserver_data;
+
+static void websocketserver_onConnectionCallback(wss_server *server, wss_client *client) {
+  NODE_DBG("websocketserver_onConnectionCallback\n");
+  wsserver_data *data = (wsserver_data *) server->reservedData;
+
+  if (data->self_ref != LUA_NOREF && data->onConnection != LUA_NOREF) {
+    lua_State *L = lua_getstate();
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->onConnection); // load the callback function
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->self_ref);  // pass itself, #1 callback argument
+    lua_pushinteger(L, client->id); // #2 callback argument
+    if (client->protocol != NULL)
+      lua_pushstring(L, client->protocol); // #3 callback argument
+    else
+      lua_pushnil(L);
+    lua_call(L, 3, 0);
+  }
+}
+
+static void websocketserver_onReceiveCallback(wss_server *server, wss_client *client, int len, char *message, int opCode) {
+  NODE_DBG("websocketserver_onReceiveCallback\n");
+  wsserver_data *data = (wsserver_data *) server->reservedData;
+
+  if (data->self_ref != LUA_NOREF && data->onReceive != LUA_NOREF) {
+    lua_State *L = lua_getstate();
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->onReceive); // load the callback function
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->self_ref);  // pass itself, #1 callback argument
+    lua_pushinteger(L, client->id); // #2 callback argument
+    lua_pushlstring(L, message, len); // #3 callback argument
+    lua_pushnumber(L, opCode); // #4 callback argument
+    lua_call(L, 4, 0);
+  }
+}
+
+static void websocketserver_onDisconnectionCallback(wss_server *server, wss_client *client) {
+  NODE_DBG("websocketserver_onDisconnectionCallback\n");
+  wsserver_data *data = (wsserver_data *) server->reservedData;
+
+  if (data->self_ref != LUA_NOREF && data->onDisconnection != LUA_NOREF) {
+    lua_State *L = lua_getstate();
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->onDisconnection); // load the callback function
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->self_ref);  // pass itself, #1 callback argument
+    lua_pushinteger(L, client->id); // #2 callback argument
+    lua_call(L, 2, 0);
+  }
+}
+
+// Lua: srv = websocket.createServer([timeout[, max_payload[, protocols]]])
+static int websocket_createServer(lua_State *L) {
+  NODE_DBG("websocket_createServer\n");
+
+  int timeout = luaL_optint(L, 1, WSSERVER_DEFAULT_TIMEOUT);
+  int maxPayload = luaL_optint(L, 2, WSSERVER_DEFAULT_MAX_PAYLOAD);
+  const char *protocols = luaL_optstring(L, 3, NULL);
+  if (timeout < 0 || maxPayload <= 0)
+    return luaL_error(L, "invalid argument");
+
+  wsserver_data *data = (wsserver_data *) lua_newuserdata(L, sizeof(wsserver_data));
+  c_memset(data, 0, sizeof(wsserver_data));
+  data->self_ref = LUA_NOREF; // only set while listening
+  data->onConnection = LUA_NOREF;
+  data->onReceive = LUA_NOREF;
+  data->onDisconnection = LUA_NOREF;
+
+  wss_server *server = &data->server;
+  server->timeout = timeout;
+  server->maxPayload = maxPayload;
+  server->onConnection = &websocketserver_onConnectionCallback;
+  server->onReceive = &websocketserver_onReceiveCallback;
+  server->onDisconnection = &websocketserver_onDisconnectionCallback;
+  server->reservedData = data;
+
+  // set its metatable
+  luaL_getmetatable(L, METATABLE_WSSERVER);
+  lua_setmetatable(L, -2);
+
+  if (protocols != NULL) {
+    char *copy = (char *) c_malloc(strlen(protocols) + 1);
+    if (copy == NULL)
+      return luaL_error(L, "out of memory");
+    strcpy(copy, protocols);
+    server->protocols = copy;
+  }
+
+  return 1;
+}
+
+// Lua: srv:on(event, function(srv, id, ...))
+static int websocketserver_on(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+
+  int handle = luaL_checkoption(L, 2, NULL, (const char * const[]){ "connection", "receive", "disconnection", NULL });
+  if (lua_type(L, 3) != LUA_TNIL && lua_type(L, 3) != LUA_TFUNCTION && lua_type(L, 3) != LUA_TLIGHTFUNCTION) {
+    return luaL_typerror(L, 3, "function or nil");
+  }
+
+  int *ref = handle == 0 ? &data->onConnection :
+             handle == 1 ? &data->onReceive : &data->onDisconnection;
+  luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+  *ref = LUA_NOREF;
+
+  if (lua_type(L, 3) != LUA_TNIL) {
+    lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
+    *ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 0;
+}
+
+// Lua: srv:listen(port[, ip])
+static int websocketserver_listen(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+  uint16_t port = luaL_checkinteger(L, 2);
+  const char *domain = luaL_optstring(L, 3, "0.0.0.0");
+
+  if (data->server.pcb != NULL)
+    return luaL_error(L, "already listening");
+
+  ip_addr_t addr;
+  if (!ipaddr_aton(domain, &addr))
+    return luaL_error(L, "invalid IP address");
+
+  if (wss_listen(&data->server, &addr, port) != ERR_OK)
+    return luaL_error(L, "unable to listen");
+
+  if (data->self_ref == LUA_NOREF) {
+    lua_pushvalue(L, 1);  // keep alive while listening
+    data->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 0;
+}
+
+static wss_client *websocketserver_checkclient(lua_State *L, wsserver_data *data) {
+  wss_client *client = wss_find(&data->server, luaL_checkinteger(L, 2));
+  if (client == NULL)
+    luaL_error(L, "no such client");
+  return client;
+}
+
+// Lua: ok = srv:send(id, data[, opcode])
+static int websocketserver_send(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+  wss_client *client = websocketserver_checkclient(L, data);
+
+  size_t msgLength;
+  const char *msg = luaL_checklstring(L, 3, &msgLength);
+  int opCode = luaL_optint(L, 4, WS_OPCODE_TEXT);
+
+  lua_pushboolean(L, wss_send(client, opCode, msg, msgLength) == ERR_OK);
+  return 1;
+}
+
+// Lua: count = srv:broadcast(data[, opcode])
+static int websocketserver_broadcast(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+
+  size_t msgLength;
+  const char *msg = luaL_checklstring(L, 2, &msgLength);
+  int opCode = luaL_optint(L, 3, WS_OPCODE_TEXT);
+
+  lua_pushinteger(L, wss_broadcast(&data->server, opCode, msg, msgLength));
+  return 1;
+}
+
+// Lua: srv:disconnect(id)
+static int websocketserver_disconnect(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+  wss_client *client = websocketserver_checkclient(L, data);
+
+  wss_disconnect(client);
+  return 0;
+}
+
+// Lua: port, ip = srv:getpeer(id)
+static int websocketserver_getpeer(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+  wss_client *client = websocketserver_checkclient(L, data);
+
+  char addr_str[16];
+  c_memset(addr_str, 0, sizeof(addr_str));
+  ets_sprintf(addr_str, IPSTR, IP2STR(&client->pcb->remote_ip.addr));
+  lua_pushinteger(L, client->pcb->remote_port);
+  lua_pushstring(L, addr_str);
+  return 2;
+}
+
+// Lua: srv:close()
+static int websocketserver_close(lua_State *L) {
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+
+  wss_close(&data->server);
+
+  if (data->self_ref != LUA_NOREF) {
+    lua_gc(L, LUA_GCSTOP, 0); // required to avoid freeing the server while in use
+    luaL_unref(L, LUA_REGISTRYINDEX, data->self_ref);
+    data->self_ref = LUA_NOREF;
+    lua_gc(L, LUA_GCRESTART, 0);
+  }
+  return 0;
+}
+
+static int websocketserver_gc(lua_State *L) {
+  NODE_DBG("websocketserver_gc\n");
+  wsserver_data *data = (wsserver_data *) luaL_checkudata(L, 1, METATABLE_WSSERVER);
+
+  data->self_ref = LUA_NOREF; // no more callbacks
+  wss_close(&data->server);
+  if (data->server.protocols != NULL) {
+    c_free((char *) data->server.protocols);
+    data->server.protocols = NULL;
+  }
+
+  luaL_unref(L, LUA_REGISTRYINDEX, data->onConnection);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->onReceive);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->onDisconnection);
+  return 0;
+}
+
 static const LUA_REG_TYPE websocket_map[] =
 {
   { LSTRKEY("createClient"), LFUNCVAL(websocket_createClient) },
+  { LSTRKEY("createServer"), LFUNCVAL(websocket_createServer) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE websocketserver_map[] =
+{
+  { LSTRKEY("on"), LFUNCVAL(websocketserver_on) },
+  { LSTRKEY("listen"), LFUNCVAL(websocketserver_listen) },
+  { LSTRKEY("send"), LFUNCVAL(websocketserver_send) },
+  { LSTRKEY("broadcast"), LFUNCVAL(websocketserver_broadcast) },
+  { LSTRKEY("disconnect"), LFUNCVAL(websocketserver_disconnect) },
+  { LSTRKEY("getpeer"), LFUNCVAL(websocketserver_getpeer) },
+  { LSTRKEY("close"), LFUNCVAL(websocketserver_close) },
+  { LSTRKEY("__gc" ), LFUNCVAL(websocketserver_gc) },
+  { LSTRKEY("__index"), LROVAL(websocketserver_map) },
   { LNILKEY, LNILVAL }
 };
 
@@ -327,6 +587,7 @@ static const LUA_REG_TYPE websocketclient_map[] =
 
 int loadWebsocketModule(lua_State *L) {
   luaL_rometatable(L, METATABLE_WSCLIENT, (void *) websocketclient_map);
+  luaL_rometatable(L, METATABLE_WSSERVER, (void *) websocketserver_map);
 
   return 0;
 }
@@ -197,6 +197,73 @@ PACK_STRUCT_END
 
 #define SIZEOF_MDNS_SERVICE 6
 
+/* TTLs of the records we own. Unicast replies are capped to MDNS_UNICAST_TTL */
+#define MDNS_RR_TTL               300
+#define MDNS_SD_TTL               3600
+#define MDNS_UNICAST_TTL          10
+
+/* A record is not multicast again within this many ms (RFC 6762, section 6) */
+#define MDNS_MCAST_INTERVAL       1000
+
+/* Scratch space for serializing the records, they are copied out afterwards */
+#define MDNS_RECORDS_SIZE         (DNS_MSG_SIZE * 2)
+
+/* Longest encoded name accepted from the network. Records with longer names
+ * stop the parsing of the packet they're in. */
+#define MDNS_NAME_MAX             128
+
+/* Number of records held in the client cache */
+#define MDNS_CACHE_MAX            24
+
+#define MDNS_RDLEN_INVALID        0xffff
+
+/* The records we answer with. They are serialized once, without name
+ * compression, whenever the registration changes, so answering a query is
+ * just a matter of copying them into the packet. */
+enum {
+  MDNS_RR_SD_PTR,       /* _services._dns-sd._udp.local PTR <service> */
+  MDNS_RR_SVC_PTR,      /* <service> PTR <instance> */
+  MDNS_RR_TXT,          /* <instance> TXT */
+  MDNS_RR_SRV,          /* <instance> SRV <host> */
+  MDNS_RR_A,            /* <host> A */
+  MDNS_RR_HOST_NSEC,    /* <host> only has an A record */
+  MDNS_RR_INST_NSEC,    /* <instance> only has TXT and SRV records */
+  MDNS_RR_SD_NSEC,      /* _services._dns-sd._udp.local only has a PTR record */
+  MDNS_RR_SVC_NSEC,     /* <service> only has a PTR record */
+  MDNS_RR_COUNT
+};
+#define RR(n)  (1 << (n))
+
+struct mdns_record {
+  u16_t off;            /* start of the owner name in mdns_records */
+  u16_t hdr;            /* offset of the type/class/ttl/len block from the owner name */
+  u16_t len;            /* total length, including the rdata */
+  u16_t type;
+  u16_t ttl;            /* multicast TTL */
+  u8_t unique;          /* set the cache flush bit when multicast */
+  u32_t last_mcast;     /* mdns_now() of the last multicast */
+};
+
+/** A resource record parsed from a received packet, names are expanded */
+struct mdns_rr_view {
+  u16_t type;
+  u16_t class;
+  u32_t ttl;
+  u16_t rdlen;          /* MDNS_RDLEN_INVALID if the rdata wasn't kept */
+  u8_t name[MDNS_NAME_MAX];
+  u8_t rdata[MDNS_NAME_MAX + SIZEOF_MDNS_SERVICE];
+};
+
+/** A record learnt from a response */
+struct mdns_cache_rr {
+  struct mdns_cache_rr *next;
+  u32_t expires;        /* mdns_now() at which it goes stale */
+  u32_t ttl;            /* seconds, as received */
+  u16_t type;
+  u16_t rdlen;
+  u8_t data[1];         /* encoded owner name, followed by the expanded rdata */
+};
+
 static os_timer_t mdns_timer;
 /* forward declarations */
 static void mdns_recv(void *s, struct udp_pcb *pcb, struct pbuf *p,
@@ -214,78 +281,131 @@ static struct ip_addr multicast_addr;
 static uint8 register_flag = 0;
 static uint8 mdns_flag = 0;
 static u8_t *mdns_payload;
+static u8_t *mdns_payload_end;
+
+static u8_t *mdns_records;
+static struct mdns_record mdns_rr[MDNS_RR_COUNT];
+static u16_t mdns_mcast_sent;   /* records with a valid last_mcast */
+
+static struct mdns_cache_rr *mdns_cache;
+static u8_t mdns_cache_count;
+static u8_t mdns_caching;       /* only keep records once a lookup was made */
+static void (*mdns_update_cb)(void);
 
 /**
- * Compare the "dotted" name "query" with the encoded name "response"
- * to make sure an answer from the DNS server matches the current mdns_table
- * entry (otherwise, answers might arrive late for hostname not on the list
- * any more).
- *
- * @param query hostname (not encoded) from the mdns_table
- * @param response encoded hostname in the DNS response
- * @return 0: names equal; 1: names differ
+ * Milliseconds since boot. system_get_time() wraps after 71 minutes, so the
+ * elapsed time is accumulated, which is fine as we're called for every packet.
  */
-static u8_t ICACHE_FLASH_ATTR
-mdns_compare_name(unsigned char *query, unsigned char *response, unsigned char *pktbase) {
-	unsigned char n;
-
-	do {
-		n = *response++;
-		/** @see RFC 1035 - 4.1.4. Message compression */
-		if ((n & 0xc0) == 0xc0) {
-		  	n = ((n << 8) + *response) & 0x3fff;
-			if (n < response - pktbase) {
-			  response = pktbase + n;
-			} else {
-			  return 1;
-			}
-		} else {
-			/* Not compressed name */
-			while (n > 0) {
-				char q = *query;
-				if (q >= 'A' && q <= 'Z') {
-				  q = q + 'a' - 'A';
-				}
-				char r = *response;
-				if (r >= 'A' && r <= 'Z') {
-				  r = r + 'a' - 'A';
-				}
-				if (q != r) {
-					return 1;
-				}
-				++response;
-				++query;
-				--n;
-			};
-			++query;
-		}
-	} while (*response != 0);
+static u32_t
+mdns_now(void) {
+  static u32_t last_us, ms, frac;
+  u32_t us = system_get_time();
+  u32_t elapsed = us - last_us + frac;
+
+  last_us = us;
+  ms += elapsed / 1000;
+  frac = elapsed % 1000;
 
-	return 0;
+  return ms;
 }
 
-static int 
-mdns_namelen(u8_t *p, unsigned int maxlen) {
-  u8_t *orig = p;
+static u8_t
+mdns_tolower(u8_t c) {
+  return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+/**
+ * Compare two encoded, uncompressed names, ignoring case.
+ *
+ * @return 1: names equal; 0: names differ
+ */
+static u8_t
+mdns_name_equal(const u8_t *a, const u8_t *b) {
+  for (;;) {
+    u8_t n = *a;
 
-  while (*p && *p <= 63) {
-    if (p - orig > maxlen) {
-      return -1;
+    if (n != *b) {
+      return 0;
+    }
+    if (!n) {
+      return 1;
+    }
+    for (a++, b++; n > 0; n--) {
+      if (mdns_tolower(*a++) != mdns_tolower(*b++)) {
+        return 0;
+      }
     }
-    p += *p + 1;
   }
+}
 
-  if (*p >= 0xc0) {
-    p += 2;	// advance over the two byte pointer
-  } else {
-    p++;	// advance over the final 0
+/* Length of an encoded, uncompressed name including the final 0 */
+static int
+mdns_name_len(const u8_t *name) {
+  const u8_t *p = name;
+
+  while (*p) {
+    p += *p + 1;
   }
 
-  if (p - orig > maxlen) {
-    return -1;
+  return p + 1 - name;
+}
+
+/**
+ * Expand a possibly compressed name in the received packet.
+ *
+ * @param p start of the name
+ * @param out receives the uncompressed name
+ * @return pointer past the name in the packet, or NULL if malformed or too long
+ */
+static u8_t *
+mdns_expand_name(u8_t *p, u8_t *out, int outlen) {
+  u8_t *next = NULL;
+  u8_t *out_end = out + outlen;
+  int jumps = 0;
+
+  while (p < mdns_payload_end) {
+    u8_t n = *p;
+
+    /** @see RFC 1035 - 4.1.4. Message compression */
+    if ((n & 0xc0) == 0xc0) {
+      if (p + 1 >= mdns_payload_end || ++jumps > 16) {
+        return NULL;
+      }
+      if (!next) {
+        next = p + 2;
+      }
+      p = mdns_payload + (((n & 0x3f) << 8) | p[1]);
+      continue;
+    }
+    if (n & 0xc0 || p + 1 + n > mdns_payload_end || out + 1 + n > out_end) {
+      return NULL;
+    }
+    *out++ = n;
+    memcpy(out, p + 1, n);
+    out += n;
+    p += n + 1;
+    if (!n) {
+      return next ? next : p;
+    }
   }
 
-  return p - orig;
+  return NULL;
+}
+
+/* Convert an encoded, uncompressed name into the dotted form */
+static void
+mdns_name_to_str(const u8_t *name, char *buf, int buflen) {
+  char *p = buf;
+
+  while (*name && (p - buf) + *name + 2 <= buflen) {
+    if (p != buf) {
+      *p++ = '.';
+    }
+    memcpy(p, name + 1, *name);
+    p += *name;
+    name += *name + 1;
+  }
+  *p = 0;
 }
 
 /* Copy an unencoded name into an encoded name */
@@ -308,6 +428,12 @@ static unsigned char *copy_and_encode_name(unsigned char *ptr, const char *name)
   return ptr;
 }
 
+/* The interface whose address goes into our A record */
+static struct netif *
+mdns_local_netif(void) {
+  return (struct netif *)eagle_lwip_getif(wifi_get_opmode() == 0x02 ? 0x01 : 0x00);
+}
+
 static err_t send_packet(struct pbuf *p, struct ip_addr *dst_addr, u16_t dst_port, u8_t *addr_ptr) {
   err_t err;
   /* send dns packet */
@@ -315,17 +441,12 @@ static err_t send_packet(struct pbuf *p, struct ip_addr *dst_addr, u16_t dst_por
   struct netif *ap_netif =  (struct netif *)eagle_lwip_getif(0x01);
 
   if (addr_ptr) {
-    if (wifi_get_opmode() == 0x02) {
-      if (!ap_netif) {
-	return;
-      }
-      memcpy(addr_ptr, &ap_netif->ip_addr, sizeof(ap_netif->ip_addr));
-    } else {
-      if (!sta_netif) {
-	return;
-      }
-      memcpy(addr_ptr, &sta_netif->ip_addr, sizeof(sta_netif->ip_addr));
+    struct netif *netif = mdns_local_netif();
+    if (!netif) {
+      pbuf_free(p);
+      return ERR_IF;
     }
+    memcpy(addr_ptr, &netif->ip_addr, sizeof(netif->ip_addr));
   }
 
   if (dst_addr) {
@@ -350,508 +471,705 @@ static err_t send_packet(struct pbuf *p, struct ip_addr *dst_addr, u16_t dst_por
 
   return err;
 }
+
+/*-----------------------------------------------------------------------------
+ * Responder records
+ *----------------------------------------------------------------------------*/
+
+/* Start a record, reserving the fixed block and checking for rdmax bytes of rdata */
+static u8_t *
+rr_begin(u8_t *p, u8_t *end, int idx, const char *name, u16_t type, u8_t unique, u16_t ttl, int rdmax) {
+  struct mdns_record *rr = &mdns_rr[idx];
+
+  if (!p || end - p < (int) c_strlen(name) + 2 + SIZEOF_DNS_ANSWER + rdmax) {
+    return NULL;
+  }
+  rr->off = p - mdns_records;
+  rr->type = type;
+  rr->unique = unique;
+  rr->ttl = ttl;
+  p = copy_and_encode_name(p, name);
+  rr->hdr = p - (mdns_records + rr->off);
+
+  return p + SIZEOF_DNS_ANSWER;
+}
+
+/* Fill in the fixed block of a record now that the rdata length is known */
+static u8_t *
+rr_end(u8_t *p, int idx) {
+  struct mdns_record *rr = &mdns_rr[idx];
+  struct mdns_answer ans;
+  u8_t *start;
+
+  if (!p) {
+    return NULL;
+  }
+  start = mdns_records + rr->off;
+  ans.type = htons(rr->type);
+  ans.class = htons(DNS_RRCLASS_IN);
+  ans.ttl = htonl(rr->ttl);
+  ans.len = htons(p - (start + rr->hdr + SIZEOF_DNS_ANSWER));
+  MEMCPY(start + rr->hdr, &ans, SIZEOF_DNS_ANSWER);
+  rr->len = p - start;
+
+  return p;
+}
+
+/* NSEC record listing the types that exist for a name (types below 40 only) */
+static u8_t *
+rr_nsec(u8_t *p, u8_t *end, int idx, const char *name, u8_t unique, u8_t type1, u8_t type2) {
+  u8_t bitmap[5];
+  int n = sizeof(bitmap);
+
+  os_memset(bitmap, 0, sizeof(bitmap));
+  bitmap[type1 >> 3] |= 0x80 >> (type1 & 7);
+  if (type2) {
+    bitmap[type2 >> 3] |= 0x80 >> (type2 & 7);
+  }
+  while (n > 1 && !bitmap[n - 1]) {
+    n--;
+  }
+
+  p = rr_begin(p, end, idx, name, DNS_RRTYPE_NSEC, unique, MDNS_RR_TTL, c_strlen(name) + 2 + 2 + n);
+  if (p) {
+    p = copy_and_encode_name(p, name);
+    *p++ = 0;
+    *p++ = n;
+    memcpy(p, bitmap, n);
+    p += n;
+  }
+
+  return rr_end(p, idx);
+}
+
 /**
- * Send a mDNS packet for the service type
+ * Serialize all the records for the registration in info. This is only
+ * done when the registration changes.
  *
- * @param id transaction ID in the DNS query packet
- * @return ERR_OK if packet is sent; an err_t indicating the problem otherwise
+ * @return TRUE if the records were built
  */
-static err_t ICACHE_FLASH_ATTR
-mdns_send_service_type(u16_t id, struct ip_addr *dst_addr, u16_t dst_port) {
-	err_t err;
-	struct mdns_hdr *hdr;
-	struct mdns_answer ans;
-	struct mdns_a_rr a_rr;
-	struct mdns_service serv;
-	struct pbuf *p ,*p_sta;
-	char *query, *nptr;
-	const char *pHostname;
-	struct netif * sta_netif = NULL;
-	struct netif * ap_netif = NULL;
-	int max_ttl = dst_addr ? 10 : 7200;
-	char tmpBuf[PUCK_DATASHEET_SIZE + PUCK_SERVICE_LENGTH];
-	u8_t n;
-	u16_t length = 0;
-	/* if here, we have either a new query or a retry on a previous query to process */
-	p = pbuf_alloc(PBUF_TRANSPORT,
-			SIZEOF_DNS_HDR + MDNS_MAX_NAME_LENGTH * 2 + SIZEOF_DNS_QUERY, PBUF_RAM);
-	if (p != NULL) {
-		LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
-		/* fill dns header */
-		hdr = (struct mdns_hdr*) p->payload;
-		os_memset(hdr, 0, SIZEOF_DNS_HDR);
-		hdr->id = htons(id);
-		hdr->flags1 = DNS_FLAG1_RESPONSE;
-
-		pHostname = DNS_SD_SERVICE;
-		hdr->numanswers = htons(1);
-		query = (char*) hdr + SIZEOF_DNS_HDR;
-		--pHostname;
-		/* convert hostname into suitable query format. */
-		do {
-			++pHostname;
-			nptr = query;
-			++query;
-			for (n = 0; *pHostname != '.' && *pHostname != 0; ++pHostname) {
-				*query = *pHostname;
-				++query;
-				++n;
-			}
-			*nptr = n;
-		} while (*pHostname != 0);
-		*query++ = '\0';
-		/* fill dns query */
-
-
-		ans.type = htons(DNS_RRTYPE_PTR);
-		ans.class = htons(DNS_RRCLASS_IN);
-		ans.ttl = htonl(min(max_ttl, 3600));
-		ans.len = htons(os_strlen(service_name_with_suffix) + 1 +1 );
-		length = 0;
-
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-
-		/* resize the query */
-		query = query + SIZEOF_DNS_ANSWER;
-		pHostname = service_name_with_suffix;
-		--pHostname;
-
-		/* convert hostname into suitable query format. */
-		do {
-			++pHostname;
-			nptr = query;
-			++query;
-			for (n = 0; *pHostname != '.' && *pHostname != 0; ++pHostname) {
-				*query = *pHostname;
-				++query;
-				++n;
-			}
-			*nptr = n;
-		} while (*pHostname != 0);
-		*query++ = '\0';
+static bool ICACHE_FLASH_ATTR
+mdns_build_records(const struct nodemcu_mdns_info *info) {
+  char host[MDNS_NAME_MAX];
+  char instance[MDNS_NAME_MAX];
+  const char *attributes[12];
+  int attr_count = 0;
+  int txt_len = 0;
+  int i;
+  u8_t *buf, *p, *end;
+
+  if (c_strlen(info->host_name) + sizeof("." MDNS_LOCAL) > sizeof(host) ||
+      c_strlen(info->host_desc) + c_strlen(service_name_with_suffix) + 2 > sizeof(instance)) {
+    MDNS_DBG("Names too long\n");
+    return FALSE;
+  }
+  os_sprintf(host, "%s." MDNS_LOCAL, info->host_name);
+  os_sprintf(instance, "%s.%s", info->host_desc, service_name_with_suffix);
+
+  for (i = 0; i < 10 && info->txt_data[i] != NULL; i++) {
+    attributes[attr_count++] = info->txt_data[i];
+  }
+  static const char *defaults[] = { "platform=nodemcu", NULL };
+  for (i = 0; defaults[i] != NULL; i++) {
+    // See if this is a duplicate
+    int j;
+    int len = strchr(defaults[i], '=') + 1 - defaults[i];
+    for (j = 0; j < attr_count; j++) {
+      if (strncmp(attributes[j], defaults[i], len) == 0) {
+        break;
+      }
+    }
+    if (j == attr_count) {
+      attributes[attr_count++] = defaults[i];
+    }
+  }
+  for (i = 0; i < attr_count; i++) {
+    txt_len += min(c_strlen(attributes[i]), 255) + 1;
+  }
 
-		/* resize pbuf to the exact dns query */
-		pbuf_realloc(p, (query + length) - ((char*) (p->payload)));
+  buf = (u8_t *) os_malloc(MDNS_RECORDS_SIZE);
+  if (!buf) {
+    return FALSE;
+  }
+  mdns_records = buf;
+  end = buf + MDNS_RECORDS_SIZE;
 
-		err = send_packet(p, dst_addr, dst_port, 0);
+  p = rr_begin(buf, end, MDNS_RR_SD_PTR, DNS_SD_SERVICE, DNS_RRTYPE_PTR, 0, MDNS_SD_TTL,
+               c_strlen(service_name_with_suffix) + 2);
+  if (p) {
+    p = copy_and_encode_name(p, service_name_with_suffix);
+  }
+  p = rr_end(p, MDNS_RR_SD_PTR);
 
-	} else {
-		err = ERR_MEM;
-	}
+  p = rr_begin(p, end, MDNS_RR_SVC_PTR, service_name_with_suffix, DNS_RRTYPE_PTR, 0, MDNS_RR_TTL,
+               c_strlen(instance) + 2);
+  if (p) {
+    p = copy_and_encode_name(p, instance);
+  }
+  p = rr_end(p, MDNS_RR_SVC_PTR);
+
+  p = rr_begin(p, end, MDNS_RR_TXT, instance, DNS_RRTYPE_TXT, 1, MDNS_RR_TTL, txt_len);
+  for (i = 0; p && i < attr_count; i++) {
+    int len = min(c_strlen(attributes[i]), 255);
+    *p++ = len;
+    memcpy(p, attributes[i], len);
+    p += len;
+  }
+  p = rr_end(p, MDNS_RR_TXT);
+
+  p = rr_begin(p, end, MDNS_RR_SRV, instance, DNS_RRTYPE_SRV, 1, MDNS_RR_TTL,
+               SIZEOF_MDNS_SERVICE + c_strlen(host) + 2);
+  if (p) {
+    struct mdns_service serv;
+    serv.prior = htons(0);
+    serv.weight = htons(0);
+    serv.port = htons(info->service_port);
+    MEMCPY(p, &serv, SIZEOF_MDNS_SERVICE);
+    p = copy_and_encode_name(p + SIZEOF_MDNS_SERVICE, host);
+  }
+  p = rr_end(p, MDNS_RR_SRV);
+
+  /* the address is filled in by send_packet() */
+  p = rr_begin(p, end, MDNS_RR_A, host, DNS_RRTYPE_A, 1, MDNS_RR_TTL, SIZEOF_MDNS_A_RR);
+  if (p) {
+    os_memset(p, 0, SIZEOF_MDNS_A_RR);
+    p += SIZEOF_MDNS_A_RR;
+  }
+  p = rr_end(p, MDNS_RR_A);
+
+  p = rr_nsec(p, end, MDNS_RR_HOST_NSEC, host, 1, DNS_RRTYPE_A, 0);
+  p = rr_nsec(p, end, MDNS_RR_INST_NSEC, instance, 1, DNS_RRTYPE_TXT, DNS_RRTYPE_SRV);
+  p = rr_nsec(p, end, MDNS_RR_SD_NSEC, DNS_SD_SERVICE, 0, DNS_RRTYPE_PTR, 0);
+  p = rr_nsec(p, end, MDNS_RR_SVC_NSEC, service_name_with_suffix, 0, DNS_RRTYPE_PTR, 0);
+
+  mdns_records = NULL;
+  if (p) {
+    mdns_records = (u8_t *) os_malloc(p - buf);
+    if (mdns_records) {
+      memcpy(mdns_records, buf, p - buf);
+    }
+  } else {
+    MDNS_DBG("Too much data to send\n");
+  }
+  os_free(buf);
+  mdns_mcast_sent = 0;
+
+  return mdns_records != NULL;
+}
+
+/* Copy one of our records into a packet, adjusting class and TTL to the destination */
+static u8_t *
+mdns_append_rr(u8_t *q, u8_t *end, int idx, u8_t unicast, u8_t **addr_ptr) {
+  struct mdns_record *rr = &mdns_rr[idx];
+  struct mdns_answer ans;
+  u8_t *fixed = q + rr->hdr;
+
+  if (end - q < rr->len) {
+    return NULL;
+  }
+  MEMCPY(q, mdns_records + rr->off, rr->len);
+  MEMCPY(&ans, fixed, SIZEOF_DNS_ANSWER);
+  ans.class = htons(!unicast && rr->unique ? DNS_RRCLASS_FLUSH_IN : DNS_RRCLASS_IN);
+  ans.ttl = htonl(unicast ? min(rr->ttl, MDNS_UNICAST_TTL) : rr->ttl);
+  MEMCPY(fixed, &ans, SIZEOF_DNS_ANSWER);
+  if (rr->type == DNS_RRTYPE_A) {
+    *addr_ptr = fixed + SIZEOF_DNS_ANSWER;
+  }
 
-	return err;
+  return q + rr->len;
 }
 
 /**
- * Send a mDNS service answer packet.
+ * Send a response made up of the cached records.
  *
- * @param name service name to query
- * @param id transaction ID in the DNS query packet
+ * @param answers bitmask of records for the answer section
+ * @param extra bitmask of records for the additional section
+ * @param dst_addr unicast destination, NULL to multicast
  * @return ERR_OK if packet is sent; an err_t indicating the problem otherwise
  */
 static err_t ICACHE_FLASH_ATTR
-mdns_send_service(struct nodemcu_mdns_info *info, u16_t id, struct ip_addr *dst_addr, u16_t dst_port) {
-	err_t err;
-	struct mdns_hdr *hdr;
-	struct mdns_answer ans;
-	struct mdns_service serv;
-	struct mdns_a_rr a_rr;
-	struct pbuf *p ,*p_sta;
-	char *query, *nptr;
-	char *query_end;
-	const char *pHostname;
-	const char *name = info->host_name;
-	int max_ttl = dst_addr ? 10 : 7200;
-	u8_t n;
-	u8_t i = 0;
-	u16_t length = 0;
-	u8_t addr1 = 12, addr2 = 12;
-	struct netif * sta_netif = NULL;
-	struct netif * ap_netif = NULL;
-	char tmpBuf[PUCK_DATASHEET_SIZE + PUCK_SERVICE_LENGTH];
-	u16_t dns_class = dst_addr ? DNS_RRCLASS_IN : DNS_RRCLASS_FLUSH_IN;
-	/* if here, we have either a new query or a retry on a previous query to process */
-	p = pbuf_alloc(PBUF_TRANSPORT,
-			SIZEOF_DNS_HDR + MDNS_MAX_NAME_LENGTH * 2 + SIZEOF_DNS_QUERY, PBUF_RAM);
-	if (p != NULL) {
-		LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
-		/* fill dns header */
-		hdr = (struct mdns_hdr*) p->payload;
-		os_memset(hdr, 0, SIZEOF_DNS_HDR);
-		hdr->id = htons(id);
-		hdr->flags1 = DNS_FLAG1_RESPONSE;
-		hdr->numanswers = htons(4);
-		hdr->numextrarr = htons(1);
-		query = (char*) hdr + SIZEOF_DNS_HDR;
-		query_end = (char *) p->payload + p->tot_len;
-		c_strlcpy(tmpBuf, service_name_with_suffix, sizeof(tmpBuf));
-
-		pHostname = tmpBuf;
-		--pHostname;
-
-		/* convert hostname into suitable query format. */
-		do {
-			++pHostname;
-			nptr = query;
-			++query;
-			++addr1;
-			++addr2;
-			for (n = 0; *pHostname != '.' && *pHostname != 0; ++pHostname) {
-				*query = *pHostname;
-				++query;
-				++addr1;
-				++addr2;
-				++n;
-			}
-			*nptr = n;
-		} while (*pHostname != 0);
-		*query++ = '\0';
-		length = sizeof(MDNS_LOCAL);
-		addr1 -= length;
-		length = os_strlen(service_name_with_suffix) + 1;
-		addr2 -= length;
-
-		ans.type = htons(DNS_RRTYPE_PTR);
-		ans.class = htons(DNS_RRCLASS_IN);
-		ans.ttl = htonl(min(max_ttl, 300));
-		length = os_strlen(ms_info->host_desc) + MDNS_LENGTH_ADD + 1;
-		ans.len = htons(length);
-		length = 0;
-
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-		/* resize the query */
-		query = query + SIZEOF_DNS_ANSWER;
-
-		int name_offset = query - (const char *) hdr;
-
-		pHostname = ms_info->host_desc;
-		--pHostname;
-		/* convert hostname into suitable query format. */
-		do {
-			++pHostname;
-			nptr = query;
-			++query;
-			for (n = 0; *pHostname != '.' && *pHostname != 0; ++pHostname) {
-				*query = *pHostname;
-				++query;
-				++n;
-			}
-			*nptr = n;
-		} while (*pHostname != 0);
-		*query++ = DNS_OFFSET_FLAG;
-		*query++ = DNS_DEFAULT_OFFSET;
-
-		*query++ = 0xc0 + (name_offset >> 8);
-		*query++ = name_offset & 0xff;
-
-		/* fill the answer */
-		ans.type = htons(DNS_RRTYPE_TXT);
-		ans.class = htons(dns_class);
-		ans.ttl = htonl(min(max_ttl, 300));
-//		length = os_strlen(TXT_DATA) + MDNS_LENGTH_ADD + 1;
-		const char *attributes[12];
-		int attr_count = 0;
-		for(i = 0; i < 10 && (info->txt_data[i] != NULL); i++) {
-		  length += os_strlen(info->txt_data[i]);
-		  length++;
-		  attributes[attr_count++] = info->txt_data[i];
-		}
-		//MDNS_DBG("Found %d user attributes\n", i);
-		static const char *defaults[] = { "platform=nodemcu", NULL };
-		for(i = 0; defaults[i] != NULL; i++) {
-		  // See if this is a duplicate
-		  int j;
-		  int len = strchr(defaults[i], '=') + 1 - defaults[i];
-		  for (j = 0; j < attr_count; j++) {
-		    if (strncmp(attributes[j], defaults[i], len) == 0) {
-		      break;
-		    }
-		  }
-		  if (j == attr_count) {
-		    length += os_strlen(defaults[i]);
-		    length++;
-		    attributes[attr_count++] = defaults[i];
-		  }
-		}
-		//MDNS_DBG("Found %d total attributes\n", attr_count);
-
-		ans.len = htons(length);
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-		query = query + SIZEOF_DNS_ANSWER;
-		// Check enough space in the packet
-	        const char *end_of_packet = query + length + 2 + SIZEOF_DNS_ANSWER + SIZEOF_MDNS_SERVICE +
-		    os_strlen(ms_info->host_name) + 7 + 1 + 2 + SIZEOF_DNS_ANSWER + SIZEOF_MDNS_A_RR +
-		    2 + SIZEOF_DNS_ANSWER + 5;
-
-	        if (query_end <= end_of_packet) {
-		  MDNS_DBG("Too much data to send\n");
-		  pbuf_free(p);
-		  return ERR_MEM;
-		}
-		//MDNS_DBG("Query=%x, query_end=%x, end_ofpacket=%x, length=%x\n", query, query_end, end_of_packet, length);
-
-		i = 0;
-		while(attributes[i] != NULL && i < attr_count) {
-			pHostname = attributes[i];
-			--pHostname;
-			/* convert hostname into suitable query format. */
-			do {
-				++pHostname;
-				nptr = query;
-				++query;
-				for (n = 0;  *pHostname != 0; ++pHostname) {
-					*query = *pHostname;
-					++query;
-					++n;
-				}
-				*nptr = n;
-			} while (*pHostname != 0);
-			i++;
-		}
-//		*query++ = '\0';
-		// Increment by length
-		*query++ = 0xc0 + (name_offset >> 8);
-		*query++ = name_offset & 0xff;
-
-		// Increment by 2
-
-		ans.type = htons(DNS_RRTYPE_SRV);
-		ans.class = htons(dns_class);
-		ans.ttl = htonl(min(max_ttl, 300));
-		c_strlcpy(tmpBuf,ms_info->host_name, sizeof(tmpBuf));
-		c_strlcat(tmpBuf, ".", sizeof(tmpBuf));
-		c_strlcat(tmpBuf, MDNS_LOCAL, sizeof(tmpBuf));
-		length = os_strlen(tmpBuf) + MDNS_LENGTH_ADD;
-		ans.len = htons(SIZEOF_MDNS_SERVICE + length);
-		length = 0;
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-
-		/* resize the query */
-		query = query + SIZEOF_DNS_ANSWER;
-
-		serv.prior = htons(0);
-		serv.weight = htons(0);
-		serv.port = htons(ms_info->service_port);
-		MEMCPY( query, &serv, SIZEOF_MDNS_SERVICE);
-		/* resize the query */
-		query = query + SIZEOF_MDNS_SERVICE;
-
-		int hostname_offset = query - (const char *) hdr;
-
-		pHostname = tmpBuf;
-		--pHostname;
-		do {
-			++pHostname;
-			nptr = query;
-			++query;
-			for (n = 0; *pHostname != '.' && *pHostname != 0; ++pHostname) {
-				*query = *pHostname;
-				++query;
-				++n;
-			}
-			*nptr = n;
-		} while (*pHostname != 0);
-		*query++ = '\0';
-
-		// increment by strlen(service_name) + 1 + 7 + sizeof_dns_answer + sizeof_mdns_service
-		
-		*query++ = 0xc0 + (hostname_offset >> 8);
-		*query++ = hostname_offset & 0xff;
-
-		ans.type = htons(DNS_RRTYPE_A);
-		ans.class = htons(dns_class);
-		ans.ttl = htonl(min(max_ttl, 300));
-		ans.len = htons(DNS_IP_ADDR_LEN);
-
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-
-		/* resize the query */
-		query = query + SIZEOF_DNS_ANSWER;
-		
-		// increment by strlen(service_name) + 1 + 7 + sizeof_dns_answer 
-		
-
-		/* fill the payload of the mDNS message */
-		/* set the local IP address */
-		a_rr.src = 0;
-		MEMCPY( query, &a_rr, SIZEOF_MDNS_A_RR);
-		u8_t *addr_ptr = query + ((char *) &a_rr.src - (char *) &a_rr);
-		/* resize the query */
-		query = query + SIZEOF_MDNS_A_RR;
-
-		// Append the NSEC record that says we only have an A record
-		*query++ = 0xc0 + (hostname_offset >> 8);
-		*query++ = hostname_offset & 0xff;
-
-		ans.type = htons(DNS_RRTYPE_NSEC);
-		ans.class = htons(dns_class);
-		ans.ttl = htonl(min(max_ttl, 300));
-		ans.len = htons(5);
-
-		MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-		query = query + SIZEOF_DNS_ANSWER;
-		*query++ = 0xc0 + (hostname_offset >> 8);
-		*query++ = hostname_offset & 0xff;
-		*query++ = 0;
-		*query++ = 1;
-		*query++ = 0x40;
-
-
-		//MDNS_DBG("Final ptr=%x\n", query);
-
-		// increment by sizeof_mdns_a_rr
-
-		/* set the name of the authority field.
-		 * The same name as the Query using the offset address*/
-
-		/* resize pbuf to the exact dns query */
-		pbuf_realloc(p, (query) - ((char*) (p->payload)));
-
-		err = send_packet(p, dst_addr, dst_port, addr_ptr);
-
-		if (!dst_addr) {
-		  // this is being sent multicast...
-		  // so reset the timer
-		  os_timer_disarm(&mdns_timer);
-		  os_timer_arm(&mdns_timer, 1000 * 280, 1);
-		}
-	} else {
-		MDNS_DBG("ERR_MEM \n");
-		err = ERR_MEM;
-	}
+mdns_send_records(u16_t answers, u16_t extra, u16_t id, struct ip_addr *dst_addr, u16_t dst_port) {
+  struct mdns_hdr *hdr;
+  struct pbuf *p;
+  u8_t *q, *end, *next;
+  u8_t *addr_ptr = NULL;
+  u16_t sent = 0;
+  u16_t nanswers = 0;
+  u16_t nextra = 0;
+  int i;
+
+  extra &= ~answers;
+  if (!mdns_records || !(answers | extra)) {
+    return ERR_OK;
+  }
+
+  p = pbuf_alloc(PBUF_TRANSPORT, DNS_MSG_SIZE, PBUF_RAM);
+  if (p == NULL) {
+    MDNS_DBG("ERR_MEM \n");
+    return ERR_MEM;
+  }
+  LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
+  /* fill dns header */
+  hdr = (struct mdns_hdr*) p->payload;
+  os_memset(hdr, 0, SIZEOF_DNS_HDR);
+  hdr->id = htons(id);
+  hdr->flags1 = DNS_FLAG1_RESPONSE;
+  q = (u8_t *) hdr + SIZEOF_DNS_HDR;
+  end = (u8_t *) p->payload + p->tot_len;
+
+  for (i = 0; i < MDNS_RR_COUNT; i++) {
+    if ((answers & RR(i)) && (next = mdns_append_rr(q, end, i, dst_addr != NULL, &addr_ptr))) {
+      q = next;
+      sent |= RR(i);
+      nanswers++;
+    }
+  }
+  for (i = 0; i < MDNS_RR_COUNT; i++) {
+    if ((extra & RR(i)) && (next = mdns_append_rr(q, end, i, dst_addr != NULL, &addr_ptr))) {
+      q = next;
+      sent |= RR(i);
+      nextra++;
+    }
+  }
+  hdr->numanswers = htons(nanswers);
+  hdr->numextrarr = htons(nextra);
+
+  /* resize pbuf to the exact dns response */
+  pbuf_realloc(p, q - (u8_t *) p->payload);
+
+  if (!dst_addr) {
+    u32_t now = mdns_now();
+    for (i = 0; i < MDNS_RR_COUNT; i++) {
+      if (sent & RR(i)) {
+        mdns_rr[i].last_mcast = now;
+      }
+    }
+    mdns_mcast_sent |= sent;
+    if (sent & RR(MDNS_RR_SVC_PTR)) {
+      // the service is being announced, so reset the timer
+      os_timer_disarm(&mdns_timer);
+      os_timer_arm(&mdns_timer, 1000 * 280, 1);
+    }
+  }
 
-	return err;
+  return send_packet(p, dst_addr, dst_port, addr_ptr);
 }
 
-static char *append_nsec_record(char *query, u32_t actual_rr, int max_ttl) {
-  struct mdns_answer ans;
+/* Owner name of one of our records */
+static const u8_t *
+mdns_rr_name(int idx) {
+  return mdns_records + mdns_rr[idx].off;
+}
 
-  ans.type = htons(DNS_RRTYPE_NSEC);
-  ans.class = htons(DNS_RRCLASS_IN);
-  ans.ttl = htonl(min(max_ttl, 300));
-  ans.len = htons(9);
-
-  MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-  char *rr_len = query + ((char *) &ans.len - (char *) &ans) + 1;
-  query = query + SIZEOF_DNS_ANSWER;
-  *query++ = 0xc0;
-  *query++ = sizeof(struct mdns_hdr);
-  *query++ = 0;
-  char *bm_len = query;
-  *query++ = 5;
-  char *abase = query;
-  *query++ = 0;
-  *query++ = 0;
-  *query++ = 0;
-  *query++ = 0;
-  *query++ = 0;
-
-  while (actual_rr > 0) {
-    int v = actual_rr & 255;
-
-    if (v < 5 * 8) {
-      abase[v >> 3] |= 0x80 >> (v & 7);
-
-      actual_rr = actual_rr >> 8;
+/**
+ * Work out which of our records answer a question. Names we own but with
+ * no record of the asked type get a negative (NSEC) response.
+ */
+static void
+mdns_match_question(const u8_t *name, u16_t type, u16_t *answers, u16_t *extra) {
+  u8_t any = type == DNS_RRTYPE_ANY;
+
+  if (mdns_name_equal(name, mdns_rr_name(MDNS_RR_SD_PTR))) {
+    if (type == DNS_RRTYPE_PTR || any) {
+      *answers |= RR(MDNS_RR_SD_PTR);
+    } else {
+      *extra |= RR(MDNS_RR_SD_NSEC);
+    }
+  } else if (mdns_name_equal(name, mdns_rr_name(MDNS_RR_SVC_PTR))) {
+    if (type == DNS_RRTYPE_PTR || any) {
+      *answers |= RR(MDNS_RR_SVC_PTR);
+      *extra |= RR(MDNS_RR_TXT) | RR(MDNS_RR_SRV) | RR(MDNS_RR_A) | RR(MDNS_RR_HOST_NSEC);
+    } else {
+      *extra |= RR(MDNS_RR_SVC_NSEC);
+    }
+  } else if (mdns_name_equal(name, mdns_rr_name(MDNS_RR_A))) {
+    if (type == DNS_RRTYPE_A || any) {
+      *answers |= RR(MDNS_RR_A);
+    }
+    *extra |= RR(MDNS_RR_HOST_NSEC);
+  } else if (mdns_name_equal(name, mdns_rr_name(MDNS_RR_TXT))) {
+    if (type == DNS_RRTYPE_TXT || any) {
+      *answers |= RR(MDNS_RR_TXT);
+    }
+    if (type == DNS_RRTYPE_SRV || any) {
+      *answers |= RR(MDNS_RR_SRV);
+      *extra |= RR(MDNS_RR_A) | RR(MDNS_RR_HOST_NSEC);
+    }
+    if (!*answers) {
+      *extra |= RR(MDNS_RR_INST_NSEC);
     }
   }
+}
+
+/* Check whether a received record is identical to one of ours */
+static u8_t
+mdns_rr_matches(int idx, const struct mdns_rr_view *rr) {
+  const struct mdns_record *our = &mdns_rr[idx];
+  const u8_t *rdata = mdns_records + our->off + our->hdr + SIZEOF_DNS_ANSWER;
+  u16_t rdlen = our->len - our->hdr - SIZEOF_DNS_ANSWER;
 
-  while (query[-1] == 0) {
-    query--;
-    (*bm_len)--;
-    (*rr_len)--;
+  if (rr->type != our->type || (rr->class & 0x7fff) != DNS_RRCLASS_IN ||
+      rr->rdlen == MDNS_RDLEN_INVALID || !mdns_name_equal(rr->name, mdns_rr_name(idx))) {
+    return 0;
   }
 
-  return query;
+  switch (our->type) {
+  case DNS_RRTYPE_A: {
+    struct netif *netif = mdns_local_netif();
+    return netif && rr->rdlen == SIZEOF_MDNS_A_RR &&
+           memcmp(rr->rdata, &netif->ip_addr, SIZEOF_MDNS_A_RR) == 0;
+  }
+  case DNS_RRTYPE_PTR:
+    return mdns_name_equal(rr->rdata, rdata);
+  case DNS_RRTYPE_SRV:
+    return memcmp(rr->rdata, rdata, SIZEOF_MDNS_SERVICE) == 0 &&
+           mdns_name_equal(rr->rdata + SIZEOF_MDNS_SERVICE, rdata + SIZEOF_MDNS_SERVICE);
+  default:
+    return rr->rdlen == rdlen && memcmp(rr->rdata, rdata, rdlen) == 0;
+  }
+}
+
+/* Skip a name in the received packet, returns NULL if malformed */
+static u8_t *
+mdns_skip_name(u8_t *p) {
+  while (p < mdns_payload_end) {
+    if ((*p & 0xc0) == 0xc0) {
+      return p + 2 <= mdns_payload_end ? p + 2 : NULL;
+    }
+    if (*p & 0xc0) {
+      return NULL;
+    }
+    if (!*p) {
+      return p + 1;
+    }
+    p += *p + 1;
+  }
+
+  return NULL;
 }
 
 /**
- * This sends an empty response -- this is used when we doin't have an RR to send
- * but the name exists
+ * Parse a resource record from the received packet. Names in the record
+ * and in PTR and SRV rdata are expanded.
+ *
+ * @return pointer to the next record, or NULL if malformed
  */
+static u8_t *
+mdns_parse_rr(u8_t *ptr, struct mdns_rr_view *rr) {
+  struct mdns_answer ans;
+  u8_t *rdata, *rdend;
+  u16_t len;
 
-static void 
-mdns_send_no_rr(struct mdns_hdr *req, const char *name, u32_t actual_rr, struct ip_addr *dst_addr, u16_t dst_port) {
-  int max_ttl = dst_addr ? 10 : 7200;
-  struct pbuf *p;
-  p = pbuf_alloc(PBUF_TRANSPORT,
-		  SIZEOF_DNS_HDR + MDNS_MAX_NAME_LENGTH * 2 + SIZEOF_DNS_QUERY, PBUF_RAM);
-  if (p != NULL) {
-    LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
-    /* fill dns header */
-    struct mdns_hdr *hdr = (struct mdns_hdr*) p->payload;
-    os_memset(hdr, 0, SIZEOF_DNS_HDR);
-    hdr->id = req->id;
-    hdr->flags1 = DNS_FLAG1_RESPONSE;
-    hdr->numextrarr = htons(1);
-    char *query = (char*) hdr + SIZEOF_DNS_HDR;
-    char *query_end = (char *) p->payload + p->tot_len;
-    // Now copy over the dns name 
-    int len = strlen(name);
-
-    if (query_end - query >= len + SIZEOF_DNS_QUERY + 15) {
-      query = copy_and_encode_name((char *) (hdr + 1), name);
-
-      query = append_nsec_record(query, actual_rr, max_ttl);
-
-      // Set the length code correctly
-      pbuf_realloc(p, query - ((char*) (p->payload)));
-
-      send_packet(p, dst_addr, dst_port, NULL);
+  ptr = mdns_expand_name(ptr, rr->name, sizeof(rr->name));
+  if (!ptr || mdns_payload_end - ptr < SIZEOF_DNS_ANSWER) {
+    return NULL;
+  }
+  MEMCPY(&ans, ptr, SIZEOF_DNS_ANSWER);
+  len = ntohs(ans.len);
+  rdata = ptr + SIZEOF_DNS_ANSWER;
+  rdend = rdata + len;
+  if (rdend > mdns_payload_end) {
+    return NULL;
+  }
+  rr->type = ntohs(ans.type);
+  rr->class = ntohs(ans.class);
+  rr->ttl = ntohl(ans.ttl);
+  rr->rdlen = MDNS_RDLEN_INVALID;
+
+  switch (rr->type) {
+  case DNS_RRTYPE_PTR:
+    if (mdns_expand_name(rdata, rr->rdata, MDNS_NAME_MAX)) {
+      rr->rdlen = mdns_name_len(rr->rdata);
     }
+    break;
+  case DNS_RRTYPE_SRV:
+    if (len > SIZEOF_MDNS_SERVICE &&
+        mdns_expand_name(rdata + SIZEOF_MDNS_SERVICE, rr->rdata + SIZEOF_MDNS_SERVICE, MDNS_NAME_MAX)) {
+      memcpy(rr->rdata, rdata, SIZEOF_MDNS_SERVICE);
+      rr->rdlen = SIZEOF_MDNS_SERVICE + mdns_name_len(rr->rdata + SIZEOF_MDNS_SERVICE);
+    }
+    break;
+  default:
+    if (len <= sizeof(rr->rdata)) {
+      memcpy(rr->rdata, rdata, len);
+      rr->rdlen = len;
+    }
+    break;
   }
+
+  return rdend;
 }
 
 /**
- * This sends a single A record and the NSEC record as additional
+ * Answer all the questions of a query with at most one unicast and one
+ * multicast response. Records listed by the querier as known answers with
+ * at least half of their TTL left are left out (RFC 6762, section 7.1).
  */
+static void ICACHE_FLASH_ATTR
+mdns_answer_query(struct mdns_hdr *hdr, struct ip_addr *addr, u16_t port) {
+  struct mdns_rr_view rr;
+  u16_t nquestions = ntohs(hdr->numquestions);
+  u16_t nanswers = ntohs(hdr->numanswers);
+  u16_t known = 0;
+  u16_t ans_u = 0, extra_u = 0, ans_m = 0, extra_m = 0;
+  u8_t asked_m = 0;
+  u8_t *ptr = (u8_t *) (hdr + 1);
+  u16_t i;
+  int j;
+
+  /* the known answers follow the questions */
+  for (i = 0; i < nquestions && ptr; i++) {
+    ptr = mdns_skip_name(ptr);
+    if (ptr) {
+      ptr += SIZEOF_DNS_QUERY;
+    }
+  }
+  for (i = 0; i < nanswers && ptr && ptr < mdns_payload_end; i++) {
+    ptr = mdns_parse_rr(ptr, &rr);
+    for (j = 0; ptr && j < MDNS_RR_COUNT; j++) {
+      if (rr.ttl >= mdns_rr[j].ttl / 2 && mdns_rr_matches(j, &rr)) {
+        known |= RR(j);
+      }
+    }
+  }
 
-static void 
-mdns_send_a_rr(struct mdns_hdr *req, const char *name, struct ip_addr *dst_addr, u16_t dst_port) {
-  int max_ttl = dst_addr ? 10 : 7200;
-  struct pbuf *p;
-  p = pbuf_alloc(PBUF_TRANSPORT,
-		  SIZEOF_DNS_HDR + MDNS_MAX_NAME_LENGTH * 2 + SIZEOF_DNS_QUERY, PBUF_RAM);
-  if (p != NULL) {
-    LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
-    /* fill dns header */
-    struct mdns_hdr *hdr = (struct mdns_hdr*) p->payload;
-    os_memset(hdr, 0, SIZEOF_DNS_HDR);
-    hdr->id = req->id;
-    hdr->flags1 = DNS_FLAG1_RESPONSE;
-    hdr->numanswers = htons(1);
-    hdr->numextrarr = htons(1);
-    char *query = (char*) hdr + SIZEOF_DNS_HDR;
-    char *query_end = (char *) p->payload + p->tot_len;
-    // Now copy over the dns name 
-    int len = strlen(name) + 1;
-
-    if (query_end - query >= len + SIZEOF_DNS_QUERY + 4 + 2 + 4 + 15) {
-      query = copy_and_encode_name((char *) (hdr + 1), name);
-
-      struct mdns_answer ans;
-
-      ans.type = htons(DNS_RRTYPE_A);
-      ans.class = htons(DNS_RRCLASS_IN);
-      ans.ttl = htonl(min(max_ttl, 300));
-      ans.len = htons(4);
-
-      MEMCPY( query, &ans, SIZEOF_DNS_ANSWER);
-      query = query + SIZEOF_DNS_ANSWER;
-      char *addr_ptr = query;
-      query += 4;
-
-      // Now add the NSEC record
-      *query++ = 0xc0;
-      *query++ = sizeof(*hdr);
-      query = append_nsec_record(query, DNS_RRTYPE_A, max_ttl);
-
-      // Set the length code correctly
-      pbuf_realloc(p, query - ((char*) (p->payload)));
-
-      send_packet(p, dst_addr, dst_port, addr_ptr);
+  ptr = (u8_t *) (hdr + 1);
+  for (i = 0; i < nquestions; i++) {
+    struct mdns_query qry;
+    u16_t answers = 0, extra = 0;
+
+    ptr = mdns_expand_name(ptr, rr.name, sizeof(rr.name));
+    if (!ptr || mdns_payload_end - ptr < SIZEOF_DNS_QUERY) {
+      break;
+    }
+    MEMCPY(&qry, ptr, SIZEOF_DNS_QUERY);
+    ptr += SIZEOF_DNS_QUERY;
+
+    mdns_match_question(rr.name, ntohs(qry.type), &answers, &extra);
+    if (answers) {
+      answers &= ~known;
+      if (!answers) {
+        continue;               // the querier has them all already
+      }
+    }
+    extra &= ~known;
+
+    if (port != DNS_MDNS_PORT || (ntohs(qry.class) & 0x8000)) {
+      ans_u |= answers;
+      extra_u |= extra;
+    } else {
+      ans_m |= answers;
+      extra_m |= extra;
+      asked_m |= answers != 0;
+    }
+  }
+
+  if (ans_u | extra_u) {
+    mdns_send_records(ans_u, extra_u, ntohs(hdr->id), addr, port);
+  }
+
+  /* don't flood the link when several hosts ask for the same records */
+  u32_t now = mdns_now();
+  for (j = 0; j < MDNS_RR_COUNT; j++) {
+    if ((mdns_mcast_sent & RR(j)) && now - mdns_rr[j].last_mcast < MDNS_MCAST_INTERVAL) {
+      ans_m &= ~RR(j);
+      extra_m &= ~RR(j);
     }
   }
+  if (asked_m && !ans_m) {
+    extra_m = 0;
+  }
+  if (ans_m | extra_m) {
+    mdns_send_records(ans_m, extra_m, 0, NULL, 0);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Client cache
+ *----------------------------------------------------------------------------*/
+
+static u8_t
+mdns_cache_expired(const struct mdns_cache_rr *e, u32_t now) {
+  return (s32_t) (e->expires - now) <= 0;
+}
+
+static void
+mdns_cache_purge(u8_t all) {
+  struct mdns_cache_rr **pe = &mdns_cache;
+  u32_t now = mdns_now();
+
+  while (*pe) {
+    struct mdns_cache_rr *e = *pe;
+    if (all || mdns_cache_expired(e, now)) {
+      *pe = e->next;
+      os_free(e);
+      mdns_cache_count--;
+    } else {
+      pe = &e->next;
+    }
+  }
+}
+
+static u8_t *
+mdns_cache_rdata(struct mdns_cache_rr *e) {
+  return e->data + mdns_name_len(e->data);
+}
+
+/**
+ * Add a record from a response to the cache. A TTL of 0 removes the record.
+ * A record with the cache flush bit set ends the other records for its name
+ * and type one second later, unless they were received within the last
+ * second themselves and so belong to the same set (RFC 6762 10.2).
+ *
+ * @return 1 if the cache changed
+ */
+static u8_t
+mdns_cache_add(const struct mdns_rr_view *rr) {
+  struct mdns_cache_rr **pe = &mdns_cache;
+  struct mdns_cache_rr **match = NULL;
+  struct mdns_cache_rr *e;
+  u32_t now = mdns_now();
+  u32_t ttl = min(rr->ttl, DNS_MAX_TTL);
+  u8_t changed = 0;
+  int namelen;
+
+  if ((rr->type != DNS_RRTYPE_A && rr->type != DNS_RRTYPE_PTR &&
+       rr->type != DNS_RRTYPE_SRV && rr->type != DNS_RRTYPE_TXT) ||
+      (rr->class & 0x7fff) != DNS_RRCLASS_IN || rr->rdlen == MDNS_RDLEN_INVALID) {
+    return 0;
+  }
+
+  // flush the others of the name and type before looking at the match itself
+  for (; (e = *pe) != NULL; pe = &e->next) {
+    if (e->type != rr->type || !mdns_name_equal(e->data, rr->name)) {
+      continue;
+    }
+    if (e->rdlen == rr->rdlen && memcmp(mdns_cache_rdata(e), rr->rdata, rr->rdlen) == 0) {
+      match = pe;
+    } else if ((rr->class & 0x8000) &&
+               (s32_t) (now - (e->expires - e->ttl * 1000)) > 1000 &&
+               (s32_t) (e->expires - (now + 1000)) > 0) {
+      // received more than a second ago, let it go in a second
+      e->expires = now + 1000;
+      changed = 1;
+    }
+  }
+
+  if (match) {
+    e = *match;
+    if (ttl) {
+      // refreshed
+      e->ttl = ttl;
+      e->expires = now + ttl * 1000;
+      return changed;
+    }
+    *match = e->next;
+    os_free(e);
+    mdns_cache_count--;
+    changed = 1;
+  }
+
+  if (!ttl) {
+    return changed;
+  }
+
+  if (mdns_cache_count >= MDNS_CACHE_MAX) {
+    // make room by dropping the record which would go stale first
+    struct mdns_cache_rr **victim = &mdns_cache;
+    for (pe = &mdns_cache; *pe; pe = &(*pe)->next) {
+      if ((s32_t) ((*pe)->expires - (*victim)->expires) < 0) {
+        victim = pe;
+      }
+    }
+    e = *victim;
+    *victim = e->next;
+    os_free(e);
+    mdns_cache_count--;
+  }
+
+  namelen = mdns_name_len(rr->name);
+  e = (struct mdns_cache_rr *) os_malloc(sizeof(*e) + namelen + rr->rdlen);
+  if (!e) {
+    return 0;
+  }
+  e->ttl = ttl;
+  e->expires = now + ttl * 1000;
+  e->type = rr->type;
+  e->rdlen = rr->rdlen;
+  memcpy(e->data, rr->name, namelen);
+  memcpy(e->data + namelen, rr->rdata, rr->rdlen);
+  e->next = mdns_cache;
+  mdns_cache = e;
+  mdns_cache_count++;
+
+  return 1;
+}
+
+/* Cache all the records of a response */
+static void ICACHE_FLASH_ATTR
+mdns_cache_response(struct mdns_hdr *hdr) {
+  struct mdns_rr_view rr;
+  u16_t nquestions = ntohs(hdr->numquestions);
+  u16_t nrecords = ntohs(hdr->numanswers) + ntohs(hdr->numauthrr) + ntohs(hdr->numextrarr);
+  u8_t *ptr = (u8_t *) (hdr + 1);
+  u8_t changed = 0;
+  u16_t i;
+
+  mdns_cache_purge(0);
+  for (i = 0; i < nquestions && ptr; i++) {
+    ptr = mdns_skip_name(ptr);
+    if (ptr) {
+      ptr += SIZEOF_DNS_QUERY;
+    }
+  }
+  for (i = 0; i < nrecords && ptr && ptr < mdns_payload_end; i++) {
+    ptr = mdns_parse_rr(ptr, &rr);
+    if (ptr) {
+      changed |= mdns_cache_add(&rr);
+    }
+  }
+
+  if (changed && mdns_update_cb) {
+    mdns_update_cb();
+  }
+}
+
+/* Find a fresh cached record by encoded name and type */
+static struct mdns_cache_rr *
+mdns_cache_find(const u8_t *name, u16_t type) {
+  struct mdns_cache_rr *e;
+  u32_t now = mdns_now();
+
+  for (e = mdns_cache; e; e = e->next) {
+    if (e->type == type && !mdns_cache_expired(e, now) && mdns_name_equal(e->data, name)) {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+/* Look up the address of an encoded host name in the cache */
+static bool
+mdns_cache_address(const u8_t *host, ip_addr_t *ip) {
+  struct mdns_cache_rr *e = mdns_cache_find(host, DNS_RRTYPE_A);
+
+  if (!e || e->rdlen != SIZEOF_MDNS_A_RR) {
+    return FALSE;
+  }
+  memcpy(&ip->addr, mdns_cache_rdata(e), SIZEOF_MDNS_A_RR);
+
+  return TRUE;
+}
+
+/* Whether the SRV, TXT and address records of a service instance are cached */
+static bool
+mdns_cache_complete(const u8_t *inst) {
+  struct mdns_cache_rr *srv = mdns_cache_find(inst, DNS_RRTYPE_SRV);
+  ip_addr_t ip;
+
+  return srv && mdns_cache_find(inst, DNS_RRTYPE_TXT) &&
+         mdns_cache_address(mdns_cache_rdata(srv) + SIZEOF_MDNS_SERVICE, &ip);
 }
 
 /**
@@ -862,12 +1180,9 @@ mdns_send_a_rr(struct mdns_hdr *req, const char *name, struct ip_addr *dst_addr,
 static void ICACHE_FLASH_ATTR
 mdns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, struct ip_addr *addr,
 		u16_t port) {
-	u16_t i;
 	struct mdns_hdr *hdr;
-	u8_t nquestions;
 	LWIP_UNUSED_ARG(arg);
 	LWIP_UNUSED_ARG(pcb);
-	struct nodemcu_mdns_info *info = (struct nodemcu_mdns_info *)arg;
 	/* is the dns message too big ? */
 	if (p->tot_len > DNS_MSG_SIZE) {
 		LWIP_DEBUGF(DNS_DEBUG, ("dns_recv: pbuf too big\n"));
@@ -876,93 +1191,26 @@ mdns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, struct ip_addr *addr,
 	}
 
 	/* is the dns message big enough ? */
-	if (p->tot_len < (SIZEOF_DNS_HDR + SIZEOF_DNS_QUERY + SIZEOF_DNS_ANSWER)) {
+	if (p->tot_len < SIZEOF_DNS_HDR) {
 		LWIP_DEBUGF(DNS_DEBUG, ("dns_recv: pbuf too small\n"));
 		/* free pbuf and return */
 		goto memerr1;
 	}
 	/* copy dns payload inside static buffer for processing */
 	if (pbuf_copy_partial(p, mdns_payload, p->tot_len, 0) == p->tot_len) {
-		/* The ID in the DNS header should be our entry into the name table. */
 		hdr = (struct mdns_hdr*) mdns_payload;
+		mdns_payload_end = mdns_payload + p->tot_len;
 
-		i = htons(hdr->id);
-
-		nquestions = htons(hdr->numquestions);
-		//nanswers   = htons(hdr->numanswers);
-		/* if we have a question send an answer if necessary */
-		u8_t qno;
-		u8_t *qptr = (u8_t *) (hdr + 1);
-		u8_t *qend = mdns_payload + p->tot_len;
-		for (qno = 0; qno < nquestions && qptr < qend; qno++) {
-		  char tmpBuf[PUCK_DATASHEET_SIZE + PUCK_SERVICE_LENGTH];
-		  struct mdns_query qry;
-
-		  int namelen = mdns_namelen(qptr, qend - qptr);
-
-		  memcpy(&qry, namelen + qptr, sizeof(qry));
-
-		  u16_t qry_type = ntohs(qry.type);
-
-		  if (port == 5353 && (ntohs(qry.class) & 0x8000) == 0) {
-		    addr = NULL;
-		  }
-
-		  u32_t actual_rr = 0;
-
-		  const char *no_rr_name = NULL;
-
-		  /* MDNS_DS_DOES_NAME_CHECK */
-		  /* Check if the name in the "question" part match with the name of the MDNS DS service. */
-		  if (mdns_compare_name((unsigned char *) DNS_SD_SERVICE,
-				  (unsigned char *) qptr, (unsigned char *) hdr) == 0) {
-		    if (qry_type == DNS_RRTYPE_PTR || qry_type == DNS_RRTYPE_ANY) {
-		      mdns_send_service_type(i, addr, port);
-		    } else {
-		      no_rr_name = DNS_SD_SERVICE;
-		      actual_rr = DNS_RRTYPE_PTR;
-		    }
-		  } else if (mdns_compare_name((unsigned char *) service_name_with_suffix,
-				  (unsigned char *) qptr, (unsigned char *) hdr) == 0) {
-		    if (qry_type == DNS_RRTYPE_PTR || qry_type == DNS_RRTYPE_ANY) {
-		      mdns_send_service(info, i, addr, port);
-		    } else {
-		      no_rr_name = service_name_with_suffix;
-		      actual_rr = DNS_RRTYPE_PTR;
-		    }
-		  } else {
-		    c_strlcpy(tmpBuf,ms_info->host_name, sizeof(tmpBuf));
-		    c_strlcat(tmpBuf, ".", sizeof(tmpBuf));
-		    c_strlcat(tmpBuf, MDNS_LOCAL, sizeof(tmpBuf));
-		    no_rr_name = tmpBuf;
-
-		    if (mdns_compare_name((unsigned char *) tmpBuf,
-				  (unsigned char *) qptr, (unsigned char *) hdr) == 0) {
-		      if (qry_type == DNS_RRTYPE_A || qry_type == DNS_RRTYPE_ANY) {
-			mdns_send_a_rr(hdr, tmpBuf, addr, port);
-		      } else {
-			actual_rr = DNS_RRTYPE_A;
-		      }
-		    } else {
-		      c_strlcpy(tmpBuf,ms_info->host_desc, sizeof(tmpBuf));
-		      c_strlcat(tmpBuf, ".", sizeof(tmpBuf));
-		      c_strlcat(tmpBuf, service_name_with_suffix, sizeof(tmpBuf));
-		      if (mdns_compare_name((unsigned char *) tmpBuf,
-				  (unsigned char *) qptr, (unsigned char *) hdr) == 0) {
-			if (qry_type == DNS_RRTYPE_TXT || qry_type == DNS_RRTYPE_SRV || qry_type == DNS_RRTYPE_ANY) {
-			  mdns_send_service(info, i, addr, port);
-			} else {
-			  actual_rr = (DNS_RRTYPE_TXT << 8) + DNS_RRTYPE_SRV;
+		/* messages with a non-zero opcode are ignored */
+		if (hdr->flags1 & 0x78) {
+			goto memerr1;
+		}
+		if (hdr->flags1 & 0x80) {
+			if (mdns_caching) {
+				mdns_cache_response(hdr);
 			}
-		      }
-		    }
-		  }
-
-		  if (actual_rr) {
-		    mdns_send_no_rr(hdr, no_rr_name, actual_rr, addr, port);
-		  }
-
-		  qptr += namelen + sizeof(qry);		// Now points to next question
+		} else if (mdns_records) {
+			mdns_answer_query(hdr, addr, port);
 		}
 	}
 memerr1:
@@ -971,6 +1219,81 @@ memerr1:
 	return;
 }
 
+/*-----------------------------------------------------------------------------
+ * UDP pcb
+ *----------------------------------------------------------------------------*/
+
+static void ICACHE_FLASH_ATTR
+mdns_close_pcb(void) {
+  if (mdns_pcb != NULL) {
+    udp_remove(mdns_pcb);
+  }
+  if (mdns_payload) {
+    os_free(mdns_payload);
+  }
+  mdns_payload = NULL;
+  mdns_pcb = NULL;
+  mdns_flag = 0;
+}
+
+/**
+ * Set up the UDP pcb listening on the mDNS port, if not done yet.
+ *
+ * returns TRUE if it worked, FALSE if it failed.
+ */
+static bool ICACHE_FLASH_ATTR
+mdns_open(void) {
+  if (mdns_pcb) {
+    return TRUE;
+  }
+
+  /* initialize default DNS server address */
+  multicast_addr.addr = DNS_MULTICAST_ADDRESS;
+
+  mdns_payload = (u8_t *) os_malloc(DNS_MSG_SIZE);
+  if (!mdns_payload) {
+    MDNS_DBG("Alloc fail\n");
+    return FALSE;
+  }
+
+  /* initialize mDNS */
+  mdns_pcb = udp_new();
+
+  if (!mdns_pcb) {
+    goto fail;
+  }
+  /* join to the multicast address 224.0.0.251 */
+  if(wifi_get_opmode() & 0x01) {
+    struct netif *sta_netif = (struct netif *)eagle_lwip_getif(0x00);
+    if (sta_netif && sta_netif->ip_addr.addr && igmp_joingroup(&sta_netif->ip_addr, &multicast_addr) != ERR_OK) {
+      MDNS_DBG("sta udp_join_multigrup failed!\n");
+      goto fail;
+    };
+  }
+  if(wifi_get_opmode() & 0x02) {
+    struct netif *ap_netif = (struct netif *)eagle_lwip_getif(0x01);
+    if (ap_netif && ap_netif->ip_addr.addr && igmp_joingroup(&ap_netif->ip_addr, &multicast_addr) != ERR_OK) {
+      MDNS_DBG("ap udp_join_multigrup failed!\n");
+      goto fail;
+    };
+  }
+  /* join to any IP address at the port 5353 */
+  if (udp_bind(mdns_pcb, IP_ADDR_ANY, DNS_MDNS_PORT) != ERR_OK) {
+	  MDNS_DBG("udp_bind failed!\n");
+	  goto fail;
+  };
+
+  /*loopback function for the multicast(224.0.0.251) messages received at port 5353*/
+  udp_recv(mdns_pcb, mdns_recv, NULL);
+  mdns_flag = 1;
+
+  return TRUE;
+
+fail:
+  mdns_close_pcb();
+  return FALSE;
+}
+
 static void
 mdns_free_info(struct nodemcu_mdns_info *info) {
   os_free((void *) info);
@@ -984,16 +1307,15 @@ nodemcu_mdns_close(void)
 {
   os_timer_disarm(&mdns_timer);
 
-  if (mdns_pcb != NULL) {
-    udp_remove(mdns_pcb);
-  }
-  if (mdns_payload) {
-    os_free(mdns_payload);
-  }
-  mdns_payload = NULL;
-  mdns_pcb = NULL;
+  mdns_close_pcb();
   mdns_free_info(ms_info);
   ms_info = NULL;
+  if (mdns_records) {
+    os_free(mdns_records);
+  }
+  mdns_records = NULL;
+  mdns_cache_purge(1);
+  mdns_caching = 0;
 }
 
 static void ICACHE_FLASH_ATTR
@@ -1015,11 +1337,13 @@ mdns_reg_handler_restart(void) {
 
 static void ICACHE_FLASH_ATTR
 mdns_reg(struct nodemcu_mdns_info *info) {
-  mdns_send_service(info,0,0,0);
+  u16_t answers = RR(MDNS_RR_SVC_PTR) | RR(MDNS_RR_TXT) | RR(MDNS_RR_SRV) | RR(MDNS_RR_A);
+
   if (reg_counter++ > 10) {
-    mdns_send_service_type(0,0,0);
+    answers |= RR(MDNS_RR_SD_PTR);
     reg_counter = 0;
   }
+  mdns_send_records(answers, RR(MDNS_RR_HOST_NSEC), 0, NULL, 0);
 }
 
 static struct nodemcu_mdns_info *
@@ -1060,14 +1384,11 @@ mdns_dup_info(const struct nodemcu_mdns_info *info) {
 /**
  * Initialize the resolver: set up the UDP pcb and configure the default server
  * (NEW IP).
- * 
+ *
  * returns TRUE if it worked, FALSE if it failed.
  */
 bool ICACHE_FLASH_ATTR
 nodemcu_mdns_init(struct nodemcu_mdns_info *info) {
-  /* initialize default DNS server address */
-  multicast_addr.addr = DNS_MULTICAST_ADDRESS;
-  struct ip_info ipconfig;
   mdns_free_info(ms_info);
   ms_info = mdns_dup_info(info);		// Save the passed block. We need all the data forever
 
@@ -1075,15 +1396,6 @@ nodemcu_mdns_init(struct nodemcu_mdns_info *info) {
     return FALSE;
   }
 
-  if (mdns_payload) {
-    os_free(mdns_payload);
-  }
-  mdns_payload = (u8_t *) os_malloc(DNS_MSG_SIZE);
-  if (!mdns_payload) {
-    MDNS_DBG("Alloc fail\n");
-    return FALSE;
-  }
-
   LWIP_DEBUGF(DNS_DEBUG, ("dns_init: initializing\n"));
 
   mdns_set_servicename(ms_info->service_name);
@@ -1093,37 +1405,17 @@ nodemcu_mdns_init(struct nodemcu_mdns_info *info) {
   MDNS_DBG("host_name = %s\n", ms_info->host_name);
   MDNS_DBG("server_name = %s\n", service_name_with_suffix);
 
-  /* initialize mDNS */
-  mdns_pcb = udp_new();
-
-  if (!mdns_pcb) {
-    return FALSE;
+  if (mdns_records) {
+    os_free(mdns_records);
   }
-  /* join to the multicast address 224.0.0.251 */
-  if(wifi_get_opmode() & 0x01) {
-    struct netif *sta_netif = (struct netif *)eagle_lwip_getif(0x00);
-    if (sta_netif && sta_netif->ip_addr.addr && igmp_joingroup(&sta_netif->ip_addr, &multicast_addr) != ERR_OK) {
-      MDNS_DBG("sta udp_join_multigrup failed!\n");
-      return FALSE;
-    };
+  if (!mdns_build_records(ms_info)) {
+    return FALSE;
   }
-  if(wifi_get_opmode() & 0x02) {
-    struct netif *ap_netif = (struct netif *)eagle_lwip_getif(0x01);
-    if (ap_netif && ap_netif->ip_addr.addr && igmp_joingroup(&ap_netif->ip_addr, &multicast_addr) != ERR_OK) {
-      MDNS_DBG("ap udp_join_multigrup failed!\n");
-      return FALSE;
-    };
+
+  if (!mdns_open()) {
+    return FALSE;
   }
   register_flag = 1;
-  /* join to any IP address at the port 5353 */
-  if (udp_bind(mdns_pcb, IP_ADDR_ANY, DNS_MDNS_PORT) != ERR_OK) {
-	  MDNS_DBG("udp_bind failed!\n");
-	  return FALSE;
-  };
-
-  /*loopback function for the multicast(224.0.0.251) messages received at port 5353*/
-  udp_recv(mdns_pcb, mdns_recv, ms_info);
-  mdns_flag = 1;
   /*
    * Register the name of the instrument
    */
@@ -1142,4 +1434,156 @@ nodemcu_mdns_init(struct nodemcu_mdns_info *info) {
   return TRUE;
 }
 
+/*-----------------------------------------------------------------------------
+ * Client
+ *----------------------------------------------------------------------------*/
+
+void ICACHE_FLASH_ATTR
+nodemcu_mdns_set_update_cb(void (*cb)(void)) {
+  mdns_update_cb = cb;
+}
+
+/**
+ * Multicast a question. Cached records answering it, with more than half of
+ * their TTL left, are listed as known answers so responders skip them.
+ * A PTR is only listed once its instance is complete in the cache, so that
+ * responders still send the SRV, TXT and address records that are missing.
+ */
+static bool ICACHE_FLASH_ATTR
+mdns_query(const char *name, u16_t type) {
+  struct mdns_hdr *hdr;
+  struct mdns_query qry;
+  struct mdns_answer ans;
+  struct mdns_cache_rr *e;
+  struct pbuf *p;
+  u8_t *q, *qname, *end;
+  u16_t nanswers = 0;
+  u32_t now;
+
+  if (c_strlen(name) + 2 > MDNS_NAME_MAX || !mdns_open()) {
+    return FALSE;
+  }
+  mdns_caching = 1;
+  mdns_cache_purge(0);
+
+  p = pbuf_alloc(PBUF_TRANSPORT, DNS_MSG_SIZE, PBUF_RAM);
+  if (p == NULL) {
+    return FALSE;
+  }
+  LWIP_ASSERT("pbuf must be in one piece", p->next == NULL);
+  hdr = (struct mdns_hdr*) p->payload;
+  os_memset(hdr, 0, SIZEOF_DNS_HDR);
+  hdr->numquestions = htons(1);
+  qname = (u8_t *) hdr + SIZEOF_DNS_HDR;
+  q = copy_and_encode_name(qname, name);
+  qry.type = htons(type);
+  qry.class = htons(DNS_RRCLASS_IN);
+  MEMCPY(q, &qry, SIZEOF_DNS_QUERY);
+  q += SIZEOF_DNS_QUERY;
+  end = (u8_t *) p->payload + p->tot_len;
+
+  now = mdns_now();
+  for (e = mdns_cache; e; e = e->next) {
+    int namelen = mdns_name_len(e->data);
+    u32_t left = (e->expires - now) / 1000;
+
+    if (e->type != type || left * 2 <= e->ttl || !mdns_name_equal(e->data, qname)) {
+      continue;
+    }
+    if (type == DNS_RRTYPE_PTR && !mdns_cache_complete(mdns_cache_rdata(e))) {
+      continue;
+    }
+    if (end - q < namelen + SIZEOF_DNS_ANSWER + e->rdlen) {
+      break;
+    }
+    memcpy(q, e->data, namelen);
+    q += namelen;
+    ans.type = htons(e->type);
+    ans.class = htons(DNS_RRCLASS_IN);
+    ans.ttl = htonl(left);
+    ans.len = htons(e->rdlen);
+    MEMCPY(q, &ans, SIZEOF_DNS_ANSWER);
+    q += SIZEOF_DNS_ANSWER;
+    memcpy(q, e->data + namelen, e->rdlen);
+    q += e->rdlen;
+    nanswers++;
+  }
+  hdr->numanswers = htons(nanswers);
+
+  pbuf_realloc(p, q - (u8_t *) p->payload);
+
+  return send_packet(p, NULL, 0, NULL) == ERR_OK;
+}
+
+bool ICACHE_FLASH_ATTR
+nodemcu_mdns_query_host(const char *host) {
+  return mdns_query(host, DNS_RRTYPE_A);
+}
+
+bool ICACHE_FLASH_ATTR
+nodemcu_mdns_query_service(const char *service) {
+  return mdns_query(service, DNS_RRTYPE_PTR);
+}
+
+bool ICACHE_FLASH_ATTR
+nodemcu_mdns_resolve_cached(const char *host, ip_addr_t *ip) {
+  u8_t name[MDNS_NAME_MAX];
+
+  if (c_strlen(host) + 2 > sizeof(name)) {
+    return FALSE;
+  }
+  copy_and_encode_name(name, host);
+
+  return mdns_cache_address(name, ip);
+}
+
+int ICACHE_FLASH_ATTR
+nodemcu_mdns_browse_cached(const char *service, nodemcu_mdns_browse_cb cb, void *arg) {
+  u8_t name[MDNS_NAME_MAX];
+  char instance[MDNS_NAME_MAX];
+  char host[MDNS_NAME_MAX];
+  struct mdns_cache_rr *e;
+  u32_t now = mdns_now();
+  int count = 0;
+
+  if (c_strlen(service) + 2 > sizeof(name)) {
+    return 0;
+  }
+  copy_and_encode_name(name, service);
+
+  for (e = mdns_cache; e; e = e->next) {
+    const u8_t *inst = mdns_cache_rdata(e);
+    struct mdns_cache_rr *srv, *txt;
+    ip_addr_t ip;
+    u8_t have_ip = 0;
+    u16_t port = 0;
+
+    if (e->type != DNS_RRTYPE_PTR || mdns_cache_expired(e, now) || !mdns_name_equal(e->data, name)) {
+      continue;
+    }
+    count++;
+    if (!cb) {
+      continue;
+    }
+
+    // the instance label on its own is the friendly name
+    memcpy(instance, inst + 1, *inst);
+    instance[*inst] = 0;
+
+    srv = mdns_cache_find(inst, DNS_RRTYPE_SRV);
+    if (srv) {
+      const u8_t *rdata = mdns_cache_rdata(srv);
+      port = (rdata[4] << 8) | rdata[5];
+      mdns_name_to_str(rdata + SIZEOF_MDNS_SERVICE, host, sizeof(host));
+      have_ip = mdns_cache_address(rdata + SIZEOF_MDNS_SERVICE, &ip);
+    }
+    txt = mdns_cache_find(inst, DNS_RRTYPE_TXT);
+
+    cb(arg, instance, srv ? host : NULL, port, have_ip ? &ip : NULL,
+       txt ? mdns_cache_rdata(txt) : NULL, txt ? txt->rdlen : 0);
+  }
+
+  return count;
+}
+
 #endif /* LWIP_MDNS */
@@ -0,0 +1,358 @@
+/*
+  This file contains the I2S driver implementation.
+
+  Samples are transferred to the I2S peripheral by the SLC DMA engine. The DMA
+  descriptors form a ring and the SLC EOF interrupt fires once per consumed
+  DMA buffer. The ISR converts the next chunk of 8 bit unsigned mono samples
+  into 16 bit signed stereo frames and re-arms the descriptor.
+
+  Output pins are fixed:
+    GPIO15  I2SO_BCK  (bit clock)
+    GPIO2   I2SO_WS   (word select)
+    GPIO3   I2SO_DATA (serial data, shared with UART0 RX)
+*/
+
+#include <ets_sys.h>
+#include "platform.h"
+#include "task/task.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include "pcm.h"
+
+
+// number of DMA buffers in the descriptor ring
+#define DRV_I2S_DMA_BUFS    3
+// stereo frames per DMA buffer
+#define DRV_I2S_DMA_SAMPLES 128
+
+// I2S registers
+#define I2S_BASE                0x60000e00
+#define I2SCONF                 (I2S_BASE + 0x08)
+#define I2SINT_ENA              (I2S_BASE + 0x14)
+#define I2SINT_CLR              (I2S_BASE + 0x18)
+#define I2S_FIFO_CONF           (I2S_BASE + 0x20)
+#define I2SCONF_CHAN            (I2S_BASE + 0x2c)
+
+#define I2S_BCK_DIV_NUM         0x3f
+#define I2S_BCK_DIV_NUM_S       22
+#define I2S_CLKM_DIV_NUM        0x3f
+#define I2S_CLKM_DIV_NUM_S      16
+#define I2S_BITS_MOD            0x0f
+#define I2S_BITS_MOD_S          12
+#define I2S_RECE_MSB_SHIFT      BIT(11)
+#define I2S_TRANS_MSB_SHIFT     BIT(10)
+#define I2S_I2S_TX_START        BIT(8)
+#define I2S_MSB_RIGHT           BIT(7)
+#define I2S_RIGHT_FIRST         BIT(6)
+#define I2S_RECE_SLAVE_MOD      BIT(5)
+#define I2S_TRANS_SLAVE_MOD     BIT(4)
+#define I2S_I2S_RESET_MASK      0x0f
+
+#define I2S_I2S_TX_FIFO_MOD     0x07
+#define I2S_I2S_TX_FIFO_MOD_S   13
+#define I2S_I2S_DSCR_EN         BIT(12)
+#define I2S_TX_CHAN_MOD         0x07
+#define I2S_TX_CHAN_MOD_S       0
+
+// SLC (DMA) registers
+#define SLC_BASE                0x60000b00
+#define SLC_CONF0               (SLC_BASE + 0x00)
+#define SLC_INT_STATUS          (SLC_BASE + 0x08)
+#define SLC_INT_ENA             (SLC_BASE + 0x0c)
+#define SLC_INT_CLR             (SLC_BASE + 0x10)
+#define SLC_RX_LINK             (SLC_BASE + 0x24)
+#define SLC_TX_LINK             (SLC_BASE + 0x28)
+#define SLC_RX_EOF_DES_ADDR     (SLC_BASE + 0x48)
+#define SLC_RX_DSCR_CONF        (SLC_BASE + 0x5c)
+
+#define SLC_MODE                0x03
+#define SLC_MODE_S              12
+#define SLC_RXLINK_RST          BIT(1)
+#define SLC_TXLINK_RST          BIT(0)
+#define SLC_RX_EOF_INT          BIT(17)
+#define SLC_LINK_STOP           BIT(28)
+#define SLC_LINK_START          BIT(29)
+#define SLC_LINK_DESCADDR_MASK  0x000fffff
+#define SLC_RX_FILL_EN          BIT(20)
+#define SLC_RX_EOF_MODE         BIT(19)
+#define SLC_RX_FILL_MODE        BIT(18)
+#define SLC_INFOR_NO_REPLACE    BIT(9)
+#define SLC_TOKEN_NO_REPLACE    BIT(8)
+
+#ifndef ETS_SLC_INUM
+# define ETS_SLC_INUM 1
+#endif
+
+// audio clock output of the BBPLL
+#define I2C_BBPLL               0x67
+#define I2C_BBPLL_HOSTID        4
+#define I2C_BBPLL_EN_AUDIO_CLK  4
+extern void rom_i2c_writeReg_Mask( uint32_t block, uint32_t host_id, uint32_t reg_add,
+                                   uint32_t msb, uint32_t lsb, uint32_t indata );
+
+#define I2S_BASE_CLK            160000000L
+
+// SLC DMA descriptor
+typedef struct slc_desc {
+  uint32_t blocksize :12;
+  uint32_t datalen   :12;
+  uint32_t unused    :5;
+  uint32_t sub_sof   :1;
+  uint32_t eof       :1;
+  uint32_t owner     :1;
+  uint32_t buf_ptr;
+  uint32_t next_link_ptr;
+} slc_desc_t;
+
+typedef struct {
+  slc_desc_t desc[DRV_I2S_DMA_BUFS];
+  uint32_t   buf[DRV_I2S_DMA_BUFS][DRV_I2S_DMA_SAMPLES];
+} dma_t;
+
+
+// fill one DMA buffer with the next samples from the play ring
+static void ICACHE_RAM_ATTR drv_i2s_fill( cfg_t *cfg, uint32_t *dst )
+{
+  uint32_t *end = dst + DRV_I2S_DMA_SAMPLES;
+
+  while (dst < end) {
+    pcm_buf_t *buf = &(cfg->bufs[cfg->rbuf_idx]);
+
+    if (cfg->isr_throttled) {
+      break;
+    }
+
+    if (buf->empty) {
+      // flag ISR throttled
+      cfg->isr_throttled = 1;
+      dbg_platform_gpio_write( PLATFORM_GPIO_LOW );
+      task_post_high( pcm_data_play_task, (os_param_t)cfg );
+      break;
+    }
+
+    // convert unsigned 8 bit mono to signed 16 bit stereo
+    while (dst < end && buf->rpos < buf->len) {
+      uint8_t sample = buf->data[buf->rpos++];
+      uint16_t tmp = abs((int16_t)sample - 128);
+      uint32_t s16 = (uint16_t)((sample - 128) << 8);
+
+      if (tmp > cfg->vu_peak_tmp) {
+        cfg->vu_peak_tmp = tmp;
+      }
+      if (++cfg->vu_samples_tmp >= cfg->vu_req_samples) {
+        cfg->vu_peak = cfg->vu_peak_tmp;
+        task_post_low( pcm_data_vu_task, (os_param_t)cfg );
+        cfg->vu_samples_tmp = 0;
+        cfg->vu_peak_tmp    = 0;
+      }
+
+      *dst++ = (s16 << 16) | s16;
+    }
+
+    if (buf->rpos >= buf->len) {
+      // buffer data consumed, request to re-fill it
+      buf->empty = TRUE;
+      task_post_high( pcm_data_play_task, (os_param_t)cfg );
+      // switch to next buffer in ring
+      if (++cfg->rbuf_idx >= cfg->num_bufs)
+        cfg->rbuf_idx = 0;
+      dbg_platform_gpio_write( PLATFORM_GPIO_LOW );
+    }
+  }
+
+  // pad with silence
+  while (dst < end) {
+    *dst++ = 0;
+  }
+}
+
+static void ICACHE_RAM_ATTR drv_i2s_slc_isr( void *arg )
+{
+  cfg_t *cfg = (cfg_t *)arg;
+  uint32_t status = READ_PERI_REG( SLC_INT_STATUS );
+
+  WRITE_PERI_REG( SLC_INT_CLR, 0xffffffff );
+
+  if (status & SLC_RX_EOF_INT) {
+    slc_desc_t *desc = (slc_desc_t *)READ_PERI_REG( SLC_RX_EOF_DES_ADDR );
+
+    drv_i2s_fill( cfg, (uint32_t *)desc->buf_ptr );
+    desc->owner = 1;
+  }
+}
+
+// find the clock dividers which give the closest match to the requested rate,
+// fails if no pair of 6 bit dividers gets within 5% of it
+static uint8_t drv_i2s_set_rate( uint32_t rate )
+{
+  uint32_t best_bck = 2, best_clkm = 2, best_err = 0xffffffff;
+
+  // 16 bit stereo frame = 32 bit clocks per sample
+  for (uint32_t bck = 2; bck <= I2S_BCK_DIV_NUM; bck++) {
+    uint32_t clkm = (I2S_BASE_CLK / 32 + (rate * bck) / 2) / (rate * bck);
+    if (clkm < 2 || clkm > I2S_CLKM_DIV_NUM)
+      continue;
+    uint32_t actual = I2S_BASE_CLK / 32 / (bck * clkm);
+    uint32_t err = actual > rate ? actual - rate : rate - actual;
+    if (err < best_err) {
+      best_err  = err;
+      best_bck  = bck;
+      best_clkm = clkm;
+    }
+  }
+  if (best_err > rate / 20)
+    return FALSE;
+
+  CLEAR_PERI_REG_MASK( I2SCONF, I2S_TRANS_SLAVE_MOD | I2S_RECE_SLAVE_MOD |
+                                (I2S_BITS_MOD << I2S_BITS_MOD_S) |
+                                (I2S_BCK_DIV_NUM << I2S_BCK_DIV_NUM_S) |
+                                (I2S_CLKM_DIV_NUM << I2S_CLKM_DIV_NUM_S) );
+  SET_PERI_REG_MASK( I2SCONF, I2S_RIGHT_FIRST | I2S_MSB_RIGHT | I2S_RECE_SLAVE_MOD |
+                              I2S_RECE_MSB_SHIFT | I2S_TRANS_MSB_SHIFT |
+                              (best_bck << I2S_BCK_DIV_NUM_S) |
+                              (best_clkm << I2S_CLKM_DIV_NUM_S) );
+  return TRUE;
+}
+
+static uint8_t drv_i2s_stop( cfg_t *cfg )
+{
+  ets_isr_mask( 1 << ETS_SLC_INUM );
+  WRITE_PERI_REG( SLC_INT_ENA, 0 );
+
+  CLEAR_PERI_REG_MASK( I2SCONF, I2S_I2S_TX_START );
+  SET_PERI_REG_MASK( SLC_RX_LINK, SLC_LINK_STOP );
+  SET_PERI_REG_MASK( SLC_TX_LINK, SLC_LINK_STOP );
+
+  return TRUE;
+}
+
+static uint8_t drv_i2s_close( cfg_t *cfg )
+{
+  drv_i2s_stop( cfg );
+
+  // hand the pins back to GPIO and UART functions
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_MTDO_U, FUNC_GPIO15 );
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_GPIO2_U, FUNC_GPIO2 );
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_U0RXD_U, FUNC_U0RXD );
+
+  if (cfg->dma) {
+    c_free( cfg->dma );
+    cfg->dma = NULL;
+  }
+
+  dbg_platform_gpio_mode( PLATFORM_GPIO_INPUT, PLATFORM_GPIO_PULLUP );
+
+  return TRUE;
+}
+
+static uint8_t drv_i2s_play( cfg_t *cfg )
+{
+  dma_t *dma = (dma_t *)cfg->dma;
+
+  if (!dma)
+    return FALSE;
+  if (!drv_i2s_set_rate( pcm_rate_hz[cfg->rate] ))
+    return FALSE;
+
+  // VU control: derive callback frequency
+  cfg->vu_req_samples = (uint16_t)(pcm_rate_hz[cfg->rate] / (uint32_t)cfg->vu_freq);
+  cfg->vu_samples_tmp = 0;
+  cfg->vu_peak_tmp    = 0;
+
+  // start with silence, the ISR fetches samples once the first buffer is consumed
+  c_memset( dma->buf, 0, sizeof( dma->buf ) );
+
+  // reset DMA engine and descriptor links
+  SET_PERI_REG_MASK( SLC_CONF0, SLC_RXLINK_RST | SLC_TXLINK_RST );
+  CLEAR_PERI_REG_MASK( SLC_CONF0, SLC_RXLINK_RST | SLC_TXLINK_RST );
+  WRITE_PERI_REG( SLC_INT_CLR, 0xffffffff );
+
+  // samples are fed to I2S through the RX link, the TX link needs a valid descriptor nonetheless
+  CLEAR_PERI_REG_MASK( SLC_TX_LINK, SLC_LINK_DESCADDR_MASK );
+  SET_PERI_REG_MASK( SLC_TX_LINK, (uint32_t)&(dma->desc[1]) & SLC_LINK_DESCADDR_MASK );
+  CLEAR_PERI_REG_MASK( SLC_RX_LINK, SLC_LINK_DESCADDR_MASK );
+  SET_PERI_REG_MASK( SLC_RX_LINK, (uint32_t)&(dma->desc[0]) & SLC_LINK_DESCADDR_MASK );
+
+  ets_isr_attach( ETS_SLC_INUM, drv_i2s_slc_isr, (void *)cfg );
+  WRITE_PERI_REG( SLC_INT_ENA, SLC_RX_EOF_INT );
+  ets_isr_unmask( 1 << ETS_SLC_INUM );
+
+  CLEAR_PERI_REG_MASK( SLC_TX_LINK, SLC_LINK_STOP );
+  CLEAR_PERI_REG_MASK( SLC_RX_LINK, SLC_LINK_STOP );
+  SET_PERI_REG_MASK( SLC_TX_LINK, SLC_LINK_START );
+  SET_PERI_REG_MASK( SLC_RX_LINK, SLC_LINK_START );
+  SET_PERI_REG_MASK( I2SCONF, I2S_I2S_TX_START );
+
+  return TRUE;
+}
+
+static uint8_t drv_i2s_init( cfg_t *cfg )
+{
+  dma_t *dma;
+
+  dbg_platform_gpio_write( PLATFORM_GPIO_HIGH );
+  dbg_platform_gpio_mode( PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_PULLUP );
+
+  if (!(dma = (dma_t *)c_malloc( sizeof( dma_t ) )))
+    return FALSE;
+  cfg->dma = dma;
+
+  // link descriptors to a ring
+  for (int i = 0; i < DRV_I2S_DMA_BUFS; i++) {
+    dma->desc[i].owner         = 1;
+    dma->desc[i].eof           = 1;
+    dma->desc[i].sub_sof       = 0;
+    dma->desc[i].unused        = 0;
+    dma->desc[i].datalen       = DRV_I2S_DMA_SAMPLES * sizeof( uint32_t );
+    dma->desc[i].blocksize     = DRV_I2S_DMA_SAMPLES * sizeof( uint32_t );
+    dma->desc[i].buf_ptr       = (uint32_t)&(dma->buf[i][0]);
+    dma->desc[i].next_link_ptr = (uint32_t)&(dma->desc[(i+1) % DRV_I2S_DMA_BUFS]);
+  }
+
+  // SLC in DMA mode
+  ets_isr_mask( 1 << ETS_SLC_INUM );
+  WRITE_PERI_REG( SLC_INT_CLR, 0xffffffff );
+  SET_PERI_REG_MASK( SLC_CONF0, SLC_RXLINK_RST | SLC_TXLINK_RST );
+  CLEAR_PERI_REG_MASK( SLC_CONF0, SLC_RXLINK_RST | SLC_TXLINK_RST );
+  CLEAR_PERI_REG_MASK( SLC_CONF0, SLC_MODE << SLC_MODE_S );
+  SET_PERI_REG_MASK( SLC_CONF0, 1 << SLC_MODE_S );
+  SET_PERI_REG_MASK( SLC_RX_DSCR_CONF, SLC_INFOR_NO_REPLACE | SLC_TOKEN_NO_REPLACE );
+  CLEAR_PERI_REG_MASK( SLC_RX_DSCR_CONF, SLC_RX_FILL_EN | SLC_RX_EOF_MODE | SLC_RX_FILL_MODE );
+
+  // route I2S output to the pins
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_MTDO_U, 1 );   // I2SO_BCK
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_GPIO2_U, 1 );  // I2SO_WS
+  PIN_FUNC_SELECT( PERIPHS_IO_MUX_U0RXD_U, 1 );  // I2SO_DATA
+
+  // enable audio clock and reset I2S
+  rom_i2c_writeReg_Mask( I2C_BBPLL, I2C_BBPLL_HOSTID, I2C_BBPLL_EN_AUDIO_CLK, 7, 7, 1 );
+  WRITE_PERI_REG( I2SINT_CLR, 0x3f );
+  WRITE_PERI_REG( I2SINT_ENA, 0 );
+  CLEAR_PERI_REG_MASK( I2SCONF, I2S_I2S_RESET_MASK );
+  SET_PERI_REG_MASK( I2SCONF, I2S_I2S_RESET_MASK );
+  CLEAR_PERI_REG_MASK( I2SCONF, I2S_I2S_RESET_MASK );
+
+  // 16 bit full duplex FIFO fed by DMA, dual channel output
+  CLEAR_PERI_REG_MASK( I2S_FIFO_CONF, I2S_I2S_TX_FIFO_MOD << I2S_I2S_TX_FIFO_MOD_S );
+  SET_PERI_REG_MASK( I2S_FIFO_CONF, I2S_I2S_DSCR_EN );
+  CLEAR_PERI_REG_MASK( I2SCONF_CHAN, I2S_TX_CHAN_MOD << I2S_TX_CHAN_MOD_S );
+
+  return TRUE;
+}
+
+static uint8_t drv_i2s_fail( cfg_t *cfg )
+{
+  return FALSE;
+}
+
+const drv_t pcm_drv_i2s = {
+  .init   = drv_i2s_init,
+  .close  = drv_i2s_close,
+  .play   = drv_i2s_play,
+  .record = drv_i2s_fail,
+  .stop   = drv_i2s_stop,
+  // 160 MHz / 32 / (63 * 63) is about 1.26 kHz, 1 kHz can't be reached
+  .min_rate = PCM_RATE_2K,
+  .max_rate = PCM_RATE_44K
+};
@@ -43,17 +43,16 @@ static void ICACHE_RAM_ATTR drv_sd_timer_isr( os_param_t arg )
     if (buf->rpos >= buf->len) {
       // buffer data consumed, request to re-fill it
       buf->empty = TRUE;
-      cfg->fbuf_idx = cfg->rbuf_idx;
       task_post_high( pcm_data_play_task, (os_param_t)cfg );
-      // switch to next buffer
-      cfg->rbuf_idx ^= 1;
+      // switch to next buffer in ring
+      if (++cfg->rbuf_idx >= cfg->num_bufs)
+        cfg->rbuf_idx = 0;
       dbg_platform_gpio_write( PLATFORM_GPIO_LOW );
     }
   } else {
     // flag ISR throttled
     cfg->isr_throttled = 1;
     dbg_platform_gpio_write( PLATFORM_GPIO_LOW );
-    cfg->fbuf_idx = cfg->rbuf_idx;
     task_post_high( pcm_data_play_task, (os_param_t)cfg );
   }
 
@@ -116,5 +115,7 @@ const drv_t pcm_drv_sd = {
   .close  = drv_sd_close,
   .play   = drv_sd_play,
   .record = drv_sd_fail,
-  .stop   = drv_sd_stop
+  .stop   = drv_sd_stop,
+  .min_rate = PCM_RATE_1K,
+  .max_rate = PCM_RATE_16K
 };
@@ -21,9 +21,16 @@
 
 #define BASE_RATE 1000000
 
+// maximum number of buffers in the play ring
+#define PCM_MAX_BUFS 8
+// defaults for native file playback
+#define PCM_FILE_BUFS     4
+#define PCM_FILE_BUF_SIZE 512
+
 enum pcm_driver_index {
   PCM_DRIVER_SD  = 0,
-  PCM_DRIVER_END = 1
+  PCM_DRIVER_I2S = 1,
+  PCM_DRIVER_END = 2
 };
 
 enum pcm_rate_index {
@@ -35,11 +42,18 @@ enum pcm_rate_index {
   PCM_RATE_10K = 5,
   PCM_RATE_12K = 6,
   PCM_RATE_16K = 7,
+  PCM_RATE_22K = 8,
+  PCM_RATE_32K = 9,
+  PCM_RATE_44K = 10,
 };
 
 static const uint16_t pcm_rate_def[] = {BASE_RATE / 1000,  BASE_RATE / 2000, BASE_RATE / 4000,
                                         BASE_RATE / 5000,  BASE_RATE / 8000, BASE_RATE / 10000,
-                                        BASE_RATE / 12000, BASE_RATE / 16000};
+                                        BASE_RATE / 12000, BASE_RATE / 16000, BASE_RATE / 22050,
+                                        BASE_RATE / 32000, BASE_RATE / 44100};
+
+static const uint16_t pcm_rate_hz[] = {1000,  2000,  4000,  5000,  8000, 10000,
+                                       12000, 16000, 22050, 32000, 44100};
 
 typedef struct {
   // available bytes in buffer
@@ -64,17 +78,23 @@ typedef struct {
   // buffer selectors
   uint8_t rbuf_idx;   // read by ISR
   uint8_t fbuf_idx;   // fill by data task
+  uint8_t num_bufs;   // buffers in ring
   // callback fn refs
   int self_ref;
     int cb_data_ref, cb_drained_ref, cb_paused_ref, cb_stopped_ref, cb_vu_ref;
   // data buffers
-  pcm_buf_t bufs[2];
+  pcm_buf_t bufs[PCM_MAX_BUFS];
+  // native file source, fd is 0 when data is fetched from Lua
+  int fd;
+  uint32_t file_left;
   // vu measuring
   uint8_t  vu_freq;
   uint16_t vu_req_samples, vu_samples_tmp;
   uint16_t vu_peak_tmp, vu_peak;
   // sigma-delta: output pin
   int pin;
+  // i2s: DMA descriptors and sample buffers
+  void *dma;
 } cfg_t;
 
 typedef uint8_t (*drv_fn_t)(cfg_t *);
@@ -85,18 +105,30 @@ typedef struct {
   drv_fn_t play;
   drv_fn_t record;
   drv_fn_t stop;
+  // lowest and highest supported rate index
+  uint8_t min_rate, max_rate;
 } drv_t;
 
 
 typedef struct {
   cfg_t cfg;
   const drv_t *drv;
+  // driver has been closed, by drv:close() or the garbage collector
+  uint8_t closed;
 } pud_t;
 
 
 void pcm_data_vu( task_param_t param, uint8 prio );
 void pcm_data_play( task_param_t param, uint8 prio );
 
+// pcm_file_open() results other than a rate index
+#define PCM_FILE_RAW      -1  // raw stream, the file holds no rate
+#define PCM_FILE_ERROR    -2  // can't be opened or isn't a valid WAV file
+#define PCM_FILE_BAD_RATE -3  // WAV file with a rate that isn't supported
+
+int  pcm_file_open( cfg_t *cfg, const char *name );
+void pcm_file_close( cfg_t *cfg );
+
 // task handles
 extern task_handle_t pcm_data_vu_task, pcm_data_play_task, pcm_start_play_task;
 
@@ -3,8 +3,9 @@
 
   pcm_data_play_task()
     Triggered by the driver ISR when further data for play mode is required.
-    It handles the play buffer allocation and forwards control to 'data' and 'drained'
-    callbacks in Lua land.
+    It reads ahead and fills all empty buffers of the play ring, either natively
+    from a file opened with drv:playfile() or by forwarding control to the 'data'
+    callback in Lua land. Fires the 'drained' callback at the end of data.
 
   pcm_data_rec_task() - n/a yet
     Triggered by the driver ISR when data for record mode is available.
@@ -15,6 +16,7 @@
 #include "task/task.h"
 #include "c_string.h"
 #include "c_stdlib.h"
+#include "vfs.h"
 
 #include "pcm.h"
 
@@ -40,59 +42,93 @@ void pcm_data_vu( task_param_t param, uint8 prio )
   }
 }
 
-void pcm_data_play( task_param_t param, uint8 prio )
+// fetch the next chunk from the Lua 'data' callback
+static uint8_t fill_from_callback( lua_State *L, cfg_t *cfg, pcm_buf_t *buf )
 {
-  cfg_t *cfg = (cfg_t *)param;
-  pcm_buf_t *buf = &(cfg->bufs[cfg->fbuf_idx]);
   size_t string_len;
-  const char *data = NULL;
-  uint8_t need_pop = FALSE;
-  lua_State *L = lua_getstate();
+  const char *data;
+
+  if (cfg->cb_data_ref == LUA_NOREF)
+    return FALSE;
 
-  // retrieve new data from callback
-  if ((cfg->isr_throttled >= 0) &&
-      (cfg->cb_data_ref != LUA_NOREF)) {
-    dispatch_callback( L, cfg->self_ref, cfg->cb_data_ref, 1 );
-    need_pop = TRUE;
-
-    if (lua_type( L, -1 ) == LUA_TSTRING) {
-      data = lua_tolstring( L, -1, &string_len );
-      if (string_len > buf->buf_size) {
-        uint8_t *new_data = (uint8_t *) c_malloc( string_len );
-        if (new_data) {
-          if (buf->data) c_free( buf->data );
-          buf->buf_size = string_len;
-          buf->data = new_data;
-        }
-      }
+  dispatch_callback( L, cfg->self_ref, cfg->cb_data_ref, 1 );
+
+  if (lua_type( L, -1 ) != LUA_TSTRING) {
+    lua_pop( L, 1 );
+    return FALSE;
+  }
+
+  data = lua_tolstring( L, -1, &string_len );
+  if (string_len > buf->buf_size) {
+    uint8_t *new_data = (uint8_t *) c_malloc( string_len );
+    if (new_data) {
+      if (buf->data) c_free( buf->data );
+      buf->buf_size = string_len;
+      buf->data = new_data;
     }
   }
 
-  if (data) {
-    size_t to_copy = string_len > buf->buf_size ? buf->buf_size : string_len;
-    c_memcpy( buf->data, data, to_copy );
+  buf->len = string_len > buf->buf_size ? buf->buf_size : string_len;
+  c_memcpy( buf->data, data, buf->len );
+  lua_pop( L, 1 );
+
+  return TRUE;
+}
+
+// read the next chunk from the native file source straight into the buffer
+static uint8_t fill_from_file( cfg_t *cfg, pcm_buf_t *buf )
+{
+  size_t to_read = buf->buf_size;
+  sint32_t n;
+
+  if (to_read > cfg->file_left)
+    to_read = cfg->file_left;
+  if (to_read == 0)
+    return FALSE;
+
+  n = vfs_read( cfg->fd, buf->data, to_read );
+  if (n <= 0) {
+    cfg->file_left = 0;
+    return FALSE;
+  }
+  cfg->file_left -= n;
+  buf->len = n;
+
+  return TRUE;
+}
+
+void pcm_data_play( task_param_t param, uint8 prio )
+{
+  cfg_t *cfg = (cfg_t *)param;
+  uint8_t got_data = FALSE;
+  lua_State *L = lua_getstate();
+
+  if (cfg->isr_throttled < 0)
+    return;
+
+  // read ahead: re-fill all empty buffers of the ring in play order
+  while (cfg->bufs[cfg->fbuf_idx].empty) {
+    pcm_buf_t *buf = &(cfg->bufs[cfg->fbuf_idx]);
+
+    if (!(cfg->fd ? fill_from_file( cfg, buf ) : fill_from_callback( L, cfg, buf )))
+      break;
 
     buf->rpos  = 0;
-    buf->len   = to_copy;
     buf->empty = FALSE;
     dbg_platform_gpio_write( PLATFORM_GPIO_HIGH );
-    lua_pop( L, 1 );
+    got_data = TRUE;
+
+    if (++cfg->fbuf_idx >= cfg->num_bufs)
+      cfg->fbuf_idx = 0;
+  }
 
+  if (got_data) {
     if (cfg->isr_throttled > 0) {
-      uint8_t other_buf = cfg->fbuf_idx ^ 1;
-
-      if (cfg->bufs[other_buf].empty) {
-        // rerun data callback to get next buffer chunk
-        dbg_platform_gpio_write( PLATFORM_GPIO_LOW );
-        cfg->fbuf_idx = other_buf;
-        pcm_data_play( param, 0 );
-      }
       // unthrottle ISR
       cfg->isr_throttled = 0;
     }
   } else {
     dbg_platform_gpio_write( PLATFORM_GPIO_HIGH );
-    if (need_pop) lua_pop( L, 1 );
 
     if (cfg->isr_throttled > 0) {
       // ISR found no further data
@@ -100,6 +136,7 @@ void pcm_data_play( task_param_t param, uint8 prio )
 
       cfg->isr_throttled = -1;
 
+      pcm_file_close( cfg );
       dispatch_callback( L, cfg->self_ref, cfg->cb_drained_ref, 0 );
     }
   }
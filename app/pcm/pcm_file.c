@@ -0,0 +1,102 @@
+/*
+  This file contains the native file source for the PCM sub-system.
+
+  pcm_file_open()
+    Opens a raw unsigned 8 bit stream or a WAV file from the VFS. WAV headers are
+    parsed and the stream is positioned at the start of the sample data. The
+    samples are then read ahead into the play ring by pcm_data_play().
+
+*/
+
+#include "c_string.h"
+#include "vfs.h"
+
+#include "pcm.h"
+
+
+static uint32_t get_le( const uint8_t *p, int len )
+{
+  uint32_t val = 0;
+
+  while (len-- > 0)
+    val = (val << 8) | p[len];
+
+  return val;
+}
+
+// parse the RIFF chunks up to the 'data' chunk
+// returns the rate index, PCM_FILE_BAD_RATE or PCM_FILE_ERROR
+static int parse_wav( cfg_t *cfg )
+{
+  uint8_t hdr[16];
+  int rate = PCM_FILE_ERROR;
+
+  while (vfs_read( cfg->fd, hdr, 8 ) == 8) {
+    uint32_t chunk_len = get_le( &hdr[4], 4 );
+
+    if (c_memcmp( hdr, "data", 4 ) == 0) {
+      cfg->file_left = chunk_len;
+      return rate;
+
+    } else if (c_memcmp( hdr, "fmt ", 4 ) == 0) {
+      if (chunk_len < 16 || vfs_read( cfg->fd, hdr, 16 ) != 16)
+        return PCM_FILE_ERROR;
+      // PCM format, mono, 8 bit samples only
+      if (get_le( &hdr[0], 2 ) != 1 || get_le( &hdr[2], 2 ) != 1 || get_le( &hdr[14], 2 ) != 8)
+        return PCM_FILE_ERROR;
+
+      uint32_t hz = get_le( &hdr[4], 4 );
+      rate = PCM_FILE_BAD_RATE;
+      for (int i = PCM_RATE_1K; i <= PCM_RATE_44K; i++) {
+        if (pcm_rate_hz[i] == hz)
+          rate = i;
+      }
+      chunk_len -= 16;
+    }
+
+    // skip remainder of chunk, chunks are padded to even length
+    if (vfs_lseek( cfg->fd, (chunk_len + 1) & ~1, VFS_SEEK_CUR ) < 0)
+      return PCM_FILE_ERROR;
+  }
+
+  return PCM_FILE_ERROR;
+}
+
+// Returns the rate index found in a WAV header, PCM_FILE_RAW for raw files,
+// PCM_FILE_BAD_RATE for WAV files with an unsupported rate and
+// PCM_FILE_ERROR if the file can't be played.  The file is left open for
+// all but PCM_FILE_ERROR.
+int pcm_file_open( cfg_t *cfg, const char *name )
+{
+  uint8_t riff[12];
+  int rate = PCM_FILE_RAW;
+
+  pcm_file_close( cfg );
+
+  if (!(cfg->fd = vfs_open( name, "r" )))
+    return PCM_FILE_ERROR;
+
+  if (vfs_read( cfg->fd, riff, 12 ) == 12 &&
+      c_memcmp( &riff[0], "RIFF", 4 ) == 0 &&
+      c_memcmp( &riff[8], "WAVE", 4 ) == 0) {
+    rate = parse_wav( cfg );
+  } else {
+    // raw stream, play until end of file
+    vfs_lseek( cfg->fd, 0, VFS_SEEK_SET );
+    cfg->file_left = 0xffffffff;
+  }
+
+  if (rate == PCM_FILE_ERROR)
+    pcm_file_close( cfg );
+
+  return rate;
+}
+
+void pcm_file_close( cfg_t *cfg )
+{
+  if (cfg->fd) {
+    vfs_close( cfg->fd );
+    cfg->fd = 0;
+  }
+  cfg->file_left = 0;
+}
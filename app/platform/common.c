@@ -4,12 +4,42 @@
 #include "common.h"
 #include "c_string.h"
 #include "c_stdio.h"
+#include "user_interface.h"
 
 void cmn_platform_init(void)
 {
 
 }
 
+// ****************************************************************************
+// Boot timeline
+
+#define BOOT_MARKS 12
+
+static struct {
+  const char *phase;
+  uint32_t us;
+} boot_marks[BOOT_MARKS];
+static unsigned boot_nmarks;
+
+void platform_boot_mark( const char *phase )
+{
+  if( boot_nmarks < BOOT_MARKS )
+  {
+    boot_marks[ boot_nmarks ].phase = phase;
+    boot_marks[ boot_nmarks++ ].us = system_get_time();
+  }
+}
+
+int platform_boot_get_mark( unsigned n, const char **phase, uint32_t *us )
+{
+  if( n >= boot_nmarks )
+    return 0;
+  *phase = boot_marks[ n ].phase;
+  *us = boot_marks[ n ].us;
+  return 1;
+}
+
 // ****************************************************************************
 // Internal flash support functions
 
@@ -302,6 +302,15 @@ int platform_ow_exists( unsigned id );
 int platform_gpio_exists( unsigned id );
 int platform_tmr_exists( unsigned id );
 
+// *****************************************************************************
+// Boot timeline
+
+// Records the time since boot, in microseconds, at which a start-up phase
+// completed. phase must be a string constant.
+void platform_boot_mark( const char *phase );
+// Returns the n-th mark (from 0), or 0 if there are no more
+int platform_boot_get_mark( unsigned n, const char **phase, uint32_t *us );
+
 // *****************************************************************************
 
 void* platform_print_deprecation_note( const char *msg, const char *time_frame);
@@ -12,6 +12,7 @@
 
 #define U8X8_USE_PINS
 #include "u8x8_nodemcu_hal.h"
+#include "u8g2_displays.h"
 
 // static variables containing info about the i2c link
 // TODO: move to user space in u8x8_t once available
@@ -19,6 +20,11 @@ typedef struct {
   uint8_t id;
 } hal_i2c_t;
 
+// size of the spi coalescing buffer, see u8g2_displays.h
+#ifndef U8G2_SPI_BUFFER_SIZE
+# define U8G2_SPI_BUFFER_SIZE 256
+#endif
+
 // static variables containing info about the spi link
 // TODO: move to user space in u8x8_t once available
 typedef struct {
@@ -35,6 +41,7 @@ typedef struct {
 static void flush_buffer_spi( hal_spi_t *hal )
 {
   if (hal->buffer.data && hal->buffer.used > 0) {
+    // buffer is word aligned, platform_spi_blkwrite() splits it into 64 byte FIFO bursts
     platform_spi_blkwrite( hal->host, hal->buffer.used, hal->buffer.data );
 
     hal->buffer.used = 0;
@@ -243,7 +250,16 @@ uint8_t u8x8_byte_nodemcu_spi(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *
         return 0;
       hal->host = host;
       ((u8g2_nodemcu_t *)u8x8)->hal = hal;
-      hal->buffer.data = NULL;
+
+      // the coalescing buffer is allocated once and kept for the display's lifetime,
+      // c_malloc returns word aligned memory as required by the fast FIFO write path
+      hal->buffer.size = (U8G2_SPI_BUFFER_SIZE + 3) & ~3;
+      if (!(hal->buffer.data = (uint8_t *)c_malloc( hal->buffer.size ))) {
+        c_free( hal );
+        ((u8g2_nodemcu_t *)u8x8)->hal = (void *)host;
+        return 0;
+      }
+      hal->buffer.used = 0;
 
       hal->last_dc = 0;
     }
@@ -258,8 +274,7 @@ uint8_t u8x8_byte_nodemcu_spi(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *
     break;
 
   case U8X8_MSG_BYTE_START_TRANSFER:
-    hal->buffer.size = 256;
-    if (!(hal->buffer.data = (uint8_t *)c_malloc( hal->buffer.size )))
+    if (!hal->buffer.data)
       return 0;
     hal->buffer.used = 0;
 
@@ -270,20 +285,24 @@ uint8_t u8x8_byte_nodemcu_spi(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *
     if (!hal->buffer.data)
       return 0;
 
-    while (hal->buffer.size - hal->buffer.used < arg_int) {
-      hal->buffer.size *= 2;
-      uint8_t *tmp;
-      if (!(tmp = (uint8_t *)c_malloc( hal->buffer.size ))) {
-        c_free( hal->buffer.data );
-        hal->buffer.data = NULL;
-        return 0;
+    {
+      const uint8_t *src = (const uint8_t *)arg_ptr;
+
+      // merge consecutive data into the buffer and drain it whenever it fills up
+      while (arg_int > 0) {
+        size_t chunk = hal->buffer.size - hal->buffer.used;
+        if (chunk > arg_int)
+          chunk = arg_int;
+
+        os_memcpy( hal->buffer.data + hal->buffer.used, src, chunk );
+        hal->buffer.used += chunk;
+        src += chunk;
+        arg_int -= chunk;
+
+        if (hal->buffer.used == hal->buffer.size)
+          flush_buffer_spi( hal );
       }
-      os_memcpy( tmp, hal->buffer.data, hal->buffer.used );
-      c_free( hal->buffer.data );
-      hal->buffer.data = tmp;
     }
-    os_memcpy( hal->buffer.data + hal->buffer.used, arg_ptr, arg_int );
-    hal->buffer.used += arg_int;
     break;
 
   case U8X8_MSG_BYTE_END_TRANSFER:
@@ -293,9 +312,6 @@ uint8_t u8x8_byte_nodemcu_spi(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *
     flush_buffer_spi( hal );
 
     u8x8_gpio_SetCS( u8x8, u8x8->display_info->chip_disable_level );
-
-    c_free( hal->buffer.data );
-    hal->buffer.data = NULL;
     break;
 
   default:
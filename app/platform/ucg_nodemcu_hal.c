@@ -11,26 +11,43 @@
 
 #define USE_PIN_LIST
 #include "ucg_nodemcu_hal.h"
+#include "ucg_config.h"
 
 #define delayMicroseconds os_delay_us
 
+// size of the spi coalescing buffer, see ucg_config.h
+#ifndef UCG_SPI_BUFFER_SIZE
+# define UCG_SPI_BUFFER_SIZE 64
+#endif
 
-static spi_data_type cache;
-static uint8_t cached;
+// consecutive data bytes are merged in a word aligned buffer and sent
+// as 64 byte HSPI FIFO bursts, the buffer is flushed before any change
+// of the CD, CS or reset lines and before delays
+static uint32_t spi_buf[(UCG_SPI_BUFFER_SIZE + 3) / 4];
+static size_t spi_buf_used;
 
-#define CACHED_TRANSFER(dat, num) cache = cached = 0;  \
-    while( arg > 0 ) {                                \
-        if (cached == 4) {                                              \
-            platform_spi_transaction( 1, 0, 0, 32, cache, 0, 0, 0 );    \
-            cache = cached = 0;                                         \
-        }                                                               \
-        cache = (cache << num*8) | dat;                                 \
-        cached += num;                                                  \
-        arg--;                                                          \
-    }                                                                   \
-    if (cached > 0) {                                                   \
-        platform_spi_transaction( 1, 0, 0, cached * 8, cache, 0, 0, 0 ); \
-    }
+static void flush_buffer_spi( void )
+{
+  if (spi_buf_used > 0) {
+    platform_spi_blkwrite( 1, spi_buf_used, (const uint8_t *)spi_buf );
+    spi_buf_used = 0;
+  }
+}
+
+static inline void buffer_byte_spi( uint8_t dat )
+{
+  ((uint8_t *)spi_buf)[spi_buf_used++] = dat;
+  if (spi_buf_used == sizeof( spi_buf ))
+    flush_buffer_spi();
+}
+
+static void buffer_repeat_spi( const uint8_t *dat, size_t num, uint16_t count )
+{
+  while (count-- > 0) {
+    for (size_t i = 0; i < num; i++)
+      buffer_byte_spi( dat[i] );
+  }
+}
 
 
 int16_t ucg_com_nodemcu_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uint8_t *data)
@@ -58,47 +75,52 @@ int16_t ucg_com_nodemcu_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uint8_t *d
         break;
 
     case UCG_COM_MSG_POWER_DOWN:
+        flush_buffer_spi();
         break;
 
     case UCG_COM_MSG_DELAY:
+        flush_buffer_spi();
         delayMicroseconds(arg);
         break;
 
     case UCG_COM_MSG_CHANGE_RESET_LINE:
+        flush_buffer_spi();
         if ( ucg->pin_list[UCG_PIN_RST] != UCG_PIN_VAL_NONE )
             platform_gpio_write( ucg->pin_list[UCG_PIN_RST], arg );
         break;
 
     case UCG_COM_MSG_CHANGE_CS_LINE:
+        flush_buffer_spi();
         if ( ucg->pin_list[UCG_PIN_CS] != UCG_PIN_VAL_NONE )
             platform_gpio_write( ucg->pin_list[UCG_PIN_CS], arg );
         break;
 
     case UCG_COM_MSG_CHANGE_CD_LINE:
+        flush_buffer_spi();
         platform_gpio_write( ucg->pin_list[UCG_PIN_CD], arg );
         break;
 
     case UCG_COM_MSG_SEND_BYTE:
-        platform_spi_send( 1, 8, arg );
+        buffer_byte_spi( arg );
         break;
 
     case UCG_COM_MSG_REPEAT_1_BYTE:
-        CACHED_TRANSFER(data[0], 1);
+        buffer_repeat_spi( data, 1, arg );
         break;
 
     case UCG_COM_MSG_REPEAT_2_BYTES:
-        CACHED_TRANSFER((data[0] << 8) | data[1], 2);
+        buffer_repeat_spi( data, 2, arg );
         break;
 
     case UCG_COM_MSG_REPEAT_3_BYTES:
-        while( arg > 0 ) {
-            platform_spi_transaction( 1, 0, 0, 24, (data[0] << 16) | (data[1] << 8) | data[2], 0, 0, 0 );
-            arg--;
-        }
+        buffer_repeat_spi( data, 3, arg );
         break;
 
     case UCG_COM_MSG_SEND_STR:
-        CACHED_TRANSFER(*data++, 1);
+        while( arg > 0 ) {
+            buffer_byte_spi( *data++ );
+            arg--;
+        }
         break;
 
     case UCG_COM_MSG_SEND_CD_DATA_SEQUENCE:
@@ -106,6 +128,7 @@ int16_t ucg_com_nodemcu_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uint8_t *d
         {
             if ( *data != 0 )
             {
+                flush_buffer_spi();
                 /* set the data line directly, ignore the setting from UCG_CFG_CD */
                 if ( *data == 1 )
                 {
@@ -117,10 +140,11 @@ int16_t ucg_com_nodemcu_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uint8_t *d
                 }
             }
             data++;
-            platform_spi_send( 1, 8, *data );
+            buffer_byte_spi( *data );
             data++;
             arg--;
         }
+        flush_buffer_spi();
         break;
   }
   return 1;
@@ -2,6 +2,7 @@
 
 #include "c_stdlib.h"
 #include "c_stdio.h"
+#include "c_string.h"
 #include "vfs.h"
 
 
@@ -67,6 +68,49 @@ static const char *normalize_path( const char *path )
 }
 
 
+// ---------------------------------------------------------------------------
+// deferred mount
+//
+static void (*mount_cb)( void ) = NULL;
+
+// called by operating system, cb mounts the file system on first access
+void vfs_defer_mount( void (*cb)( void ) )
+{
+  mount_cb = cb;
+}
+
+static void mount_pending( void )
+{
+  if (mount_cb) {
+    void (*cb)( void ) = mount_cb;
+
+    mount_cb = NULL;  // cb itself goes through vfs_mount() and vfs_format()
+    cb();
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// change tracking
+//
+static uint32_t changes = 0, writes = 0, chdirs = 0;
+
+uint32_t vfs_changes( void )
+{
+  return changes;
+}
+
+uint32_t vfs_writes( void )
+{
+  return writes;
+}
+
+uint32_t vfs_chdirs( void )
+{
+  return chdirs;
+}
+
+
 // ---------------------------------------------------------------------------
 // file system functions
 //
@@ -76,6 +120,10 @@ vfs_vol *vfs_mount( const char *name, int num )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
+  changes++;
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
     return fs_fns->mount( outname, num );
@@ -99,6 +147,18 @@ int vfs_open( const char *name, const char *mode )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
+  if (mode[0] != 'r' || c_strchr( mode, '+' )) {
+    writes++;
+    if (mode[0] != 'r') {
+      // only a file that doesn't exist yet changes the set of files
+      struct vfs_stat st;
+      if (vfs_stat( name, &st ) != VFS_RES_OK)
+        changes++;
+    }
+  }
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
     return (int)fs_fns->open( outname, mode );
@@ -122,6 +182,8 @@ vfs_dir *vfs_opendir( const char *name )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
     return fs_fns->opendir( outname );
@@ -145,6 +207,8 @@ sint32_t vfs_stat( const char *name, struct vfs_stat *buf )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
     return fs_fns->stat( outname, buf );
@@ -168,6 +232,10 @@ sint32_t vfs_remove( const char *name )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
+  changes++;
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
     return fs_fns->remove( outname );
@@ -192,6 +260,10 @@ sint32_t vfs_rename( const char *oldname, const char *newname )
   const char *normnewname = normalize_path( newname );
   char *oldoutname, *newoutname;
 
+  mount_pending();
+
+  changes++;
+
 #ifdef BUILD_SPIFFS
   if (myspiffs_realm( normoldname, &oldoutname, FALSE )) {
     if (fs_fns = myspiffs_realm( normnewname, &newoutname, FALSE )) {
@@ -221,6 +293,10 @@ sint32_t vfs_mkdir( const char *name )
   const char *normname = normalize_path( name );
   char *outname;
 
+  mount_pending();
+
+  changes++;
+
 #ifdef BUILD_SPIFFS
   // not supported
 #endif
@@ -241,6 +317,8 @@ sint32_t vfs_fsinfo( const char *name, uint32_t *total, uint32_t *used )
   vfs_fs_fns *fs_fns;
   char *outname;
 
+  mount_pending();
+
   if (!name) name = "";  // current drive
 
   const char *normname = normalize_path( name );
@@ -266,6 +344,8 @@ sint32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size)
   vfs_fs_fns *fs_fns;
   char *outname;
 
+  mount_pending();
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
     return fs_fns->fscfg( phys_addr, phys_size );
@@ -285,6 +365,10 @@ sint32_t vfs_format( void )
   vfs_fs_fns *fs_fns;
   char *outname;
 
+  mount_cb = NULL;  // formatting leaves the file system mounted
+
+  changes++;
+
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
     return fs_fns->format();
@@ -307,6 +391,10 @@ sint32_t vfs_chdir( const char *path )
   char *outname;
   int ok = VFS_RES_ERR;
 
+  mount_pending();
+
+  chdirs++;
+
 #if LDRV_TRAVERSAL
   // track dir level
   if (normpath[0] == '/') {
@@ -357,6 +445,8 @@ sint32_t vfs_errno( const char *name )
   vfs_fs_fns *fs_fns;
   char *outname;
 
+  mount_pending();
+
   if (!name) name = "";  // current drive
 
   const char *normname = normalize_path( name );
@@ -411,6 +501,8 @@ void vfs_clearerr( const char *name )
   vfs_fs_fns *fs_fns;
   char *outname;
 
+  mount_pending();
+
   if (!name) name = "";  // current drive
 
   const char *normname = normalize_path( name );
@@ -193,6 +193,24 @@ void      vfs_clearerr( const char *name );
 //   cb: pointer to callback function
 void vfs_register_rtc_cb( sint32_t (*cb)( vfs_time *tm ) );
 
+// vfs_defer_mount - register callback function which mounts the file system,
+//   called once before the first file system access
+//   cb: pointer to callback function
+void vfs_defer_mount( void (*cb)( void ) );
+
+// vfs_changes - count of operations which may have changed the set of files
+//   (mount, creating open, remove, rename, mkdir and format)
+//   Returns: counter value, only meaningful for comparison with a previous one
+uint32_t vfs_changes( void );
+
+// vfs_writes - count of opens for writing, which may have changed file contents
+//   Returns: counter value, only meaningful for comparison with a previous one
+uint32_t vfs_writes( void );
+
+// vfs_chdirs - count of chdir calls, which change what relative names refer to
+//   Returns: counter value, only meaningful for comparison with a previous one
+uint32_t vfs_chdirs( void );
+
 // vfs_basename - identify basename (incl. extension)
 //   path: full file system path
 //   Returns: pointer to basename within path string
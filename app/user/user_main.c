@@ -109,6 +109,7 @@ void TEXT_SECTION_ATTR user_start_trampoline (void)
 // +================== New task interface ==================+
 static void start_lua(task_param_t param, uint8 priority) {
   char* lua_argv[] = { (char *)"lua", (char *)"-i", NULL };
+  platform_boot_mark("lua_task");
   NODE_DBG("Task task_lua started.\n");
   lua_main( 2, lua_argv );
   // Only enable UART interrupts once we've successfully started up,
@@ -129,7 +130,23 @@ bool user_process_input(bool force) {
     return task_post_low(input_sig, force);
 }
 
+#ifdef BUILD_SPIFFS
+static void mount_fs(void) {
+    if (!vfs_mount("/FLASH", 0)) {
+        // Failed to mount -- try reformat
+	dbg_printf("Formatting file system. Please wait...\n");
+        if (!vfs_format()) {
+            NODE_ERR( "\n*** ERROR ***: unable to format. FS might be compromised.\n" );
+            NODE_ERR( "It is advised to re-flash the NodeMCU image.\n" );
+        }
+        // Note that fs_format leaves the file system mounted
+    }
+    platform_boot_mark("fs_mount");
+}
+#endif
+
 void nodemcu_init(void) {
+    platform_boot_mark("sdk_init");
     NODE_ERR("\n");
     // Initialize platform first for lua modules.
     if( platform_init() != PLATFORM_OK )
@@ -138,6 +155,7 @@ void nodemcu_init(void) {
         NODE_DBG("Can not init platform for modules.\n");
         return;
     }
+    platform_boot_mark("platform");
     uint32_t size_detected = flash_detect_size_byte();
     uint32_t size_from_rom = flash_rom_get_size_byte();
     if( size_detected != size_from_rom ) {
@@ -160,15 +178,12 @@ void nodemcu_init(void) {
 #endif
 
 #ifdef BUILD_SPIFFS
-    if (!vfs_mount("/FLASH", 0)) {
-        // Failed to mount -- try reformat
-	dbg_printf("Formatting file system. Please wait...\n");
-        if (!vfs_format()) {
-            NODE_ERR( "\n*** ERROR ***: unable to format. FS might be compromised.\n" );
-            NODE_ERR( "It is advised to re-flash the NodeMCU image.\n" );
-        }
-        // Note that fs_format leaves the file system mounted
-    }
+#ifdef FAST_BOOT
+    // Mounting may scan the whole FS, leave it until a file is first used
+    vfs_defer_mount(mount_fs);
+#else
+    mount_fs();
+#endif
     // test_spiffs();
 #endif
     // endpoint_setup();
@@ -249,6 +264,7 @@ user_rf_cal_sector_set(void)
 *******************************************************************************/
 void user_init(void)
 {
+    platform_boot_mark("user_init");
 #ifdef LUA_USE_MODULES_RTCTIME
     rtctime_late_startup ();
 #endif
@@ -64,6 +64,9 @@ typedef struct uzlib_data UZLIB_DATA;
 int uzlib_inflate (uint8_t (*)(void), void (*)(uint8_t),
                    uint8_t (*)(uint32_t), uint32_t len, uint32_t *crc, void **state);
 
+int uzlib_inflate_raw (uint8_t (*)(void), void (*)(uint8_t),
+                       uint8_t (*)(uint32_t), uint32_t len, void **state);
+
 int uzlib_compress (uint8_t **dest, uint32_t *destLen,
                     const uint8_t *src, uint32_t srcLen);
 
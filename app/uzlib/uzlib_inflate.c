@@ -548,11 +548,11 @@ static int uncompress_stream (UZLIB_DATA *d) {
  * the maximum dictionary size.
  */
 
-int uzlib_inflate (
+static int inflate (
      uchar (*get_byte)(void),
      void (*put_byte)(uchar v),
      uchar (*recall_byte)(uint offset),
-     uint len, uint *crc, void **state) {
+     uint len, uint *crc, void **state, int gzip) {
   int res;
 
   /* initialize decompression structure */
@@ -590,14 +590,35 @@ int uzlib_inflate (
   d->lengthBits[28] = 0;              /* fix a special case */
   d->lengthBase[28] = 258;
 
-  if ((res = parse_gzip_header(d))== UZLIB_OK)
+  if ((res = gzip ? parse_gzip_header(d) : UZLIB_OK) == UZLIB_OK)
     while ((res = uncompress_stream(d)) == UZLIB_OK)
       {}
 
-  if (res == UZLIB_DONE) {
+  if (res == UZLIB_DONE && gzip) {
     d->checksum = get_le_uint32(d);
     (void) get_le_uint32(d);         /* already got length so ignore */ 
   }
 
   UZLIB_THROW(res);
 }
+
+int uzlib_inflate (
+     uchar (*get_byte)(void),
+     void (*put_byte)(uchar v),
+     uchar (*recall_byte)(uint offset),
+     uint len, uint *crc, void **state) {
+  return inflate(get_byte, put_byte, recall_byte, len, crc, state, 1);
+}
+
+/*
+ * As above but for a raw RFC 1951 bitstream without gzip header and
+ * trailer, as used for example by the WebSocket permessage-deflate
+ * extension.  Decompression stops at the end of the final block.
+ */
+int uzlib_inflate_raw (
+     uchar (*get_byte)(void),
+     void (*put_byte)(uchar v),
+     uchar (*recall_byte)(uint offset),
+     uint len, void **state) {
+  return inflate(get_byte, put_byte, recall_byte, len, NULL, state, 0);
+}
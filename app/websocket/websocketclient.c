@@ -35,13 +35,13 @@
 #include "c_stdio.h"
 
 #include "websocketclient.h"
-
-// Depends on 'crypto' module for sha1
-#include "../crypto/digests.h"
-#include "../crypto/mech.h"
+#include "websocketcommon.h"
 
 #include "pm/swtimer.h"
 
+// Decompression for permessage-deflate
+#include "uzlib.h"
+
 #define PROTOCOL_SECURE "wss://"
 #define PROTOCOL_INSECURE "ws://"
 
@@ -53,24 +53,20 @@
                          "Host: %s:%d\r\n"
 
 #define WS_INIT_REQUEST_LENGTH 30
-#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define WS_GUID_LENGTH 36
 
 #define WS_HTTP_SWITCH_PROTOCOL_HEADER "HTTP/1.1 101"
 #define WS_HTTP_SEC_WEBSOCKET_ACCEPT "Sec-WebSocket-Accept:"
 
+// Without context takeover, each message can be inflated on its own
+#define WS_DEFLATE_OFFER "permessage-deflate; client_no_context_takeover; server_no_context_takeover"
+#define WS_DEFLATE_NAME "permessage-deflate"
+#define WS_DEFLATE_NO_TAKEOVER "server_no_context_takeover"
+
 #define WS_CONNECT_TIMEOUT_MS 10 * 1000
 #define WS_PING_INTERVAL_MS 30 * 1000
 #define WS_FORCE_CLOSE_TIMEOUT_MS 5 * 1000
 #define WS_UNHEALTHY_THRESHOLD 2
 
-#define WS_OPCODE_CONTINUATION 0x0
-#define WS_OPCODE_TEXT 0x1
-#define WS_OPCODE_BINARY 0x2
-#define WS_OPCODE_CLOSE 0x8
-#define WS_OPCODE_PING 0x9
-#define WS_OPCODE_PONG 0xA
-
 static const header_t DEFAULT_HEADERS[] = {
   {"User-Agent", "ESP8266"},
   {"Sec-WebSocket-Protocol", "chat"},
@@ -78,37 +74,6 @@ static const header_t DEFAULT_HEADERS[] = {
 };
 static const header_t *EMPTY_HEADERS = DEFAULT_HEADERS + sizeof(DEFAULT_HEADERS) / sizeof(header_t) - 1;
 
-static char *cryptoSha1(char *data, unsigned int len) {
-  SHA1_CTX ctx;
-  SHA1Init(&ctx);
-  SHA1Update(&ctx, data, len);
-  
-  uint8_t *digest = (uint8_t *) c_zalloc(20);
-  SHA1Final(digest, &ctx);
-  return (char *) digest; // Requires free
-}
-
-static const char *bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static char *base64Encode(char *data, unsigned int len) {
-  int blen = (len + 2) / 3 * 4;
-
-  char *out = (char *) c_zalloc(blen + 1);
-  out[blen] = '\0';
-  int j = 0, i;
-  for (i = 0; i < len; i += 3) {
-    int a = data[i];
-    int b = (i + 1 < len) ? data[i + 1] : 0;
-    int c = (i + 2 < len) ? data[i + 2] : 0;
-    out[j++] = bytes64[a >> 2];
-    out[j++] = bytes64[((a & 3) << 4) | (b >> 4)];
-    out[j++] = (i + 1 < len) ? bytes64[((b & 15) << 2) | (c >> 6)] : 61;
-    out[j++] = (i + 2 < len) ? bytes64[(c & 63)] : 61;
-  }
-
-  return out; // Requires free
-}
-
 static void generateSecKeys(char **key, char **expectedKey) {
   char rndData[16];
   int i;
@@ -117,16 +82,7 @@ static void generateSecKeys(char **key, char **expectedKey) {
   }
 
   *key = base64Encode(rndData, 16);
-
-  // expectedKey = b64(sha1(keyB64 + GUID))
-  char keyWithGuid[24 + WS_GUID_LENGTH];
-  memcpy(keyWithGuid, *key, 24);
-  memcpy(keyWithGuid + 24, WS_GUID, WS_GUID_LENGTH);
-
-  char *keyEncrypted = cryptoSha1(keyWithGuid, 24 + WS_GUID_LENGTH);
-  *expectedKey = base64Encode(keyEncrypted, 20);
-
-  os_free(keyEncrypted);
+  *expectedKey = ws_acceptKey(*key);
 }
 
 static char *_strcpy(char *dst, char *src) {
@@ -241,10 +197,7 @@ static void ws_sendFrame(struct espconn *conn, int opCode, const char *data, uns
   memcpy(b + bufOffset, data, len);
 
   // Apply mask to encode payload
-  int i;
-  for (i = 0; i < len; i++) {
-    b[bufOffset + i] ^= b[bufOffset - 4 + i % 4]; 
-  }
+  ws_unmask(b + bufOffset, len, b + bufOffset - 4, 0);
   bufOffset += len;
 
   NODE_DBG("b[0] = %d \n", b[0]);
@@ -287,247 +240,269 @@ static void ws_sendPingTimeout(void *arg) {
   ws->unhealthyPoints += 1;
 }
 
-static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
-  NODE_DBG("ws_receiveCallback %d \n", len);
-  struct espconn *conn = (struct espconn *) arg;
-  ws_info *ws = (ws_info *) conn->reverse;
+static void ws_failure(struct espconn *conn, ws_info *ws, int failureCode) {
+  ws->knownFailureCode = failureCode;
+  if (ws->isSecure)
+    espconn_secure_disconnect(conn);
+  else
+    espconn_disconnect(conn);
+}
 
-  ws->unhealthyPoints = 0; // received data, connection is healthy
-  os_timer_disarm(&ws->timeoutTimer); // reset ping check
-  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
+// Makes room for another `extra` bytes plus a terminating NUL in the payload buffer
+static bool ws_reservePayload(ws_info *ws, unsigned int extra) {
+  unsigned int size = ws->payloadBufferLen + extra + 1;
+  if (size <= ws->payloadBufferSize)
+    return true;
 
+  // fragmented message, grow geometrically as the total length isn't known
+  if (ws->payloadBufferLen > 0 && size < ws->payloadBufferSize * 2)
+    size = ws->payloadBufferSize * 2;
 
-  char *b = buf;
-  if (ws->frameBuffer != NULL) { // Append previous frameBuffer with new content
-    NODE_DBG("Appending new frameBuffer to old one \n");
+  char *buf = ws->payloadBuffer ? c_realloc(ws->payloadBuffer, size) : c_malloc(size);
+  if (buf == NULL)
+    return false;
 
-    ws->frameBuffer = c_realloc(ws->frameBuffer, ws->frameBufferLen + len);
-    if (ws->frameBuffer == NULL) {
-      NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
+  ws->payloadBuffer = buf;
+  ws->payloadBufferSize = size;
+  return true;
+}
 
-      ws->knownFailureCode = -8;
-      if (ws->isSecure)
-        espconn_secure_disconnect(conn);
-      else
-        espconn_disconnect(conn);
-      return;
-    }
-    memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
-
-    ws->frameBufferLen += len;
-
-    len = ws->frameBufferLen;
-    b = ws->frameBuffer;
-    NODE_DBG("New frameBufferLen: %d\n", len);
-  }
-
-  while (b != NULL) { // several frames can be present, b pointer will be moved to the next frame
-    NODE_DBG("b[0] = %d \n", b[0]);
-    NODE_DBG("b[1] = %d \n", b[1]);
-    NODE_DBG("b[2] = %d \n", b[2]);
-    NODE_DBG("b[3] = %d \n", b[3]);
-    NODE_DBG("b[4] = %d \n", b[4]);
-    NODE_DBG("b[5] = %d \n", b[5]);
-    NODE_DBG("b[6] = %d \n", b[6]);
-    NODE_DBG("b[7] = %d \n", b[7]);
-
-    int isFin = b[0] & 0x80 ? 1 : 0;
-    int opCode = b[0] & 0x0f;
-    int hasMask = b[1] & 0x80 ? 1 : 0;
-    uint64_t payloadLength = b[1] & 0x7f;
-    int bufOffset = 2;
-    if (payloadLength == 126) {
-      payloadLength = (b[2] << 8) + b[3];
-      bufOffset = 4;
-    } else if (payloadLength == 127) { // this will clearly not hold in heap, abort??
-      payloadLength = (b[2] << 24) + (b[3] << 16) + (b[4] << 8) + b[5];
-      bufOffset = 6;
-    }
+static void ws_freePayload(ws_info *ws) {
+  if (ws->payloadBuffer != NULL) {
+    os_free(ws->payloadBuffer);
+    ws->payloadBuffer = NULL;
+  }
+  ws->payloadBufferLen = 0;
+  ws->payloadBufferSize = 0;
+  ws->payloadOriginalOpCode = 0;
+  ws->payloadCompressed = false;
+  ws->payloadStreaming = false;
+}
 
-    if (hasMask) {
-      int maskOffset = bufOffset;
-      bufOffset += 4;
+// uzlib callbacks carry no context
+static struct {
+  const uint8_t *in;
+  unsigned int inLen;
+  unsigned int inPos;
+  char *out;
+  unsigned int outLen;
+  unsigned int outSize;
+} ws_inflateState;
+
+// The sender strips the 00 00 ff ff trailer of the final flush from each message. Restore it
+// and follow it by an empty final block, so that the end of the stream is seen.
+static const uint8_t ws_deflateTrailer[] = { 0x00, 0x00, 0xff, 0xff, 0x03, 0x00 };
+
+static uint8_t ws_inflateGetByte(void) {
+  if (ws_inflateState.inPos < ws_inflateState.inLen)
+    return ws_inflateState.in[ws_inflateState.inPos++];
+
+  unsigned int i = ws_inflateState.inPos++ - ws_inflateState.inLen;
+  if (i >= sizeof(ws_deflateTrailer))
+    UZLIB_THROW(UZLIB_DATA_ERROR);
+  return ws_deflateTrailer[i];
+}
 
-      int i;
-      for (i = 0; i < payloadLength; i++) {
-        b[bufOffset + i] ^= b[maskOffset + i % 4]; // apply mask to decode payload
-      }
-    }
+static void ws_inflatePutByte(uint8_t b) {
+  if (ws_inflateState.outLen + 1 >= ws_inflateState.outSize) { // keep room for the terminating NUL
+    char *out = c_realloc(ws_inflateState.out, ws_inflateState.outSize * 2);
+    if (out == NULL)
+      UZLIB_THROW(UZLIB_MEMORY_ERROR);
+    ws_inflateState.out = out;
+    ws_inflateState.outSize *= 2;
+  }
+  ws_inflateState.out[ws_inflateState.outLen++] = b;
+}
 
-    if (payloadLength > len - bufOffset) {
-      NODE_DBG("INCOMPLETE Frame \n");
-      if (ws->frameBuffer == NULL) {
-        NODE_DBG("Allocing new frameBuffer \n");
-        ws->frameBuffer = c_zalloc(len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate framebuffer, disconnecting... \n");
-
-          ws->knownFailureCode = -9;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->frameBuffer, b, len);
-        ws->frameBufferLen = len;
-      }
-      break; // since the buffer were already concat'ed, wait for the next receive
+static uint8_t ws_inflateRecallByte(uint32_t offset) {
+  if (offset > ws_inflateState.outLen)
+    UZLIB_THROW(UZLIB_DATA_ERROR);
+  return ws_inflateState.out[ws_inflateState.outLen - offset];
+}
+
+// Replaces the compressed payload by its decompressed content
+static int ws_inflatePayload(ws_info *ws) {
+  void *state;
+
+  ws_inflateState.in = (const uint8_t *) ws->payloadBuffer;
+  ws_inflateState.inLen = ws->payloadBufferLen;
+  ws_inflateState.inPos = 0;
+  ws_inflateState.outLen = 0;
+  ws_inflateState.outSize = ws->payloadBufferLen * 4 + 64;
+  ws_inflateState.out = c_malloc(ws_inflateState.outSize);
+  if (ws_inflateState.out == NULL)
+    return UZLIB_MEMORY_ERROR;
+
+  // no context takeover was negotiated, so the whole window is within this message
+  int res = uzlib_inflate_raw(ws_inflateGetByte, ws_inflatePutByte, ws_inflateRecallByte,
+                              UINT_MAX, &state);
+  if (res != UZLIB_DONE) {
+    os_free(ws_inflateState.out);
+    return res;
+  }
+
+  os_free(ws->payloadBuffer);
+  ws->payloadBuffer = ws_inflateState.out;
+  ws->payloadBufferLen = ws_inflateState.outLen;
+  ws->payloadBufferSize = ws_inflateState.outSize;
+  return UZLIB_DONE;
+}
+
+// Called once the frame header is complete, sets up where its payload goes
+static bool ws_beginFrame(struct espconn *conn, ws_info *ws) {
+  const uint8_t *h = (const uint8_t *) ws->frameHeader;
+  int isFin = h[0] & 0x80 ? 1 : 0;
+  int isCompressed = h[0] & 0x40 ? 1 : 0;
+  int opCode = h[0] & 0x0f;
+  uint32_t payloadLength = h[1] & 0x7f;
+  if (payloadLength == 126) {
+    payloadLength = (h[2] << 8) + h[3];
+  } else if (payloadLength == 127) {
+    if (h[2] | h[3] | h[4] | h[5]) { // this will clearly not hold in heap
+      NODE_DBG("Frame too large, disconnecting...\n");
+      ws_failure(conn, ws, -20);
+      return false;
     }
+    payloadLength = (h[6] << 24) + (h[7] << 16) + (h[8] << 8) + h[9];
+  }
 
-    if (!isFin) {
-      NODE_DBG("PARTIAL frame! Should concat payload and later restore opcode\n");
-      if(ws->payloadBuffer == NULL) {
-        NODE_DBG("Allocing new payloadBuffer \n");
-        ws->payloadBuffer = c_zalloc(payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -10;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer, b + bufOffset, payloadLength);
-        ws->frameBufferLen = payloadLength;
-        ws->payloadOriginalOpCode = opCode;
-      } else {
-        NODE_DBG("Appending new payloadBuffer to old one \n");
-        ws->payloadBuffer = c_realloc(ws->payloadBuffer, ws->payloadBufferLen + payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -11;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer + ws->payloadBufferLen, b + bufOffset, payloadLength);
+  NODE_DBG("isFin %d \n", isFin);
+  NODE_DBG("opCode %d \n", opCode);
+  NODE_DBG("payloadLength %d \n", payloadLength);
 
-        ws->payloadBufferLen += payloadLength;
-      }
-    } else {
-      char *payload;
-      if (opCode == WS_OPCODE_CONTINUATION) {
-        NODE_DBG("restoring original opcode\n");
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Got FIN continuation frame but didn't receive any beforehand, disconnecting...\n");
-
-          ws->knownFailureCode = -15;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        // concat buffer with payload
-        payload = c_zalloc(ws->payloadBufferLen + payloadLength);
+  ws->framePos = 0;
+  ws->frameLeft = payloadLength;
 
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
+  if (opCode & 0x08) { // control frames may come in between fragments
+    if (!isFin || isCompressed || payloadLength > sizeof(ws->controlBuffer)) {
+      NODE_DBG("Invalid control frame, disconnecting...\n");
+      ws_failure(conn, ws, -20);
+      return false;
+    }
+    return true;
+  }
 
-          ws->knownFailureCode = -12;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(payload, ws->payloadBuffer, ws->payloadBufferLen);
-        memcpy(payload + ws->payloadBufferLen, b + bufOffset, payloadLength);
+  if ((h[0] & 0x30) || (isCompressed && !ws->deflate)) {
+    NODE_DBG("Unexpected reserved bits, disconnecting...\n");
+    ws_failure(conn, ws, -20);
+    return false;
+  }
 
-        os_free(ws->payloadBuffer); // free previous buffer
-        ws->payloadBuffer = NULL;
+  if (opCode == WS_OPCODE_CONTINUATION) {
+    if (ws->payloadOriginalOpCode == 0 || isCompressed) {
+      NODE_DBG("Got continuation frame but didn't receive any beforehand, disconnecting...\n");
+      ws_failure(conn, ws, -15);
+      return false;
+    }
+  } else {
+    if (ws->payloadOriginalOpCode != 0) {
+      NODE_DBG("Got new message before previous one was finished, disconnecting...\n");
+      ws_failure(conn, ws, -15);
+      return false;
+    }
+    ws->payloadOriginalOpCode = opCode;
+    ws->payloadCompressed = isCompressed;
+    ws->payloadStreaming = ws->streamThreshold > 0 && !isCompressed &&
+                           (!isFin || payloadLength >= ws->streamThreshold);
+  }
 
-        payloadLength += ws->payloadBufferLen;
-        ws->payloadBufferLen = 0;
+  // sized once from the header, the payload is then copied straight from the network buffers
+  if (!ws->payloadStreaming && !ws_reservePayload(ws, payloadLength)) {
+    NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
+    ws_failure(conn, ws, -8);
+    return false;
+  }
+  return true;
+}
 
-        opCode = ws->payloadOriginalOpCode;
-        ws->payloadOriginalOpCode = 0;
-      } else {
-        int extensionDataOffset = 0;
+static void ws_framePayload(ws_info *ws, char *data, unsigned int len) {
+  int isFin = ws->frameHeader[0] & 0x80 ? 1 : 0;
+  int opCode = ws->frameHeader[0] & 0x0f;
 
-        if (opCode == WS_OPCODE_CLOSE && payloadLength > 0) {
-          unsigned int reasonCode = b[bufOffset] << 8 + b[bufOffset + 1];
-          NODE_DBG("Closing due to: %d\n", reasonCode); // Must not be shown to client as per spec
-          extensionDataOffset += 2;
-        }
+  if (ws->frameHeader[1] & 0x80)
+    ws_unmask(data, len, ws->frameHeader + ws->frameHeaderLen - 4, ws->framePos);
 
-        payload = c_zalloc(payloadLength - extensionDataOffset + 1);
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate payload, disconnecting...\n");
+  if (opCode & 0x08) {
+    memcpy(ws->controlBuffer + ws->framePos, data, len);
+  } else if (ws->payloadStreaming) {
+    if (ws->onReceive) ws->onReceive(ws, len, data, ws->payloadOriginalOpCode, isFin && len == ws->frameLeft);
+  } else {
+    memcpy(ws->payloadBuffer + ws->payloadBufferLen, data, len);
+    ws->payloadBufferLen += len;
+  }
 
-          ws->knownFailureCode = -13;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
+  ws->framePos += len;
+  ws->frameLeft -= len;
+}
 
-        memcpy(payload, b + bufOffset + extensionDataOffset, payloadLength - extensionDataOffset);
-        payload[payloadLength - extensionDataOffset] = '\0';
-      }
+static bool ws_endFrame(struct espconn *conn, ws_info *ws) {
+  int isFin = ws->frameHeader[0] & 0x80 ? 1 : 0;
+  int opCode = ws->frameHeader[0] & 0x0f;
 
-      NODE_DBG("isFin %d \n", isFin);
-      NODE_DBG("opCode %d \n", opCode);
-      NODE_DBG("hasMask %d \n", hasMask);
-      NODE_DBG("payloadLength %d \n", payloadLength);
-      NODE_DBG("len %d \n", len);
-      NODE_DBG("bufOffset %d \n", bufOffset);
-
-      if (opCode == WS_OPCODE_CLOSE) {
-        NODE_DBG("Closing message: %s\n", payload); // Must not be shown to client as per spec
-
-        espconn_regist_sentcb(conn, ws_closeSentCallback);
-        ws_sendFrame(conn, WS_OPCODE_CLOSE, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-        ws->connectionState = 4;
-      } else if (opCode == WS_OPCODE_PING) {
-        ws_sendFrame(conn, WS_OPCODE_PONG, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-      } else if (opCode == WS_OPCODE_PONG) {
-        // ping alarm was already reset...
-      } else {
-        if (ws->onReceive) ws->onReceive(ws, payloadLength, payload, opCode);
-      }
-      os_free(payload);
+  ws->frameHeaderLen = 0;
+
+  if (opCode == WS_OPCODE_CLOSE) {
+    if (ws->framePos >= 2) {
+      unsigned int reasonCode = ((uint8_t) ws->controlBuffer[0] << 8) + (uint8_t) ws->controlBuffer[1];
+      NODE_DBG("Closing due to: %d\n", reasonCode); // Must not be shown to client as per spec
     }
 
-    bufOffset += payloadLength;
-    NODE_DBG("bufOffset %d \n", bufOffset);
-    if (bufOffset == len) { // (bufOffset > len) won't happen here because it's being checked earlier
-      b = NULL;
-      if (ws->frameBuffer != NULL) { // the last frame inside buffer was processed
-        os_free(ws->frameBuffer);
-        ws->frameBuffer = NULL;
-        ws->frameBufferLen = 0;
-      }
+    espconn_regist_sentcb(conn, ws_closeSentCallback);
+    ws_sendFrame(conn, WS_OPCODE_CLOSE, ws->controlBuffer, (unsigned short) ws->framePos);
+    ws->connectionState = 4;
+  } else if (opCode == WS_OPCODE_PING) {
+    ws_sendFrame(conn, WS_OPCODE_PONG, ws->controlBuffer, (unsigned short) ws->framePos);
+  } else if (opCode == WS_OPCODE_PONG) {
+    // ping alarm was already reset...
+  } else if (isFin) {
+    opCode = ws->payloadOriginalOpCode;
+
+    if (ws->payloadStreaming) {
+      if (ws->framePos == 0 && ws->onReceive) ws->onReceive(ws, 0, "", opCode, 1);
     } else {
-      len -= bufOffset;
-      b += bufOffset; // move b to next frame
-      if (ws->frameBuffer != NULL) {
-        NODE_DBG("Reallocing frameBuffer to remove consumed frame\n");
-
-        ws->frameBuffer = c_realloc(ws->frameBuffer, ws->frameBufferLen + len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate new frame buffer, disconnecting...\n");
-
-          ws->knownFailureCode = -14;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
+      if (ws->payloadCompressed) {
+        int res = ws_inflatePayload(ws);
+        if (res != UZLIB_DONE) {
+          NODE_DBG("Failed to inflate message: %d, disconnecting...\n", res);
+          ws_failure(conn, ws, res == UZLIB_MEMORY_ERROR ? -9 : -21);
+          return false;
         }
-        memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
-
-        ws->frameBufferLen += len;
-        b = ws->frameBuffer;
       }
+      ws->payloadBuffer[ws->payloadBufferLen] = '\0';
+      if (ws->onReceive) ws->onReceive(ws, ws->payloadBufferLen, ws->payloadBuffer, opCode, 1);
+    }
+    ws_freePayload(ws);
+  }
+  return true;
+}
+
+static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
+  NODE_DBG("ws_receiveCallback %d \n", len);
+  struct espconn *conn = (struct espconn *) arg;
+  ws_info *ws = (ws_info *) conn->reverse;
+
+  ws->unhealthyPoints = 0; // received data, connection is healthy
+  os_timer_disarm(&ws->timeoutTimer); // reset ping check
+  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
+
+  // several frames can be present and frames can span several receives
+  while (len > 0) {
+    if (ws->frameHeaderLen < ws_frameHeaderLength(ws->frameHeader, ws->frameHeaderLen)) {
+      ws->frameHeader[ws->frameHeaderLen++] = *buf++;
+      len--;
+      if (ws->frameHeaderLen < ws_frameHeaderLength(ws->frameHeader, ws->frameHeaderLen))
+        continue;
+      if (!ws_beginFrame(conn, ws))
+        return;
+    } else {
+      unsigned int chunk = len < ws->frameLeft ? len : ws->frameLeft;
+      ws_framePayload(ws, buf, chunk);
+      buf += chunk;
+      len -= chunk;
     }
+
+    if (ws->frameLeft == 0 && !ws_endFrame(conn, ws))
+      return;
   }
 }
 
@@ -560,6 +535,9 @@ static void ws_initReceiveCallback(void *arg, char *buf, unsigned short len) {
 
   NODE_DBG("Server response is valid, it's now a websocket!\n");
 
+  ws->deflate = ws->wantDeflate && strstr(buf, WS_DEFLATE_NAME) != NULL &&
+                strstr(buf, WS_DEFLATE_NO_TAKEOVER) != NULL;
+
   os_timer_disarm(&ws->timeoutTimer);
   os_timer_setfn(&ws->timeoutTimer, (os_timer_func_t *) ws_sendPingTimeout, conn);
   SWTIMER_REG_CB(ws_sendPingTimeout, SWTIMER_RESUME)
@@ -595,8 +573,13 @@ static void connect_callback(void *arg) {
 	  {"Connection", "Upgrade"},
 	  {"Sec-WebSocket-Key", key},
 	  {"Sec-WebSocket-Version", "13"},
+	  {0},
 	  {0}
   };
+  if (ws->wantDeflate) {
+    headers[4].key = "Sec-WebSocket-Extensions";
+    headers[4].value = WS_DEFLATE_OFFER;
+  }
 
   const header_t *extraHeaders = ws->extraHeaders ? ws->extraHeaders : EMPTY_HEADERS;
 
@@ -639,13 +622,7 @@ static void disconnect_callback(void *arg) {
     os_free(ws->expectedSecKey);
   }
 
-  if (ws->frameBuffer != NULL) {
-    os_free(ws->frameBuffer);
-  }
-
-  if (ws->payloadBuffer != NULL) {
-    os_free(ws->payloadBuffer);
-  }
+  ws_freePayload(ws);
 
   if (conn->proto.tcp != NULL) {
     os_free(conn->proto.tcp);
@@ -805,11 +782,16 @@ void ws_connect(ws_info *ws, const char *url) {
   ws->path = c_strdup(path);
   ws->expectedSecKey = NULL;
   ws->knownFailureCode = 0;
-  ws->frameBuffer = NULL;
-  ws->frameBufferLen = 0;
+  ws->frameHeaderLen = 0;
+  ws->framePos = 0;
+  ws->frameLeft = 0;
   ws->payloadBuffer = NULL;
   ws->payloadBufferLen = 0;
+  ws->payloadBufferSize = 0;
   ws->payloadOriginalOpCode = 0;
+  ws->payloadCompressed = false;
+  ws->payloadStreaming = false;
+  ws->deflate = false;
   ws->unhealthyPoints = 0;
 
   // Prepare espconn
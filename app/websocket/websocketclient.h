@@ -40,7 +40,7 @@
 struct ws_info;
 
 typedef void (*ws_onConnectionCallback)(struct ws_info *wsInfo);
-typedef void (*ws_onReceiveCallback)(struct ws_info *wsInfo, int len, char *message, int opCode);
+typedef void (*ws_onReceiveCallback)(struct ws_info *wsInfo, int len, char *message, int opCode, int isFin);
 typedef void (*ws_onFailureCallback)(struct ws_info *wsInfo, int errorCode);
 
 typedef struct {
@@ -62,12 +62,25 @@ typedef struct ws_info {
   void *reservedData;
   int knownFailureCode;
 
-  char *frameBuffer;
-  int frameBufferLen;
+  // Frame parser, frames are consumed as they arrive from the network
+  char frameHeader[14];
+  int frameHeaderLen;
+  unsigned int framePos;
+  unsigned int frameLeft;
 
+  // Message assembly, sized from the frame header
   char *payloadBuffer;
-  int payloadBufferLen;
+  unsigned int payloadBufferLen;
+  unsigned int payloadBufferSize;
   int payloadOriginalOpCode;
+  bool payloadCompressed;
+  bool payloadStreaming;
+
+  char controlBuffer[125];
+
+  unsigned int streamThreshold; // deliver larger or fragmented messages in pieces, 0 = never
+  bool wantDeflate;             // offer permessage-deflate
+  bool deflate;                 // permessage-deflate was negotiated
 
   os_timer_t  timeoutTimer;
   int unhealthyPoints;
@@ -0,0 +1,143 @@
+/* Helpers shared by the websocket client and server
+ *
+ * Copyright (c) 2016 Luís Fonseca <miguelluisfonseca@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "osapi.h"
+#include "mem.h"
+
+#include "c_types.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+
+#include "websocketcommon.h"
+
+// Depends on 'crypto' module for sha1
+#include "../crypto/digests.h"
+#include "../crypto/mech.h"
+
+char *cryptoSha1(char *data, unsigned int len) {
+  SHA1_CTX ctx;
+  SHA1Init(&ctx);
+  SHA1Update(&ctx, data, len);
+  
+  uint8_t *digest = (uint8_t *) c_zalloc(20);
+  SHA1Final(digest, &ctx);
+  return (char *) digest; // Requires free
+}
+
+static const char *bytes64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+char *base64Encode(char *data, unsigned int len) {
+  int blen = (len + 2) / 3 * 4;
+
+  char *out = (char *) c_zalloc(blen + 1);
+  out[blen] = '\0';
+  int j = 0, i;
+  for (i = 0; i < len; i += 3) {
+    int a = (uint8_t) data[i];
+    int b = (i + 1 < len) ? (uint8_t) data[i + 1] : 0;
+    int c = (i + 2 < len) ? (uint8_t) data[i + 2] : 0;
+    out[j++] = bytes64[a >> 2];
+    out[j++] = bytes64[((a & 3) << 4) | (b >> 4)];
+    out[j++] = (i + 1 < len) ? bytes64[((b & 15) << 2) | (c >> 6)] : 61;
+    out[j++] = (i + 2 < len) ? bytes64[(c & 63)] : 61;
+  }
+
+  return out; // Requires free
+}
+
+char *ws_acceptKey(const char *key) {
+  // acceptKey = b64(sha1(keyB64 + GUID))
+  char keyWithGuid[WS_KEY_LENGTH + WS_GUID_LENGTH];
+  memcpy(keyWithGuid, key, WS_KEY_LENGTH);
+  memcpy(keyWithGuid + WS_KEY_LENGTH, WS_GUID, WS_GUID_LENGTH);
+
+  char *keyEncrypted = cryptoSha1(keyWithGuid, WS_KEY_LENGTH + WS_GUID_LENGTH);
+  if (keyEncrypted == NULL)
+    return NULL;
+  char *acceptKey = base64Encode(keyEncrypted, 20);
+
+  os_free(keyEncrypted);
+  return acceptKey; // Requires free
+}
+
+int ws_frameHeaderLength(const char *header, int len) {
+  if (len < 2)
+    return 2;
+
+  int headerLength = 2;
+  int payloadLength = header[1] & 0x7f;
+  if (payloadLength == 126)
+    headerLength += 2;
+  else if (payloadLength == 127)
+    headerLength += 8;
+  if (header[1] & 0x80)
+    headerLength += 4; // mask
+  return headerLength;
+}
+
+int ws_putFrameHeader(char *header, int opCode, unsigned int len) {
+  header[0] = (1 << 7) + opCode; // has fin
+  if (len < 126) {
+    header[1] = len;
+    return 2;
+  } else if (len < 0x10000) {
+    header[1] = 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    return 4;
+  } else {
+    header[1] = 127;
+    header[2] = header[3] = header[4] = header[5] = 0;
+    header[6] = len >> 24;
+    header[7] = len >> 16;
+    header[8] = len >> 8;
+    header[9] = len;
+    return 10;
+  }
+}
+
+void ws_unmask(char *data, unsigned int len, const char *mask, unsigned int pos) {
+  while (len > 0 && ((uint32_t) data & 3)) {
+    *data++ ^= mask[pos++ & 3];
+    len--;
+  }
+
+  if (len >= 4) {
+    union {
+      uint32_t word;
+      char bytes[4];
+    } m;
+    int i;
+    for (i = 0; i < 4; i++)
+      m.bytes[i] = mask[(pos + i) & 3];
+
+    uint32_t *w = (uint32_t *) data;
+    for (; len >= 4; len -= 4)
+      *w++ ^= m.word;
+    data = (char *) w;
+  }
+
+  while (len-- > 0)
+    *data++ ^= mask[pos++ & 3];
+}
@@ -0,0 +1,72 @@
+/* Helpers shared by the websocket client and server
+ *
+ * Copyright (c) 2016 Luís Fonseca <miguelluisfonseca@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _WEBSOCKETCOMMON_H_
+#define _WEBSOCKETCOMMON_H_
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_GUID_LENGTH 36
+#define WS_KEY_LENGTH 24 // base64 of 16 random bytes
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+#define WS_MAX_FRAME_HEADER 14
+#define WS_MAX_CONTROL_PAYLOAD 125
+
+/*
+ * Returns the SHA1 digest (20 bytes) of data. Requires free.
+ */
+char *cryptoSha1(char *data, unsigned int len);
+
+/*
+ * Returns the NUL terminated base64 encoding of data. Requires free.
+ */
+char *base64Encode(char *data, unsigned int len);
+
+/*
+ * Computes the Sec-WebSocket-Accept value for a Sec-WebSocket-Key. Requires free.
+ */
+char *ws_acceptKey(const char *key);
+
+/*
+ * Returns the length of a frame header, given the first `len` bytes of it.
+ */
+int ws_frameHeaderLength(const char *header, int len);
+
+/*
+ * Writes a frame header without mask, returns its length.
+ */
+int ws_putFrameHeader(char *header, int opCode, unsigned int len);
+
+/*
+ * XORs len bytes of payload with the mask, `pos` being the offset of `data` within the payload.
+ */
+void ws_unmask(char *data, unsigned int len, const char *mask, unsigned int pos);
+
+#endif // _WEBSOCKETCOMMON_H_
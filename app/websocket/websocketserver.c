@@ -0,0 +1,671 @@
+/* Websocket server implementation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "osapi.h"
+#include "mem.h"
+
+#include "c_types.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_stdio.h"
+
+#include "websocketserver.h"
+
+#define WSS_HTTP_GET "GET "
+#define WSS_HTTP_END "\r\n\r\n"
+#define WSS_HTTP_SEC_WEBSOCKET_KEY "Sec-WebSocket-Key:"
+#define WSS_HTTP_SEC_WEBSOCKET_PROTOCOL "Sec-WebSocket-Protocol:"
+
+#define WSS_HTTP_SWITCH_PROTOCOL "HTTP/1.1 101 Switching Protocols\r\n"\
+                                 "Upgrade: websocket\r\n"\
+                                 "Connection: Upgrade\r\n"\
+                                 "Sec-WebSocket-Accept: %s\r\n"
+#define WSS_HTTP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\n\r\n"
+
+#define WSS_CLOSE_NORMAL 1000
+#define WSS_CLOSE_PROTOCOL_ERROR 1002
+#define WSS_CLOSE_TOO_BIG 1009
+
+// Hands as much of the send queue to lwIP as the send buffer takes
+static void wss_drain(wss_client *client) {
+  struct tcp_pcb *pcb = client->pcb;
+  wss_frame *frame;
+  int written = 0;
+
+  while (pcb != NULL && (frame = client->sendQueue) != NULL) {
+    unsigned int chunk = frame->len - frame->sent;
+    if (chunk > tcp_sndbuf(pcb))
+      chunk = tcp_sndbuf(pcb);
+    if (chunk == 0)
+      break;
+
+    u8_t flags = TCP_WRITE_FLAG_COPY;
+    if (frame->sent + chunk < frame->len || frame->next != NULL)
+      flags |= TCP_WRITE_FLAG_MORE;
+    if (tcp_write(pcb, frame->data + frame->sent, chunk, flags) != ERR_OK)
+      break; // out of segments, wait for the next ACK
+    written = 1;
+
+    frame->sent += chunk;
+    client->queued -= chunk;
+    if (frame->sent < frame->len)
+      break;
+    client->sendQueue = frame->next;
+    os_free(frame);
+  }
+  if (written)
+    tcp_output(pcb);
+}
+
+// Appends header and data to the send queue. Unless forced, only one frame of any
+// size or up to WSS_MAX_QUEUED bytes may wait.
+static err_t wss_queue(wss_client *client, const char *header, int headerLen, const char *data, unsigned int len, bool force) {
+  unsigned int size = headerLen + len;
+  if (!force && client->sendQueue != NULL && client->queued + size > WSS_MAX_QUEUED)
+    return ERR_MEM;
+
+  wss_frame *frame = (wss_frame *) c_malloc(sizeof(wss_frame) + size);
+  if (frame == NULL)
+    return ERR_MEM;
+  frame->next = NULL;
+  frame->len = size;
+  frame->sent = 0;
+  memcpy(frame->data, header, headerLen);
+  if (len > 0)
+    memcpy(frame->data + headerLen, data, len);
+
+  wss_frame **pp = &client->sendQueue;
+  while (*pp != NULL)
+    pp = &(*pp)->next;
+  *pp = frame;
+  client->queued += size;
+
+  wss_drain(client);
+  return ERR_OK;
+}
+
+// Sends a frame, or queues what doesn't fit. Forced frames are queued whatever is waiting.
+static err_t wss_write(wss_client *client, const char *header, int headerLen, const char *data, unsigned int len, bool force) {
+  struct tcp_pcb *pcb = client->pcb;
+  if (pcb == NULL)
+    return ERR_CONN;
+
+  // keep the order, and never hand lwIP half a frame unless the rest is queued
+  if (client->sendQueue != NULL || tcp_sndbuf(pcb) < headerLen + len)
+    return wss_queue(client, header, headerLen, data, len, force);
+
+  if (tcp_write(pcb, header, headerLen, TCP_WRITE_FLAG_COPY | (len ? TCP_WRITE_FLAG_MORE : 0)) != ERR_OK)
+    return wss_queue(client, header, headerLen, data, len, force);
+  if (len > 0 && tcp_write(pcb, data, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+    // the header went out already, so the payload must follow
+    err_t err = wss_queue(client, NULL, 0, data, len, true);
+    if (err != ERR_OK) {
+      // a truncated frame corrupts the stream, close once the header is acknowledged
+      client->state = WSS_STATE_CLOSING;
+      client->closeWhenSent = 1;
+      tcp_output(pcb);
+    }
+    return err;
+  }
+  tcp_output(pcb);
+  return ERR_OK;
+}
+
+static void wss_freeClient(wss_client *client) {
+  wss_client **pp;
+  for (pp = &client->server->clients; *pp; pp = &(*pp)->next) {
+    if (*pp == client) {
+      *pp = client->next;
+      break;
+    }
+  }
+
+  if (client->request != NULL)
+    os_free(client->request);
+  if (client->payloadBuffer != NULL)
+    os_free(client->payloadBuffer);
+  if (client->protocol != NULL)
+    os_free(client->protocol);
+  while (client->sendQueue != NULL) {
+    wss_frame *frame = client->sendQueue;
+    client->sendQueue = frame->next;
+    os_free(frame);
+  }
+  os_free(client);
+}
+
+static err_t wss_closePcb(wss_client *client) {
+  struct tcp_pcb *pcb = client->pcb;
+  if (pcb == NULL)
+    return ERR_OK;
+
+  client->pcb = NULL;
+  tcp_arg(pcb, NULL);
+  tcp_recv(pcb, NULL);
+  tcp_sent(pcb, NULL);
+  tcp_err(pcb, NULL);
+  if (tcp_close(pcb) != ERR_OK) {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+// Completes a deferred close once no callback is running for the client any more
+static err_t wss_leave(wss_client *client) {
+  if (--client->busy > 0 || client->state != WSS_STATE_CLOSED)
+    return ERR_OK;
+
+  err_t err = wss_closePcb(client);
+  wss_freeClient(client);
+  return err;
+}
+
+static err_t wss_release(wss_client *client) {
+  if (client->state == WSS_STATE_CLOSED)
+    return ERR_OK;
+
+  int wasOpen = client->state != WSS_STATE_HANDSHAKE;
+  client->state = WSS_STATE_CLOSED;
+
+  client->busy++;
+  if (wasOpen && client->server->onDisconnection)
+    client->server->onDisconnection(client->server, client);
+  return wss_leave(client);
+}
+
+// Releases the client once everything queued went out
+static void wss_finish(wss_client *client) {
+  if (client->sendQueue != NULL && client->pcb != NULL)
+    client->closeWhenSent = 1;
+  else
+    wss_release(client);
+}
+
+static void wss_sendClose(wss_client *client, const char *payload, int len) {
+  char header[WS_MAX_FRAME_HEADER];
+  int headerLen = ws_putFrameHeader(header, WS_OPCODE_CLOSE, len);
+
+  wss_write(client, header, headerLen, payload, len, true);
+  client->state = WSS_STATE_CLOSING;
+}
+
+static void wss_fail(wss_client *client, int statusCode) {
+  NODE_DBG("wss_fail %d\n", statusCode);
+  char status[2] = { statusCode >> 8, statusCode };
+
+  if (client->state == WSS_STATE_OPEN)
+    wss_sendClose(client, status, sizeof(status));
+  wss_finish(client);
+}
+
+// Returns the value of a header line if it is called `name`, or NULL
+static char *wss_headerValue(char *line, const char *name) {
+  int nameLen = strlen(name);
+  if (c_strncasecmp(line, name, nameLen) != 0)
+    return NULL;
+
+  char *value = line + nameLen;
+  while (*value == ' ' || *value == '\t')
+    value++;
+  return value;
+}
+
+// Whether the comma separated list contains the token
+static bool wss_hasToken(const char *list, const char *token, int len) {
+  while (*list) {
+    while (*list == ' ' || *list == ',')
+      list++;
+    const char *end = list;
+    while (*end && *end != ',' && *end != ' ')
+      end++;
+    if (end - list == len && strncmp(list, token, len) == 0)
+      return true;
+    list = end;
+  }
+  return false;
+}
+
+// Picks the first subprotocol the client offers that the server supports
+static void wss_pickProtocol(wss_client *client, const char *offered) {
+  const char *protocols = client->server->protocols;
+  if (protocols == NULL || client->protocol != NULL)
+    return;
+
+  while (*offered) {
+    while (*offered == ' ' || *offered == '\t' || *offered == ',')
+      offered++;
+    const char *end = offered;
+    while (*end && *end != ',' && *end != ' ' && *end != '\t')
+      end++;
+    int len = end - offered;
+    if (len > 0 && wss_hasToken(protocols, offered, len)) {
+      client->protocol = (char *) c_malloc(len + 1);
+      if (client->protocol != NULL) {
+        memcpy(client->protocol, offered, len);
+        client->protocol[len] = '\0';
+      }
+      return;
+    }
+    offered = end;
+  }
+}
+
+// Returns the Sec-WebSocket-Key header value, or NULL, and picks the subprotocol.
+// The request must end with "\r\n", header lines are NUL terminated in place.
+static char *wss_parseRequest(wss_client *client, char *request) {
+  char *key = NULL;
+  char *next = strstr(request, "\r\n");
+
+  while (next != NULL && next[2] != '\0') {
+    char *line = next + 2;
+    next = strstr(line, "\r\n");
+    *next = '\0';
+
+    char *value;
+    if ((value = wss_headerValue(line, WSS_HTTP_SEC_WEBSOCKET_KEY)) != NULL)
+      key = strlen(value) == WS_KEY_LENGTH ? value : NULL;
+    else if ((value = wss_headerValue(line, WSS_HTTP_SEC_WEBSOCKET_PROTOCOL)) != NULL)
+      wss_pickProtocol(client, value);
+  }
+  return key;
+}
+
+// Consumes the HTTP upgrade request, returns the number of bytes used
+static unsigned int wss_handshake(wss_client *client, char *data, unsigned int len) {
+  if (client->request == NULL) {
+    client->request = (char *) c_malloc(WSS_MAX_REQUEST + 1);
+    if (client->request == NULL) {
+      wss_release(client);
+      return len;
+    }
+  }
+
+  unsigned int oldLen = client->requestLen;
+  unsigned int copy = WSS_MAX_REQUEST - oldLen;
+  if (copy > len)
+    copy = len;
+  memcpy(client->request + oldLen, data, copy);
+  client->requestLen += copy;
+  client->request[client->requestLen] = '\0';
+
+  // the end of headers may straddle two receives
+  char *end = strstr(client->request + (oldLen > 3 ? oldLen - 3 : 0), WSS_HTTP_END);
+  if (end == NULL) {
+    if (client->requestLen == WSS_MAX_REQUEST) {
+      NODE_DBG("Request too large\n");
+      wss_write(client, WSS_HTTP_BAD_REQUEST, strlen(WSS_HTTP_BAD_REQUEST), NULL, 0, true);
+      wss_finish(client);
+    }
+    return len;
+  }
+
+  unsigned int used = end + strlen(WSS_HTTP_END) - client->request - oldLen;
+  end[2] = '\0';
+
+  char *key = NULL;
+  if (strncmp(client->request, WSS_HTTP_GET, strlen(WSS_HTTP_GET)) == 0)
+    key = wss_parseRequest(client, client->request);
+
+  char *acceptKey = key ? ws_acceptKey(key) : NULL;
+  os_free(client->request);
+  client->request = NULL;
+
+  if (acceptKey == NULL) {
+    NODE_DBG("Not a websocket upgrade request\n");
+    wss_write(client, WSS_HTTP_BAD_REQUEST, strlen(WSS_HTTP_BAD_REQUEST), NULL, 0, true);
+    wss_finish(client);
+    return len;
+  }
+
+  int protocolLen = client->protocol ? strlen(WSS_HTTP_SEC_WEBSOCKET_PROTOCOL) + strlen(client->protocol) + 3 : 0;
+  char response[strlen(WSS_HTTP_SWITCH_PROTOCOL) + WS_KEY_LENGTH + protocolLen + 8];
+  int responseLen = os_sprintf(response, WSS_HTTP_SWITCH_PROTOCOL, acceptKey);
+  os_free(acceptKey);
+  if (client->protocol != NULL) {
+    strcpy(response + responseLen, WSS_HTTP_SEC_WEBSOCKET_PROTOCOL " ");
+    strcat(response, client->protocol);
+    strcat(response, "\r\n");
+    responseLen += strlen(response + responseLen);
+  }
+  strcpy(response + responseLen, "\r\n");
+  responseLen += 2;
+
+  if (wss_write(client, response, responseLen, NULL, 0, true) != ERR_OK) {
+    wss_release(client);
+    return len;
+  }
+
+  client->state = WSS_STATE_OPEN;
+  if (client->server->onConnection)
+    client->server->onConnection(client->server, client);
+  return used;
+}
+
+// Makes room for another `extra` bytes plus a terminating NUL in the payload buffer
+static bool wss_reservePayload(wss_client *client, unsigned int extra) {
+  unsigned int size = client->payloadBufferLen + extra + 1;
+  if (size <= client->payloadBufferSize)
+    return true;
+
+  // fragmented message, grow geometrically as the total length isn't known
+  if (client->payloadBufferLen > 0 && size < client->payloadBufferSize * 2)
+    size = client->payloadBufferSize * 2;
+
+  char *buf = client->payloadBuffer ? c_realloc(client->payloadBuffer, size) : c_malloc(size);
+  if (buf == NULL)
+    return false;
+
+  client->payloadBuffer = buf;
+  client->payloadBufferSize = size;
+  return true;
+}
+
+static void wss_freePayload(wss_client *client) {
+  if (client->payloadBuffer != NULL) {
+    os_free(client->payloadBuffer);
+    client->payloadBuffer = NULL;
+  }
+  client->payloadBufferLen = 0;
+  client->payloadBufferSize = 0;
+  client->payloadOriginalOpCode = 0;
+}
+
+static bool wss_beginFrame(wss_client *client) {
+  const uint8_t *h = (const uint8_t *) client->frameHeader;
+  int isFin = h[0] & 0x80 ? 1 : 0;
+  int opCode = h[0] & 0x0f;
+  uint32_t payloadLength = h[1] & 0x7f;
+  if (payloadLength == 126) {
+    payloadLength = (h[2] << 8) + h[3];
+  } else if (payloadLength == 127) {
+    if (h[2] | h[3] | h[4] | h[5]) {
+      wss_fail(client, WSS_CLOSE_TOO_BIG);
+      return false;
+    }
+    payloadLength = (h[6] << 24) + (h[7] << 16) + (h[8] << 8) + h[9];
+  }
+
+  client->framePos = 0;
+  client->frameLeft = payloadLength;
+
+  // client frames must be masked, no extensions are negotiated
+  if (!(h[1] & 0x80) || (h[0] & 0x70)) {
+    wss_fail(client, WSS_CLOSE_PROTOCOL_ERROR);
+    return false;
+  }
+
+  if (opCode & 0x08) { // control frames may come in between fragments
+    if (!isFin || payloadLength > WS_MAX_CONTROL_PAYLOAD) {
+      wss_fail(client, WSS_CLOSE_PROTOCOL_ERROR);
+      return false;
+    }
+    return true;
+  }
+
+  if ((opCode == WS_OPCODE_CONTINUATION) != (client->payloadOriginalOpCode != 0)) {
+    NODE_DBG("Unexpected continuation or new message\n");
+    wss_fail(client, WSS_CLOSE_PROTOCOL_ERROR);
+    return false;
+  }
+  if (opCode != WS_OPCODE_CONTINUATION)
+    client->payloadOriginalOpCode = opCode;
+
+  if (client->payloadBufferLen + payloadLength > client->server->maxPayload ||
+      !wss_reservePayload(client, payloadLength)) {
+    wss_fail(client, WSS_CLOSE_TOO_BIG);
+    return false;
+  }
+  return true;
+}
+
+static void wss_framePayload(wss_client *client, char *data, unsigned int len) {
+  int opCode = client->frameHeader[0] & 0x0f;
+
+  ws_unmask(data, len, client->frameHeader + client->frameHeaderLen - 4, client->framePos);
+
+  if (opCode & 0x08) {
+    memcpy(client->controlBuffer + client->framePos, data, len);
+  } else {
+    memcpy(client->payloadBuffer + client->payloadBufferLen, data, len);
+    client->payloadBufferLen += len;
+  }
+
+  client->framePos += len;
+  client->frameLeft -= len;
+}
+
+static void wss_endFrame(wss_client *client) {
+  int isFin = client->frameHeader[0] & 0x80 ? 1 : 0;
+  int opCode = client->frameHeader[0] & 0x0f;
+  wss_server *server = client->server;
+
+  client->frameHeaderLen = 0;
+
+  if (opCode == WS_OPCODE_CLOSE) {
+    if (client->state == WSS_STATE_OPEN)
+      wss_sendClose(client, client->controlBuffer, client->framePos >= 2 ? 2 : 0);
+    wss_finish(client);
+  } else if (opCode == WS_OPCODE_PING) {
+    char header[WS_MAX_FRAME_HEADER];
+    int headerLen = ws_putFrameHeader(header, WS_OPCODE_PONG, client->framePos);
+    wss_write(client, header, headerLen, client->controlBuffer, client->framePos, false);
+  } else if (opCode == WS_OPCODE_PONG) {
+    // nothing to do
+  } else if (isFin) {
+    client->payloadBuffer[client->payloadBufferLen] = '\0';
+    if (server->onReceive && client->state == WSS_STATE_OPEN)
+      server->onReceive(server, client, client->payloadBufferLen, client->payloadBuffer, client->payloadOriginalOpCode);
+    wss_freePayload(client);
+  }
+}
+
+static void wss_input(wss_client *client, char *data, unsigned int len) {
+  while (len > 0 && client->state != WSS_STATE_CLOSED && !client->closeWhenSent) {
+    if (client->state == WSS_STATE_HANDSHAKE) {
+      unsigned int used = wss_handshake(client, data, len);
+      data += used;
+      len -= used;
+      continue;
+    }
+
+    if (client->frameHeaderLen < ws_frameHeaderLength(client->frameHeader, client->frameHeaderLen)) {
+      client->frameHeader[client->frameHeaderLen++] = *data++;
+      len--;
+      if (client->frameHeaderLen < ws_frameHeaderLength(client->frameHeader, client->frameHeaderLen))
+        continue;
+      if (!wss_beginFrame(client))
+        return;
+    } else {
+      unsigned int chunk = len < client->frameLeft ? len : client->frameLeft;
+      wss_framePayload(client, data, chunk);
+      data += chunk;
+      len -= chunk;
+    }
+
+    if (client->frameLeft == 0)
+      wss_endFrame(client);
+  }
+}
+
+static err_t wss_recv_cb(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+  wss_client *client = (wss_client *) arg;
+  if (client == NULL) {
+    if (p != NULL)
+      pbuf_free(p);
+    return ERR_OK;
+  }
+
+  if (p == NULL) // remote end closed
+    return wss_release(client);
+
+  tcp_recved(pcb, p->tot_len);
+
+  client->busy++;
+  struct pbuf *q;
+  for (q = p; q != NULL && client->state != WSS_STATE_CLOSED && !client->closeWhenSent; q = q->next)
+    wss_input(client, (char *) q->payload, q->len);
+  pbuf_free(p);
+
+  return wss_leave(client);
+}
+
+static err_t wss_sent_cb(void *arg, struct tcp_pcb *pcb, u16_t len) {
+  wss_client *client = (wss_client *) arg;
+  if (client == NULL)
+    return ERR_OK;
+
+  client->busy++;
+  wss_drain(client);
+  if (client->sendQueue == NULL && client->closeWhenSent)
+    wss_release(client);
+  return wss_leave(client);
+}
+
+static void wss_err_cb(void *arg, err_t err) {
+  wss_client *client = (wss_client *) arg;
+  if (client == NULL)
+    return;
+
+  client->pcb = NULL; // Will be freed at LWIP level
+  wss_release(client);
+}
+
+static err_t wss_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err) {
+  wss_server *server = (wss_server *) arg;
+  if (server == NULL || server->pcb == NULL || err != ERR_OK) {
+    if (newpcb != NULL)
+      tcp_abort(newpcb);
+    return ERR_ABRT;
+  }
+
+  wss_client *client = (wss_client *) c_zalloc(sizeof(wss_client));
+  if (client == NULL)
+    return ERR_MEM;
+
+  client->server = server;
+  client->pcb = newpcb;
+  client->state = WSS_STATE_HANDSHAKE;
+  if (++server->nextId <= 0)
+    server->nextId = 1;
+  client->id = server->nextId;
+  client->next = server->clients;
+  server->clients = client;
+
+  tcp_arg(newpcb, client);
+  tcp_recv(newpcb, wss_recv_cb);
+  tcp_sent(newpcb, wss_sent_cb);
+  tcp_err(newpcb, wss_err_cb);
+  if (server->timeout > 0) {
+    newpcb->so_options |= SOF_KEEPALIVE;
+    newpcb->keep_idle = server->timeout * 1000;
+    newpcb->keep_cnt = 1;
+  }
+  tcp_accepted(server->pcb);
+  return ERR_OK;
+}
+
+err_t wss_listen(wss_server *server, ip_addr_t *addr, uint16_t port) {
+  struct tcp_pcb *pcb = tcp_new();
+  if (pcb == NULL)
+    return ERR_MEM;
+
+  pcb->so_options |= SOF_REUSEADDR;
+  err_t err = tcp_bind(pcb, addr, port);
+  if (err == ERR_OK) {
+    tcp_arg(pcb, server);
+    struct tcp_pcb *lpcb = tcp_listen(pcb);
+    if (lpcb == NULL) {
+      err = ERR_MEM;
+    } else {
+      server->pcb = lpcb;
+      tcp_accept(lpcb, wss_accept_cb);
+      return ERR_OK;
+    }
+  }
+  tcp_close(pcb);
+  return err;
+}
+
+wss_client *wss_find(wss_server *server, int id) {
+  wss_client *client;
+  for (client = server->clients; client != NULL; client = client->next) {
+    if (client->id == id && client->state == WSS_STATE_OPEN)
+      return client;
+  }
+  return NULL;
+}
+
+err_t wss_send(wss_client *client, int opCode, const char *message, unsigned int length) {
+  if (client->state != WSS_STATE_OPEN)
+    return ERR_CONN;
+
+  char header[WS_MAX_FRAME_HEADER];
+  int headerLen = ws_putFrameHeader(header, opCode, length);
+  return wss_write(client, header, headerLen, message, length, false);
+}
+
+int wss_broadcast(wss_server *server, int opCode, const char *message, unsigned int length) {
+  char header[WS_MAX_FRAME_HEADER];
+  int headerLen = ws_putFrameHeader(header, opCode, length); // the same frame goes to everybody
+  int count = 0;
+  wss_client *client;
+
+  for (client = server->clients; client != NULL; client = client->next) {
+    if (client->state == WSS_STATE_OPEN &&
+        wss_write(client, header, headerLen, message, length, false) == ERR_OK)
+      count++;
+  }
+  return count;
+}
+
+void wss_disconnect(wss_client *client) {
+  if (client->state == WSS_STATE_OPEN) {
+    char status[2] = { WSS_CLOSE_NORMAL >> 8, WSS_CLOSE_NORMAL & 0xff };
+    wss_sendClose(client, status, sizeof(status));
+  }
+  wss_finish(client);
+}
+
+void wss_close(wss_server *server) {
+  if (server->pcb != NULL) {
+    tcp_arg(server->pcb, NULL);
+    tcp_close(server->pcb);
+    server->pcb = NULL;
+  }
+
+  // callbacks may close other clients, so restart from the head each time.
+  // Nothing waits for the send queues here, the server is going away.
+  wss_client *client;
+  do {
+    for (client = server->clients; client != NULL; client = client->next) {
+      if (client->state != WSS_STATE_CLOSED) {
+        if (client->state == WSS_STATE_OPEN) {
+          char status[2] = { WSS_CLOSE_NORMAL >> 8, WSS_CLOSE_NORMAL & 0xff };
+          wss_sendClose(client, status, sizeof(status));
+        }
+        wss_release(client);
+        break;
+      }
+    }
+  } while (client != NULL);
+}
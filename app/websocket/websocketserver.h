@@ -0,0 +1,136 @@
+/* Websocket server implementation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _WEBSOCKETSERVER_H_
+#define _WEBSOCKETSERVER_H_
+
+#include "c_types.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
+
+#include "websocketcommon.h"
+
+#define WSS_STATE_HANDSHAKE 0
+#define WSS_STATE_OPEN      1
+#define WSS_STATE_CLOSING   2 // close frame sent
+#define WSS_STATE_CLOSED    3 // pcb released, waiting to be freed
+
+#define WSS_MAX_REQUEST 1024
+#define WSS_MAX_QUEUED  8192 // bytes a client may have waiting beyond the TCP send buffer
+
+struct wss_server;
+struct wss_client;
+
+typedef void (*wss_onConnectionCallback)(struct wss_server *server, struct wss_client *client);
+typedef void (*wss_onReceiveCallback)(struct wss_server *server, struct wss_client *client, int len, char *message, int opCode);
+typedef void (*wss_onDisconnectionCallback)(struct wss_server *server, struct wss_client *client);
+
+// Outgoing data that didn't fit into the TCP send buffer yet
+typedef struct wss_frame {
+  struct wss_frame *next;
+  unsigned int len;
+  unsigned int sent;
+  char data[];
+} wss_frame;
+
+typedef struct wss_client {
+  struct wss_client *next;
+  struct wss_server *server;
+  struct tcp_pcb *pcb;
+  int id;
+  int state;
+  int busy; // inside a callback, freeing is deferred
+  char *protocol; // negotiated subprotocol, or NULL
+
+  // Send queue, drained as the peer acknowledges data
+  wss_frame *sendQueue;
+  unsigned int queued;
+  int closeWhenSent;
+
+  // HTTP upgrade request, until the handshake completes
+  char *request;
+  unsigned int requestLen;
+
+  // Frame parser
+  char frameHeader[WS_MAX_FRAME_HEADER];
+  int frameHeaderLen;
+  unsigned int framePos;
+  unsigned int frameLeft;
+
+  // Message assembly, sized from the frame header
+  char *payloadBuffer;
+  unsigned int payloadBufferLen;
+  unsigned int payloadBufferSize;
+  int payloadOriginalOpCode;
+
+  char controlBuffer[WS_MAX_CONTROL_PAYLOAD];
+} wss_client;
+
+typedef struct wss_server {
+  struct tcp_pcb *pcb;
+  wss_client *clients;
+  int nextId;
+  int timeout;  // seconds of idle time before a client is checked, 0 = never
+  unsigned int maxPayload;
+  const char *protocols; // comma separated subprotocols offered, or NULL
+
+  void *reservedData;
+
+  wss_onConnectionCallback onConnection;
+  wss_onReceiveCallback onReceive;
+  wss_onDisconnectionCallback onDisconnection;
+} wss_server;
+
+/*
+ * Starts listening for connections on the given address and port.
+ */
+err_t wss_listen(wss_server *server, ip_addr_t *addr, uint16_t port);
+
+/*
+ * Looks up an open client by id.
+ */
+wss_client *wss_find(wss_server *server, int id);
+
+/*
+ * Sends a message to one client. What doesn't fit into the TCP send buffer is queued
+ * and sent as the peer acknowledges data. Fails with ERR_MEM if more than
+ * WSS_MAX_QUEUED bytes would be waiting, nothing is sent in that case.
+ */
+err_t wss_send(wss_client *client, int opCode, const char *message, unsigned int length);
+
+/*
+ * Sends a message to all open clients, returns the number of clients it was sent to.
+ */
+int wss_broadcast(wss_server *server, int opCode, const char *message, unsigned int length);
+
+/*
+ * Sends a close frame and closes the connection to a client once the queued data is out.
+ */
+void wss_disconnect(wss_client *client);
+
+/*
+ * Closes all connections and stops listening. Queued data is dropped.
+ */
+void wss_close(wss_server *server);
+
+#endif // _WEBSOCKETSERVER_H_
@@ -56,21 +56,17 @@ local G=getfenv()
 G.LFS = setmetatable(lfs_t,lfs_t)
 
 --[[-------------------------------------------------------------------------------
-  The second section adds the LFS to the require searchlist, so that you can
-  require a Lua module 'jean' in the LFS by simply doing require "jean". However
-  note that this is at the search entry following the FS searcher, so if you also
-  have jean.lc or jean.lua in SPIFFS, then this SPIFFS version will get loaded into 
-  RAM instead of using. (Useful, for development).
+  The LFS is already first in the require searchlist, so you can require a Lua
+  module 'jean' in the LFS by simply doing require "jean", even if there is also a
+  jean.lc or jean.lua in SPIFFS. If you want these SPIFFS versions to be loaded
+  instead (useful for development), then swap the LFS and SPIFFS searchers:
+
+    package.loaders[1], package.loaders[3] = package.loaders[3], package.loaders[1]
 
   See docs/en/lfs.md and the 'loaders' array in app/lua/loadlib.c for more details.
 
 ---------------------------------------------------------------------------------]]
 
-package.loaders[3] = function(module) -- loader_flash
-  local fn, ba = index(module)
-  return ba and "Module not in LFS" or fn 
-end
-
 --[[-------------------------------------------------------------------------------
   You can add any other initialisation here, for example a couple of the globals
   are never used, so setting them to nil saves a couple of global entries
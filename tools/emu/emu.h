@@ -0,0 +1,88 @@
+/*
+** Host emulation of what the NodeMCU firmware runs on: the flash chip, the
+** SDK's task queues and timers, and the event loop that drives them.  The
+** SDK, lwIP and flash calls of the firmware sources are implemented over
+** these in sdk.c, lwip.c and flash.c.  Time is simulated, so timers fire as
+** soon as nothing else is runnable rather than when the wall clock reaches
+** them.
+*/
+
+#ifndef emu_h
+#define emu_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* the flash image (flash.c) */
+int  emu_flash_open (const char *image, uint32_t create_size);
+void emu_flash_close (void);
+
+/* simulated clock, in microseconds since start-up (loop.c) */
+uint64_t emu_now (void);
+void emu_delay (uint32_t us);
+
+typedef struct emu_timer {
+  struct emu_timer *next;
+  uint64_t due;                  /* emu_now() at which it fires */
+  uint64_t period;               /* in us; re-armed after firing if repeat */
+  int repeat;
+  int background;                /* does not keep the loop running */
+  void (*fn)(void *arg);
+  void *arg;
+} emu_timer;
+
+void emu_timer_setfn (emu_timer *t, void (*fn)(void *arg), void *arg);
+void emu_timer_arm (emu_timer *t, uint64_t us, int repeat);
+void emu_timer_disarm (emu_timer *t);
+extern int emu_background;       /* timers armed meanwhile are background */
+
+/* task queues, serviced highest priority first as by the SDK */
+#define EMU_TASK_LOW     0
+#define EMU_TASK_MEDIUM  1
+#define EMU_TASK_HIGH    2
+
+typedef void (*emu_task_fn) (int prio, uint32_t sig, uintptr_t par);
+int emu_task_init (int prio, emu_task_fn fn, int qlen);
+int emu_task_post (int prio, uint32_t sig, uintptr_t par);
+
+/* sockets watched by the loop; events are POLLIN/POLLOUT, 0 to stop */
+typedef void (*emu_io_cb) (void *arg, int revents);
+void emu_io_watch (int fd, int events, emu_io_cb cb, void *arg);
+
+/* the host's IPv4 sockets, for lwip.c; -errno on failure (hostsock.c) */
+int  emu_sock_open (int udp, int reuseaddr);
+void emu_sock_close (int fd, int reset);
+int  emu_sock_bind (int fd, uint32_t addr, uint16_t port);
+int  emu_sock_listen (int fd, int backlog);
+int  emu_sock_connect (int fd, uint32_t addr, uint16_t port);
+int  emu_sock_accept (int fd);
+int  emu_sock_error (int fd);
+int  emu_sock_name (int fd, int peer, uint32_t *addr, uint16_t *port);
+long emu_sock_send (int fd, const void *buf, size_t len,
+                    const uint32_t *addr, uint16_t port);
+long emu_sock_recv (int fd, void *buf, size_t len, uint32_t *addr,
+                    uint16_t *port);
+void emu_sock_ttl (int fd, int ttl);
+int  emu_sock_group (int fd, uint32_t group, uint32_t ifaddr, int join);
+int  emu_resolve (const char *name, uint32_t *addr);
+int  emu_inet_aton (const char *cp, uint32_t *addr);
+
+/* run until nothing is pending, emu_stop() or limit_us of simulated time */
+void emu_run (uint64_t limit_us);
+void emu_stop (void);
+extern int emu_realtime;         /* timers wait for the wall clock too */
+
+typedef struct emu_stats {
+  uint32_t tasks;
+  uint32_t timers;
+  uint32_t polls;
+  uint32_t errors;
+} emu_stats;
+extern emu_stats emu_stat;
+
+/* the Lua side (main.c) */
+extern uint32_t emu_heap;        /* -m, the heap of the emulated chip */
+extern int emu_restarted;
+uint32_t emu_heap_used (void);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+** The flash chip, as an image file mapped into memory as spiffsimg does it,
+** so the same image can be prepared with spiffsimg beforehand or inspected
+** with it afterwards.  Without an image file the flash is held in memory
+** and is lost on exit.
+**
+** The image is the part of the flash that the file system may use: the
+** reported flash size adds the SDK's system parameter sectors at the top,
+** so that INTERNAL_FLASH_SIZE is the size of the image.  The firmware image
+** itself takes no room, as app/spiffs/spiffs.c is built with a fixed
+** location of 0.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "c_stdio.h"
+#include "platform.h"
+#include "flash_api.h"
+#include "spi_flash.h"
+#include "emu.h"
+
+#define EMU_FLASH_ID  0x001640e0        /* a 4MB part */
+
+static uint8_t *flash;
+static uint32_t flash_size;
+static int mapped;
+
+/* only the linker needs it, as the file system has a fixed location */
+char _flash_used_end[1];
+
+
+/*
+** Maps the image, creating it when create_size is given or the file does
+** not exist (in which case a 256Kb one is made).  A new image is erased.
+*/
+int emu_flash_open (const char *image, uint32_t create_size) {
+  int fd = -1, create = create_size != 0;
+  if (image) {
+    fd = open(image, O_RDWR);
+    if (fd < 0) {
+      fd = open(image, O_RDWR | O_CREAT, 0664);
+      create = 1;
+      if (!create_size)
+        create_size = 0x40000;
+    }
+    if (fd < 0)
+      return -1;
+    if (create) {
+      flash_size = create_size & ~0x1fff;
+      if (ftruncate(fd, 0) || ftruncate(fd, flash_size))
+        goto fail;
+    } else {
+      off_t end = lseek(fd, 0, SEEK_END);
+      if (end <= 0 || (end & 0xfff))
+        goto fail;
+      flash_size = end;
+    }
+    flash = mmap(0, flash_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash == MAP_FAILED) {
+      flash = NULL;
+      return -1;
+    }
+    mapped = 1;
+  } else {
+    create = 1;
+    flash_size = (create_size ? create_size : 0x40000) & ~0x1fff;
+    flash = malloc(flash_size);
+    if (!flash)
+      return -1;
+  }
+  if (create)
+    memset(flash, 0xff, flash_size);
+  return 0;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+void emu_flash_close (void) {
+  if (!flash)
+    return;
+  if (mapped)
+    munmap(flash, flash_size);
+  else
+    free(flash);
+  flash = NULL;
+  mapped = 0;
+}
+
+
+/*
+** {======================================================
+** The SDK's flash calls
+** =======================================================
+*/
+
+static int in_flash (uint32 addr, uint32 size) {
+  return flash && addr <= flash_size && size <= flash_size - addr;
+}
+
+SpiFlashOpResult spi_flash_read (uint32 src_addr, uint32 *des_addr,
+                                 uint32 size) {
+  if (!in_flash(src_addr, size))
+    return SPI_FLASH_RESULT_ERR;
+  memcpy(des_addr, flash + src_addr, size);
+  return SPI_FLASH_RESULT_OK;
+}
+
+/* NOR flash can only clear bits */
+SpiFlashOpResult spi_flash_write (uint32 des_addr, uint32 *src_addr,
+                                  uint32 size) {
+  const uint8_t *src = (const uint8_t *)src_addr;
+  uint32 i;
+  if (!in_flash(des_addr, size))
+    return SPI_FLASH_RESULT_ERR;
+  for (i = 0; i < size; i++)
+    flash[des_addr + i] &= src[i];
+  return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_erase_sector (uint16 sec) {
+  uint32 addr = (uint32)sec * SPI_FLASH_SEC_SIZE;
+  if (!in_flash(addr, SPI_FLASH_SEC_SIZE))
+    return SPI_FLASH_RESULT_ERR;
+  memset(flash + addr, 0xff, SPI_FLASH_SEC_SIZE);
+  return SPI_FLASH_RESULT_OK;
+}
+
+uint32 spi_flash_get_id (void) {
+  return EMU_FLASH_ID;
+}
+
+uint32_t flash_rom_get_size_byte (void) {
+  return flash_size + SYS_PARAM_SEC_NUM * SPI_FLASH_SEC_SIZE;
+}
+
+/* the size is that of the image, which cannot change under the firmware */
+bool flash_rom_set_size_byte (uint32_t size) {
+  return size == flash_rom_get_size_byte();
+}
+
+uint16_t flash_rom_get_sec_num (void) {
+  return flash_rom_get_size_byte() / SPI_FLASH_SEC_SIZE;
+}
+
+uint8_t flash_rom_get_mode (void) {
+  return 0;                             /* QIO */
+}
+
+uint32_t flash_rom_get_speed (void) {
+  return 40000000;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** The platform layer's flash calls
+** =======================================================
+*/
+
+/* host buffers need no alignment, unlike those of the chip */
+uint32_t platform_s_flash_write (const void *from, uint32_t toaddr,
+                                 uint32_t size) {
+  if (spi_flash_write(toaddr, (uint32 *)from, size) != SPI_FLASH_RESULT_OK) {
+    NODE_ERR("ERROR in flash_write at 0x%x\n", toaddr);
+    return 0;
+  }
+  return size;
+}
+
+uint32_t platform_s_flash_read (void *to, uint32_t fromaddr, uint32_t size) {
+  if (size == 0 ||
+      spi_flash_read(fromaddr, (uint32 *)to, size) != SPI_FLASH_RESULT_OK)
+    return 0;
+  return size;
+}
+
+int platform_flash_erase_sector (uint32_t sector_id) {
+  return spi_flash_erase_sector(sector_id) == SPI_FLASH_RESULT_OK ?
+         PLATFORM_OK : PLATFORM_ERR;
+}
+
+/* the flash is not mapped into the address space */
+uint32_t platform_flash_mapped2phys (uint32_t mapped_addr) {
+  (void)mapped_addr;
+  return -1;
+}
+
+uint32_t platform_flash_phys2mapped (uint32_t phys_addr) {
+  (void)phys_addr;
+  return -1;
+}
+
+/* }====================================================== */
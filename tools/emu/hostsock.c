@@ -0,0 +1,153 @@
+/*
+** The host's sockets, for lwip.c.  They are kept apart as the firmware's
+** include path has lwIP's own <sys/socket.h> in it, so this file is built
+** without it.  Addresses are IPv4 ones in network order, as in ip_addr_t,
+** ports are in host order and failures return -errno.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "emu.h"
+
+static void to_sockaddr (struct sockaddr_in *sa, uint32_t addr,
+                         uint16_t port) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_addr.s_addr = addr;
+  sa->sin_port = htons(port);
+}
+
+int emu_sock_open (int udp, int reuseaddr) {
+  int one = 1;
+  int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+  if (fd < 0)
+    return -errno;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  if (reuseaddr)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  return fd;
+}
+
+/* a reset rather than a FIN is sent if asked for */
+void emu_sock_close (int fd, int reset) {
+  if (reset) {
+    struct linger l = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  close(fd);
+}
+
+int emu_sock_bind (int fd, uint32_t addr, uint16_t port) {
+  struct sockaddr_in sa;
+  to_sockaddr(&sa, addr, port);
+  return bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ? -errno : 0;
+}
+
+int emu_sock_listen (int fd, int backlog) {
+  return listen(fd, backlog) < 0 ? -errno : 0;
+}
+
+/* 0 once started; emu_sock_error() tells how it went when it is writable */
+int emu_sock_connect (int fd, uint32_t addr, uint16_t port) {
+  struct sockaddr_in sa;
+  to_sockaddr(&sa, addr, port);
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 &&
+      errno != EINPROGRESS)
+    return -errno;
+  return 0;
+}
+
+int emu_sock_accept (int fd) {
+  int nfd = accept(fd, NULL, NULL);
+  if (nfd < 0)
+    return -errno;
+  fcntl(nfd, F_SETFL, O_NONBLOCK);
+  return nfd;
+}
+
+int emu_sock_error (int fd) {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+  return -error;
+}
+
+int emu_sock_name (int fd, int peer, uint32_t *addr, uint16_t *port) {
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  if ((peer ? getpeername(fd, (struct sockaddr *)&sa, &len) :
+              getsockname(fd, (struct sockaddr *)&sa, &len)) < 0)
+    return -errno;
+  *addr = sa.sin_addr.s_addr;
+  *port = ntohs(sa.sin_port);
+  return 0;
+}
+
+/* to the connected peer when addr is NULL */
+long emu_sock_send (int fd, const void *buf, size_t len,
+                    const uint32_t *addr, uint16_t port) {
+  struct sockaddr_in sa;
+  ssize_t n;
+  if (addr) {
+    to_sockaddr(&sa, *addr, port);
+    n = sendto(fd, buf, len, MSG_NOSIGNAL, (struct sockaddr *)&sa,
+               sizeof(sa));
+  } else
+    n = send(fd, buf, len, MSG_NOSIGNAL);
+  return n < 0 ? -errno : n;
+}
+
+/* 0 at the end of a stream; addr may be NULL */
+long emu_sock_recv (int fd, void *buf, size_t len, uint32_t *addr,
+                    uint16_t *port) {
+  struct sockaddr_in sa;
+  socklen_t salen = sizeof(sa);
+  ssize_t n = recvfrom(fd, buf, len, 0, (struct sockaddr *)&sa, &salen);
+  if (n < 0)
+    return -errno;
+  if (addr) {
+    *addr = sa.sin_addr.s_addr;
+    *port = ntohs(sa.sin_port);
+  }
+  return n;
+}
+
+void emu_sock_ttl (int fd, int ttl) {
+  setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+}
+
+int emu_sock_group (int fd, uint32_t group, uint32_t ifaddr, int join) {
+  struct ip_mreq mreq;
+  mreq.imr_multiaddr.s_addr = group;
+  mreq.imr_interface.s_addr = ifaddr;
+  if (setsockopt(fd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+                 &mreq, sizeof(mreq)) < 0)
+    return -errno;
+  return 0;
+}
+
+int emu_resolve (const char *name, uint32_t *addr) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(name, NULL, &hints, &res) != 0)
+    return -1;
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(res);
+  return 0;
+}
+
+int emu_inet_aton (const char *cp, uint32_t *addr) {
+  struct in_addr in;
+  if (!inet_aton(cp, &in))
+    return 0;
+  *addr = in.s_addr;
+  return 1;
+}
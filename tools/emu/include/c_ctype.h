@@ -0,0 +1,10 @@
+/*
+** Host stand-in for app/libc/c_ctype.h.
+*/
+
+#ifndef _C_CTYPE_H_
+#define _C_CTYPE_H_
+
+#include <ctype.h>
+
+#endif
@@ -0,0 +1,10 @@
+/*
+** Host stand-in for app/libc/c_limits.h.
+*/
+
+#ifndef __c_limits_h
+#define __c_limits_h
+
+#include <limits.h>
+
+#endif
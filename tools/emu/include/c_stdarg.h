@@ -0,0 +1,10 @@
+/*
+** Host stand-in for app/libc/c_stdarg.h.
+*/
+
+#ifndef __c_stdarg_h
+#define __c_stdarg_h
+
+#include <stdarg.h>
+
+#endif
@@ -0,0 +1,10 @@
+/*
+** Host stand-in for app/libc/c_stddef.h, which assumes 32 bit pointers.
+*/
+
+#ifndef __c_stddef_h
+#define __c_stddef_h
+
+#include <stddef.h>
+
+#endif
@@ -0,0 +1,10 @@
+/*
+** Host stand-in for app/libc/c_stdint.h.
+*/
+
+#ifndef __c_stdint_h
+#define __c_stdint_h
+
+#include "c_types.h"
+
+#endif
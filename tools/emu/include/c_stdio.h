@@ -0,0 +1,32 @@
+/*
+** Host stand-in for app/libc/c_stdio.h.  Output goes where it goes on the
+** chip: c_puts() through output_redirect(), so node.output() sees it, and
+** dbg_printf() straight to the console.
+*/
+
+#ifndef _C_STDIO_H_
+#define _C_STDIO_H_
+
+#include <stdio.h>
+#include "c_stddef.h"
+#include "c_stdarg.h"
+#include "osapi.h"
+
+#define c_stdin stdin
+#define c_stdout stdout
+#define c_stderr stderr
+
+extern void output_redirect(const char *str);
+#define c_puts output_redirect
+
+#define c_sprintf sprintf
+#define c_vsprintf vsprintf
+#define c_printf(...) do {					\
+	char __print_buf[BUFSIZ];				\
+	snprintf(__print_buf, BUFSIZ, __VA_ARGS__);		\
+	c_puts(__print_buf);					\
+} while(0)
+
+#define dbg_printf printf
+
+#endif
@@ -0,0 +1,27 @@
+/*
+** Host stand-in for app/libc/c_stdlib.h: the c_ names over the host's
+** <stdlib.h>.  The heap is the host's, see system_get_free_heap_size().
+*/
+
+#ifndef _C_STDLIB_H_
+#define _C_STDLIB_H_
+
+#include <stdlib.h>
+#include "c_stddef.h"
+#include "mem.h"
+
+#define c_free os_free
+#define c_malloc os_malloc
+#define c_zalloc os_zalloc
+#define c_realloc os_realloc
+
+#define c_abs abs
+#define c_atoi atoi
+#define c_exit exit
+#define c_getenv getenv
+#define c_strtod strtod
+#define c_strtol strtol
+#define c_strtoll strtoll
+#define c_strtoul strtoul
+
+#endif
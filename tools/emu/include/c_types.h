@@ -0,0 +1,70 @@
+/*
+** Host stand-in for the SDK's c_types.h: the same type names over the
+** host's <stdint.h>.  Register access is compiled out, as there are no
+** peripherals behind the addresses the firmware writes to.
+*/
+
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef int8_t   sint8_t;
+typedef int16_t  sint16_t;
+typedef int32_t  sint32_t;
+typedef int64_t  sint64_t;
+
+typedef unsigned char       uint8;
+typedef unsigned char       u8;
+typedef signed char         sint8;
+typedef signed char         int8;
+typedef signed char         s8;
+typedef unsigned short      uint16;
+typedef unsigned short      u16;
+typedef signed short        sint16;
+typedef signed short        s16;
+typedef unsigned int        uint32;
+typedef unsigned int        u_int;
+typedef unsigned int        u32;
+typedef signed int          sint32;
+typedef signed int          s32;
+typedef int                 int32;
+typedef signed long long    sint64;
+typedef unsigned long long  uint64;
+typedef unsigned long long  u64;
+typedef float               real32;
+typedef double              real64;
+
+#define __le16      u16
+
+#define __packed    __attribute__((packed))
+
+#define LOCAL       static
+
+typedef enum {
+  OK = 0,
+  FAIL,
+  PENDING,
+  BUSY,
+  CANCEL,
+} STATUS;
+
+#define BIT(nr)                 (1UL << (nr))
+
+#define REG_SET_BIT(_r, _b)     ((void)(_r), (void)(_b))
+#define REG_CLR_BIT(_r, _b)     ((void)(_r), (void)(_b))
+
+#define DMEM_ATTR
+#define SHMEM_ATTR
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_TYPEDEF_ATTR      __attribute__((aligned(4),packed))
+#define STORE_ATTR              __attribute__((aligned(4)))
+
+#define BOOL        bool
+#define TRUE        true
+#define FALSE       false
+
+#endif
@@ -0,0 +1,22 @@
+/*
+** Host stand-in for the SDK's eagle_soc.h.  There are no registers on the
+** host: reads give 0 and writes are dropped.
+*/
+
+#ifndef _EAGLE_SOC_H_
+#define _EAGLE_SOC_H_
+
+#include "c_types.h"
+#include "emu.h"
+
+/* FRC2, the free running timer lwIP takes its time from, at 80MHz/16 */
+#define TIMER_CLK_FREQ                    (80000000>>4)
+#define NOW()                             ((uint32_t)(emu_now() * 5))
+
+#define READ_PERI_REG(addr)               ((void)(addr), 0)
+#define WRITE_PERI_REG(addr, val)         ((void)(addr), (void)(val))
+#define CLEAR_PERI_REG_MASK(reg, mask)    ((void)(reg), (void)(mask))
+#define SET_PERI_REG_MASK(reg, mask)      ((void)(reg), (void)(mask))
+#define GET_PERI_REG_MASK(reg, mask)      ((void)(reg), (void)(mask), 0)
+
+#endif
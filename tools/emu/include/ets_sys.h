@@ -0,0 +1,48 @@
+/*
+** Host stand-in for the SDK's ets_sys.h.  A task parameter is wide enough
+** for a host pointer, and an ETSTimer is a timer of the emulator's event
+** loop.
+*/
+
+#ifndef _ETS_SYS_H
+#define _ETS_SYS_H
+
+#include "c_types.h"
+#include "c_stdarg.h"
+#include "eagle_soc.h"
+#include "emu.h"
+
+typedef uint32_t ETSSignal;
+typedef uintptr_t ETSParam;
+
+typedef struct ETSEventTag ETSEvent;
+
+struct ETSEventTag {
+  ETSSignal sig;
+  ETSParam  par;
+};
+
+typedef void (*ETSTask)(ETSEvent *e);
+
+typedef void ETSTimerFunc(void *timer_arg);
+
+typedef struct emu_timer ETSTimer;
+
+void ets_timer_setfn (ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg);
+void ets_timer_arm_new (ETSTimer *ptimer, uint32_t time, bool repeat_flag,
+                        bool ms_flag);
+void ets_timer_disarm (ETSTimer *ptimer);
+
+void ets_delay_us (uint32_t us);
+
+int ets_sprintf (char *str, const char *format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+int ets_vsprintf (char *d, const char *s, va_list ap);
+
+void ets_update_cpu_frequency (uint32_t ticks_per_us);
+uint32_t ets_get_cpu_frequency (void);
+
+#define ETS_INTR_LOCK()
+#define ETS_INTR_UNLOCK()
+
+#endif
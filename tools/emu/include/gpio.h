@@ -0,0 +1,20 @@
+/*
+** Host stand-in for the SDK's gpio.h.  There are no pins on the host, the
+** header is only here for what platform.h pulls in.
+*/
+
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include "c_types.h"
+
+typedef enum {
+  GPIO_PIN_INTR_DISABLE = 0,
+  GPIO_PIN_INTR_POSEDGE = 1,
+  GPIO_PIN_INTR_NEGEDGE = 2,
+  GPIO_PIN_INTR_ANYEDGE = 3,
+  GPIO_PIN_INTR_LOLEVEL = 4,
+  GPIO_PIN_INTR_HILEVEL = 5
+} GPIO_INT_TYPE;
+
+#endif
@@ -0,0 +1,17 @@
+/*
+** Host stand-in for the SDK's mem.h: the firmware's heap calls on the
+** host's malloc().
+*/
+
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include <stdlib.h>
+
+#define os_free(s)        free(s)
+#define os_malloc(s)      malloc(s)
+#define os_calloc(l, s)   calloc(l, s)
+#define os_realloc(p, s)  realloc(p, s)
+#define os_zalloc(s)      calloc(1, s)
+
+#endif
@@ -0,0 +1,46 @@
+/*
+** Host stand-in for the SDK's osapi.h: the os_ names over the host's C
+** library and the emulator's timers.
+*/
+
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <string.h>
+#include <stdio.h>
+#include "os_type.h"
+#include "user_config.h"
+
+#define os_bzero(s, n) memset((s), 0, (n))
+#define os_delay_us ets_delay_us
+
+#define os_memcmp memcmp
+#define os_memcpy memcpy
+#define os_memmove memmove
+#define os_memset memset
+#define os_strcat strcat
+#define os_strchr strchr
+#define os_strcmp strcmp
+#define os_strcpy strcpy
+#define os_strlen strlen
+#define os_strncmp strncmp
+#define os_strncpy strncpy
+#define os_strstr strstr
+
+#define os_timer_arm(a, b, c)    ets_timer_arm_new(a, b, c, 1)
+#define os_timer_arm_us(a, b, c) ets_timer_arm_new(a, b, c, 0)
+#define os_timer_disarm ets_timer_disarm
+#define os_timer_setfn  ets_timer_setfn
+
+#define os_sprintf  ets_sprintf
+#define os_printf   printf
+#define os_printf_plus printf
+
+/* in the ROM and so used without a declaration by some modules */
+void bzero (void *s, size_t n);
+int stricmp (const char *s1, const char *s2);
+
+unsigned long os_random (void);
+int os_get_random (unsigned char *buf, size_t len);
+
+#endif
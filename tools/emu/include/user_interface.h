@@ -0,0 +1,64 @@
+/*
+** Host stand-in for the SDK's user_interface.h, cut down to the system_
+** calls the emulated modules make.  They are implemented in sdk.c.
+*/
+
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "os_type.h"
+#include "lwip/ip_addr.h"
+#include "user_config.h"
+#include "spi_flash.h"
+#include "gpio.h"
+
+enum rst_reason {
+  REASON_DEFAULT_RST      = 0,
+  REASON_WDT_RST          = 1,
+  REASON_EXCEPTION_RST    = 2,
+  REASON_SOFT_WDT_RST     = 3,
+  REASON_SOFT_RESTART     = 4,
+  REASON_DEEP_SLEEP_AWAKE = 5,
+  REASON_EXT_SYS_RST      = 6
+};
+
+struct rst_info {
+  uint32 reason;
+  uint32 exccause;
+  uint32 epc1;
+  uint32 epc2;
+  uint32 epc3;
+  uint32 excvaddr;
+  uint32 depc;
+};
+
+struct rst_info *system_get_rst_info (void);
+
+#define USER_TASK_PRIO_0   0
+#define USER_TASK_PRIO_1   1
+#define USER_TASK_PRIO_2   2
+#define USER_TASK_PRIO_MAX 3
+
+bool system_os_task (os_task_t task, uint8 prio, os_event_t *queue,
+                     uint8 qlen);
+bool system_os_post (uint8 prio, os_signal_t sig, os_param_t par);
+
+void system_restore (void);
+void system_restart (void);
+
+bool system_deep_sleep_set_option (uint8 option);
+bool system_deep_sleep (uint64 time_in_us);
+bool system_deep_sleep_instant (uint64 time_in_us);
+
+uint32 system_get_time (void);
+uint32 system_get_rtc_time (void);
+uint32 system_rtc_clock_cali_proc (void);
+
+uint32 system_get_free_heap_size (void);
+uint32 system_get_chip_id (void);
+uint8 system_get_cpu_freq (void);
+
+void system_soft_wdt_feed (void);
+void system_set_os_print (uint8 onoff);
+
+#endif
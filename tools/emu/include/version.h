@@ -0,0 +1,15 @@
+/*
+** Host stand-in for the SDK's version.h: the SDK the firmware is built
+** against, see SDK_BASE_VER in the top Makefile.
+*/
+
+#ifndef ESP_SDK_VERSION_H
+#define ESP_SDK_VERSION_H
+
+#define ESP_SDK_VERSION_STRING  "2.2.1"
+
+#define ESP_SDK_VERSION_MAJOR   2
+#define ESP_SDK_VERSION_MINOR   2
+#define ESP_SDK_VERSION_PATCH   1
+
+#endif
@@ -0,0 +1,267 @@
+/*
+** The event loop: task queues, timers and socket watches, serviced in that
+** order of preference.  Time is simulated.  When no task is runnable and no
+** watched socket is ready, the clock jumps straight to the next timer, so a
+** script waiting on a 10 second timer runs at once.  Only when there is no
+** timer left to jump to does the loop block on its sockets, and then the
+** clock follows the wall clock.  With emu_realtime set it always does.
+**
+** Background timers, such as the one behind tmr.time(), are those armed
+** while emu_background is set.  They fire as any other, but on their own
+** they do not keep the loop running or the clock jumping.
+*/
+
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include "emu.h"
+
+#define MAX_WATCH       64
+
+typedef struct {
+  uint32_t sig;
+  uintptr_t par;
+} Task;
+
+/* of the length given to system_os_task(), so overflows show up here */
+typedef struct {
+  emu_task_fn fn;
+  Task *q;
+  unsigned len, head, count;
+} TaskQueue;
+
+typedef struct {
+  int fd, events;
+  emu_io_cb cb;
+  void *arg;
+} Watch;
+
+emu_stats emu_stat;
+int emu_realtime;
+int emu_background;
+
+static uint64_t now;
+static emu_timer *timers;               /* armed timers in order of due */
+static TaskQueue queue[EMU_TASK_HIGH+1];
+static Watch watch[MAX_WATCH];
+static int nwatch;
+static int running;
+
+
+uint64_t emu_now (void) {
+  return now;
+}
+
+/* busy waits, like os_delay_us(): nothing else runs meanwhile */
+void emu_delay (uint32_t us) {
+  now += us;
+}
+
+static uint64_t wallclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+** {======================================================
+** Timers
+** =======================================================
+*/
+
+void emu_timer_setfn (emu_timer *t, void (*fn)(void *arg), void *arg) {
+  emu_timer_disarm(t);
+  t->fn = fn;
+  t->arg = arg;
+}
+
+static void insert (emu_timer *t) {
+  emu_timer **p = &timers;
+  while (*p && (*p)->due <= t->due)  /* equal deadlines fire in arm order */
+    p = &(*p)->next;
+  t->next = *p;
+  *p = t;
+}
+
+/* the list is searched rather than a flag trusted, as modules disarm
+   timers whose memory has never been set, as the SDK lets them */
+void emu_timer_disarm (emu_timer *t) {
+  emu_timer **p;
+  for (p = &timers; *p; p = &(*p)->next)
+    if (*p == t) {
+      *p = t->next;
+      break;
+    }
+}
+
+void emu_timer_arm (emu_timer *t, uint64_t us, int repeat) {
+  emu_timer_disarm(t);
+  t->period = us;
+  t->repeat = repeat;
+  t->background = emu_background;
+  t->due = now + us;
+  insert(t);
+}
+
+static int fire_timer (void) {
+  emu_timer *t = timers;
+  if (!t || t->due > now)
+    return 0;
+  timers = t->next;
+  if (t->repeat) {  /* re-armed first, so the callback may stop it */
+    t->due += t->period ? t->period : 1;
+    insert(t);
+  }
+  emu_stat.timers++;
+  t->fn(t->arg);
+  return 1;
+}
+
+static int foreground_timers (void) {
+  emu_timer *t;
+  for (t = timers; t; t = t->next)
+    if (!t->background)
+      return 1;
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Tasks
+** =======================================================
+*/
+
+int emu_task_init (int prio, emu_task_fn fn, int qlen) {
+  TaskQueue *tq = &queue[prio];
+  if (tq->fn || qlen <= 0 || (tq->q = calloc(qlen, sizeof(Task))) == NULL)
+    return 0;
+  tq->fn = fn;
+  tq->len = qlen;
+  return 1;
+}
+
+int emu_task_post (int prio, uint32_t sig, uintptr_t par) {
+  TaskQueue *tq = &queue[prio];
+  Task *t;
+  if (!tq->fn || tq->count == tq->len)
+    return 0;
+  t = &tq->q[(tq->head + tq->count++) % tq->len];
+  t->sig = sig;
+  t->par = par;
+  return 1;
+}
+
+static int run_task (void) {
+  int prio;
+  for (prio = EMU_TASK_HIGH; prio >= EMU_TASK_LOW; prio--) {
+    TaskQueue *tq = &queue[prio];
+    if (tq->count) {
+      Task t = tq->q[tq->head];
+      tq->head = (tq->head + 1) % tq->len;
+      tq->count--;
+      emu_stat.tasks++;
+      tq->fn(prio, t.sig, t.par);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Sockets
+** =======================================================
+*/
+
+void emu_io_watch (int fd, int events, emu_io_cb cb, void *arg) {
+  int i;
+  for (i = 0; i < nwatch && watch[i].fd != fd; i++) ;
+  if (!events) {
+    if (i < nwatch)
+      watch[i] = watch[--nwatch];
+    return;
+  }
+  if (i == nwatch) {
+    if (nwatch == MAX_WATCH)
+      return;
+    nwatch++;
+  }
+  watch[i].fd = fd;
+  watch[i].events = events;
+  watch[i].cb = cb;
+  watch[i].arg = arg;
+}
+
+/* polls for up to timeout ms (-1 for ever) and dispatches; 0 if none ready */
+static int poll_watches (int timeout) {
+  struct pollfd pfd[MAX_WATCH];
+  Watch ready[MAX_WATCH];
+  int i, n, nready = 0;
+  for (i = 0; i < nwatch; i++) {
+    pfd[i].fd = watch[i].fd;
+    pfd[i].events = watch[i].events;
+    pfd[i].revents = 0;
+  }
+  emu_stat.polls++;
+  n = poll(pfd, nwatch, timeout);
+  if (n <= 0)
+    return 0;
+  for (i = 0; i < nwatch; i++)
+    if (pfd[i].revents) {
+      ready[nready] = watch[i];
+      ready[nready++].events = pfd[i].revents;
+    }
+  /* a callback may close or replace the watches of the others */
+  for (i = 0; i < nready; i++) {
+    int j;
+    for (j = 0; j < nwatch; j++)
+      if (watch[j].fd == ready[i].fd && watch[j].cb == ready[i].cb &&
+          watch[j].arg == ready[i].arg)
+        break;
+    if (j < nwatch)
+      ready[i].cb(ready[i].arg, ready[i].events);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+void emu_stop (void) {
+  running = 0;
+}
+
+void emu_run (uint64_t limit_us) {
+  running = 1;
+  while (running && (!limit_us || now < limit_us)) {
+    uint64_t until, start;
+    int ready, foreground;
+    if (run_task() || fire_timer())
+      continue;
+    if (nwatch && !emu_realtime && poll_watches(0))
+      continue;
+    foreground = foreground_timers();
+    if (!foreground && !nwatch)
+      break;                            /* nothing can happen any more */
+    until = timers ? timers->due : limit_us;
+    if (limit_us && until > limit_us)
+      until = limit_us;
+    if (foreground && !emu_realtime) {
+      now = until;
+      continue;
+    }
+    start = wallclock();
+    ready = poll_watches(until ? (int)((until - now + 999) / 1000) : -1);
+    now += wallclock() - start;
+    if (!ready && until && now < until)
+      now = until;
+  }
+  running = 0;
+}
@@ -0,0 +1,678 @@
+/*
+** The part of lwIP's raw API that app/modules/net.c uses, over non-blocking
+** host sockets watched by the event loop.  The PCBs are lwIP's own structs,
+** so the module reads and sets their fields as on the chip, and the
+** callbacks are made in the same order and with the same error codes as
+** lwIP makes them.  Some of lwIP's limits are kept too: tcp_write() refuses
+** more than TCP_SND_BUF unsent bytes, received data is handed over in
+** segments of at most TCP_MSS bytes and no more than TCP_WND bytes are
+** taken from the socket before tcp_recved() opens the window again.
+**
+** A PCB that is closed or aborted is freed only when the loop next calls
+** in here, so that none is freed under a callback that is still using it.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/dns.h"
+#include "lwip/igmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "emu.h"
+
+#define UDP_MAX_PAYLOAD  1472           /* what fits in one Ethernet frame */
+#define MAX_GROUPS       8
+
+typedef struct sock {
+  union {                        /* first, so PCB pointers convert */
+    struct tcp_pcb tcp;
+    struct udp_pcb udp;
+  } pcb;
+  int udp;
+  int fd;                        /* -1 when there is no host socket */
+  int dead;
+  int reset;                     /* closed by tcp_abort() */
+  struct sock *next;             /* among the live ones, then the dead */
+  /* only for TCP: */
+  char *out;                     /* written but not yet sent */
+  size_t outlen;
+  uint32_t wnd;                  /* bytes that may still be received */
+  int eof;
+  int closing;                   /* closed with data still to send */
+} sock;
+
+typedef struct dns_query {
+  emu_timer timer;
+  dns_found_callback found;
+  void *arg;
+  int ok;
+  ip_addr_t addr;
+  char name[1];
+} dns_query;
+
+const ip_addr_t ip_addr_any = {IPADDR_ANY};
+const ip_addr_t ip_addr_broadcast = {IPADDR_BROADCAST};
+
+static sock *socks, *graveyard;
+static ip_addr_t dns_servers[DNS_MAX_SERVERS];
+static struct {
+  ip_addr_t ifaddr, groupaddr;
+} groups[MAX_GROUPS];
+static int ngroups;
+
+static void io_cb (void *arg, int revents);
+
+
+/*
+** {======================================================
+** Sockets
+** =======================================================
+*/
+
+static err_t errno2err (int e) {
+  switch (e) {
+    case ECONNREFUSED: case ECONNRESET: case EPIPE: return ERR_RST;
+    case ETIMEDOUT: return ERR_TIMEOUT;
+    case EADDRINUSE: return ERR_USE;
+    case ENETUNREACH: case EHOSTUNREACH: return ERR_RTE;
+    case ENOBUFS: case ENOMEM: case EMSGSIZE: return ERR_MEM;
+    default: return ERR_ABRT;
+  }
+}
+
+static sock *new_sock (int udp) {
+  sock *s = calloc(1, sizeof(sock));
+  if (!s)
+    return NULL;
+  s->udp = udp;
+  s->fd = -1;
+  s->next = socks;
+  socks = s;
+  return s;
+}
+
+static int open_socket (sock *s) {
+  int fd;
+  if (s->fd >= 0)
+    return 0;
+  fd = emu_sock_open(s->udp, s->pcb.tcp.so_options & SOF_REUSEADDR);
+  if (fd < 0)
+    return fd;
+  s->fd = fd;
+  return 0;
+}
+
+static err_t bind_socket (sock *s, ip_addr_t *ipaddr, u16_t port) {
+  int rc = open_socket(s);
+  if (rc == 0)
+    rc = emu_sock_bind(s->fd, ipaddr ? ipaddr->addr : IPADDR_ANY, port);
+  if (rc < 0)
+    return rc == -EADDRINUSE ? ERR_USE : rc == -EMFILE ? ERR_MEM : ERR_VAL;
+  return ERR_OK;
+}
+
+/* the local and remote ends, as lwIP keeps them in the PCB */
+static void get_names (sock *s) {
+  if (s->udp)
+    emu_sock_name(s->fd, 0, &s->pcb.udp.local_ip.addr, &s->pcb.udp.local_port);
+  else {
+    emu_sock_name(s->fd, 0, &s->pcb.tcp.local_ip.addr, &s->pcb.tcp.local_port);
+    emu_sock_name(s->fd, 1, &s->pcb.tcp.remote_ip.addr,
+                  &s->pcb.tcp.remote_port);
+  }
+}
+
+static void watch (sock *s) {
+  int events = 0;
+  if (s->fd < 0)
+    return;
+  if (s->udp)
+    events = POLLIN;
+  else if (s->pcb.tcp.state == LISTEN)
+    events = POLLIN;
+  else if (s->pcb.tcp.state == SYN_SENT)
+    events = POLLOUT;
+  else
+    events = (s->wnd && !s->eof && !s->closing ? POLLIN : 0) |
+             (s->outlen ? POLLOUT : 0);
+  emu_io_watch(s->fd, events, io_cb, s);
+}
+
+/* closes the socket; the sock itself is freed by the next io_cb() */
+static void bury (sock *s) {
+  sock **p;
+  if (s->fd >= 0) {
+    emu_io_watch(s->fd, 0, NULL, NULL);
+    emu_sock_close(s->fd, s->reset);
+    s->fd = -1;
+  }
+  if (s->dead)
+    return;
+  for (p = &socks; *p; p = &(*p)->next)
+    if (*p == s) {
+      *p = s->next;
+      break;
+    }
+  s->dead = 1;
+  s->next = graveyard;
+  graveyard = s;
+}
+
+static void free_graveyard (void) {
+  while (graveyard) {
+    sock *s = graveyard;
+    graveyard = s->next;
+    free(s->out);
+    free(s);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** TCP
+** =======================================================
+*/
+
+/* the connection is gone; lwIP frees the PCB before it tells */
+static void tcp_fail (sock *s, err_t err) {
+  tcp_err_fn errf = s->pcb.tcp.errf;
+  void *arg = s->pcb.tcp.callback_arg;
+  s->pcb.tcp.state = CLOSED;
+  bury(s);
+  if (errf)
+    errf(arg, err);
+}
+
+struct tcp_pcb *tcp_new (void) {
+  sock *s = new_sock(0);
+  if (!s)
+    return NULL;
+  s->pcb.tcp.ttl = TCP_TTL;
+  s->pcb.tcp.prio = TCP_PRIO_NORMAL;
+  s->pcb.tcp.state = CLOSED;
+  s->pcb.tcp.snd_buf = TCP_SND_BUF;
+  s->pcb.tcp.mss = TCP_MSS;
+  return &s->pcb.tcp;
+}
+
+void tcp_arg (struct tcp_pcb *pcb, void *arg) {
+  pcb->callback_arg = arg;
+}
+
+void tcp_accept (struct tcp_pcb *pcb, tcp_accept_fn accept) {
+  pcb->accept = accept;
+}
+
+void tcp_recv (struct tcp_pcb *pcb, tcp_recv_fn recv) {
+  pcb->recv = recv;
+}
+
+void tcp_sent (struct tcp_pcb *pcb, tcp_sent_fn sent) {
+  pcb->sent = sent;
+}
+
+void tcp_err (struct tcp_pcb *pcb, tcp_err_fn err) {
+  pcb->errf = err;
+}
+
+err_t tcp_bind (struct tcp_pcb *pcb, ip_addr_t *ipaddr, u16_t port) {
+  sock *s = (sock *)pcb;
+  err_t err;
+  if (pcb->state != CLOSED)
+    return ERR_ISCONN;
+  if ((err = bind_socket(s, ipaddr, port)) == ERR_OK)
+    get_names(s);
+  return err;
+}
+
+/* the PCB is listened on as it is, rather than swapped for a smaller one */
+struct tcp_pcb *tcp_listen_with_backlog (struct tcp_pcb *pcb, u8_t backlog) {
+  sock *s = (sock *)pcb;
+  if (pcb->state != CLOSED || open_socket(s) ||
+      emu_sock_listen(s->fd, backlog ? backlog : TCP_DEFAULT_LISTEN_BACKLOG))
+    return NULL;
+  pcb->state = LISTEN;
+  watch(s);
+  return pcb;
+}
+
+err_t tcp_connect (struct tcp_pcb *pcb, ip_addr_t *ipaddr, u16_t port,
+                   tcp_connected_fn connected) {
+  sock *s = (sock *)pcb;
+  int rc;
+  if (pcb->state != CLOSED)
+    return ERR_ISCONN;
+  if (open_socket(s))
+    return ERR_MEM;
+  pcb->remote_ip = *ipaddr;
+  pcb->remote_port = port;
+  pcb->connected = connected;
+  if ((rc = emu_sock_connect(s->fd, ipaddr->addr, port)) < 0)
+    return errno2err(-rc);
+  pcb->state = SYN_SENT;
+  watch(s);
+  return ERR_OK;
+}
+
+void tcp_recved (struct tcp_pcb *pcb, u16_t len) {
+  sock *s = (sock *)pcb;
+  s->wnd += len;
+  if (s->wnd > TCP_WND)
+    s->wnd = TCP_WND;
+  if (!s->dead)
+    watch(s);
+}
+
+err_t tcp_write (struct tcp_pcb *pcb, const void *dataptr, u16_t len,
+                 u8_t apiflags) {
+  sock *s = (sock *)pcb;
+  char *out;
+  (void)apiflags;                       /* the data is always copied */
+  if (pcb->state != ESTABLISHED && pcb->state != CLOSE_WAIT &&
+      pcb->state != SYN_SENT && pcb->state != SYN_RCVD)
+    return ERR_CONN;
+  if (len > pcb->snd_buf)
+    return ERR_MEM;
+  if (len == 0)
+    return ERR_OK;
+  out = realloc(s->out, s->outlen + len);
+  if (!out)
+    return ERR_MEM;
+  memcpy(out + s->outlen, dataptr, len);
+  s->out = out;
+  s->outlen += len;
+  pcb->snd_buf -= len;
+  watch(s);
+  return ERR_OK;
+}
+
+/*
+** What is still unsent goes out before the socket is closed.  Nothing is
+** reported on a closed PCB, as its argument may well have been freed.
+*/
+err_t tcp_close (struct tcp_pcb *pcb) {
+  sock *s = (sock *)pcb;
+  if (s->outlen && s->fd >= 0 && pcb->state != LISTEN &&
+      pcb->state != SYN_SENT) {
+    pcb->state = FIN_WAIT_1;
+    pcb->callback_arg = NULL;
+    pcb->recv = NULL;
+    pcb->sent = NULL;
+    pcb->errf = NULL;
+    s->closing = 1;
+    watch(s);
+    return ERR_OK;
+  }
+  pcb->state = CLOSED;
+  bury(s);
+  return ERR_OK;
+}
+
+/* the peer gets a reset, and the error callback ERR_ABRT */
+void tcp_abort (struct tcp_pcb *pcb) {
+  sock *s = (sock *)pcb;
+  s->reset = 1;
+  tcp_fail(s, ERR_ABRT);
+}
+
+static void tcp_do_accept (sock *ls) {
+  struct tcp_pcb *lpcb = &ls->pcb.tcp, *pcb;
+  sock *s;
+  err_t err;
+  int fd = emu_sock_accept(ls->fd);
+  if (fd < 0)
+    return;
+  if (!(s = new_sock(0))) {
+    emu_sock_close(fd, 1);
+    return;
+  }
+  s->fd = fd;
+  s->wnd = TCP_WND;
+  pcb = &s->pcb.tcp;
+  pcb->state = ESTABLISHED;
+  pcb->ttl = lpcb->ttl;
+  pcb->prio = lpcb->prio;
+  pcb->so_options = lpcb->so_options & SOF_INHERITED;
+  pcb->callback_arg = lpcb->callback_arg;
+  pcb->snd_buf = TCP_SND_BUF;
+  pcb->mss = TCP_MSS;
+  get_names(s);
+  watch(s);
+  err = lpcb->accept ? lpcb->accept(lpcb->callback_arg, pcb, ERR_OK) : ERR_ABRT;
+  if (err != ERR_OK && !s->dead)
+    bury(s);
+}
+
+static void tcp_do_connected (sock *s) {
+  struct tcp_pcb *pcb = &s->pcb.tcp;
+  int rc = emu_sock_error(s->fd);
+  if (rc < 0) {
+    tcp_fail(s, errno2err(-rc));
+    return;
+  }
+  pcb->state = ESTABLISHED;
+  s->wnd = TCP_WND;
+  get_names(s);
+  watch(s);
+  if (pcb->connected &&
+      pcb->connected(pcb->callback_arg, pcb, ERR_OK) != ERR_OK && !s->dead)
+    bury(s);
+}
+
+static void tcp_do_send (sock *s) {
+  struct tcp_pcb *pcb = &s->pcb.tcp;
+  long n = emu_sock_send(s->fd, s->out, s->outlen, NULL, 0);
+  if (n < 0) {
+    if (n != -EAGAIN && n != -EINTR)
+      tcp_fail(s, errno2err(-n));
+    return;
+  }
+  s->outlen -= n;
+  memmove(s->out, s->out + n, s->outlen);
+  pcb->snd_buf += n;
+  if (s->closing) {
+    if (s->outlen == 0) {
+      pcb->state = CLOSED;
+      bury(s);
+    }
+    return;
+  }
+  watch(s);
+  if (pcb->sent)
+    pcb->sent(pcb->callback_arg, pcb, n);
+}
+
+static void tcp_do_recv (sock *s) {
+  struct tcp_pcb *pcb = &s->pcb.tcp;
+  char buf[TCP_MSS];
+  struct pbuf *p;
+  long n = emu_sock_recv(s->fd, buf, s->wnd < sizeof(buf) ? s->wnd : sizeof(buf),
+                         NULL, NULL);
+  if (n < 0) {
+    if (n != -EAGAIN && n != -EINTR)
+      tcp_fail(s, errno2err(-n));
+    return;
+  }
+  if (n == 0) {                         /* a FIN */
+    s->eof = 1;
+    pcb->state = CLOSE_WAIT;
+    watch(s);
+    if (pcb->recv)
+      pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK);
+    else
+      tcp_close(pcb);
+    return;
+  }
+  if (!(p = pbuf_alloc(PBUF_RAW, n, PBUF_RAM)))
+    return;
+  memcpy(p->payload, buf, n);
+  s->wnd -= n;
+  watch(s);
+  if (pcb->recv)
+    pcb->recv(pcb->callback_arg, pcb, p, ERR_OK);
+  else {
+    tcp_recved(pcb, n);
+    pbuf_free(p);
+  }
+}
+
+static void tcp_io (sock *s, int revents) {
+  switch (s->pcb.tcp.state) {
+    case LISTEN:
+      tcp_do_accept(s);
+      break;
+    case SYN_SENT:
+      tcp_do_connected(s);
+      break;
+    default:
+      if ((revents & POLLOUT) && s->outlen) {
+        tcp_do_send(s);
+        if (s->dead)
+          break;
+      }
+      if ((revents & (POLLIN | POLLHUP | POLLERR)) && s->wnd && !s->eof &&
+          !s->closing)
+        tcp_do_recv(s);
+      break;
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** UDP and IGMP
+** =======================================================
+*/
+
+static void set_group (sock *s, int i, int join) {
+  emu_sock_group(s->fd, groups[i].groupaddr.addr, groups[i].ifaddr.addr, join);
+}
+
+struct udp_pcb *udp_new (void) {
+  sock *s = new_sock(1);
+  if (!s)
+    return NULL;
+  s->pcb.udp.ttl = UDP_TTL;
+  return &s->pcb.udp;
+}
+
+void udp_remove (struct udp_pcb *pcb) {
+  bury((sock *)pcb);
+}
+
+/* memberships are per socket on the host, so all of them join the groups */
+err_t udp_bind (struct udp_pcb *pcb, ip_addr_t *ipaddr, u16_t port) {
+  sock *s = (sock *)pcb;
+  err_t err;
+  int i;
+  if ((err = bind_socket(s, ipaddr, port)) != ERR_OK)
+    return err;
+  get_names(s);
+  for (i = 0; i < ngroups; i++)
+    set_group(s, i, 1);
+  watch(s);
+  return ERR_OK;
+}
+
+void udp_recv (struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+  pcb->recv = recv;
+  pcb->recv_arg = recv_arg;
+}
+
+err_t udp_sendto (struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
+                  u16_t dst_port) {
+  sock *s = (sock *)pcb;
+  char buf[UDP_MAX_PAYLOAD];
+  struct pbuf *q;
+  size_t len = 0;
+  long n;
+  if (s->fd < 0) {
+    err_t err = udp_bind(pcb, IP_ADDR_ANY, 0);
+    if (err != ERR_OK)
+      return err;
+  }
+  for (q = p; q && len < sizeof(buf); q = q->next) {
+    size_t l = q->len < sizeof(buf) - len ? q->len : sizeof(buf) - len;
+    memcpy(buf + len, q->payload, l);
+    len += l;
+  }
+  if (q)
+    return ERR_MEM;
+  emu_sock_ttl(s->fd, pcb->ttl);
+  n = emu_sock_send(s->fd, buf, len, &dst_ip->addr, dst_port);
+  return n < 0 ? errno2err(-n) : ERR_OK;
+}
+
+static void udp_io (sock *s) {
+  struct udp_pcb *pcb = &s->pcb.udp;
+  char buf[UDP_MAX_PAYLOAD];
+  ip_addr_t addr;
+  u16_t port;
+  struct pbuf *p;
+  long n = emu_sock_recv(s->fd, buf, sizeof(buf), &addr.addr, &port);
+  if (n < 0 || !(p = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM)))
+    return;
+  memcpy(p->payload, buf, n);
+  if (pcb->recv)
+    pcb->recv(pcb->recv_arg, pcb, p, &addr, port);
+  else
+    pbuf_free(p);
+}
+
+/* the host does the IGMP, for each socket */
+void igmp_init (void) {
+}
+
+err_t igmp_joingroup (ip_addr_t *ifaddr, ip_addr_t *groupaddr) {
+  sock *s;
+  if (!ip_addr_ismulticast(groupaddr))
+    return ERR_VAL;
+  if (ngroups == MAX_GROUPS)
+    return ERR_MEM;
+  groups[ngroups].ifaddr = *ifaddr;
+  groups[ngroups].groupaddr = *groupaddr;
+  for (s = socks; s; s = s->next)
+    if (s->udp && s->fd >= 0)
+      set_group(s, ngroups, 1);
+  ngroups++;
+  return ERR_OK;
+}
+
+err_t igmp_leavegroup (ip_addr_t *ifaddr, ip_addr_t *groupaddr) {
+  sock *s;
+  int i;
+  for (i = 0; i < ngroups; i++)
+    if (groups[i].ifaddr.addr == ifaddr->addr &&
+        groups[i].groupaddr.addr == groupaddr->addr)
+      break;
+  if (i == ngroups)
+    return ERR_VAL;
+  for (s = socks; s; s = s->next)
+    if (s->udp && s->fd >= 0)
+      set_group(s, i, 0);
+  groups[i] = groups[--ngroups];
+  return ERR_OK;
+}
+
+/* }====================================================== */
+
+
+static void io_cb (void *arg, int revents) {
+  sock *s = (sock *)arg;
+  free_graveyard();
+  if (s->udp)
+    udp_io(s);
+  else
+    tcp_io(s, revents);
+}
+
+
+/*
+** {======================================================
+** Buffers, addresses and DNS
+** =======================================================
+*/
+
+/* a single buffer, whatever the type asked for */
+struct pbuf *pbuf_alloc (pbuf_layer layer, u16_t length, pbuf_type type) {
+  struct pbuf *p = malloc(sizeof(struct pbuf) + length);
+  (void)layer;
+  if (!p)
+    return NULL;
+  memset(p, 0, sizeof(*p));
+  p->payload = p + 1;
+  p->tot_len = p->len = length;
+  p->type = type;
+  p->ref = 1;
+  return p;
+}
+
+u8_t pbuf_free (struct pbuf *p) {
+  u8_t count = 0;
+  while (p && --p->ref == 0) {
+    struct pbuf *q = p->next;
+    free(p);
+    count++;
+    p = q;
+  }
+  return count;
+}
+
+err_t pbuf_take (struct pbuf *buf, const void *dataptr, u16_t len) {
+  const char *src = dataptr;
+  struct pbuf *p;
+  if (!buf || buf->tot_len < len)
+    return ERR_ARG;
+  for (p = buf; len; p = p->next) {
+    u16_t l = p->len < len ? p->len : len;
+    memcpy(p->payload, src, l);
+    src += l;
+    len -= l;
+  }
+  return ERR_OK;
+}
+
+int ipaddr_aton (const char *cp, ip_addr_t *addr) {
+  u32_t a;
+  if (!emu_inet_aton(cp, &a))
+    return 0;
+  if (addr)
+    addr->addr = a;
+  return 1;
+}
+
+u32_t ipaddr_addr (const char *cp) {
+  ip_addr_t addr;
+  return ipaddr_aton(cp, &addr) ? addr.addr : IPADDR_NONE;
+}
+
+/*
+** Names are looked up by the host's resolver, whatever servers are set,
+** but the answer is given from the loop, as it comes from the network on
+** the chip.
+*/
+static void dns_answer (void *arg) {
+  dns_query *q = (dns_query *)arg;
+  q->found(q->name, q->ok ? &q->addr : NULL, q->arg);
+  free(q);
+}
+
+err_t dns_gethostbyname (const char *hostname, ip_addr_t *addr,
+                         dns_found_callback found, void *callback_arg) {
+  dns_query *q;
+  size_t len;
+  if (!hostname || !found || !hostname[0] ||
+      (len = strlen(hostname)) >= DNS_MAX_NAME_LENGTH)
+    return ERR_ARG;
+  if (ipaddr_aton(hostname, addr))
+    return ERR_OK;
+  if (!(q = calloc(1, sizeof(dns_query) + len)))
+    return ERR_MEM;
+  memcpy(q->name, hostname, len + 1);
+  q->found = found;
+  q->arg = callback_arg;
+  q->ok = emu_resolve(hostname, &q->addr.addr) == 0;
+  emu_timer_setfn(&q->timer, dns_answer, q);
+  emu_timer_arm(&q->timer, 0, 0);
+  return ERR_INPROGRESS;
+}
+
+void dns_setserver (u8_t numdns, ip_addr_t *dnsserver) {
+  if (numdns < DNS_MAX_SERVERS)
+    dns_servers[numdns] = dnsserver ? *dnsserver : ip_addr_any;
+}
+
+ip_addr_t dns_getserver (u8_t numdns) {
+  return numdns < DNS_MAX_SERVERS ? dns_servers[numdns] : ip_addr_any;
+}
+
+/* }====================================================== */
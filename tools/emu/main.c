@@ -0,0 +1,448 @@
+/*
+** nodemcu-emu: runs NodeMCU Lua scripts on the host, against the VM as
+** built for luac.cross and the firmware's own modules, VFS and task layer
+** over the host shims in this directory.  The flash image is mounted as
+** /FLASH, init.lua is run from it as on boot, then any scripts named on the
+** command line are run from the host file system, and then the event loop
+** runs the tasks, timers and sockets until there is nothing left to do,
+** node.restart() is called or a Lua error goes unhandled.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+#include "user_interface.h"
+#include "task/task.h"
+#include "vfs.h"
+#include "emu.h"
+
+/* the modules are built for the chip and the VM for the host, so their
+   TValues must be laid out alike */
+#if defined(LUA_NANBOX_TVALUES) || defined(LUA_PACK_TVALUES)
+# error "nodemcu-emu cannot be built with LUA_NANBOX_TVALUES or LUA_PACK_TVALUES"
+#endif
+
+#define EMU_HEAP  (44*1024)  /* free heap of a freshly booted ESP8266 */
+
+/* what NODEMCU_MODULE() puts in the .lua_libs and .lua_rotable sections
+   for the modules of the Makefile's MODULES */
+extern const luaL_Reg lua_lib_FILE, lua_lib_NODE, lua_lib_TMR, lua_lib_NET;
+extern const luaR_entry FILE_module_selected, NODE_module_selected,
+                        TMR_module_selected, NET_module_selected;
+
+static const struct {
+  const luaL_Reg *lib;
+  const luaR_entry *entry;
+} modules[] = {
+  {&lua_lib_FILE, &FILE_module_selected},
+  {&lua_lib_NODE, &NODE_module_selected},
+  {&lua_lib_TMR,  &TMR_module_selected},
+  {&lua_lib_NET,  &NET_module_selected},
+};
+#define NMODULES  (sizeof(modules) / sizeof(*modules))
+
+static struct {
+  uint32_t us;
+  int heap;
+} libinfo[NMODULES];
+
+uint32_t emu_heap = EMU_HEAP;
+int emu_restarted;
+
+static const char *progname = "nodemcu-emu";
+static jmp_buf panic_jmp;
+
+
+/*
+** An error outside of any pcall reboots the chip; here it ends the run.
+** The module callbacks are made with lua_call() as on the chip, so an error
+** in one of them ends up here too.
+*/
+static int panic (lua_State *L) {
+  fflush(stdout);
+  fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
+          lua_tostring(L, -1));
+  emu_stat.errors++;
+  longjmp(panic_jmp, 1);
+  return 0;
+}
+
+static int traceback (lua_State *L) {
+  lua_getglobal(L, "debug");
+  lua_getfield(L, -1, "traceback");
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 2);
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+static int docall (lua_State *L, int nargs, int nresults) {
+  int base = lua_gettop(L) - nargs;
+  int status;
+  lua_pushcfunction(L, traceback);
+  lua_insert(L, base);
+  status = lua_pcall(L, nargs, nresults, base);
+  lua_remove(L, base);
+  return status;
+}
+
+/* loads and runs a script; any error ends the run */
+static void dochunk (lua_State *L, int status) {
+  if (status == 0)
+    status = docall(L, 0, 0);
+  if (status) {
+    fflush(stdout);
+    fprintf(stderr, "%s: %s\n", progname, lua_tostring(L, -1));
+    lua_pop(L, 1);
+    emu_stat.errors++;
+  }
+}
+
+uint32_t emu_heap_used (void) {
+  lua_State *L = lua_getstate();
+  if (L == NULL)
+    return 0;
+  return lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+
+/*
+** {======================================================
+** Loading from the VFS, for dofile, loadfile and require
+** =======================================================
+*/
+
+LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
+  luaL_Buffer b;
+  const char *s;
+  size_t l;
+  int fd, n;
+  if (filename == NULL)
+    return luaL_error(L, "filename is NULL");
+  if (!(fd = vfs_open(filename, "r"))) {
+    lua_pushfstring(L, "cannot open %s", filename);
+    return LUA_ERRFILE;
+  }
+  luaL_buffinit(L, &b);
+  while ((n = vfs_read(fd, luaL_prepbuffer(&b), LUAL_BUFFERSIZE)) > 0)
+    luaL_addsize(&b, n);
+  vfs_close(fd);
+  luaL_pushresult(&b);
+  s = lua_tolstring(L, -1, &l);
+  if (l && *s == '#') {  /* Unix exec. file? keep the newline */
+    while (l && *s != '\n') s++, l--;
+  }
+  lua_pushfstring(L, "@%s", filename);
+  n = luaL_loadbuffer(L, s, l, lua_tostring(L, -1));
+  lua_replace(L, -3);  /* chunk or message in place of the source */
+  lua_pop(L, 1);
+  return n;
+}
+
+/* the VM's own, from the host file system, as lauxlib.h only declares it
+   for the cross compiler */
+LUALIB_API int (luaL_loadfile) (lua_State *L, const char *filename);
+
+static int emu_loadfile (lua_State *L) {
+  if (luaL_loadfsfile(L, luaL_checkstring(L, 1)) == 0)
+    return 1;
+  lua_pushnil(L);
+  lua_insert(L, -2);
+  return 2;
+}
+
+static int emu_dofile (lua_State *L) {
+  int n = lua_gettop(L);
+  if (luaL_loadfsfile(L, luaL_checkstring(L, 1)) != 0)
+    lua_error(L);
+  lua_call(L, 0, LUA_MULTRET);
+  return lua_gettop(L) - n;
+}
+
+static int emu_loader (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *path;
+  struct vfs_stat st;
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "path");
+  path = lua_tostring(L, -1);
+  if (path == NULL)
+    luaL_error(L, LUA_QL("package.path") " must be a string");
+  lua_pushliteral(L, "");  /* error accumulator */
+  while (*path) {
+    const char *e = strchr(path, ';');
+    const char *filename;
+    if (e == NULL) e = path + strlen(path);
+    lua_pushlstring(L, path, e - path);
+    filename = luaL_gsub(L, lua_tostring(L, -1), "?", name);
+    if (vfs_stat(filename, &st) == VFS_RES_OK) {
+      if (luaL_loadfsfile(L, filename) != 0)
+        luaL_error(L, "error loading module " LUA_QS " from file " LUA_QS
+                      ":\n\t%s", name, filename, lua_tostring(L, -1));
+      return 1;
+    }
+    lua_pushfstring(L, "\n\tno file " LUA_QS, filename);
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    lua_concat(L, 2);
+    path = *e ? e + 1 : e;
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** The console, which only node.input() writes to
+** =======================================================
+*/
+
+static char line[LUA_MAXINPUT];
+static int line_pending;
+static task_handle_t input_sig;
+
+int lua_put_line (const char *s, size_t l) {
+  if (s == NULL || ++l > LUA_MAXINPUT || line_pending)
+    return 0;
+  memcpy(line, s, l);
+  line_pending = 1;
+  return 1;
+}
+
+/* runs the line as the interpreter does, minus continuation lines */
+static void handle_input (task_param_t flag, uint8 priority) {
+  lua_State *L = lua_getstate();
+  int base = lua_gettop(L), status;
+  size_t l = strlen(line);
+  (void)flag;
+  (void)priority;
+  if (!line_pending)
+    return;
+  if (l > 0 && line[l-1] == '\n')
+    line[l-1] = '\0';
+  if (line[0] == '=')
+    lua_pushfstring(L, "return %s", line + 1);
+  else
+    lua_pushstring(L, line);
+  line_pending = 0;
+  status = luaL_loadbuffer(L, lua_tostring(L, -1), lua_strlen(L, -1), "=stdin");
+  lua_remove(L, base + 1);
+  if (status == 0)
+    status = docall(L, 0, LUA_MULTRET);
+  if (status) {
+    c_printf("%s\n", lua_tostring(L, -1));
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  } else if (lua_gettop(L) > base) {
+    lua_getglobal(L, "print");
+    lua_insert(L, base + 1);
+    if (lua_pcall(L, lua_gettop(L) - base - 1, 0, 0) != 0)
+      c_printf("error calling " LUA_QL("print") " (%s)\n",
+               lua_tostring(L, -1));
+  }
+  lua_settop(L, base);
+}
+
+bool user_process_input (bool force) {
+  return task_post_low(input_sig, force);
+}
+
+/* there is no UART to upload over */
+int lua_upload_start (const char *name, uint32_t size) {
+  (void)name;
+  (void)size;
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Modules
+** =======================================================
+*/
+
+/* Lua: node.libinfo(), for the modules only */
+LUALIB_API int luaL_libinfo (lua_State *L) {
+  unsigned i;
+  lua_createtable(L, 0, NMODULES);
+  for (i = 0; i < NMODULES; i++) {
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, libinfo[i].us);
+    lua_setfield(L, -2, "us");
+    lua_pushinteger(L, libinfo[i].heap);
+    lua_setfield(L, -2, "heap");
+    lua_setfield(L, -2, modules[i].lib->name);
+  }
+  return 1;
+}
+
+/*
+** The ROTables of the modules are made globals, as the cross-compiler VM
+** has no ROM table to find them in.  Timers that the modules start when
+** opened do not keep the loop running.
+*/
+static void openlibs (lua_State *L) {
+  unsigned i;
+  luaL_openlibs(L);
+  emu_background = 1;
+  for (i = 0; i < NMODULES; i++) {
+    const luaL_Reg *lib = modules[i].lib;
+    uint32_t us = system_get_time();
+    int heap = system_get_free_heap_size();
+    if (lib->func) {
+      lua_pushcfunction(L, lib->func);
+      lua_pushstring(L, lib->name);
+      lua_call(L, 1, 0);
+    }
+    lua_pushrotable(L, (void *)modules[i].entry->value.value.p);
+    lua_setglobal(L, lib->name);
+    libinfo[i].us = system_get_time() - us;
+    libinfo[i].heap = heap - (int)system_get_free_heap_size();
+  }
+  emu_background = 0;
+  lua_register(L, "dofile", emu_dofile);
+  lua_register(L, "loadfile", emu_loadfile);
+  /* require finds preloads, then files in the VFS; there is no LFS
+     searcher or bytecode cache as on the chip */
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "loaders");
+  lua_createtable(L, 2, 0);
+  lua_rawgeti(L, -2, 1);
+  lua_rawseti(L, -2, 1);
+  lua_pushcfunction(L, emu_loader);
+  lua_rawseti(L, -2, 2);
+  lua_setfield(L, -3, "loaders");
+  lua_pop(L, 2);
+}
+
+/* }====================================================== */
+
+
+static int upload (const char *arg) {
+  char buf[4096];
+  const char *name = strchr(arg, ':');
+  char *src = strdup(arg);
+  FILE *f;
+  int fd = 0, n, ok = 1;
+  if (name)
+    src[name++ - arg] = '\0';
+  else
+    name = (name = strrchr(arg, '/')) ? name + 1 : arg;
+  f = fopen(src, "rb");
+  if (f)
+    fd = vfs_open(name, "w");
+  while (fd && (n = fread(buf, 1, sizeof(buf), f)) > 0)
+    ok &= vfs_write(fd, buf, n) == n;
+  if (fd)
+    ok &= vfs_close(fd) == VFS_RES_OK;
+  if (f)
+    fclose(f);
+  free(src);
+  return fd && ok;
+}
+
+static double seconds (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage (void) {
+  fprintf(stderr,
+    "usage: %s [options] [script.lua ...]\n"
+    "Available options are:\n"
+    "  -f image   flash image file, created if missing (default in memory)\n"
+    "  -c size    create the image with this size and format it\n"
+    "  -u file[:name]  copy a host file into the file system before booting\n"
+    "  -n         do not run init.lua\n"
+    "  -m bytes   emulated heap size (default %d)\n"
+    "  -t secs    stop after this much simulated time\n"
+    "  -r         let timers wait for the wall clock\n"
+    "  -s         print run statistics on exit\n",
+    progname, EMU_HEAP);
+  exit(1);
+}
+
+int main (int argc, char **argv) {
+  const char *image = NULL;
+  uint32_t create = 0;
+  uint64_t limit = 0;
+  int opt, noinit = 0, stats = 0, nupload = 0, i;
+  const char *uploads[32];
+  struct vfs_stat st;
+  lua_State *L;
+  double start;
+
+  /* the VFS keeps pointers in ints, so the heap must stay below 4G */
+  mallopt(M_MMAP_MAX, 0);
+
+  while ((opt = getopt(argc, argv, "f:c:u:nm:t:rs")) != -1) {
+    switch (opt) {
+      case 'f': image = optarg; break;
+      case 'c': create = strtoul(optarg, NULL, 0); break;
+      case 'u':
+        if (nupload == sizeof(uploads)/sizeof(*uploads)) usage();
+        uploads[nupload++] = optarg;
+        break;
+      case 'n': noinit = 1; break;
+      case 'm': emu_heap = strtoul(optarg, NULL, 0); break;
+      case 't': limit = strtod(optarg, NULL) * 1e6; break;
+      case 'r': emu_realtime = 1; break;
+      case 's': stats = 1; break;
+      default: usage();
+    }
+  }
+  if (emu_flash_open(image, create) ||
+      (!vfs_mount("/FLASH", 0) && !vfs_format())) {
+    fprintf(stderr, "%s: cannot mount %s\n", progname,
+            image ? image : "file system");
+    return 1;
+  }
+  for (i = 0; i < nupload; i++)
+    if (!upload(uploads[i])) {
+      fprintf(stderr, "%s: cannot upload %s\n", progname, uploads[i]);
+      return 1;
+    }
+
+  start = seconds();
+  input_sig = task_get_id(handle_input);
+  L = lua_open();
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", progname);
+    return 1;
+  }
+  lua_atpanic(L, panic);
+  if (setjmp(panic_jmp) == 0) {
+    openlibs(L);
+    if (!noinit && vfs_stat("init.lua", &st) == VFS_RES_OK)
+      dochunk(L, luaL_loadfsfile(L, "init.lua"));
+    for (i = optind; i < argc && !emu_stat.errors && !emu_restarted; i++)
+      dochunk(L, luaL_loadfile(L, argv[i]));
+    if (!emu_stat.errors && !emu_restarted)
+      emu_run(limit);
+  }
+
+  fflush(stdout);
+  if (stats)
+    fprintf(stderr, "%s: %.3fs simulated in %.3fs, %u tasks, %u timers, "
+            "%u polls, %u errors%s\n", progname, emu_now() / 1e6,
+            seconds() - start, emu_stat.tasks, emu_stat.timers,
+            emu_stat.polls, emu_stat.errors,
+            emu_restarted ? ", restarted" : "");
+  /* after a panic the state is not fit to be closed */
+  if (!emu_stat.errors)
+    lua_close(L);
+  emu_flash_close();
+  return emu_stat.errors ? 1 : 0;
+}
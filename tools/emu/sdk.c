@@ -0,0 +1,203 @@
+/*
+** The SDK and ROM calls of the firmware sources, over the event loop in
+** loop.c.  The task queues and timers keep the SDK's behaviour, down to
+** dropping posts to a full queue.  Everything that would touch the
+** hardware either does nothing or reports the values of a freshly booted
+** ESP8266 running at 80MHz.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "ets_sys.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "rom.h"
+#include "platform.h"
+#include "c_stdio.h"
+#include "driver/uart.h"
+#include "emu.h"
+
+#define EMU_CHIP_ID  0x00e1e100
+
+static os_task_t handler[USER_TASK_PRIO_MAX];
+static uint8 cpu_freq = 80;
+static struct rst_info rst_info = {REASON_DEFAULT_RST};
+
+
+/*
+** {======================================================
+** Tasks and timers
+** =======================================================
+*/
+
+static void dispatch (int prio, uint32_t sig, uintptr_t par) {
+  os_event_t e;
+  e.sig = sig;
+  e.par = par;
+  handler[prio](&e);
+}
+
+/* the queue is the loop's own, of the same length */
+bool system_os_task (os_task_t task, uint8 prio, os_event_t *queue,
+                     uint8 qlen) {
+  (void)queue;
+  if (prio >= USER_TASK_PRIO_MAX || !task)
+    return false;
+  handler[prio] = task;
+  return emu_task_init(prio, dispatch, qlen);
+}
+
+bool system_os_post (uint8 prio, os_signal_t sig, os_param_t par) {
+  if (prio >= USER_TASK_PRIO_MAX)
+    return false;
+  return emu_task_post(prio, sig, par);
+}
+
+void ets_timer_setfn (ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg) {
+  emu_timer_setfn(ptimer, pfunction, parg);
+}
+
+void ets_timer_arm_new (ETSTimer *ptimer, uint32_t time, bool repeat_flag,
+                        bool ms_flag) {
+  emu_timer_arm(ptimer, ms_flag ? (uint64_t)time * 1000 : time, repeat_flag);
+}
+
+void ets_timer_disarm (ETSTimer *ptimer) {
+  emu_timer_disarm(ptimer);
+}
+
+void ets_delay_us (uint32_t us) {
+  emu_delay(us);
+}
+
+/* the RTC ticks once a microsecond */
+uint32 system_get_time (void) {
+  return (uint32)emu_now();
+}
+
+uint32 system_get_rtc_time (void) {
+  return (uint32)emu_now();
+}
+
+uint32 system_rtc_clock_cali_proc (void) {
+  return 1 << 12;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** System
+** =======================================================
+*/
+
+uint32 system_get_free_heap_size (void) {
+  uint32_t used = emu_heap_used();
+  return used < emu_heap ? emu_heap - used : 0;
+}
+
+uint32 system_get_chip_id (void) {
+  return EMU_CHIP_ID;
+}
+
+struct rst_info *system_get_rst_info (void) {
+  return &rst_info;
+}
+
+int rtc_get_reset_reason (void) {
+  return 1;                             /* power on */
+}
+
+/* restarts and deep sleep end the run, as there is no boot to go back to */
+void system_restart (void) {
+  emu_restarted = 1;
+  emu_stop();
+}
+
+void system_restore (void) {
+}
+
+bool system_deep_sleep_set_option (uint8 option) {
+  return option <= 4;
+}
+
+bool system_deep_sleep (uint64 time_in_us) {
+  (void)time_in_us;
+  system_restart();
+  return true;
+}
+
+bool system_deep_sleep_instant (uint64 time_in_us) {
+  return system_deep_sleep(time_in_us);
+}
+
+void ets_update_cpu_frequency (uint32_t ticks_per_us) {
+  cpu_freq = ticks_per_us;
+}
+
+uint32_t ets_get_cpu_frequency (void) {
+  return cpu_freq;
+}
+
+uint8 system_get_cpu_freq (void) {
+  return cpu_freq;
+}
+
+void system_soft_wdt_feed (void) {
+}
+
+void system_set_os_print (uint8 onoff) {
+  (void)onoff;
+}
+
+void uart0_sendStr (const char *str) {
+  fputs(str, stdout);
+}
+
+void *platform_print_deprecation_note (const char *msg,
+                                       const char *time_frame) {
+  c_printf("Warning, deprecated API! %s. It will be removed %s. "
+           "See documentation for details.\n", msg, time_frame);
+  return NULL;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** C library calls of the ROM
+** =======================================================
+*/
+
+int ets_vsprintf (char *d, const char *s, va_list ap) {
+  return vsprintf(d, s, ap);
+}
+
+int ets_sprintf (char *str, const char *format, ...) {
+  va_list ap;
+  int n;
+  va_start(ap, format);
+  n = vsprintf(str, format, ap);
+  va_end(ap);
+  return n;
+}
+
+int stricmp (const char *s1, const char *s2) {
+  return strcasecmp(s1, s2);
+}
+
+unsigned long os_random (void) {
+  return (unsigned long)random() << 1 ^ random();
+}
+
+int os_get_random (unsigned char *buf, size_t len) {
+  while (len--)
+    *buf++ = random();
+  return 0;
+}
+
+/* }====================================================== */